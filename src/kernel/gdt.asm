@@ -5,11 +5,13 @@
 section .text
 global loadPML4T
 global loadGDT
-global loadTSS
+global loadCPUGDT
 global getCR3
+extern cr3_reloads
 
 loadPML4T:
 	mov cr3, rdi
+	inc qword [cr3_reloads]	; Counted for the memstat syscall.
 	ret
 
 getCR3:
@@ -57,22 +59,26 @@ _gdt_loaded:
 	ret
 
 
-loadTSS:
-	; The TSS however CAN change, and when SMP support is added we'll need
-	; a different one for each processor.
-	;
-	; This function copies a GDT entry to where the TSS should be.
-	; rdi should hold a pointer to the gdt
-	; entry.
+loadCPUGDT:
+	; Every CPU has its own GDT, with its TSS in it (see tss.c). The layout is
+	; the same as GDT64, but the segments have to be reloaded anyway.
+	; rdi should hold a pointer to the GDT descriptor.
+	lgdt [rdi]
+
+	push GDT64.code
+	mov rax, _cpu_gdt_loaded
 	push rax
-	; This loads the entire entry, since the TSS entry is 16 bytes.
-	mov rax, [rdi]
-	mov [GDT64.tss], rax
-	mov rax, [rdi + 8]
-	mov [GDT64.tss + 8], rax
+	retfq
+
+_cpu_gdt_loaded:
+	mov ax, GDT64.data
+	mov ds, ax
+	mov ss, ax
+	mov es, ax
+	mov fs, ax
+	mov gs, ax
 	mov ax, 0x28
 	ltr ax
-	pop rax
 	ret
 
 
@@ -100,19 +106,21 @@ GDT64:
 		db 10010010b
 		db 0
 		db 0
-	.user_code: equ $ - GDT64 ; USER CODE           0x18
+	; SYSRET takes the user segments from STAR: data at +8, code at +16. So
+	; user data has to come before user code.
+	.user_data: equ $ - GDT64 ; USER DATA           0x18
 		dw 0
 		dw 0
 		db 0
-		db 11111010b  ; access. NOTE: The DC bit might be the culprit for a bug later on.
-		db 00100000b
+		db 11110010b  ; access
+		db 00000000b
 		db 0
-	.user_data: equ $ - GDT64 ; USER DATA           0x20
+	.user_code: equ $ - GDT64 ; USER CODE           0x20
 		dw 0
 		dw 0
 		db 0
-		db 11110010b  ; access
-		db 00000000b
+		db 11111010b  ; access. NOTE: The DC bit might be the culprit for a bug later on.
+		db 00100000b
 		db 0
 	.tss:  ; Task State Segment                     0x28
 		dq 0  ; allocate space for  16 bytes, the size of a long mode TSS.
@@ -30,13 +30,31 @@
 #include <keyboard.h>
 #include <config.h>
 #include <err.h>
+#include <cpu.h>
+#include <fpu.h>
+#include <klog.h>
+#include <timer.h>
+#include <smp.h>
+#include <acpi.h>
+#include <ioapic.h>
+#include <workqueue.h>
 
 static uint8_t stack[4096 * 2];
 
+/* Asks the bootloader to start the APs and park them, see smp.c */
+struct stivale2_header_tag_smp smp_hdr_tag = {
+	.tag = {
+		.identifier = STIVALE2_HEADER_TAG_SMP_ID,
+		.next = 0
+	},
+
+	.flags = 0
+};
+
 struct stivale2_header_tag_framebuffer framebuffer_hdr_tag = {
 	.tag = {
 		.identifier = STIVALE2_HEADER_TAG_FRAMEBUFFER_ID,
-		.next = 0
+		.next = (uint64_t)&smp_hdr_tag
 	},
 
 	.framebuffer_width 	= 1024,
@@ -83,6 +101,12 @@ void _start(struct stivale2_struct *hdr) {
 	/* We should load our own GDT as soon as possible. */
 	loadGDT();
 	init_serial();
+	init_cpu();
+	init_bsp_cpu();
+	if (init_fpu()) {
+		klog_err("FPU init failed.\n");
+		kpanic();
+	}
 	/*
 	 * It is important that we extract all the information from the bootloader
 	 * we need before loading our own page tables.
@@ -100,12 +124,32 @@ void _start(struct stivale2_struct *hdr) {
 
 	struct stivale2_struct_tag_memmap* mm = get_stivale_header(hdr, STIVALE2_STRUCT_TAG_MEMMAP_ID);
 
+	/* The tag is in bootloader reclaimable memory, which is left alone. It is
+	 * mapped again once the APs are started. */
+	uintptr_t smp_tag = (uintptr_t)get_stivale_header(hdr, STIVALE2_STRUCT_TAG_SMP_ID);
+
+	/* The ACPI tables are only read through the bootloader's identity map. */
+	struct stivale2_struct_tag_rsdp *rsdp_tag = get_stivale_header(hdr, STIVALE2_STRUCT_TAG_RSDP_ID);
+	if ((rsdp_tag == NULL) || init_acpi(rsdp_tag->rsdp)) {
+		klog_warn("No MADT found.\n");
+	}
+
 	/* We have everything we need. Now initialise the memory manager. */
 	if (init_memory(mm)) {
-		serial_puts("Memory init failed.\r\n");
+		klog_err("Memory init failed.\n");
+		kpanic();
+	}
+	klog_info("Memory manager OK\n");
+
+	/* From here on, the kernel log no longer waits for the serial port. */
+	if (init_klog()) {
+		klog_err("Kernel log init failed.\n");
 		kpanic();
 	}
-	serial_puts("Memory manager OK\r\n");
+
+	#ifdef BENCH
+	string_bench();
+	#endif
 
 
 	/*
@@ -117,10 +161,10 @@ void _start(struct stivale2_struct *hdr) {
 
 	krefresh_vmm();		/* Refresh the page tables. */
 	if (vga_init(0xFFFFFFFFFB000000, fb_width, fb_height, fb_bpp, fb_pitch)) {
-		serial_puts("VGA init failed.\r\n");
+		klog_err("VGA init failed.\n");
 		kpanic();
 	}
-	serial_puts("VGA OK\r\n");
+	klog_info("VGA OK\n");
 
 	/* Now initialise everything else. The screen will be filled with red on failure.
 	 * This "failure report mechanism" is not perfect, and will not even work if an error
@@ -129,43 +173,72 @@ void _start(struct stivale2_struct *hdr) {
 
 	/* First, interrupts. */
 	if (init_interrupts()) {
-		serial_puts("Interrupt setup failed.\r\n");
+		klog_err("Interrupt setup failed.\n");
 		kpanic();
 	}
 
+	/* The local APIC timer takes over the tick from the PIT, if there is one. */
+	uint8_t lapic_ok = !init_tick();
+	if (!lapic_ok) {
+		klog_warn("No usable local APIC, the PIT drives the timer.\n");
+	} else {
+		klog_info("LAPIC timer OK\n");
+	}
+
+	/* With a local APIC, the IO-APIC takes the IRQs over from the PICs. */
+	if (lapic_ok && !init_ioapic()) {
+		klog_info("IO-APIC OK\n");
+	}
+
+	/* The clock has to be there before the first address space is made. */
+	if (init_clock()) {
+		klog_warn("No usable TSC, the clock runs on the timer ticks.\n");
+	}
+
 	/* We can get the scheduler up as well. */
 	if (init_scheduler()) {
-		serial_puts("Scheduler failed to initialise.\r\n");
+		klog_err("Scheduler failed to initialise.\n");
+		kpanic();
+	}
+	klog_info("Scheduler OK\n");
+
+	/* Interrupt handlers defer their work to these, see workqueue.c */
+	if (init_workqueues()) {
+		klog_err("Workqueues failed to initialise.\n");
 		kpanic();
 	}
-	serial_puts("Scheduler OK\r\n");
+
+	/* The other CPUs need a local APIC for their ticks and IPIs. */
+	if (lapic_ok && !init_smp(smp_tag)) {
+		klog_info("SMP OK, %u CPUs\n", cpu_count);
+	}
 
 	/* PCI. The IDE driver depends on this. */
 	if (pci_scan_all_buses()) {
-		serial_puts("PCI failed initialise.\r\n");
+		klog_err("PCI failed initialise.\n");
 		kpanic();
 	}
-	serial_puts("PCI OK\r\n");
+	klog_info("PCI OK\n");
 
 	/* Disk drivers. */
 	if (init_disk()) {
-		serial_puts("Disk driver failed to initialise.\r\n");
+		klog_err("Disk driver failed to initialise.\n");
 		kpanic();
 	}
-	serial_puts("Disk OK\r\n");
+	klog_info("Disk OK\n");
 
 	/* The file system drivers. */
 	if (!init_fs()) {
-		serial_puts("FS drivers failed to initialise and/or no FS was found.\r\n");
+		klog_err("FS drivers failed to initialise and/or no FS was found.\n");
 		kpanic();
 	}
-	serial_puts("FS & VFS OK\r\n");
+	klog_info("FS & VFS OK\n");
 
 	/* Read the configuration file, and load settings from it. */
 	if (reload_config("/boot/nettapus.cfg")) {
-		serial_puts("Config file not found.\r\n");
+		klog_warn("Config file not found.\n");
 	} else {
-		serial_puts("Config file loaded.\r\n");
+		klog_info("Config file loaded.\n");
 		#ifdef DEBUG
 		config_put_variables();
 		#endif
@@ -173,12 +246,17 @@ void _start(struct stivale2_struct *hdr) {
 
 	/* TTY. This will ask for a config variable name font_file. */
 	if (tty_init()) {
-		serial_puts("TTY failed.\r\n");
+		klog_err("TTY failed.\n");
 		kpanic();
 	}
-	serial_puts("TTY OK\r\n");
+	klog_info("TTY OK\n");
 	__asm__("sti;");
 
+	#ifdef BENCH
+	tick_bench();
+	switch_bench();
+	#endif
+
 	/* We need to create the stdin and stdout fds for the first task.
 	 *
 	 * This will hold the fds for the pipe we created. See, the std output file
@@ -193,7 +271,7 @@ void _start(struct stivale2_struct *hdr) {
 	struct file_descriptor *nfd = kmalloc(sizeof(*nfd));
 
 	if (nfd == NULL) {
-		serial_puts("OUT OF MEMORY\r\n");
+		klog_err("OUT OF MEMORY\n");
 		kpanic();
 	}
 
@@ -209,10 +287,10 @@ void _start(struct stivale2_struct *hdr) {
 	/* Now create the file descriptor for standard input. */
 	struct file_descriptor *rfd = init_kbd();
 	if (rfd == NULL) {
-		serial_puts("KBD error\r\n");
+		klog_err("KBD error\n");
 		kpanic();
 	}
-	serial_puts("KBD OK\r\n");
+	klog_info("KBD OK\n");
 	rfd->next = nfd;
 	rfd->fd = 0;
 
@@ -230,19 +308,17 @@ void _start(struct stivale2_struct *hdr) {
 		__asm__("cli;hlt;");
 	}
 
-	lock_scheduler();
 	struct task *t = create_task((void (*)())entry_addr, pml4t, 3, NULL);
 	t->fds = rfd;
-	unlock_scheduler();
+	wake_up_new_task(t);
 
 	while (1) {
 		char buf[2] = {'\0', '\0'};
 		if (kread(stdpipe[0], buf, 1) != 1) {
-			serial_puts("kread() failed.\r\n");
+			klog_err("kread() failed.\n");
 			continue;
 		}
 		kputs(buf);
-		__asm__("hlt;");
 	}
 }
 
@@ -0,0 +1,194 @@
+#include <acpi.h>
+#include <err.h>
+#include <klog.h>
+#include <string.h>
+
+/* Finds the MADT through the RSDP the bootloader passed, and copies out the
+ * interrupt controllers. This runs before init_memory(), while the
+ * bootloader's identity mapping of the first 4GiB is still loaded, so tables
+ * are read at their physical addresses and nothing has to be mapped.
+ */
+
+struct rsdp {
+	char signature[8];		/* "RSD PTR " */
+	uint8_t checksum;
+	char oem_id[6];
+	uint8_t revision;
+	uint32_t rsdt_address;
+
+	/* Revision 2 and up. */
+	uint32_t length;
+	uint64_t xsdt_address;
+	uint8_t ext_checksum;
+	uint8_t reserved[3];
+} __attribute__((packed));
+
+struct sdt_header {
+	char signature[4];
+	uint32_t length;
+	uint8_t revision;
+	uint8_t checksum;
+	char oem_id[6];
+	char oem_table_id[8];
+	uint32_t oem_revision;
+	uint32_t creator_id;
+	uint32_t creator_revision;
+} __attribute__((packed));
+
+struct madt {
+	struct sdt_header hdr;
+	uint32_t lapic_address;
+	uint32_t flags;
+	uint8_t entries[];
+} __attribute__((packed));
+
+#define MADT_PCAT_COMPAT	1
+
+/* Entry types. */
+#define MADT_IOAPIC			1
+#define MADT_OVERRIDE		2
+#define MADT_LAPIC_ADDRESS	5
+
+struct madt_entry {
+	uint8_t type;
+	uint8_t length;
+} __attribute__((packed));
+
+struct madt_entry_ioapic {
+	struct madt_entry e;
+	uint8_t id;
+	uint8_t reserved;
+	uint32_t address;
+	uint32_t gsi_base;
+} __attribute__((packed));
+
+struct madt_entry_override {
+	struct madt_entry e;
+	uint8_t bus;
+	uint8_t irq;
+	uint32_t gsi;
+	uint16_t flags;
+} __attribute__((packed));
+
+struct madt_entry_lapic_address {
+	struct madt_entry e;
+	uint16_t reserved;
+	uint64_t address;
+} __attribute__((packed));
+
+/* Only what the bootloader identity maps can be read. */
+#define ACPI_MAX_PHYS	0x100000000
+
+struct madt_info madt_info;
+
+
+static uint8_t checksum_ok(void *p, size_t len) {
+	uint8_t sum = 0;
+	for (size_t i = 0; i < len; i++) {
+		sum += ((uint8_t*)p)[i];
+	}
+	return sum == 0;
+}
+
+static struct sdt_header *get_table(uint64_t phys) {
+	if ((phys == 0) || (phys + sizeof(struct sdt_header) > ACPI_MAX_PHYS)) {
+		return NULL;
+	}
+	struct sdt_header *h = (void*)phys;
+	if ((phys + h->length > ACPI_MAX_PHYS) || !checksum_ok(h, h->length)) {
+		return NULL;
+	}
+	return h;
+}
+
+static struct madt *find_madt(struct rsdp *r) {
+	uint8_t xsdt = (r->revision >= 2) && (r->xsdt_address != 0)
+	               && checksum_ok(r, sizeof(*r));
+	struct sdt_header *root = get_table(xsdt ? r->xsdt_address : r->rsdt_address);
+	if (root == NULL) {
+		return NULL;
+	}
+
+	/* The RSDT has 32 bit pointers, the XSDT 64 bit ones. Those aren't
+	 * necessarily aligned. */
+	size_t width = xsdt ? 8 : 4;
+	size_t count = (root->length - sizeof(*root)) / width;
+	uint8_t *ptrs = (uint8_t*)(root + 1);
+	for (size_t i = 0; i < count; i++) {
+		uint64_t phys = 0;
+		memcpy(&phys, ptrs + i * width, width);
+
+		struct sdt_header *h = get_table(phys);
+		if ((h != NULL) && !memcmp(h->signature, "APIC", 4)) {
+			return (struct madt*)h;
+		}
+	}
+	return NULL;
+}
+
+static void parse_madt(struct madt *m) {
+	madt_info.lapic_phys = m->lapic_address;
+	madt_info.has_8259 = m->flags & MADT_PCAT_COMPAT;
+
+	uint8_t *p = m->entries;
+	uint8_t *end = (uint8_t*)m + m->hdr.length;
+	while (p + sizeof(struct madt_entry) <= end) {
+		struct madt_entry *e = (void*)p;
+		if ((e->length < sizeof(*e)) || (p + e->length > end)) {
+			break;
+		}
+
+		switch (e->type) {
+		case MADT_IOAPIC: {
+			struct madt_entry_ioapic *io = (void*)e;
+			if (madt_info.num_ioapics < MADT_MAX_IOAPICS) {
+				struct madt_ioapic *d = &madt_info.ioapics[madt_info.num_ioapics++];
+				d->id = io->id;
+				d->phys = io->address;
+				d->gsi_base = io->gsi_base;
+			}
+			break;
+		}
+		case MADT_OVERRIDE: {
+			struct madt_entry_override *o = (void*)e;
+			if ((o->bus == 0) && (madt_info.num_overrides < MADT_MAX_OVERRIDES)) {
+				struct madt_override *d = &madt_info.overrides[madt_info.num_overrides++];
+				d->irq = o->irq;
+				d->gsi = o->gsi;
+				d->flags = o->flags;
+			}
+			break;
+		}
+		case MADT_LAPIC_ADDRESS:
+			madt_info.lapic_phys = ((struct madt_entry_lapic_address*)e)->address;
+			break;
+		default:
+			break;
+		}
+		p += e->length;
+	}
+}
+
+uint8_t init_acpi(uintptr_t rsdp) {
+	/* Returns ERR_NOT_FOUND if there is no usable MADT. */
+	memset(&madt_info, 0, sizeof(madt_info));
+	if ((rsdp == 0) || (rsdp + sizeof(struct rsdp) > ACPI_MAX_PHYS)) {
+		return ERR_INVALID_PARAM;
+	}
+
+	struct rsdp *r = (void*)rsdp;
+	if (memcmp(r->signature, "RSD PTR ", 8) || !checksum_ok(r, 20)) {
+		return ERR_INVALID_PARAM;
+	}
+
+	struct madt *m = find_madt(r);
+	if (m == NULL) {
+		return ERR_NOT_FOUND;
+	}
+	parse_madt(m);
+	madt_info.found = 1;
+
+	klog_debug("MADT: %u IO-APIC(s), %u override(s)\n",
+	           (uint64_t)madt_info.num_ioapics, (uint64_t)madt_info.num_overrides);
+	return GENERIC_SUCCESS;
+}
@@ -0,0 +1,108 @@
+#include <apic.h>
+#include <cpu.h>
+#include <mem.h>
+#include <io.h>
+#include <err.h>
+#include <smp.h>
+
+#define IA32_APIC_BASE		0x1B
+#define APIC_BASE_ENABLE	(1 << 11)
+
+static volatile uint32_t *lapic = NULL;
+
+
+uint32_t lapic_read(uint32_t reg) {
+	return lapic[reg / 4];
+}
+
+void lapic_write(uint32_t reg, uint32_t val) {
+	lapic[reg / 4] = val;
+}
+
+void lapic_eoi(void) {
+	lapic_write(LAPIC_EOI, 0);
+}
+
+uint8_t init_lapic(void) {
+	/* Maps the local APIC and enables it, with its timer masked. The 8259 PICs
+	 * keep working through LINT0, which the firmware set up. */
+	if (!cpu_info.apic) {
+		return ERR_INCOMPAT_PARAM;
+	}
+
+	uint64_t base = rdmsr(IA32_APIC_BASE);
+	if (map_memory(base & ~(uint64_t)0xFFF, LAPIC_VIRT, 1, kgetPML4T(), 0)) {
+		return ERR_OUT_OF_MEM;
+	}
+	krefresh_vmm();
+	lapic = (volatile uint32_t*)LAPIC_VIRT;
+
+	lapic_enable();
+	this_cpu()->lapic_id = lapic_id();
+	return GENERIC_SUCCESS;
+}
+
+void lapic_enable(void) {
+	/* Enables the calling CPU's local APIC. Every CPU sees its own at the same
+	 * physical address, so the mapping init_lapic() made is shared. */
+	wrmsr(IA32_APIC_BASE, rdmsr(IA32_APIC_BASE) | APIC_BASE_ENABLE);
+
+	lapic_write(LAPIC_TPR, 0);
+	lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+	lapic_write(LAPIC_TIMER_DIV, 0x3);	/* Divide by 16. */
+	lapic_write(LAPIC_SVR, 0x100 | LAPIC_SPURIOUS_VECTOR);
+}
+
+uint32_t lapic_id(void) {
+	return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_send_ipi(uint32_t id, uint8_t vector) {
+	/* A fixed interrupt to a single CPU. Writing the low half sends it. */
+	uint64_t flags = irq_save();
+	while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {
+		__asm__ volatile ("pause");
+	}
+	lapic_write(LAPIC_ICR_HIGH, id << 24);
+	lapic_write(LAPIC_ICR_LOW, vector);
+	irq_restore(flags);
+}
+
+uint32_t lapic_timer_calibrate(uint16_t pit_count) {
+	/* Returns how far the timer counts while the PIT counts pit_count. This
+	 * uses PIT channel 2 (the speaker's), since channel 0 drives irq0. Must be
+	 * called with interrupts disabled. */
+	uint8_t gate = inb(0x61);
+	outb(0x61, (gate & ~0x02) | 0x01);	/* Speaker off, gate on. */
+
+	outb(0x43, 0xB0);	/* Channel 2, lobyte/hibyte, mode 0. */
+	outb(0x42, pit_count & 0xFF);
+	outb(0x42, (pit_count >> 8) & 0xFF);
+
+	/* Mode 0 only starts counting on a rising edge of the gate. */
+	uint8_t v = inb(0x61) & ~0x01;
+	outb(0x61, v);
+	outb(0x61, v | 0x01);
+
+	lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+	while (!(inb(0x61) & 0x20));	/* OUT2 goes high when the count is done. */
+	uint32_t cur = lapic_read(LAPIC_TIMER_CUR);
+	lapic_write(LAPIC_TIMER_INIT, 0);
+
+	outb(0x61, gate);
+	return 0xFFFFFFFF - cur;
+}
+
+void lapic_timer_oneshot(uint32_t count) {
+	lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_VECTOR);
+	lapic_write(LAPIC_TIMER_INIT, count);
+}
+
+void lapic_timer_periodic(uint32_t count) {
+	lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | LAPIC_TIMER_VECTOR);
+	lapic_write(LAPIC_TIMER_INIT, count);
+}
+
+uint32_t lapic_timer_current(void) {
+	return lapic_read(LAPIC_TIMER_CUR);
+}
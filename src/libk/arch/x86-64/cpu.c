@@ -0,0 +1,36 @@
+#include <cpu.h>
+
+struct cpu_info cpu_info;
+
+void init_cpu(void) {
+	uint32_t a, b, c, d;
+
+	cpuid(0, 0, &a, &b, &c, &d);
+	cpu_info.max_leaf = a;
+
+	cpuid(0x80000000, 0, &a, &b, &c, &d);
+	cpu_info.max_ext_leaf = a;
+
+	cpuid(1, 0, &a, &b, &c, &d);
+	cpu_info.tsc = (d >> 4) & 1;
+	cpu_info.apic = (d >> 9) & 1;
+	cpu_info.fxsr = (d >> 24) & 1;
+	cpu_info.xsave = (c >> 26) & 1;
+	cpu_info.avx = (c >> 28) & 1;
+
+	if (cpu_info.max_leaf >= 7) {
+		cpuid(7, 0, &a, &b, &c, &d);
+		cpu_info.erms = (b >> 9) & 1;
+		cpu_info.fsrm = (d >> 4) & 1;
+	}
+
+	if (cpu_info.max_ext_leaf >= 0x80000007) {
+		cpuid(0x80000007, 0, &a, &b, &c, &d);
+		cpu_info.tsc_invariant = (d >> 8) & 1;
+	}
+
+	if (cpu_info.xsave && (cpu_info.max_leaf >= 0xD)) {
+		cpuid(0xD, 1, &a, &b, &c, &d);
+		cpu_info.xsaveopt = a & 1;
+	}
+}
@@ -0,0 +1,190 @@
+#include <fpu.h>
+#include <cpu.h>
+#include <task.h>
+#include <mem.h>
+#include <err.h>
+#include <klog.h>
+#include <smp.h>
+
+/* FPU/SSE state is switched lazily. On a task switch CR0.TS is set, unless the
+ * next task is the one whose state is still in the registers (the CPU's
+ * fpu_owner). The first FPU/SSE instruction after that traps with #NM, and only
+ * then are the states swapped. Tasks that never touch the FPU never pay for it.
+ *
+ * With more than one CPU, a task may run on another CPU next, so the owner's
+ * state is saved when it is switched away from. The registers keep it though,
+ * and if it comes back to the same CPU (and didn't load its state anywhere
+ * else in between, see fpu_cpu) nothing has to be restored.
+ */
+
+/* Size of a save area. 512 for fxsave, whatever cpuid says for xsave. */
+size_t fpu_state_size = 512;
+
+
+static void clts(void) {
+	__asm__ volatile ("clts");
+}
+
+static void stts(void) {
+	uint64_t cr0;
+	__asm__ volatile ("mov %%cr0, %0" : "=r"(cr0));
+	if (cr0 & 8) {
+		return;
+	}
+	__asm__ volatile ("mov %0, %%cr0" : : "r"(cr0 | 8));
+}
+
+static void fpu_save(void *area) {
+	if (cpu_info.xsaveopt) {
+		__asm__ volatile ("xsaveopt64 (%0)" : : "r"(area), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+	} else if (cpu_info.xsave) {
+		__asm__ volatile ("xsave64 (%0)" : : "r"(area), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+	} else {
+		__asm__ volatile ("fxsave64 (%0)" : : "r"(area) : "memory");
+	}
+}
+
+static void fpu_restore(void *area) {
+	if (cpu_info.xsave) {
+		__asm__ volatile ("xrstor64 (%0)" : : "r"(area), "a"(0xFFFFFFFF), "d"(0xFFFFFFFF) : "memory");
+	} else {
+		__asm__ volatile ("fxrstor64 (%0)" : : "r"(area) : "memory");
+	}
+}
+
+static void *alloc_state(void) {
+	/* xsave needs 64 byte alignment. The pointer kmalloc() returned is kept
+	 * right before the area, for free_state(). */
+	uint8_t *raw = kmalloc(fpu_state_size + 64 + 8);
+	if (raw == NULL) {
+		return NULL;
+	}
+	uintptr_t area = ((uintptr_t)raw + 8 + 63) & ~(uintptr_t)63;
+	((void**)area)[-1] = raw;
+
+	/* The values fninit would set. With a zeroed xsave header, every other
+	 * component is loaded in its initial state. */
+	memset((void*)area, 0, fpu_state_size);
+	*(uint16_t*)area = 0x37F;			/* FCW */
+	*(uint32_t*)(area + 24) = 0x1F80;	/* MXCSR */
+	return (void*)area;
+}
+
+static void free_state(void *area) {
+	kfree(((void**)area)[-1]);
+}
+
+
+uint8_t init_fpu(void) {
+	if (!cpu_info.fxsr) {
+		return ERR_INCOMPAT_PARAM;
+	}
+
+	if (cpu_info.xsave) {
+		/* Set CR4.OSXSAVE, then enable x87, SSE and AVX (if there) state in XCR0. */
+		uint64_t cr4;
+		__asm__ volatile ("mov %%cr4, %0" : "=r"(cr4));
+		__asm__ volatile ("mov %0, %%cr4" : : "r"(cr4 | (1 << 18)));
+
+		uint64_t xcr0 = 3 | (cpu_info.avx ? 4 : 0);
+		__asm__ volatile ("xsetbv" : : "c"(0), "a"((uint32_t)xcr0), "d"((uint32_t)(xcr0 >> 32)));
+
+		uint32_t a, b, c, d;
+		cpuid(0xD, 0, &a, &b, &c, &d);
+		fpu_state_size = b;
+	}
+
+	/* Nobody owns the registers yet. */
+	stts();
+	return GENERIC_SUCCESS;
+}
+
+static uint8_t fpu_loaded(struct cpu *c, struct task *t) {
+	/* Whether the registers of c hold the latest state of t. */
+	return (t != NULL) && (c->fpu_owner == t) && (t->fpu_cpu == c->id);
+}
+
+void exception_nm_handler(void) {
+	/* The current task used the FPU while someone else's state (or nothing)
+	 * was in the registers. */
+	clts();
+
+	struct cpu *c = this_cpu();
+	struct task *t = get_current_task();
+	if (fpu_loaded(c, t)) {
+		c->fpu_saved = 0;
+		return;
+	}
+
+	if ((c->fpu_owner != NULL) && !c->fpu_saved) {
+		fpu_save(c->fpu_owner->fpu);
+	}
+	c->fpu_owner = NULL;
+	if (t == NULL) {
+		return;
+	}
+
+	if (t->fpu == NULL) {
+		t->fpu = alloc_state();
+		if (t->fpu == NULL) {
+			klog_err("No memory for FPU state.\n");
+			terminate_task();
+		}
+	}
+	fpu_restore(t->fpu);
+	c->fpu_owner = t;
+	c->fpu_saved = 0;
+	t->fpu_cpu = c->id;
+}
+
+void fpu_switch(struct task *prev, struct task *next) {
+	/* Called by the scheduler right before switching from prev to next. */
+	struct cpu *c = this_cpu();
+	if ((cpu_count > 1) && (c->fpu_owner == prev) && !c->fpu_saved) {
+		fpu_save(prev->fpu);
+		c->fpu_saved = 1;
+	}
+
+	if (fpu_loaded(c, next)) {
+		clts();
+		c->fpu_saved = 0;
+	} else {
+		stts();
+	}
+}
+
+void fpu_copy(struct task *dest, struct task *src) {
+	/* Gives dest a copy of src's FPU state (for fork). src must be the
+	 * current task. */
+	dest->fpu = NULL;
+	if (src->fpu == NULL) {
+		return;
+	}
+
+	dest->fpu = alloc_state();
+	if (dest->fpu == NULL) {
+		return;
+	}
+
+	lock_task_switches();
+	struct cpu *c = this_cpu();
+	if (fpu_loaded(c, src) && !c->fpu_saved) {
+		/* The latest state is still in the registers. src keeps them. */
+		clts();
+		fpu_save(src->fpu);
+	}
+	memcpy(dest->fpu, src->fpu, fpu_state_size);
+	unlock_task_switches();
+}
+
+void fpu_release(struct task *t) {
+	for (uint64_t i = 0; i < cpu_count; i++) {
+		if (cpus[i].fpu_owner == t) {
+			cpus[i].fpu_owner = NULL;
+		}
+	}
+	if (t->fpu != NULL) {
+		free_state(t->fpu);
+		t->fpu = NULL;
+	}
+}
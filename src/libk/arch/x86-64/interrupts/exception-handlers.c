@@ -2,6 +2,7 @@
 #include <interrupts.h>
 #include <err.h>
 #include <vga.h>
+#include <task.h>
 
 
 
@@ -28,6 +29,16 @@ void exception_ss_handler(void) {
 	serial_puts("Stack Fault handler was called.\r\n");
 }
 
+void exception_simd_handler(void) {
+	/* An unmasked x87/SSE exception. There are no signals, so the task dies. */
+	serial_puts("FPU/SIMD exception.\r\n");
+	struct task *t = get_current_task();
+	if ((t == NULL) || (t->ring == 0)) {
+		kpanic();
+	}
+	terminate_task();
+}
+
 void exception_pf_handler(uint64_t addr, uint64_t code) {
 	serial_puts("Page Fault handler was called for addr ");
 	serial_putx(addr);
@@ -9,8 +9,9 @@ GLOBAL exception_np
 GLOBAL exception_ss
 GLOBAL exception_pf
 GLOBAL exception_double_fault
-
-EXTERN fx_area	; Area we save the SSE registers.
+GLOBAL exception_nm
+GLOBAL exception_mf
+GLOBAL exception_xm
 
 ; C functions to handle the exceptions.
 EXTERN divide_by_zero_handler
@@ -20,11 +21,14 @@ EXTERN exception_ts_handler
 EXTERN exception_np_handler
 EXTERN exception_ss_handler
 EXTERN exception_pf_handler
+EXTERN exception_nm_handler
+EXTERN exception_simd_handler
 EXTERN kpanic
 
 
 ; The actual interrupt handlers for the exceptions.
 exception_gpf: ; General Protection Fault.0xFFFFFFFF8020A36C
+	SWAPGS_IF_USER 16
 	mov ax, 0x10
 	mov ss, ax
 	mov ds, ax
@@ -36,6 +40,7 @@ exception_gpf: ; General Protection Fault.0xFFFFFFFF8020A36C
 	cli
 	hlt
 exception_ud: ; Invalid opcode.
+	SWAPGS_IF_USER 8
 	mov ax, 0x10
 	mov ss, ax
 	mov ds, ax ; GCC will not use any other segments, so we're fine.
@@ -46,6 +51,7 @@ exception_ud: ; Invalid opcode.
 	cli
 	hlt
 exception_ts: ; Invalid TSS.
+	SWAPGS_IF_USER 16
 	mov ax, 0x10
 	mov ss, ax
 	mov ds, ax
@@ -56,6 +62,7 @@ exception_ts: ; Invalid TSS.
 	cli
 	hlt
 exception_np: ; Segment Not Present
+	SWAPGS_IF_USER 16
 	mov ax, 0x10
 	mov ss, ax
 	mov ds, ax
@@ -66,6 +73,7 @@ exception_np: ; Segment Not Present
 	cli
 	hlt
 exception_ss: ; Stack Fault.
+	SWAPGS_IF_USER 16
 	mov ax, 0x10
 	mov ss, ax
 	mov ds, ax
@@ -76,6 +84,7 @@ exception_ss: ; Stack Fault.
 	cli
 	hlt
 exception_pf: ; Page Fault.
+	SWAPGS_IF_USER 16
 	mov ax, 0x10
 	mov ss, ax
 	mov ds, ax
@@ -89,16 +98,29 @@ exception_pf: ; Page Fault.
 	cli
 	hlt
 
+exception_nm: ; Device Not Available, see fpu.c
+	SWAPGS_IF_USER 8
+	PUSHAQ
+	cld
+	call exception_nm_handler
+	POPAQ
+	SWAPGS_IF_USER 8
+	iretq
+exception_mf: ; x87 Floating-Point Exception.
+exception_xm: ; SIMD Floating-Point Exception.
+	SWAPGS_IF_USER 8
+	PUSHAQ
+	cld
+	call exception_simd_handler
+	POPAQ
+	SWAPGS_IF_USER 8
+	iretq
+
 exception_divide_by_zero:
 exception_double_fault: ; Double Fault.
 	mov ax, 0x10
 	mov ss, ax
 	mov ds, ax
-	mov rsp, fault_stack_top
+	; Already on the CPU's own stack (IST2), see tss.c
 	mov rbp, rsp
 	jmp kpanic
-
-SECTION .bss
-fault_stack:
-	resb 0x1000
-fault_stack_top:
@@ -1,13 +1,19 @@
 %include "src/libk/arch/x86-64/interrupts/macros.asm"
 
 SECTION .text
-GLOBAL fx_area
 GLOBAL loadIDT
 GLOBAL irq0
 GLOBAL irq1
+GLOBAL irq4
+GLOBAL lapic_timer
+GLOBAL lapic_spurious
+GLOBAL ipi_resched
 
 EXTERN irq0_handler
 EXTERN irq1_handler
+EXTERN irq4_handler
+EXTERN lapic_timer_handler
+EXTERN ipi_resched_handler
 
 EXTERN get_current_task
 
@@ -26,38 +32,65 @@ loadIDT:
 
 irq0:
 	; At this point, the old rsp of the interrupt could get wiped, and we don't care.
+	SWAPGS_IF_USER 8
 	PUSHAQ
+	cld
 
 	call irq0_handler
 
 	POPAQ
+	SWAPGS_IF_USER 8
 	iretq
 
 
 irq1:
-	pushfq
-	cld
-	fxsave [fx_area]
-
+	SWAPGS_IF_USER 8
 	PUSHAQ
+	cld
 
 	call irq1_handler
 
 	POPAQ
+	SWAPGS_IF_USER 8
+	iretq
 
-	fxrstor [fx_area]
-	popfq
+
+irq4:
+	SWAPGS_IF_USER 8
+	PUSHAQ
+	cld
+
+	call irq4_handler
+
+	POPAQ
+	SWAPGS_IF_USER 8
 	iretq
 
 
+lapic_timer:
+	SWAPGS_IF_USER 8
+	PUSHAQ
+	cld
 
+	call lapic_timer_handler
 
-SECTION .bss
+	POPAQ
+	SWAPGS_IF_USER 8
+	iretq
 
-align 16
-fx_area:
-	resb 0x200
 
+ipi_resched:
+	SWAPGS_IF_USER 8
+	PUSHAQ
+	cld
 
+	call ipi_resched_handler
 
+	POPAQ
+	SWAPGS_IF_USER 8
+	iretq
 
+
+; Spurious interrupts must not be acknowledged.
+lapic_spurious:
+	iretq
@@ -1,6 +1,8 @@
 
 #include <interrupts.h>
 #include <io.h>
+#include <apic.h>
+#include <smp.h>
 
 struct IDT_descriptor IDTR;
 
@@ -61,7 +63,11 @@ void set_IDT_entry(uint8_t index, void (*func_ptr)(), uint8_t user_callable) {
 	IDT[index].offset_low16 = (addr & 0xFFFF);
 	IDT[index].offset_mid16 = ((addr >> 16) & 0xFFFF);
 	IDT[index].offset_hi32 = ((addr >> 32) & 0xFFFFFFFF);
-	IDT[index].ist = 1; /* Always switch stacks. */
+	/* No IST: from user mode the CPU switches to the task's kernel stack (rsp0
+	 * in the TSS), in the kernel it stays on the current stack. System calls
+	 * can be interrupted, so resetting to the top of the kernel stack on every
+	 * interrupt would overwrite them. */
+	IDT[index].ist = 0;
 	IDT[index].zero32 = 0;
 	if (user_callable) {
 		IDT[index].type_attr = 0xee;
@@ -84,16 +90,24 @@ uint8_t init_interrupts() {
 	/* First comes the exceptions. */
 	set_IDT_entry(0, exception_divide_by_zero, 0);
 	set_IDT_entry(6, exception_ud, 0); // Invalid opcode
+	set_IDT_entry(7, exception_nm, 0); // Device not available (lazy FPU switch)
 	set_IDT_entry(8, exception_double_fault, 0);
+	IDT[8].ist = 2;	/* The CPU's own stack, see tss.c */
 	set_IDT_entry(0xa, exception_ts, 0); // Invalid TSS
 	set_IDT_entry(0xb, exception_np, 0); // Invalid Segment
 	set_IDT_entry(0xc, exception_ss, 0); // Invalid Stack
 	set_IDT_entry(0xd, exception_gpf, 0); // General Protection Fault
 	set_IDT_entry(0xe, exception_pf, 0); // Page Fault
+	set_IDT_entry(0x10, exception_mf, 0); // x87 FPU error
+	set_IDT_entry(0x13, exception_xm, 0); // SIMD FPU error
 
 	/* Now hardware IRQs*/
 	set_IDT_entry(0x20, irq0, 0);
 	set_IDT_entry(0x21, irq1, 0);
+	set_IDT_entry(0x24, irq4, 0); // COM1, for the kernel log
+	set_IDT_entry(LAPIC_TIMER_VECTOR, lapic_timer, 0);
+	set_IDT_entry(LAPIC_SPURIOUS_VECTOR, lapic_spurious, 0);
+	set_IDT_entry(IPI_RESCHED_VECTOR, ipi_resched, 0);
 
 	/* interrupt for a syscall. */
 	set_IDT_entry(0x80, syscall_interrupt, 1);
@@ -107,8 +121,13 @@ uint8_t init_interrupts() {
 	/* Initialise the Programmable Interval Timer, so that we can keep track of time.*/
 	init_pit(0xE90);
 
-	outb(PIC_MASTER_DATA, 0xFC);
+	outb(PIC_MASTER_DATA, 0xEC);	/* IRQ 0, 1 and 4 */
 	outb(PIC_SLAVE_DATA, 0xFF);
 
 	return 0;
 }
+
+void init_ap_interrupts(void) {
+	/* The APs share the BSP's IDT. The PIC and the PIT stay the BSP's. */
+	loadIDT(&IDTR);
+}
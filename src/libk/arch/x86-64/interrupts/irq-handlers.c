@@ -4,24 +4,43 @@
 #include <io.h>
 #include <keyboard.h>
 #include <task.h>
-
-uint64_t time = 0;
+#include <klog.h>
+#include <timer.h>
+#include <apic.h>
+#include <ioapic.h>
 
 void put_time() {
-	kputx(time);
+	kputx(timer_ticks());
 }
 
 void irq0_handler() {
-	time++;
-	outb(PIC_MASTER_CMD, 0x20);
+	timer_tick(tick_irq());	/* Runs the timers that are due, this may wake tasks. */
+	irq_eoi(0);
 	scheduler_irq0();	/* The function itself determines whether a task switch should take place.*/
 }
 
+void lapic_timer_handler() {
+	/* Takes over from irq0 once init_tick() found a local APIC. */
+	timer_tick(tick_irq());
+	lapic_eoi();
+	scheduler_irq0();
+}
+
+void ipi_resched_handler() {
+	/* Another CPU queued a task for this one, see smp_send_resched(). */
+	lapic_eoi();
+	scheduler_ipi();
+}
+
 
 void irq1_handler() {
 	uint8_t key = inb(0x60);	/* Get the key  that was pressed. */
-	kbd_handle_key(key);
-	outb(PIC_MASTER_CMD, 0x20);
+	kbd_irq(key);
+	irq_eoi(1);
 }
 
-
+void irq4_handler() {
+	/* COM1. Only the transmit interrupt is enabled, which feeds the kernel log. */
+	klog_uart_irq();
+	irq_eoi(4);
+}
@@ -33,3 +33,13 @@
 	pop rbx
 	pop rax
 %endmacro
+
+; The kernel's GS base points at the running CPU's struct cpu (see smp.h), user
+; mode has its own. Swap them when the interrupt came from (or returns to) user
+; mode. The argument is where the saved CS is, relative to rsp.
+%macro SWAPGS_IF_USER 1
+	test QWORD [rsp + %1], 3
+	jz %%kernel
+	swapgs
+%%kernel:
+%endmacro
@@ -0,0 +1,207 @@
+#include <ioapic.h>
+#include <apic.h>
+#include <acpi.h>
+#include <smp.h>
+#include <interrupts.h>
+#include <spinlock.h>
+#include <mem.h>
+#include <io.h>
+#include <err.h>
+
+/* Interrupt routing. At boot the 8259 PICs deliver the ISA IRQs, and need an
+ * EOI through port I/O. Once init_ioapic() found an IO-APIC in the MADT, the
+ * PICs are masked for good, every IRQ goes through a redirection entry to a
+ * chosen CPU's local APIC, and is acknowledged with a local APIC EOI.
+ */
+
+#define IOAPIC_REGSEL	0x00
+#define IOAPIC_WIN		0x10
+
+#define IOAPIC_VER		0x01
+#define IOAPIC_REDTBL(n)	(0x10 + 2 * (n))
+
+/* Low half of a redirection entry. Fixed delivery, physical destination. */
+#define REDIR_ACTIVE_LOW	(1 << 13)
+#define REDIR_LEVEL			(1 << 15)
+#define REDIR_MASKED		(1 << 16)
+
+struct ioapic {
+	volatile uint32_t *regs;
+	uint32_t gsi_base;
+	uint32_t entries;
+};
+
+static struct ioapic ioapics[MADT_MAX_IOAPICS];
+static size_t num_ioapics = 0;
+static uint8_t ioapic_active = 0;
+
+/* IOREGSEL and IOWIN are written in pairs. */
+static struct spinlock ioapic_lock;
+
+
+static uint32_t ioapic_read(struct ioapic *io, uint32_t reg) {
+	io->regs[IOAPIC_REGSEL / 4] = reg;
+	return io->regs[IOAPIC_WIN / 4];
+}
+
+static void ioapic_write(struct ioapic *io, uint32_t reg, uint32_t val) {
+	io->regs[IOAPIC_REGSEL / 4] = reg;
+	io->regs[IOAPIC_WIN / 4] = val;
+}
+
+static uint32_t irq_to_gsi(uint8_t irq, uint32_t *flags) {
+	/* Returns the GSI of irq, and the bits of its redirection entry that
+	 * describe the line in flags. */
+	if (irq >= 16) {
+		*flags = REDIR_LEVEL | REDIR_ACTIVE_LOW;
+		return irq;
+	}
+
+	/* ISA IRQs are edge triggered and active high, unless overridden. */
+	*flags = 0;
+	for (size_t i = 0; i < madt_info.num_overrides; i++) {
+		struct madt_override *o = &madt_info.overrides[i];
+		if (o->irq != irq) {
+			continue;
+		}
+		if ((o->flags & MADT_POLARITY_MASK) == MADT_POLARITY_LOW) {
+			*flags |= REDIR_ACTIVE_LOW;
+		}
+		if ((o->flags & MADT_TRIGGER_MASK) == MADT_TRIGGER_LEVEL) {
+			*flags |= REDIR_LEVEL;
+		}
+		return o->gsi;
+	}
+	return irq;
+}
+
+static struct ioapic *find_ioapic(uint32_t gsi, uint32_t *pin) {
+	for (size_t i = 0; i < num_ioapics; i++) {
+		struct ioapic *io = &ioapics[i];
+		if ((gsi >= io->gsi_base) && (gsi < io->gsi_base + io->entries)) {
+			*pin = gsi - io->gsi_base;
+			return io;
+		}
+	}
+	return NULL;
+}
+
+static void pic_set_mask(uint8_t irq, uint8_t masked) {
+	uint16_t port = (irq < 8) ? PIC_MASTER_DATA : PIC_SLAVE_DATA;
+	uint8_t bit = 1 << (irq % 8);
+	uint8_t mask = inb(port);
+	outb(port, masked ? (mask | bit) : (mask & ~bit));
+}
+
+static void set_mask(uint8_t irq, uint8_t masked) {
+	uint64_t flags = spin_lock_irqsave(&ioapic_lock);
+	if (!ioapic_active) {
+		if (irq < 16) {
+			pic_set_mask(irq, masked);
+		}
+		spin_unlock_irqrestore(&ioapic_lock, flags);
+		return;
+	}
+
+	uint32_t line, pin;
+	struct ioapic *io = find_ioapic(irq_to_gsi(irq, &line), &pin);
+	if (io != NULL) {
+		uint32_t low = ioapic_read(io, IOAPIC_REDTBL(pin));
+		low = masked ? (low | REDIR_MASKED) : (low & ~REDIR_MASKED);
+		ioapic_write(io, IOAPIC_REDTBL(pin), low);
+	}
+	spin_unlock_irqrestore(&ioapic_lock, flags);
+}
+
+void irq_mask(uint8_t irq) {
+	set_mask(irq, 1);
+}
+
+void irq_unmask(uint8_t irq) {
+	set_mask(irq, 0);
+}
+
+void irq_eoi(uint8_t irq) {
+	if (ioapic_active) {
+		lapic_eoi();
+		return;
+	}
+	if (irq >= 8) {
+		outb(PIC_SLAVE_CMD, 0x20);
+	}
+	outb(PIC_MASTER_CMD, 0x20);
+}
+
+uint8_t irq_route(uint8_t irq, uint8_t vector, uint64_t cpu) {
+	/* Sends irq to vector on cpu (an index into cpus[]). Whether it is
+	 * masked stays as it was. */
+	if ((cpu >= cpu_count) || (vector < 0x20)) {
+		return ERR_INVALID_PARAM;
+	}
+	if (!ioapic_active) {
+		return ERR_INCOMPAT_PARAM;
+	}
+
+	uint32_t line, pin;
+	struct ioapic *io = find_ioapic(irq_to_gsi(irq, &line), &pin);
+	if (io == NULL) {
+		return ERR_NOT_FOUND;
+	}
+
+	uint64_t flags = spin_lock_irqsave(&ioapic_lock);
+	uint32_t masked = ioapic_read(io, IOAPIC_REDTBL(pin)) & REDIR_MASKED;
+
+	/* Mask it while the halves disagree. */
+	ioapic_write(io, IOAPIC_REDTBL(pin), REDIR_MASKED);
+	ioapic_write(io, IOAPIC_REDTBL(pin) + 1, cpus[cpu].lapic_id << 24);
+	ioapic_write(io, IOAPIC_REDTBL(pin), vector | line | masked);
+	spin_unlock_irqrestore(&ioapic_lock, flags);
+	return GENERIC_SUCCESS;
+}
+
+uint8_t init_ioapic(void) {
+	/* Moves the ISA IRQs from the PICs to the IO-APIC(s), all to the BSP and
+	 * on the vectors they had. Needs the local APIC. */
+	if (!madt_info.found || (madt_info.num_ioapics == 0)) {
+		return ERR_NOT_FOUND;
+	}
+
+	for (size_t i = 0; i < madt_info.num_ioapics; i++) {
+		uintptr_t virt = IOAPIC_VIRT + i * 0x1000;
+		if (map_memory(madt_info.ioapics[i].phys & ~(uint64_t)0xFFF, virt, 1, kgetPML4T(), 0)) {
+			return ERR_OUT_OF_MEM;
+		}
+		struct ioapic *io = &ioapics[num_ioapics++];
+		io->regs = (volatile uint32_t*)(virt + (madt_info.ioapics[i].phys & 0xFFF));
+		io->gsi_base = madt_info.ioapics[i].gsi_base;
+	}
+	krefresh_vmm();
+
+	uint64_t flags = irq_save();
+	for (size_t i = 0; i < num_ioapics; i++) {
+		struct ioapic *io = &ioapics[i];
+		io->entries = ((ioapic_read(io, IOAPIC_VER) >> 16) & 0xFF) + 1;
+		for (uint32_t pin = 0; pin < io->entries; pin++) {
+			ioapic_write(io, IOAPIC_REDTBL(pin), REDIR_MASKED);
+		}
+	}
+
+	/* Whatever the PICs let through keeps coming, through the IO-APIC. The
+	 * PICs are silenced for good. */
+	uint16_t enabled = ~(inb(PIC_MASTER_DATA) | (inb(PIC_SLAVE_DATA) << 8));
+	outb(PIC_MASTER_DATA, 0xFF);
+	outb(PIC_SLAVE_DATA, 0xFF);
+	ioapic_active = 1;
+
+	for (uint8_t irq = 0; irq < 16; irq++) {
+		if (irq == 2) {
+			continue;	/* The cascade. */
+		}
+		irq_route(irq, ISA_IRQ_VECTOR(irq), 0);
+		if (enabled & (1 << irq)) {
+			irq_unmask(irq);
+		}
+	}
+	irq_restore(flags);
+	return GENERIC_SUCCESS;
+}
@@ -0,0 +1,170 @@
+#include <smp.h>
+#include <task.h>
+#include <apic.h>
+#include <cpu.h>
+#include <fpu.h>
+#include <mem.h>
+#include <err.h>
+#include <klog.h>
+#include <timer.h>
+#include <interrupts.h>
+#include <stivale2.h>
+
+/* The bootloader starts the APs and parks them, each spinning on the
+ * goto_address field of its entry in the SMP tag. Writing an address there
+ * releases it, on the stack in target_stack, with the bootloader's page tables
+ * and GDT still loaded and a pointer to its entry in RDI.
+ *
+ * The bootloader's tables map the kernel image, but not the heap, so until an
+ * AP has loaded its own CR3 it may only touch static data.
+ */
+
+/* Where the SMP tag is mapped while the APs are started. */
+#define SMP_TAG_VIRT	0xFFFFFFFFF9000000
+#define SMP_TAG_PAGES	2
+
+/* How long to wait for an AP to come online, in spins. */
+#define AP_TIMEOUT		100000000
+
+/* Only used until an AP switches to its idle task's stack. */
+#define AP_STACK_SIZE	0x1000
+
+struct cpu cpus[MAX_CPUS];
+uint64_t cpu_count = 1;
+
+static uint8_t ap_stacks[MAX_CPUS][AP_STACK_SIZE] __attribute__((aligned(16)));
+static uint64_t ap_cr3[MAX_CPUS];
+
+
+void init_bsp_cpu(void) {
+	/* Makes this_cpu() work on the BSP. Has to run before anything that
+	 * touches per-CPU data, init_tss() later sets the GS base again. */
+	struct cpu *c = &cpus[0];
+	c->self = c;
+	c->id = 0;
+	c->online = 1;
+	wrmsr(MSR_GS_BASE, (uint64_t)c);
+	wrmsr(MSR_KERNEL_GS_BASE, 0);
+}
+
+static void ap_entry(struct stivale2_smp_info *info) {
+	struct cpu *c = (struct cpu*)info->extra_argument;
+	wrmsr(MSR_GS_BASE, (uint64_t)c);
+	wrmsr(MSR_KERNEL_GS_BASE, 0);
+
+	/* The idle task is a kernel thread, on the kernel's page tables, with a
+	 * kernel stack of its own for interrupts. */
+	loadPML4T((uint64_t*)ap_cr3[c->id]);
+
+	if (init_tss(c)) {
+		/* Never comes online, init_smp() gives up on it. */
+		while (1) {
+			__asm__ volatile ("cli; hlt");
+		}
+	}
+	tss_set_kernel_stack(c, c->rq.idle->reg.kernel_rsp);
+	init_ap_interrupts();
+	init_fpu();
+	lapic_enable();
+	init_tick_ap();
+
+	__atomic_store_n(&c->online, 1, __ATOMIC_RELEASE);
+
+	/* Become the idle task on its own stack, where kthread_create() put it
+	 * (rbp). ap_stacks[] is only for getting here: interrupts taken in the
+	 * kernel nest on whatever stack is current. */
+	__asm__ volatile (
+		"mov %0, %%rsp\n"
+		"xor %%ebp, %%ebp\n"
+		"sti\n"
+		"call idle_task_main\n"
+		: : "r"(c->rq.idle->reg.rbp), "D"(0) : "memory");
+	__builtin_unreachable();
+}
+
+static uint8_t prepare_ap(struct cpu *c) {
+	/* Gives c its idle task. The AP becomes that task as soon as it runs, so
+	 * it is marked as running on c right away. */
+	lock_scheduler();
+	struct task *idle = kthread_create(idle_task_main, NULL);
+	if (idle == NULL) {
+		unlock_scheduler();
+		return ERR_OUT_OF_MEM;
+	}
+	idle->sched_class->dequeue(&cpus[idle->cpu].rq, idle);
+	idle->sched_class = &idle_sched_class;
+	idle->base_class = &idle_sched_class;
+	idle->state = TASK_STATE_RUNNING;
+	idle->cpu = c->id;
+	idle->on_cpu = 1;
+
+	c->rq.idle = idle;
+	c->current_task = idle;
+	ap_cr3[c->id] = idle->reg.cr3;
+	unlock_scheduler();
+	return GENERIC_SUCCESS;
+}
+
+uint8_t init_smp(uintptr_t smp_tag_phys) {
+	/* Starts every AP the bootloader found. Returns ERR_NOT_FOUND if there
+	 * are none. Needs the scheduler and the local APIC. */
+	if (smp_tag_phys == 0) {
+		return ERR_NOT_FOUND;
+	}
+
+	uintptr_t page = smp_tag_phys & ~(uintptr_t)0xFFF;
+	if (map_memory(page, SMP_TAG_VIRT, SMP_TAG_PAGES, kgetPML4T(), 0)) {
+		return ERR_OUT_OF_MEM;
+	}
+	krefresh_vmm();
+	struct stivale2_struct_tag_smp *tag = (void*)(SMP_TAG_VIRT + (smp_tag_phys - page));
+
+	size_t max_entries = (SMP_TAG_PAGES * 0x1000 - (smp_tag_phys - page) - sizeof(*tag)) / sizeof(tag->smp_info[0]);
+	uint64_t entries = tag->cpu_count;
+	if (entries > max_entries) {
+		entries = max_entries;
+	}
+
+	cpus[0].lapic_id = tag->bsp_lapic_id;
+
+	uint64_t n = 1;
+	for (uint64_t i = 0; (i < entries) && (n < MAX_CPUS); i++) {
+		struct stivale2_smp_info *info = &tag->smp_info[i];
+		if (info->lapic_id == tag->bsp_lapic_id) {
+			continue;
+		}
+
+		struct cpu *c = &cpus[n];
+		c->self = c;
+		c->id = n;
+		c->lapic_id = info->lapic_id;
+		if (prepare_ap(c)) {
+			break;
+		}
+
+		/* From here on there is more than one CPU, see fpu_switch(). */
+		cpu_count = n + 1;
+
+		info->target_stack = (uint64_t)ap_stacks[n] + AP_STACK_SIZE;
+		info->extra_argument = (uint64_t)c;
+		__atomic_store_n(&info->goto_address, (uint64_t)ap_entry, __ATOMIC_RELEASE);
+
+		for (uint64_t spins = 0; !__atomic_load_n(&c->online, __ATOMIC_ACQUIRE); spins++) {
+			if (spins == AP_TIMEOUT) {
+				klog_warn("CPU %u (LAPIC %u) did not come online.\n", n, (uint64_t)c->lapic_id);
+				break;
+			}
+			__asm__ volatile ("pause");
+		}
+		n++;
+	}
+
+	unmap_memory(SMP_TAG_VIRT, SMP_TAG_PAGES, kgetPML4T());
+	krefresh_vmm();
+
+	return (n > 1) ? GENERIC_SUCCESS : ERR_NOT_FOUND;
+}
+
+void smp_send_resched(struct cpu *c) {
+	lapic_send_ipi(c->lapic_id, IPI_RESCHED_VECTOR);
+}
@@ -1,28 +1,95 @@
 %include "src/libk/arch/x86-64/interrupts/macros.asm"
 GLOBAL syscall_interrupt
+GLOBAL syscall_entry
 EXTERN syscall_table
 EXTERN syscall_count
 
 ; This interrupt MUST NOT be called by a kernel task. It will trash the ds and ss
 ; with user values otherwise.
 syscall_interrupt:
+	SWAPGS_IF_USER 8
 	PUSHAQ
 	cld
+	sti
 
 	cmp [syscall_count], rax
 	jb .done ; This was the fix. run it and see.
 	je .done
 	; Pass the parameters in registers, and call the appropriate syscall handler.
-	; The specific system call is determined by rax.
+	; The specific system call is determined by rax. They come in rbx, rcx, rdx
+	; and rsi (for futex() and clone()), and go in rdi, rsi, rdx and rcx.
 	mov rax, [syscall_table + rax * 0x8]
 	mov rdi, rbx
-	mov rsi, rcx
-	mov rdx, rdx ;
+	xchg rsi, rcx
 
 	call rax
 
 	mov [rsp + 14 * 8], rax
 
 	.done:
+	cli							; The user's GS is loaded before the iretq.
 	POPAQ
+	SWAPGS_IF_USER 8
+	iretq
+
+
+; The SYSCALL instruction, see init_syscall() in tss.c. rax holds the number,
+; the parameters are in rdi, rsi and rdx (r10 for a fourth one, rcx is taken by
+; the return address). Interrupts are off until the user's RSP is off the CPU's
+; scratch slot and on the task's kernel stack; from there on the handler may be
+; preempted like any kernel code. Unlike syscall_interrupt, only what SYSRET
+; needs is saved: the handlers preserve the callee-saved registers, and the
+; caller expects the rest to be clobbered.
+syscall_entry:
+	swapgs
+	mov [gs:0x18], rsp			; See struct cpu.
+	mov rsp, [gs:0x08]			; The current task...
+	mov rsp, [rsp + 0xA8]		; ...and its kernel stack.
+	push QWORD [gs:0x18]		; User RSP
+	push r11					; User RFLAGS
+	push rcx					; User RIP
+	sub rsp, 8					; Keep the stack 16 byte aligned.
+	cld
+	sti
+
+	cmp rax, [syscall_count]
+	jae .done
+	mov rcx, r10
+	call [syscall_table + rax * 0x8]
+
+	.done:
+	add rsp, 8
+	cli
+	pop rcx
+	pop r11
+
+	; Don't leave kernel values in the scratch registers.
+	xor edi, edi
+	xor esi, esi
+	xor edx, edx
+	xor r9d, r9d
+	xor r10d, r10d
+
+	; SYSRET to a non-canonical RIP faults in ring 0, with the user's stack.
+	; Such a task gets the slow way out.
+	mov r8, rcx
+	shl r8, 16
+	sar r8, 16
+	cmp r8, rcx
+	jne .iret
+
+	xor r8d, r8d
+	pop rsp
+	swapgs
+	o64 sysret
+
+	.iret:
+	pop r8
+	push QWORD 0x18 | 3			; SS
+	push r8						; RSP
+	push r11					; RFLAGS
+	push QWORD 0x20 | 3			; CS
+	push rcx					; RIP
+	xor r8d, r8d
+	swapgs
 	iretq
@@ -2,7 +2,10 @@
 #include <task.h>
 #include <tty.h>
 #include <err.h>
+#include <mem.h>
 #include <fs/fs.h>
+#include <klog.h>
+#include <timer.h>
 
 /* This file implements all the system calls. The functions here (called by the
  * syscall interrupt) only check the given parameters and then call a function
@@ -33,6 +36,11 @@ int64_t fork(void) {
  */
 int64_t exec(char *fname, char *argv[]) {
 	struct task *t = get_current_task();
+	if ((t->leader != NULL) || (t->group_users != 1)) {
+		/* The other threads would be left in an address space that goes
+		 * away. */
+		return -ERR_INCOMPAT_PARAM;
+	}
 	if (!is_mapped((uintptr_t)fname, t->pml4t)) {
 		return -ERR_INVALID_PARAM;
 	}
@@ -70,7 +78,7 @@ int64_t exec(char *fname, char *argv[]) {
 		 * if this system is supposed to be anything other than a joke.
 		 */
 	}
-	serial_puts("After the argv check!\r\n");
+	klog_debug("exec: argv checked\n");
 
 	uintptr_t entry_addr;
 
@@ -79,32 +87,52 @@ int64_t exec(char *fname, char *argv[]) {
 		return -ERR_NOT_FOUND;
 	}
 
-	lock_scheduler();
+	/* The new task only runs once it is queued, so setting it up doesn't
+	 * need the scheduler locked. */
 	struct task *oldt = get_current_task();
 	struct task *newt = create_task((void (*)())entry_addr, pml4t, 3, argv);
-	newt->pid = oldt->pid;
+	if (newt == NULL) {
+		skeleton_put_space(pml4t);
+		return -ERR_OUT_OF_MEM;
+	}
+	pid_transfer(oldt, newt);
 	newt->fds = oldt->fds;
 	newt->current_dir = oldt->current_dir;
+	sched_setscheduler(newt, (oldt->base_class == &idle_sched_class) ? SCHED_IDLE : SCHED_FAIR, oldt->nice);
 
-	kfree(newt->wait_queue);
+	/* Swap the queues, so the old task goes back to the skeleton cache with
+	 * a usable (empty) one. */
+	QUEUE *wq = newt->wait_queue;
 	newt->wait_queue = oldt->wait_queue;
-	oldt->wait_queue = NULL;
+	oldt->wait_queue = wq;
 	oldt->fds = NULL;
 	oldt->current_dir = NULL;
-
-
-	unlock_scheduler();
+	wake_up_new_task(newt);
 
 	exit(0);
 	return GENERIC_SUCCESS;
 }
 
 int64_t wait(uint64_t pid) {
-	struct task *t = find_task(pid);
-	if (t == NULL) {
+	/* The task must not end between being found and being waited for, so
+	 * both happen at once. */
+	QUEUE *q;
+	lock_task_switches();
+	uint8_t ret = prepare_to_wait_task(pid, &q);
+	unlock_task_switches();
+	if (ret != GENERIC_SUCCESS) {
 		return -ERR_INVALID_PARAM;
 	}
-	wait_queue(t->wait_queue);
+
+	while (finish_wait(q) == ERR_NO_RESULT) {
+		/* Woken up by something else. If it's gone by now, it has ended. */
+		lock_task_switches();
+		ret = prepare_to_wait_task(pid, &q);
+		unlock_task_switches();
+		if (ret != GENERIC_SUCCESS) {
+			break;
+		}
+	}
 	return 0;
 }
 
@@ -122,15 +150,12 @@ int64_t open(char *fname, int64_t mode) {
 
 
 int64_t read(int64_t fd, void *buf, int64_t amount) {
-	if (!is_mapped((uintptr_t)buf, get_current_task()->pml4t)) {
-		return -ERR_INVALID_PARAM;
-	}
-	if ((uintptr_t)buf >= 0xFFFFFF7FFFFFF000) {
-		return -ERR_INVALID_PARAM;
-	}
 	if (amount < 0) {
 		return 0;
 	}
+	if (!is_user_writable((uintptr_t)buf, amount, get_current_task()->pml4t)) {
+		return -ERR_INVALID_PARAM;
+	}
 
 	return kread(fd, buf, amount);
 }
@@ -154,10 +179,7 @@ int64_t close(int32_t fd) {
 }
 
 int64_t pipe(int32_t *ret) {
-	if (!is_mapped((uintptr_t)ret, get_current_task()->pml4t)) {
-		return -ERR_INVALID_PARAM;
-	}
-	if ((uintptr_t)ret >= 0xFFFFFF7FFFFFF000) {
+	if (!is_user_writable((uintptr_t)ret, 2 * sizeof(*ret), get_current_task()->pml4t)) {
 		return -ERR_INVALID_PARAM;
 	}
 	return kpipeu(get_current_task(), ret);
@@ -170,7 +192,7 @@ int64_t chdir(char *path) {
 	if ((uintptr_t)path >= 0xFFFFFF7FFFFFF000) {
 		return -ERR_INVALID_PARAM;
 	}
-	return kchdir(get_current_task(), path);
+	return kchdir(task_leader(get_current_task()), path);
 }
 
 int64_t getarg(uint64_t arg, char *buf, uint64_t limit) {
@@ -178,31 +200,137 @@ int64_t getarg(uint64_t arg, char *buf, uint64_t limit) {
 	 * buf is the buffer the argument will be copied to
 	 * limit is the maximum size of buf
 	 */
-	if (!is_mapped((uintptr_t)buf, get_current_task()->pml4t)) {
-		return -ERR_INVALID_PARAM;
-	}
-	if ((uintptr_t)buf >= 0xFFFFFF7FFFFFF000) {
-		return -ERR_INVALID_PARAM;
-	}
-
-	char *str = task_get_arg(get_current_task(), arg);
+	char *str = task_get_arg(task_leader(get_current_task()), arg);
 	if (str == NULL) {
 		return -ERR_NOT_FOUND;
 	}
 
 	size_t len = strlen(str);
 	size_t to_copy = (len >= limit) ? (limit - 1) : len;
+	if (!is_user_writable((uintptr_t)buf, to_copy, get_current_task()->pml4t)) {
+		return -ERR_INVALID_PARAM;
+	}
 
 	memcpy(buf, str, to_copy);
 
 	return to_copy;
 }
 
+/* Copies the memory counters (struct mem_stats, see mem.h) to buf. */
+int64_t memstat(struct mem_stats *buf) {
+	if (!is_user_writable((uintptr_t)buf, sizeof(*buf), get_current_task()->pml4t)) {
+		return -ERR_INVALID_PARAM;
+	}
+
+	return get_mem_stats(buf) ? -ERR_INVALID_PARAM : 0;
+}
+
+
+/* Copies the kernel log history (the messages already sent to the serial port)
+ * to buf, starting offset bytes after the oldest message still kept.
+ */
+int64_t klogread(char *buf, uint64_t size, uint64_t offset) {
+	if (size == 0) {
+		return 0;
+	}
+	if (!is_user_writable((uintptr_t)buf, size, get_current_task()->pml4t)) {
+		return -ERR_INVALID_PARAM;
+	}
+
+	return klog_read(buf, size, offset);
+}
+
+/* Adds inc to the nice value of the calling task, and returns the new value.
+ * The result is clamped to NICE_MIN..NICE_MAX.
+ */
+int64_t nice(int64_t inc) {
+	/* Anything past the width of the range is clamped anyway, this keeps the
+	 * sum from overflowing. */
+	if (inc < -40) { inc = -40; }
+	if (inc > 40)  { inc = 40; }
+
+	struct task *t = get_current_task();
+	int64_t n = t->nice + inc;
+	if (n < NICE_MIN) { n = NICE_MIN; }
+	if (n > NICE_MAX) { n = NICE_MAX; }
+
+	uint64_t policy = (t->base_class == &idle_sched_class) ? SCHED_IDLE : SCHED_FAIR;
+	if (sched_setscheduler(t, policy, n)) {
+		return -ERR_INVALID_PARAM;
+	}
+	return n;
+}
+
+/* Sets the scheduling policy (SCHED_FAIR or SCHED_IDLE) and nice value of the
+ * task with the given pid. A pid of -1 means the calling task.
+ */
+int64_t sched_setparam(int64_t pid, uint64_t policy, int64_t nice) {
+	/* Kernel tasks have no PID, so they're off limits. Another task could
+	 * end in the meantime, it's changed under pid_lock. */
+	if (pid == -1) {
+		return -(int64_t)sched_setscheduler(get_current_task(), policy, nice);
+	}
+	if (pid < 0) {
+		return -ERR_NOT_FOUND;
+	}
+	return -(int64_t)sched_setscheduler_task(pid, policy, nice);
+}
+
+/* Blocks the calling task for at least ns nanoseconds. The timer runs at
+ * TIMER_HZ, so the sleep is rounded up to whole ticks.
+ */
+int64_t nanosleep(uint64_t ns) {
+	sleep_ticks(ns_to_ticks(ns));
+	return 0;
+}
+
+/* Does nothing but return the caller's PID, which makes it the cheapest
+ * round trip into the kernel. */
+int64_t getpid(void) {
+	return get_current_task()->pid;
+}
+
+/* Returns the monotonic clock, in nanoseconds since boot. The libc reads the
+ * time page instead, this is only its fallback. */
+int64_t clock_gettime(void) {
+	return clock_gettime_ns();
+}
+
+/* FUTEX_WAIT blocks while *addr == val, for at most timeout_ns nanoseconds
+ * (0 means forever), until someone does a FUTEX_WAKE on the same word.
+ * FUTEX_WAKE wakes up to val waiters and returns how many there were. */
+int64_t futex(uint32_t *addr, uint64_t op, uint64_t val, uint64_t timeout_ns) {
+	if (op == FUTEX_WAIT) {
+		return futex_wait(addr, (uint32_t)val, timeout_ns);
+	}
+	if (op == FUTEX_WAKE) {
+		return futex_wake(addr, val);
+	}
+	return -ERR_INVALID_PARAM;
+}
 
+/* Waits until one of nfds descriptors is ready, see kpoll(). fds is an array
+ * of struct pollfd, which is written back with what each one is ready for. */
+int64_t poll(struct pollfd *fds, uint64_t nfds, int64_t timeout_ns) {
+	if (nfds > POLL_MAX) {
+		return -ERR_INVALID_PARAM;
+	}
+	if (!is_user_writable((uintptr_t)fds, nfds * sizeof(*fds), get_current_task()->pml4t)) {
+		return -ERR_INVALID_PARAM;
+	}
+
+	return kpoll(fds, nfds, timeout_ns);
+}
 
+/* Starts a thread of the calling process, sharing its address space, files
+ * and working directory. It begins at entry with arg as its first argument,
+ * stack as its stack pointer and tls as its FS base. Returns its PID. */
+int64_t clone(void (*entry)(), uint64_t stack, uint64_t arg, uint64_t tls) {
+	return kclone(entry, stack, arg, tls);
+}
 
-/* This array holds pointers to all system calls. The syscall handler (in syscall.asm)
- * references this table.
+/* This array holds pointers to all system calls. The syscall handlers (in syscall.asm)
+ * reference this table.
  */
 uintptr_t syscall_table[128] = {
 	(uintptr_t)&exit,    //  0
@@ -216,9 +344,19 @@ uintptr_t syscall_table[128] = {
 	(uintptr_t)&pipe,    //  8
 	(uintptr_t)&chdir,   //  9
 	(uintptr_t)&getarg,  //  10
+	(uintptr_t)&memstat, //  11
+	(uintptr_t)&klogread, // 12
+	(uintptr_t)&nice,    //  13
+	(uintptr_t)&sched_setparam, // 14
+	(uintptr_t)&nanosleep, // 15
+	(uintptr_t)&getpid,  //  16
+	(uintptr_t)&clock_gettime, // 17
+	(uintptr_t)&futex,   //  18
+	(uintptr_t)&poll,    //  19
+	(uintptr_t)&clone,   //  20
 };
 
 /* Likewise, the syscall handler also accesses this. That is the sole reason we
  * need this one, actually.
  */
-uint64_t syscall_count = 11;
+uint64_t syscall_count = 21;
@@ -0,0 +1,77 @@
+#include <task.h>
+#include <cpu.h>
+#include <mem.h>
+#include <err.h>
+#include <string.h>
+
+#ifdef BENCH
+
+/* The cost of switch_task(), in TSC ticks per switch. The calling task plays
+ * ping-pong with a bare context of its own, with interrupts off and without
+ * the scheduler, once with both in the same address space and once in two.
+ */
+
+#define SWITCH_ROUNDS	100000
+#define PEER_STACK_SIZE	0x2000
+
+static struct task_registers bench_self;
+static struct task_registers bench_peer;
+
+static void peer_main(void) {
+	while (1) {
+		switch_task(&bench_peer, &bench_self);
+	}
+}
+
+static uint64_t ping_pong(uint64_t cr3) {
+	uint8_t *stack = kmalloc(PEER_STACK_SIZE);
+	if (stack == NULL) {
+		return 0;
+	}
+
+	/* The top half is the peer's kernel stack, where switch_task() builds
+	 * the iretq frame for its first load. */
+	uint64_t top = ((uint64_t)stack + PEER_STACK_SIZE) & ~(uint64_t)0xF;
+	memset(&bench_peer, 0, sizeof(bench_peer));
+	bench_peer.rip = (uint64_t)peer_main;
+	bench_peer.rsp = top - PEER_STACK_SIZE / 2 - 8;
+	bench_peer.rflags = 0x2;
+	bench_peer.cs = 0x08;
+	bench_peer.ds = 0x10;
+	bench_peer.cr3 = cr3;
+	bench_peer.kernel_rsp = top;
+
+	uint64_t flags = irq_save();
+	switch_task(&bench_self, &bench_peer);	/* Takes the full path. */
+
+	uint64_t start = rdtsc();
+	for (size_t i = 0; i < SWITCH_ROUNDS; i++) {
+		switch_task(&bench_self, &bench_peer);
+	}
+	uint64_t tsc = rdtsc() - start;
+	irq_restore(flags);
+
+	kfree(stack);
+	return tsc / (SWITCH_ROUNDS * 2);
+}
+
+static void report(char *name, uint64_t val) {
+	serial_puts(name);
+	serial_puts(": ");
+	serial_putx(val);
+	serial_puts("\r\n");
+}
+
+void switch_bench(void) {
+	serial_puts("switch_bench\r\n");
+	report("same address space", ping_pong((uint64_t)getCR3()));
+
+	p_map_level4_table *pml4t = create_address_space();
+	if (pml4t == NULL) {
+		return;
+	}
+	report("other address space", ping_pong(pml4t->physical_address));
+	skeleton_put_space(pml4t);
+}
+
+#endif /* BENCH */
@@ -3,6 +3,7 @@
 #include <mem.h>
 #include <err.h>
 #include <fs/fs.h>
+#include <klog.h>
 
 char elf_magic[] = {'\x7f', 'E', 'L', 'F'};
 /* This is the file where ELF files are loaded into memory. I decided the function
@@ -63,13 +64,10 @@ p_map_level4_table *load_elf(char *file_name, uintptr_t *entry_point) {
 	 */
 	p_map_level4_table *pml4t = create_address_space();
 	if (pml4t == NULL) {
-		serial_puts("load_elf() could not create address space.\r\n");
+		klog_err("load_elf() could not create address space.\n");
 		kpanic(); /* This is likely a fatal error. */
 	}
 
-	/* This next part has to happen atomically. */
-	lock_scheduler();
-
 	/* Now we can create the task. */
 	for (size_t i = 0; i < hdr->phdr_entry_count; i++) {
 		if (kread(fd, &entry, sizeof(entry)) != sizeof(entry)) {
@@ -87,6 +85,11 @@ p_map_level4_table *load_elf(char *file_name, uintptr_t *entry_point) {
 			size_t vp_base = entry.vaddr / 0x1000;
 
 			map_memory(pp_base * 0x1000, vp_base * 0x1000, page_count, pml4t, 1);
+
+			/* The segment is loaded through the window, which everyone
+			 * shares. It is held for one segment at a time, so other tasks
+			 * get a turn while a big program loads. */
+			lock_phys_window();
 			/* temporarily map the same physical pages to the kernel PDPT at
 			 * a predetermined address. see "doc/memory_map.txt" for info.
 			 * TODO check page_count, and divide up if theres more than we can
@@ -106,15 +109,8 @@ p_map_level4_table *load_elf(char *file_name, uintptr_t *entry_point) {
 			kseek(fd, entry.data_off);
 			size_t red = kread(fd, mem_base, entry.size_file);
 			if (red != entry.size_file) {
-				serial_puts("[load_elf] Could not read bytes from file. Requested read: ");
-				serial_putx(entry.size_file);
-				serial_puts(" Amount actually read: ");
-				serial_putx(red);
-				serial_puts("\r\nFile name : ");
-				serial_puts(file_name);
-				serial_puts("\r\nPHDR index : ");
-				serial_putx(i);
-				serial_puts("\r\n");
+				klog_warn("load_elf: %s: PHDR %u: read %x of %x bytes\n",
+				          file_name, (uint64_t)i, (uint64_t)red, (uint64_t)entry.size_file);
 				/* Don't return or anything, ignore the error. Attempting to
 				 * recover from an error here would be very difficult.
 				 */
@@ -124,15 +120,14 @@ p_map_level4_table *load_elf(char *file_name, uintptr_t *entry_point) {
 
 			unmap_memory(0xFFFFFFFF98000000, page_count, pml4t);
 			loadPML4T(getCR3());
+			unlock_phys_window();
 		} else {
-			serial_puts("Encountered a non-recognized segment.\r\n");
+			klog_debug("load_elf: %s: skipping segment of type %x\n", file_name, (uint64_t)entry.segment_type);
 			continue;
 		}
 
 	}
 
-	unlock_scheduler();
-
 	/* return */
 	*entry_point = hdr->entry_addr;
 
@@ -2,6 +2,7 @@
 #include <string.h>
 #include <mem.h>
 #include <err.h>
+#include <klog.h>
 #include <tty.h>
 
 
@@ -11,39 +12,86 @@ extern void kpanic();
 
 /* This is a kernel-side implementation of the fork() syscall. */
 int64_t kfork(void) {
-	lock_scheduler();
 	struct task *ptask = get_current_task(); /* Parent*/
 	if (ptask == NULL) {
-		unlock_scheduler();
 		return -ERR_NO_RESULT;
 	}
+	if (ptask->leader != NULL) {
+		/* Only the leader's kernel stack is at TASK_KERNEL_STACK, where
+		 * fork_ret() copies it from. */
+		return -ERR_INCOMPAT_PARAM;
+	}
 
 	struct task *ctask = copy_task(ptask);
+	if (ctask == NULL) {
+		return -ERR_OUT_OF_MEM;
+	}
 
 	/* We have to temporarily map the kernel stack of the child task here. */
+	lock_phys_window();
 	map_memory(get_page_entry(ctask->pml4t, 0xFFFFFF7FFFFFF000), 0xFFFFFFFF98000000, 1, ptask->pml4t, 0);
 	loadPML4T(getCR3());
 
+	/* Interrupts use the top of the kernel stack that is being copied. The
+	 * child isn't queued yet, so nobody can run it before the copy is done. */
+	uint64_t flags = irq_save();
 	int64_t ret = fork_ret(ptask, ctask, 0xFFFFFFFF98000000);
 
 	if (ret == 1) {
 		/* Success, parent process. */
+		irq_restore(flags);
 		unmap_memory(0xFFFFFFFF98000000, 1, ptask->pml4t);
-		unlock_scheduler();
 		loadPML4T(getCR3());
+		unlock_phys_window();
 
-		return ctask->pid;
+		/* Once queued, the child may run (and exit) on another CPU. */
+		int64_t pid = ctask->pid;
+		wake_up_new_task(ctask);
+		return pid;
 	} else if (ret == 0) {
 		/* Success, child process. */
-		unlock_scheduler();
+		schedule_tail();
 		loadPML4T(getCR3());
 		return 0;
 	} else {
 		/* Failure. */
-		serial_puts("kfork() failed \r\n");
+		klog_err("kfork() failed\n");
 		kpanic();
 	}
 
 	return ret;
 }
 
+/* The kernel side of clone(): starts a thread of the current process at entry,
+ * with arg in rdi, stack as its stack pointer and tls as its FS base. Returns
+ * the thread's PID, which wait() takes as well. */
+int64_t kclone(void (*entry)(), uint64_t stack, uint64_t arg, uint64_t tls) {
+	struct task *t = get_current_task();
+	if ((stack < 16) || (stack >= 0xFFFFFF7FFFFFF000)) {
+		return -ERR_INVALID_PARAM;
+	}
+	/* create_thread() writes entry just below the stack. */
+	if (!is_user_writable((stack & ~(uint64_t)0xF) - 8, 8, t->pml4t)) {
+		return -ERR_INVALID_PARAM;
+	}
+	if ((entry == NULL) || ((uintptr_t)entry >= 0xFFFFFF7FFFFFF000)) {
+		return -ERR_INVALID_PARAM;
+	}
+	/* A non-canonical base would fault in wrmsr. */
+	if (((int64_t)(tls << 16) >> 16) != (int64_t)tls) {
+		return -ERR_INVALID_PARAM;
+	}
+	if (tls >= 0xFFFFFF7FFFFFF000) {
+		return -ERR_INVALID_PARAM;
+	}
+
+	struct task *nt = create_thread(t, entry, stack, arg, tls);
+	if (nt == NULL) {
+		return -ERR_OUT_OF_MEM;
+	}
+
+	/* Once queued, the thread may run (and exit) on another CPU. */
+	int64_t pid = nt->pid;
+	wake_up_new_task(nt);
+	return pid;
+}
@@ -0,0 +1,151 @@
+#include <task.h>
+#include <timer.h>
+#include <spinlock.h>
+#include <mem.h>
+#include <err.h>
+
+/* Futexes. A user program keeps its locks in its own memory, and only makes a
+ * syscall to sleep until a word changes (futex_wait()), or to wake whoever
+ * sleeps on it (futex_wake()). An uncontended lock never enters the kernel.
+ *
+ * A futex is known by the physical address of its word, so a word that is
+ * mapped into more than one address space is the same futex in all of them.
+ * Waiters are kept in a hash table of buckets, each with its own lock, in the
+ * order they came. Every task has its own waiter structure.
+ */
+
+#define FUTEX_BUCKETS	64
+
+struct futex_bucket {
+	struct spinlock lock;
+	struct futex_waiter *first;
+	struct futex_waiter *last;
+};
+
+static struct futex_bucket buckets[FUTEX_BUCKETS];
+
+
+static uint64_t futex_key(uint32_t *uaddr) {
+	/* Returns the physical address of uaddr, or 0 if it isn't a usable user
+	 * address of the current task. A futex word is always the user's to
+	 * write, so nothing else (like the time page) can be one. */
+	struct task *t = get_current_task();
+	if ((t->pml4t == NULL) || ((uintptr_t)uaddr & 3)) {
+		return 0;
+	}
+	if (!is_user_writable((uintptr_t)uaddr, sizeof(*uaddr), t->pml4t)) {
+		return 0;
+	}
+
+	uint64_t entry = get_page_entry(t->pml4t, (uintptr_t)uaddr);
+	return (entry & 0x000FFFFFFFFFF000) | ((uintptr_t)uaddr & 0xFFF);
+}
+
+static struct futex_bucket *get_bucket(uint64_t key) {
+	return &buckets[((key >> 2) * 0x9E3779B97F4A7C15) >> 58];
+}
+
+static void unlink_waiter(struct futex_bucket *b, struct futex_waiter *prev, struct futex_waiter *w) {
+	/* prev is the waiter before w, NULL if w is the first. */
+	if (prev == NULL) {
+		b->first = w->next;
+	} else {
+		prev->next = w->next;
+	}
+	if (b->last == w) {
+		b->last = prev;
+	}
+	w->next = NULL;
+}
+
+int64_t futex_wait(uint32_t *uaddr, uint32_t val, uint64_t timeout_ns) {
+	/* Sleeps until woken by futex_wake() on the same word, if it still holds
+	 * val. A timeout of 0 means none. Returns -ERR_INCOMPAT_PARAM if the word
+	 * didn't hold val, and -ERR_NO_RESULT on a timeout. */
+	uint64_t key = futex_key(uaddr);
+	if (key == 0) {
+		return -ERR_INVALID_PARAM;
+	}
+	struct futex_bucket *b = get_bucket(key);
+
+	struct futex_waiter *w = &get_current_task()->futex;
+	w->key = key;
+	w->task = get_current_task();
+	w->woken = 0;
+	struct sleeper *sl = &get_current_task()->sleeper;
+
+	/* The word is checked with the bucket locked, so a futex_wake() after
+	 * the change can't be missed. */
+	lock_task_switches();
+	uint64_t flags = spin_lock_irqsave(&b->lock);
+	if (__atomic_load_n(uaddr, __ATOMIC_SEQ_CST) != val) {
+		spin_unlock_irqrestore(&b->lock, flags);
+		unlock_task_switches();
+		return -ERR_INCOMPAT_PARAM;
+	}
+
+	w->next = NULL;
+	if (b->last == NULL) {
+		b->first = w;
+	} else {
+		b->last->next = w;
+	}
+	b->last = w;
+	if (timeout_ns) {
+		sleeper_arm(sl, timer_ticks() + ns_to_ticks(timeout_ns));
+	} else {
+		block_task();
+	}
+	spin_unlock_irqrestore(&b->lock, flags);
+	unlock_task_switches();	/* This is where we block. */
+
+	if (timeout_ns) {
+		sleeper_disarm(sl);
+	}
+
+	int64_t ret = 0;
+	flags = spin_lock_irqsave(&b->lock);
+	if (!w->woken) {
+		struct futex_waiter *prev = NULL;
+		for (struct futex_waiter *i = b->first; i != w; i = i->next) {
+			prev = i;
+		}
+		unlink_waiter(b, prev, w);
+		ret = -ERR_NO_RESULT;
+	}
+	spin_unlock_irqrestore(&b->lock, flags);
+	return ret;
+}
+
+int64_t futex_wake(uint32_t *uaddr, uint64_t n) {
+	/* Wakes up to n tasks sleeping on uaddr, the ones that waited longest
+	 * first. Returns how many were woken. */
+	uint64_t key = futex_key(uaddr);
+	if (key == 0) {
+		return -ERR_INVALID_PARAM;
+	}
+	struct futex_bucket *b = get_bucket(key);
+
+	int64_t woken = 0;
+	uint64_t flags = spin_lock_irqsave(&b->lock);
+	struct futex_waiter *prev = NULL;
+	struct futex_waiter *w = b->first;
+	while ((w != NULL) && ((uint64_t)woken < n)) {
+		struct futex_waiter *next = w->next;
+		if (w->key != key) {
+			prev = w;
+			w = next;
+			continue;
+		}
+
+		/* Unblocked with the bucket locked, once the waiter sees woken
+		 * it may be gone, and its task waiting on something else. */
+		unlink_waiter(b, prev, w);
+		w->woken = 1;
+		unblock_task(w->task);
+		woken++;
+		w = next;
+	}
+	spin_unlock_irqrestore(&b->lock, flags);
+	return woken;
+}
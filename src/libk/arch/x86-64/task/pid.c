@@ -0,0 +1,181 @@
+#include <task.h>
+#include <bitmap.h>
+#include <spinlock.h>
+#include <containers/radix.h>
+#include <err.h>
+
+/* PIDs and the list of every task. Only user tasks get a PID, kernel tasks
+ * keep 0, which is never handed out. A PID is found in the radix tree in a
+ * couple of steps, whatever state its task is in.
+ *
+ * PIDs are handed out in increasing order and wrap around at PID_MAX, so a
+ * PID that was just freed isn't reused right away.
+ *
+ * pid_lock protects all of it. It may be taken with the scheduler locked, but
+ * then nothing may be waited for under it: prepare_to_wait_task() takes a
+ * queue's lock and the scheduler's inside it, sched_setscheduler_task() the
+ * scheduler's.
+ */
+
+static uint64_t pid_words[PID_MAX / 64];
+static uint64_t pid_summary[BITMAP_SUMMARY_WORDS(PID_MAX)];
+static struct bitmap pid_map;
+static uint64_t last_pid = 0;
+
+static struct radix_tree pid_tree;
+RADIX_DEFINE(pid, struct task)
+
+static struct task *all_tasks = NULL;
+static uint64_t task_count = 0;
+
+static struct spinlock pid_lock;
+
+
+void init_pids(void) {
+	bitmap_init(&pid_map, pid_words, pid_summary, PID_MAX);
+	bitmap_set(&pid_map, 0);
+}
+
+static int64_t alloc_pid(void) {
+	int64_t pid = bitmap_find_zero(&pid_map, last_pid + 1);
+	if (pid < 0) {
+		pid = bitmap_find_zero(&pid_map, 1);
+	}
+	if (pid < 0) {
+		return -ERR_NO_RESULT;
+	}
+	bitmap_set(&pid_map, pid);
+	last_pid = pid;
+	return pid;
+}
+
+uint8_t register_task(struct task *t, uint8_t user) {
+	/* Adds t to the task list and, for user tasks, gives it a PID. */
+	uint64_t flags = spin_lock_irqsave(&pid_lock);
+	t->pid = 0;
+	if (user) {
+		int64_t pid = alloc_pid();
+		if (pid < 0) {
+			spin_unlock_irqrestore(&pid_lock, flags);
+			return -pid;
+		}
+		if (pid_insert(&pid_tree, pid, t)) {
+			bitmap_clear(&pid_map, pid);
+			spin_unlock_irqrestore(&pid_lock, flags);
+			return ERR_OUT_OF_MEM;
+		}
+		t->pid = pid;
+	}
+
+	t->all_prev = NULL;
+	t->all_next = all_tasks;
+	if (all_tasks != NULL) {
+		all_tasks->all_prev = t;
+	}
+	all_tasks = t;
+	task_count++;
+	spin_unlock_irqrestore(&pid_lock, flags);
+	return GENERIC_SUCCESS;
+}
+
+void unregister_task(struct task *t) {
+	/* Takes t off the list and frees its PID, unless it was handed on. */
+	uint64_t flags = spin_lock_irqsave(&pid_lock);
+	if ((t->pid != 0) && (pid_lookup(&pid_tree, t->pid) == t)) {
+		pid_remove(&pid_tree, t->pid);
+		bitmap_clear(&pid_map, t->pid);
+	}
+	t->pid = 0;
+
+	if (t->all_prev != NULL) {
+		t->all_prev->all_next = t->all_next;
+	} else {
+		all_tasks = t->all_next;
+	}
+	if (t->all_next != NULL) {
+		t->all_next->all_prev = t->all_prev;
+	}
+	t->all_next = NULL;
+	t->all_prev = NULL;
+	task_count--;
+	spin_unlock_irqrestore(&pid_lock, flags);
+}
+
+void pid_transfer(struct task *from, struct task *to) {
+	/* to takes over the PID of from (for exec), and its own is freed. */
+	uint64_t flags = spin_lock_irqsave(&pid_lock);
+	if ((to->pid != 0) && (pid_lookup(&pid_tree, to->pid) == to)) {
+		pid_remove(&pid_tree, to->pid);
+		bitmap_clear(&pid_map, to->pid);
+	}
+	to->pid = from->pid;
+	if (from->pid != 0) {
+		/* Replacing a slot never allocates. */
+		pid_insert(&pid_tree, from->pid, to);
+	}
+	from->pid = 0;
+	spin_unlock_irqrestore(&pid_lock, flags);
+}
+
+struct task *find_task(uint64_t pid) {
+	/* Nothing keeps the task from ending once this returns. To do something
+	 * with it, do it under pid_lock, like prepare_to_wait_task(). */
+	if ((pid == 0) || (pid >= PID_MAX)) {
+		return NULL;
+	}
+	uint64_t flags = spin_lock_irqsave(&pid_lock);
+	struct task *t = pid_lookup(&pid_tree, pid);
+	spin_unlock_irqrestore(&pid_lock, flags);
+	return t;
+}
+
+uint8_t prepare_to_wait_task(uint64_t pid, QUEUE **q) {
+	/* prepare_to_wait() on the wait queue of the task with the given PID,
+	 * which is put in q. The task is looked up and waited for under pid_lock,
+	 * and the terminator unregisters a task before it signals the queue, so
+	 * the caller is sure to be woken. The queue stays until the caller is back
+	 * from finish_wait(q). Returns ERR_NOT_FOUND if there's no such task. */
+	if ((pid == 0) || (pid >= PID_MAX)) {
+		return ERR_NOT_FOUND;
+	}
+	uint64_t flags = spin_lock_irqsave(&pid_lock);
+	struct task *t = pid_lookup(&pid_tree, pid);
+	uint8_t ret = ERR_NOT_FOUND;
+	if (t != NULL) {
+		*q = t->wait_queue;
+		ret = prepare_to_wait(*q);
+	}
+	spin_unlock_irqrestore(&pid_lock, flags);
+	return ret;
+}
+
+uint8_t sched_setscheduler_task(uint64_t pid, uint64_t policy, int64_t nice) {
+	/* sched_setscheduler() on the task with the given PID. The task can't
+	 * end while pid_lock is held, so it's done under it. Returns ERR_NOT_FOUND
+	 * if there's no such task. */
+	if ((pid == 0) || (pid >= PID_MAX)) {
+		return ERR_NOT_FOUND;
+	}
+	uint64_t flags = spin_lock_irqsave(&pid_lock);
+	struct task *t = pid_lookup(&pid_tree, pid);
+	uint8_t ret = ERR_NOT_FOUND;
+	if (t != NULL) {
+		ret = sched_setscheduler(t, policy, nice);
+	}
+	spin_unlock_irqrestore(&pid_lock, flags);
+	return ret;
+}
+
+void for_each_task(void (*fn)(struct task *t, void *arg), void *arg) {
+	/* Calls fn for every task, with pid_lock held. fn must not block, or
+	 * create or end tasks. */
+	uint64_t flags = spin_lock_irqsave(&pid_lock);
+	for (struct task *t = all_tasks; t != NULL; t = t->all_next) {
+		fn(t, arg);
+	}
+	spin_unlock_irqrestore(&pid_lock, flags);
+}
+
+uint64_t get_task_count(void) {
+	return task_count;
+}
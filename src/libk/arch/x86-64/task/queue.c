@@ -1,4 +1,5 @@
 #include <task.h>
+#include <timer.h>
 #include <mem.h>
 #include <err.h>
 
@@ -14,72 +15,263 @@
  * access to a certain resource.
  */
 
-void wait_queue(QUEUE *q) {
-	/* This function simply puts the caller process in the queue, and blocks. */
+/* Every task has a struct queue_waiter of its own, so it can wait on a queue no
+ * matter what else its next field is used for. A waiter is only ever unlinked
+ * with the queue locked: by whoever wakes it (who sets woken and the result
+ * first), or by the task itself if it gave up.
+ *
+ * Waiting is split in two, so the caller can release its own locks in between
+ * without missing a signal:
+ *
+ *	lock_task_switches();
+ *	prepare_to_wait(q);		<- blocks, once task switches are unlocked
+ *	release_rwsem_write(...);
+ *	unlock_task_switches();		<- the switch happens here
+ *	finish_wait(q);
+ *
+ * wait_queue() and wait_queue_timeout() do all of it for a caller with nothing
+ * to release.
+ */
 
-	if (q == NULL) {
-		return;
+static uint8_t link_waiter(QUEUE *q) {
+	/* With q locked. */
+	if (q->dead) {
+		return ERR_NOT_FOUND;
 	}
-	/* Queues should also have spinlocks when SMP is added. */
-	lock_task_switches();
-
+	struct queue_waiter *w = &get_current_task()->queue;
+	w->task = get_current_task();
+	w->next = NULL;
+	w->woken = 0;
+	w->result = GENERIC_SUCCESS;
+	if (q->last_waiter == NULL) {
+		q->first_waiter = w;
+	} else {
+		q->last_waiter->next = w;
+	}
+	q->last_waiter = w;
 	q->amount_waiting++;
-	if (q->first_task == NULL) {
-		q->first_task = get_current_task();
-		q->last_task = q->first_task;
-		q->last_task->next = NULL;
+	q->users++;
+	return GENERIC_SUCCESS;
+}
+
+static void unlink_waiter(QUEUE *q, struct queue_waiter *w) {
+	/* With q locked. */
+	struct queue_waiter *prev = NULL;
+	for (struct queue_waiter *i = q->first_waiter; i != w; prev = i, i = i->next);
+	if (prev == NULL) {
+		q->first_waiter = w->next;
 	} else {
-		q->last_task->next = get_current_task();
-		q->last_task = q->last_task->next;
-		q->last_task->next = NULL;
+		prev->next = w->next;
+	}
+	if (q->last_waiter == w) {
+		q->last_waiter = prev;
 	}
+	q->amount_waiting--;
+}
 
-	block_task();
+static size_t wake_waiters(QUEUE *q, size_t n, uint8_t result) {
+	/* With q locked. The task is unblocked before the lock is released,
+	 * after that its waiter may be gone. */
+	size_t woken = 0;
+	while ((q->first_waiter != NULL) && (woken < n)) {
+		struct queue_waiter *w = q->first_waiter;
+		q->first_waiter = w->next;
+		if (q->first_waiter == NULL) {
+			q->last_waiter = NULL;
+		}
+		q->amount_waiting--;
 
-	unlock_task_switches();
-	return;
+		w->result = result;
+		w->woken = 1;
+		unblock_task(w->task);
+		woken++;
+	}
+	return woken;
+}
+
+static void wake_pollers(QUEUE *q) {
+	/* With q locked. The flag is set with the scheduler locked, kpoll()
+	 * checks it the same way before it blocks. */
+	for (struct poll_entry *e = q->pollers; e != NULL; e = e->next) {
+		lock_scheduler();
+		e->task->poll_woken = 1;
+		unblock_task(e->task);
+		unlock_scheduler();
+	}
 }
 
 
-void signal_queue(QUEUE *q) {
-	/* This function simply wakes up the next task on the queue. */
+uint8_t prepare_to_wait(QUEUE *q) {
+	/* Puts the caller on q and blocks it, which happens once task switches
+	 * are unlocked. Must be called with task switches locked, and followed by
+	 * finish_wait() (unless it failed). Returns ERR_NOT_FOUND if q was
+	 * destroyed. */
 	if (q == NULL) {
-		return;
+		return ERR_INVALID_PARAM;
 	}
-	if (q->amount_waiting == 0) {
-		return;
+
+	uint64_t flags = spin_lock_irqsave(&q->lock);
+	uint8_t ret = link_waiter(q);
+	if (ret == GENERIC_SUCCESS) {
+		block_task();
 	}
+	spin_unlock_irqrestore(&q->lock, flags);
+	return ret;
+}
 
-	lock_task_switches();
+uint8_t finish_wait(QUEUE *q) {
+	/* Returns GENERIC_SUCCESS if q was signaled, ERR_NOT_FOUND if it was
+	 * destroyed, and ERR_NO_RESULT if the task was woken up by something
+	 * else (e.g. a timeout). In that case, it is taken off q. */
+	struct queue_waiter *w = &get_current_task()->queue;
+	uint64_t flags = spin_lock_irqsave(&q->lock);
+	uint8_t ret = w->result;
+	if (!w->woken) {
+		unlink_waiter(q, w);
+		ret = ERR_NO_RESULT;
+	}
+	q->users--;
+	spin_unlock_irqrestore(&q->lock, flags);
+	return ret;
+}
 
-	if (q->first_task != NULL) {
-		q->amount_waiting--;
-		unblock_task(q->first_task);
-		q->first_task = q->first_task->next;
-		if (q->first_task == NULL) {
-			q->last_task = NULL;
+uint8_t wait_queue(QUEUE *q) {
+	/* Blocks until q is signaled. Returns ERR_NOT_FOUND if q was destroyed. */
+	uint8_t ret;
+	do {
+		lock_task_switches();
+		ret = prepare_to_wait(q);
+		unlock_task_switches();
+		if (ret != GENERIC_SUCCESS) {
+			return ret;
 		}
+		ret = finish_wait(q);
+	} while (ret == ERR_NO_RESULT);
+	return ret;
+}
+
+
+uint8_t wait_queue_timeout(QUEUE *q, uint64_t ticks) {
+	/* Like wait_queue(), but gives up after ticks timer ticks. Returns
+	 * ERR_NO_RESULT if it timed out, GENERIC_SUCCESS if the queue was signaled.
+	 */
+	if (q == NULL) {
+		return ERR_INVALID_PARAM;
+	}
+
+	struct sleeper *s = &get_current_task()->sleeper;
+	lock_task_switches();
+	uint64_t flags = spin_lock_irqsave(&q->lock);
+	uint8_t ret = link_waiter(q);
+	if (ret != GENERIC_SUCCESS) {
+		spin_unlock_irqrestore(&q->lock, flags);
+		unlock_task_switches();
+		return ret;
 	}
 
+	sleeper_arm(s, timer_ticks() + ticks);
+	spin_unlock_irqrestore(&q->lock, flags);
 	unlock_task_switches();
-	return;
+	sleeper_disarm(s);
+
+	/* If we were signaled, that counts, even if the timer fired as well. */
+	return finish_wait(q);
+}
+
+
+size_t signal_queue_n(QUEUE *q, size_t n) {
+	/* Wakes up the next n tasks on the queue, and returns how many there
+	 * were. */
+	if (q == NULL) {
+		return 0;
+	}
+	if ((q->amount_waiting == 0) && (q->pollers == NULL)) {
+		return 0;
+	}
+
+	lock_task_switches();
+	uint64_t flags = spin_lock_irqsave(&q->lock);
+	size_t woken = wake_waiters(q, n, GENERIC_SUCCESS);
+	wake_pollers(q);
+	spin_unlock_irqrestore(&q->lock, flags);
+	unlock_task_switches();
+	return woken;
 }
 
+void signal_queue(QUEUE *q) {
+	/* This function simply wakes up the next task on the queue. */
+	signal_queue_n(q, 1);
+}
+
+size_t signal_queue_all(QUEUE *q) {
+	return signal_queue_n(q, (size_t)-1);
+}
+
+uint8_t queue_add_poller(QUEUE *q, struct poll_entry *e) {
+	/* Has e->task woken up (and its poll_woken set) whenever q is signaled,
+	 * until queue_remove_poller(). */
+	if ((q == NULL) || (e == NULL)) {
+		return ERR_INVALID_PARAM;
+	}
+
+	uint64_t flags = spin_lock_irqsave(&q->lock);
+	if (q->dead) {
+		spin_unlock_irqrestore(&q->lock, flags);
+		return ERR_NOT_FOUND;
+	}
+	e->q = q;
+	e->next = q->pollers;
+	q->pollers = e;
+	q->users++;
+	spin_unlock_irqrestore(&q->lock, flags);
+	return GENERIC_SUCCESS;
+}
+
+void queue_remove_poller(QUEUE *q, struct poll_entry *e) {
+	uint64_t flags = spin_lock_irqsave(&q->lock);
+	struct poll_entry **i = &q->pollers;
+	while (*i != e) {
+		i = &(*i)->next;
+	}
+	*i = e->next;
+	q->users--;
+	spin_unlock_irqrestore(&q->lock, flags);
+}
+
+
+void drain_queue(QUEUE *q) {
+	/* Waits until every task that was woken from q has left finish_wait(),
+	 * and every poller has removed itself. The caller has to make sure nobody
+	 * starts waiting on q any more, then q can be freed or reused. They have
+	 * to run to leave, so this mustn't be called with task switches locked.
+	 * One of them may be preempted on its way out, so the CPU is given up
+	 * while waiting. */
+	if (q == NULL) { return; }
+
+	uint64_t flags = spin_lock_irqsave(&q->lock);
+	while (q->users != 0) {
+		spin_unlock_irqrestore(&q->lock, flags);
+		lock_scheduler();
+		yield();
+		unlock_scheduler();
+		flags = spin_lock_irqsave(&q->lock);
+	}
+	spin_unlock_irqrestore(&q->lock, flags);
+}
 
 void destroy_queue(QUEUE *q) {
+	/* Whoever waits on q, or tries to, gets ERR_NOT_FOUND. Pollers are woken.
+	 * q is freed once the last of them is done with it. */
 	if (q == NULL) { return; }
-	/* THERE IS A BUG HERE. FIXME!
-	 * This is a serious race condition, if another process tries to wait()
-	 * this queue before we can free it they will stay blocked forever.
-	 * THIS SHOULD BE FIXED.
-	 *
-	 * IDEAS: Maybe have a spinlock preventing the structure to be modified by multiple
-	 * processes, and a variable inside the structure to indicate that the structure
-	 * has been freed? This way, we can have wait_queue() return an error
-	 * when the structure has been deleted, and the task that called wait_queue()
-	 * would have to deal with the consequences? The same could be done with
-	 * semaphores, too! That sounds good, but I'll have to do it in another commit.
-	 */
+
+	lock_task_switches();
+	uint64_t flags = spin_lock_irqsave(&q->lock);
+	q->dead = 1;
+	wake_waiters(q, (size_t)-1, ERR_NOT_FOUND);
+	wake_pollers(q);
+	spin_unlock_irqrestore(&q->lock, flags);
+	unlock_task_switches();
+
+	drain_queue(q);
 	kfree(q);
 }
-
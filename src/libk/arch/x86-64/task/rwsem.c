@@ -0,0 +1,155 @@
+#include <task.h>
+#include <mem.h>
+#include <string.h>
+#include <err.h>
+
+/* Reader-writer semaphores. Any number of readers may hold one at the same
+ * time, or a single writer. Writers come first: once a writer waits, new
+ * readers queue behind it, so a steady stream of readers can't starve it.
+ *
+ * Like with semaphores, a task that has to wait blocks with the spinlock held,
+ * and the one releasing the rwsem hands it over before unblocking the waiter.
+ * Waiting tasks are linked through their next field.
+ */
+
+RWSEM *create_rwsem(void) {
+	RWSEM *s = kmalloc(sizeof(RWSEM));
+	if (s == NULL) { return NULL; }
+
+	memset(s, 0, sizeof(*s));
+	return s;
+}
+
+static void enqueue(struct task **first, struct task **last, struct task *t) {
+	t->next = NULL;
+	if (*last == NULL) {
+		*first = t;
+	} else {
+		(*last)->next = t;
+	}
+	*last = t;
+}
+
+static struct task *dequeue(struct task **first, struct task **last) {
+	struct task *t = *first;
+	*first = t->next;
+	if (*first == NULL) {
+		*last = NULL;
+	}
+	return t;
+}
+
+
+uint8_t acquire_rwsem_read(RWSEM *s) {
+	/* Returns ERR_NOT_FOUND if s was destroyed instead. */
+	if (s == NULL) { return ERR_INVALID_PARAM; }
+	lock_task_switches();
+	uint64_t flags = spin_lock_irqsave(&s->lock);
+	if (s->dead) {
+		spin_unlock_irqrestore(&s->lock, flags);
+		unlock_task_switches();
+		return ERR_NOT_FOUND;
+	}
+
+	struct task *t = get_current_task();
+	t->sem_result = GENERIC_SUCCESS;
+	if ((s->count >= 0) && (s->first_writer == NULL)) {
+		s->count++;
+	} else {
+		enqueue(&s->first_reader, &s->last_reader, t);
+		block_task();
+	}
+
+	spin_unlock_irqrestore(&s->lock, flags);
+	unlock_task_switches();
+	return t->sem_result;
+}
+
+void release_rwsem_read(RWSEM *s) {
+	if (s == NULL) { return; }
+	lock_task_switches();
+	uint64_t flags = spin_lock_irqsave(&s->lock);
+
+	s->count--;
+	if ((s->count == 0) && (s->first_writer != NULL)) {
+		s->count = -1;
+		unblock_task(dequeue(&s->first_writer, &s->last_writer));
+	}
+
+	spin_unlock_irqrestore(&s->lock, flags);
+	unlock_task_switches();
+}
+
+uint8_t acquire_rwsem_write(RWSEM *s) {
+	/* Returns ERR_NOT_FOUND if s was destroyed instead. */
+	if (s == NULL) { return ERR_INVALID_PARAM; }
+	lock_task_switches();
+	uint64_t flags = spin_lock_irqsave(&s->lock);
+	if (s->dead) {
+		spin_unlock_irqrestore(&s->lock, flags);
+		unlock_task_switches();
+		return ERR_NOT_FOUND;
+	}
+
+	struct task *t = get_current_task();
+	t->sem_result = GENERIC_SUCCESS;
+	if (s->count == 0) {
+		s->count = -1;
+	} else {
+		enqueue(&s->first_writer, &s->last_writer, t);
+		block_task();
+	}
+
+	spin_unlock_irqrestore(&s->lock, flags);
+	unlock_task_switches();
+	return t->sem_result;
+}
+
+void release_rwsem_write(RWSEM *s) {
+	/* The next writer gets it if there is one, otherwise every waiting
+	 * reader does. */
+	if (s == NULL) { return; }
+	lock_task_switches();
+	uint64_t flags = spin_lock_irqsave(&s->lock);
+
+	if (s->first_writer != NULL) {
+		unblock_task(dequeue(&s->first_writer, &s->last_writer));
+	} else {
+		s->count = 0;
+		while (s->first_reader != NULL) {
+			s->count++;
+			unblock_task(dequeue(&s->first_reader, &s->last_reader));
+		}
+	}
+
+	spin_unlock_irqrestore(&s->lock, flags);
+	unlock_task_switches();
+}
+
+void destroy_rwsem(RWSEM *s) {
+	/* Waits for s's holders to let go of it, then fails whoever still waits
+	 * on it, or tries to, with ERR_NOT_FOUND. Waiters don't touch s after
+	 * they're woken, so it can be freed right away. */
+	if (s == NULL) { return; }
+	if (acquire_rwsem_write(s) != GENERIC_SUCCESS) {
+		return;
+	}
+
+	lock_task_switches();
+	uint64_t flags = spin_lock_irqsave(&s->lock);
+	s->dead = 1;
+	while (s->first_writer != NULL) {
+		struct task *t = dequeue(&s->first_writer, &s->last_writer);
+		t->sem_result = ERR_NOT_FOUND;
+		unblock_task(t);
+	}
+	while (s->first_reader != NULL) {
+		struct task *t = dequeue(&s->first_reader, &s->last_reader);
+		t->sem_result = ERR_NOT_FOUND;
+		unblock_task(t);
+	}
+	spin_unlock_irqrestore(&s->lock, flags);
+	unlock_task_switches();
+
+	kfree(s);
+}
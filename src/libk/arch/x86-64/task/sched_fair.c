@@ -0,0 +1,151 @@
+#include <task.h>
+#include <err.h>
+
+/* The fair scheduling class. Every task has a virtual runtime, which grows
+ * while it runs: by SCHED_TICK_VRUNTIME a tick at nice 0, faster for nicer
+ * tasks and slower for less nice ones. The queued task with the smallest
+ * virtual runtime runs next, so over time everybody gets CPU time in proportion
+ * to their weight.
+ *
+ * A task that wakes up gets its virtual runtime raised to slightly below the
+ * smallest one, so sleeping doesn't save up CPU time, but an interactive task
+ * still gets to run (and preempt a CPU hog) soon after waking up.
+ */
+
+#define SCHED_TICK_VRUNTIME	1024
+#define NICE_0_WEIGHT		1024
+
+/* How far behind min_vruntime a woken task may be placed, and how much a woken
+ * task has to be behind the running one to preempt it.
+ */
+#define SLEEPER_CREDIT		((SCHED_LATENCY / 2) * SCHED_TICK_VRUNTIME)
+#define WAKEUP_GRANULARITY	SCHED_TICK_VRUNTIME
+
+/* Weights of the nice levels -20 to 19. Every level gets about 1.25 times the
+ * CPU time of the next one.
+ */
+static const uint64_t nice_weights[40] = {
+	88761, 71755, 56483, 46273, 36291,
+	29154, 23254, 18705, 14949, 11916,
+	 9548,  7620,  6100,  4904,  3906,
+	 3121,  2501,  1991,  1586,  1277,
+	 1024,   820,   655,   526,   423,
+	  335,   272,   215,   172,   137,
+	  110,    87,    70,    56,    45,
+	   36,    29,    23,    18,    15,
+};
+
+RB_DEFINE(fair_rq, struct task, run_node)
+
+
+uint64_t sched_nice_weight(int64_t nice) {
+	if (nice < NICE_MIN) { nice = NICE_MIN; }
+	if (nice > NICE_MAX) { nice = NICE_MAX; }
+	return nice_weights[nice - NICE_MIN];
+}
+
+static void update_min_vruntime(struct rq *rq, struct task *curr) {
+	struct task *left = fair_rq_first(&rq->fair_queue);
+	uint64_t v;
+
+	if ((curr != NULL) && (left != NULL)) {
+		v = (curr->vruntime < left->vruntime) ? curr->vruntime : left->vruntime;
+	} else if (curr != NULL) {
+		v = curr->vruntime;
+	} else if (left != NULL) {
+		v = left->vruntime;
+	} else {
+		return;
+	}
+
+	if (v > rq->min_vruntime) {
+		rq->min_vruntime = v;
+	}
+}
+
+static void fair_enqueue(struct rq *rq, struct task *t, uint8_t flags) {
+	if (flags & SCHED_ENQUEUE_NEW) {
+		t->vruntime = rq->min_vruntime;
+	} else if (flags & SCHED_ENQUEUE_WAKEUP) {
+		uint64_t floor = (rq->min_vruntime > SLEEPER_CREDIT) ? (rq->min_vruntime - SLEEPER_CREDIT) : 0;
+		if (t->vruntime < floor) {
+			t->vruntime = floor;
+		}
+	}
+
+	fair_rq_insert(&rq->fair_queue, t, t->vruntime);
+	rq->fair_weight += t->weight;
+	rq->nr_queued++;
+}
+
+static void fair_dequeue(struct rq *rq, struct task *t) {
+	fair_rq_remove(&rq->fair_queue, t);
+	rq->fair_weight -= t->weight;
+	rq->nr_queued--;
+}
+
+static struct task *fair_pick_next(struct rq *rq) {
+	struct task *t = fair_rq_first(&rq->fair_queue);
+	if (t == NULL) {
+		return NULL;
+	}
+
+	/* The task's share of the latency period. */
+	uint64_t slice = (SCHED_LATENCY * t->weight) / rq->fair_weight;
+	if (slice < SCHED_MIN_GRANULARITY) {
+		slice = SCHED_MIN_GRANULARITY;
+	}
+
+	fair_dequeue(rq, t);
+	t->ticks_remaining = slice;
+	update_min_vruntime(rq, t);
+	return t;
+}
+
+static void fair_tick(struct rq *rq, struct task *t) {
+	t->vruntime += (SCHED_TICK_VRUNTIME * NICE_0_WEIGHT) / t->weight;
+	if (t->ticks_remaining != 0) {
+		t->ticks_remaining--;
+	}
+	update_min_vruntime(rq, t);
+}
+
+static uint8_t fair_check_preempt(struct task *curr, struct task *woken) {
+	return (woken->vruntime + WAKEUP_GRANULARITY) < curr->vruntime;
+}
+
+static struct task *fair_iterate(struct rq *rq, struct task *prev) {
+	if (prev == NULL) {
+		return fair_rq_first(&rq->fair_queue);
+	}
+	return fair_rq_next(prev);
+}
+
+static void fair_migrate(struct rq *from, struct rq *to, struct task *t) {
+	/* Virtual runtimes only mean something within a run queue. Keep the
+	 * task's distance to min_vruntime. A task that slept may be far behind
+	 * it, it gets no more credit than a wakeup would. */
+	int64_t lag = (int64_t)(t->vruntime - from->min_vruntime);
+	if (lag < -(int64_t)SLEEPER_CREDIT) {
+		lag = -(int64_t)SLEEPER_CREDIT;
+	}
+	if ((lag < 0) && ((uint64_t)-lag > to->min_vruntime)) {
+		t->vruntime = 0;
+	} else {
+		t->vruntime = to->min_vruntime + lag;
+	}
+}
+
+
+struct sched_class fair_sched_class = {
+	.name = "fair",
+	.next = &idle_sched_class,
+
+	.enqueue = fair_enqueue,
+	.dequeue = fair_dequeue,
+	.pick_next = fair_pick_next,
+	.tick = fair_tick,
+	.check_preempt = fair_check_preempt,
+	.iterate = fair_iterate,
+	.migrate = fair_migrate,
+};
@@ -0,0 +1,70 @@
+#include <task.h>
+#include <err.h>
+
+/* The idle class, for background work. Its tasks only run when the fair class
+ * has nothing to run, and take turns with TASK_DEFAULT_TIME ticks each. The
+ * kernel's own idle tasks (the ones that halt) are not queued here, see
+ * struct rq.
+ *
+ * All tasks are queued with the same key, and equal keys keep their insertion
+ * order, so the tree works as a FIFO.
+ */
+
+RB_DEFINE(idle_rq, struct task, run_node)
+
+
+static void idle_enqueue(struct rq *rq, struct task *t, uint8_t flags) {
+	(void)flags;
+	idle_rq_insert(&rq->idle_queue, t, 0);
+	rq->nr_queued++;
+}
+
+static void idle_dequeue(struct rq *rq, struct task *t) {
+	idle_rq_remove(&rq->idle_queue, t);
+	rq->nr_queued--;
+}
+
+static struct task *idle_pick_next(struct rq *rq) {
+	struct task *t = idle_rq_first(&rq->idle_queue);
+	if (t == NULL) {
+		return NULL;
+	}
+
+	idle_dequeue(rq, t);
+	t->ticks_remaining = TASK_DEFAULT_TIME;
+	return t;
+}
+
+static void idle_tick(struct rq *rq, struct task *t) {
+	(void)rq;
+	if (t->ticks_remaining != 0) {
+		t->ticks_remaining--;
+	}
+}
+
+static uint8_t idle_check_preempt(struct task *curr, struct task *woken) {
+	(void)curr;
+	(void)woken;
+	return 0;
+}
+
+static struct task *idle_iterate(struct rq *rq, struct task *prev) {
+	if (prev == NULL) {
+		return idle_rq_first(&rq->idle_queue);
+	}
+	return idle_rq_next(prev);
+}
+
+
+struct sched_class idle_sched_class = {
+	.name = "idle",
+	.next = NULL,
+
+	.enqueue = idle_enqueue,
+	.dequeue = idle_dequeue,
+	.pick_next = idle_pick_next,
+	.tick = idle_tick,
+	.check_preempt = idle_check_preempt,
+	.iterate = idle_iterate,
+	.migrate = NULL,
+};
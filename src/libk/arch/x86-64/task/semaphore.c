@@ -1,6 +1,8 @@
 
 #include <task.h>
+#include <timer.h>
 #include <mem.h>
+#include <err.h>
 
 
 SEMAPHORE *create_semaphore(int32_t max_count) {
@@ -19,29 +21,110 @@ SEMAPHORE *create_semaphore(int32_t max_count) {
 }
 
 
-/* TODO: When SMP support is added, these should be guarded by a spinlock. */
+/* The semaphore's fields are guarded by its spinlock. A task that has to wait
+ * blocks before the lock is released, the switch happens once task switches
+ * are unlocked.
+ *
+ * Binary semaphores (max_count 1) have an owner, and priority inheritance: the
+ * owner runs with at least the priority of the highest task waiting on it,
+ * through chains of owners waiting on other semaphores. A fair task's priority
+ * is its weight, a task of a lower class has none. Waiting lists, owners and
+ * boosts are changed with the scheduler locked as well, so a chain can be
+ * followed without taking every semaphore's lock.
+ */
 
-void acquire_semaphore(SEMAPHORE *s) {
-	if (s == NULL) { return; }
-	/* This is where the spinlock would go, but we don't have
-	 * SMP, so this works well enough.
-	 */
+#define PI_MAX_DEPTH	8
+
+static uint64_t pi_prio(struct task *t) {
+	return (t->sched_class == &fair_sched_class) ? t->weight : 0;
+}
+
+static void pi_update(struct task *t) {
+	/* Boosts t to its highest waiter, and passes the change on to whoever
+	 * holds what t waits for. With the scheduler locked. */
+	for (size_t depth = 0; (t != NULL) && (depth < PI_MAX_DEPTH); depth++) {
+		uint64_t boost = 0;
+		for (SEMAPHORE *s = t->pi_held; s != NULL; s = s->held_next) {
+			for (struct task *w = s->first_waiting_task; w != NULL; w = w->next) {
+				boost = (pi_prio(w) > boost) ? pi_prio(w) : boost;
+			}
+		}
+		if (boost == t->pi_weight) {
+			return;
+		}
+		sched_pi_boost(t, boost);
+		t = (t->pi_blocked_on != NULL) ? t->pi_blocked_on->owner : NULL;
+	}
+}
+
+static void pi_take(SEMAPHORE *s, struct task *t) {
+	/* t now holds s. */
+	if (s->max_count != 1) {
+		return;
+	}
+	lock_scheduler();
+	t->pi_blocked_on = NULL;
+	s->owner = t;
+	s->held_next = t->pi_held;
+	t->pi_held = s;
+	pi_update(t);
+	unlock_scheduler();
+}
+
+static void pi_drop(SEMAPHORE *s) {
+	/* s's owner lets go of it, and loses what it got from its waiters. */
+	if ((s->max_count != 1) || (s->owner == NULL)) {
+		return;
+	}
+	lock_scheduler();
+	struct task *t = s->owner;
+	SEMAPHORE **i = &t->pi_held;
+	while ((*i != NULL) && (*i != s)) {
+		i = &(*i)->held_next;
+	}
+	if (*i != NULL) {
+		*i = s->held_next;
+	}
+	s->owner = NULL;
+	s->held_next = NULL;
+	pi_update(t);
+	unlock_scheduler();
+}
+
+uint8_t acquire_semaphore(SEMAPHORE *s) {
+	/* Returns ERR_NOT_FOUND if s was destroyed instead. */
+	if (s == NULL) { return ERR_INVALID_PARAM; }
 	lock_task_switches();
+	uint64_t flags = spin_lock_irqsave(&s->lock);
+	if (s->dead) {
+		spin_unlock_irqrestore(&s->lock, flags);
+		unlock_task_switches();
+		return ERR_NOT_FOUND;
+	}
 
+	struct task *t = get_current_task();
+	t->sem_result = GENERIC_SUCCESS;
 
 	/* If the semaphore is already at its limit, block. */
 	if (s->current_count >= s->max_count) {
 
 		/* First, we add the currently running task to the list of waiting
-		 * tasks for that semaphore.
+		 * tasks for that semaphore, and lend the owner our priority.
 		 */
+		lock_scheduler();
+		t->next = NULL;
 		if (s->last_waiting_task == NULL) {
-			s->first_waiting_task = get_current_task();
-			s->last_waiting_task = get_current_task();
+			s->first_waiting_task = t;
+			s->last_waiting_task = t;
 		} else {
-			s->last_waiting_task->next = get_current_task();
-			s->last_waiting_task = get_current_task();
+			s->last_waiting_task->next = t;
+			s->last_waiting_task = t;
 		}
+		if (s->max_count == 1) {
+			t->pi_blocked_on = s;
+			pi_update(s->owner);
+		}
+		unlock_scheduler();
 
 		/* Now we block. When the task that is currently using this
 		 * semaphore finishes its job, it will call release_semaphore(),
@@ -56,37 +139,121 @@ void acquire_semaphore(SEMAPHORE *s) {
 	} else {
 		/* The semaphore is available. */
 		s->current_count++;
+		pi_take(s, t);
 	}
 
-	/* This is where the lock for this semaphore would be released. */
+	spin_unlock_irqrestore(&s->lock, flags);
 	unlock_task_switches();
 
-	return;
+	return t->sem_result;
 }
 
 
+uint8_t acquire_semaphore_timeout(SEMAPHORE *s, uint64_t ticks) {
+	/* Like acquire_semaphore(), but gives up after ticks timer ticks. Returns
+	 * ERR_NO_RESULT if the semaphore wasn't acquired, ERR_NOT_FOUND if it was
+	 * destroyed.
+	 */
+	if (s == NULL) { return ERR_INVALID_PARAM; }
+	lock_task_switches();
+	uint64_t flags = spin_lock_irqsave(&s->lock);
+	if (s->dead) {
+		spin_unlock_irqrestore(&s->lock, flags);
+		unlock_task_switches();
+		return ERR_NOT_FOUND;
+	}
+
+	if (s->current_count < s->max_count) {
+		s->current_count++;
+		pi_take(s, get_current_task());
+		spin_unlock_irqrestore(&s->lock, flags);
+		unlock_task_switches();
+		return GENERIC_SUCCESS;
+	}
+
+	struct task *t = get_current_task();
+	struct sleeper *sl = &get_current_task()->sleeper;
+	t->sem_result = GENERIC_SUCCESS;
+	s->users++;
+	lock_scheduler();
+	t->next = NULL;
+	if (s->last_waiting_task == NULL) {
+		s->first_waiting_task = t;
+	} else {
+		s->last_waiting_task->next = t;
+	}
+	s->last_waiting_task = t;
+	if (s->max_count == 1) {
+		t->pi_blocked_on = s;
+		pi_update(s->owner);
+	}
+	unlock_scheduler();
+
+	sleeper_arm(sl, timer_ticks() + ticks);
+	spin_unlock_irqrestore(&s->lock, flags);
+	unlock_task_switches();
+	sleeper_disarm(sl);
+
+	/* release_semaphore() hands the semaphore over by unlinking the task. If
+	 * we're still in the list, we don't own it. destroy_semaphore() unlinks
+	 * it too, but with ERR_NOT_FOUND as the result. */
+	lock_task_switches();
+	flags = spin_lock_irqsave(&s->lock);
+	uint8_t ret = t->sem_result;
+	lock_scheduler();
+	struct task *prev = NULL;
+	for (struct task *i = s->first_waiting_task; i != NULL; prev = i, i = i->next) {
+		if (i != t) {
+			continue;
+		}
+
+		if (prev == NULL) {
+			s->first_waiting_task = t->next;
+		} else {
+			prev->next = t->next;
+		}
+		if (s->last_waiting_task == t) {
+			s->last_waiting_task = prev;
+		}
+
+		/* The owner doesn't get our priority any more. */
+		t->pi_blocked_on = NULL;
+		pi_update(s->owner);
+		ret = ERR_NO_RESULT;
+		break;
+	}
+	unlock_scheduler();
+	s->users--;
+	spin_unlock_irqrestore(&s->lock, flags);
+	unlock_task_switches();
+	return ret;
+}
+
 
 void release_semaphore(SEMAPHORE *s) {
 	if (s == NULL) { return; }
-	/* This is where the spinlock would go, but we don't have
-	 * SMP, so this works well enough.
-	 */
 	lock_task_switches();
+	uint64_t flags = spin_lock_irqsave(&s->lock);
 
 	if (s->first_waiting_task == NULL) {
 		s->current_count--;
+		pi_drop(s);
 	} else {
-		/* Unblock the first waiting task. */
-		unblock_task(s->first_waiting_task);
-
-		/* Unlink the task we just unblocked. */
-		s->first_waiting_task = s->first_waiting_task->next;
+		/* Unlink the first waiting task, hand it the semaphore, then
+		 * unblock it. Once it runs it may wait on something else. */
+		lock_scheduler();
+		struct task *t = s->first_waiting_task;
+		s->first_waiting_task = t->next;
 		if (s->first_waiting_task == NULL) {
 			s->last_waiting_task = NULL;
 		}
+		pi_drop(s);
+		pi_take(s, t);
+		unblock_task(t);
+		unlock_scheduler();
 	}
 
-	/* This is where the lock for this semaphore would be released. */
+	spin_unlock_irqrestore(&s->lock, flags);
 	unlock_task_switches();
 
 	return;
@@ -95,18 +262,43 @@ void release_semaphore(SEMAPHORE *s) {
 
 
 void destroy_semaphore(SEMAPHORE *s) {
+	/* Waits for s like acquire_semaphore() does, then fails whoever still
+	 * waits on it, or tries to, with ERR_NOT_FOUND. s is freed once the last
+	 * of them is done with it, see destroy_queue(). */
 	if (s == NULL) { return; }
+	if (acquire_semaphore(s) != GENERIC_SUCCESS) {
+		return;
+	}
 
-	/* THERE IS A BUG HERE. FIXME!
-	 * This is a serious race condition, if another process tries to acquire()
-	 * this semaphore they will stay blocked forever. THIS SHOULD BE FIXED.
-	 * see destroy_queue() in queues.c for ideas on how to fix it.
-	 */
+	lock_task_switches();
+	uint64_t flags = spin_lock_irqsave(&s->lock);
+	s->dead = 1;
 
-	acquire_semaphore(s);
+	/* Nobody is blocked on s any more, so the PI chains stop here. */
 	lock_scheduler();
+	while (s->first_waiting_task != NULL) {
+		struct task *t = s->first_waiting_task;
+		s->first_waiting_task = t->next;
+		t->pi_blocked_on = NULL;
+		t->sem_result = ERR_NOT_FOUND;
+		unblock_task(t);
+	}
+	s->last_waiting_task = NULL;
+	pi_drop(s);
+	unlock_scheduler();
+
+	/* Timed waiters look at s once more after being woken. */
+	while (s->users != 0) {
+		spin_unlock_irqrestore(&s->lock, flags);
+		unlock_task_switches();
+		lock_scheduler();
+		yield();
+		unlock_scheduler();
+		lock_task_switches();
+		flags = spin_lock_irqsave(&s->lock);
+	}
+	spin_unlock_irqrestore(&s->lock, flags);
+	unlock_task_switches();
 
 	kfree(s);
-	unlock_scheduler();
 }
-
@@ -0,0 +1,194 @@
+#include <task.h>
+#include <string.h>
+#include <mem.h>
+#include <err.h>
+#include <fpu.h>
+#include <spinlock.h>
+
+/* Spawning a task needs a task structure, a wait queue, a PML4T with the kernel
+ * PDPT linked in, and the two stack frames. Exiting tears all of that down
+ * again. Instead of doing that for every short-lived command, the terminator
+ * hands the pieces back here and create_task()/create_address_space() pick
+ * them up again.
+ *
+ * Both caches are protected by skel_lock.
+ */
+static struct spinlock skel_lock;
+
+struct task *task_cache[SKELETON_CACHE_SIZE];
+size_t task_cache_count = 0;
+
+p_map_level4_table *space_cache[SKELETON_CACHE_SIZE];
+size_t space_cache_count = 0;
+
+struct skeleton_stats skel_stats;
+
+
+static uint8_t is_stack_page(size_t i, size_t j, size_t k, size_t l) {
+	uint64_t va = (i << 39) | (j << 30) | (k << 21) | (l << 12);
+	if (i >= 256) {
+		va |= 0xFFFF000000000000;	/* Canonical form. */
+	}
+	return (va == TASK_USER_STACK) || (va == TASK_KERNEL_STACK);
+}
+
+/* Frees every user page and page struct of an address space. If keep_stacks is
+ * set, the two stack frames and the shared pages (and the tables leading to
+ * them) are left in place.
+ * The kernel PDPT is never touched.
+ */
+static void strip_addr_space(p_map_level4_table *pml4t, size_t keep_stacks) {
+	for (size_t i = 0; i < 511; i++) {
+		pd_ptr_table *pdpt = pml4t->child[i];
+		if (pdpt == NULL) {
+			continue;
+		}
+		size_t pdpt_kept = 0;
+
+		for (size_t j = 0; j < 512; j++) {
+			page_dir *pd = pdpt->child[j];
+			if (pd == NULL) {
+				continue;
+			}
+			size_t pd_kept = 0;
+
+			for (size_t k = 0; k < 512; k++) {
+				page_table *pt = pd->child[k];
+				if (pt == NULL) {
+					continue;
+				}
+				size_t pt_kept = 0;
+
+				for (size_t l = 0; l < 512; l++) {
+					uint64_t entry = pt->entries[l];
+					if (entry == 0) {
+						continue;
+					}
+
+					if (keep_stacks && is_stack_page(i, j, k, l)) {
+						pt_kept++;
+						continue;
+					}
+					if (entry & PAGE_SHARED) {
+						/* Not ours to free, see MAP_USER_RO. */
+						if (keep_stacks) {
+							pt_kept++;
+						} else {
+							pt->entries[l] = 0;
+						}
+						continue;
+					}
+
+					freepp(entry / 0x1000);
+					pt->entries[l] = 0;
+				}
+
+				if (pt_kept) {
+					pd_kept++;
+					continue;
+				}
+				free_page_struct((struct page_struct*)pt);
+				pd->child[k] = NULL;
+				pd->entries[k] = 0;
+			}
+
+			if (pd_kept) {
+				pdpt_kept++;
+				continue;
+			}
+			free_page_struct(pd);
+			pdpt->child[j] = NULL;
+			pdpt->entries[j] = 0;
+		}
+
+		if (pdpt_kept) {
+			continue;
+		}
+		free_page_struct(pdpt);
+		pml4t->child[i] = NULL;
+		pml4t->entries[i] = 0;
+	}
+}
+
+
+struct task *skeleton_get_task(void) {
+	uint64_t flags = spin_lock_irqsave(&skel_lock);
+	if (task_cache_count == 0) {
+		skel_stats.task_misses++;
+		spin_unlock_irqrestore(&skel_lock, flags);
+		return NULL;
+	}
+
+	struct task *t = task_cache[--task_cache_count];
+	skel_stats.task_hits++;
+	spin_unlock_irqrestore(&skel_lock, flags);
+	return t;
+}
+
+void skeleton_put_task(struct task *t) {
+	if (t == NULL) { return; }
+	fpu_release(t);
+
+	uint64_t flags = spin_lock_irqsave(&skel_lock);
+	if ((task_cache_count >= SKELETON_CACHE_SIZE) || (t->wait_queue == NULL)) {
+		spin_unlock_irqrestore(&skel_lock, flags);
+		kfree(t->wait_queue);
+		kfree(t);
+		return;
+	}
+
+	QUEUE *q = t->wait_queue;
+	memset(t, 0, sizeof(*t));
+	memset(q, 0, sizeof(*q));
+	t->wait_queue = q;
+
+	task_cache[task_cache_count++] = t;
+	spin_unlock_irqrestore(&skel_lock, flags);
+}
+
+p_map_level4_table *skeleton_get_space(void) {
+	uint64_t flags = spin_lock_irqsave(&skel_lock);
+	if (space_cache_count == 0) {
+		skel_stats.space_misses++;
+		spin_unlock_irqrestore(&skel_lock, flags);
+		return NULL;
+	}
+
+	p_map_level4_table *pml4t = space_cache[--space_cache_count];
+	skel_stats.space_hits++;
+	spin_unlock_irqrestore(&skel_lock, flags);
+	return pml4t;
+}
+
+void skeleton_put_space(p_map_level4_table *pml4t) {
+	if (pml4t == NULL) { return; }
+
+	/* Stripping walks the whole address space, so it's done without the
+	 * lock. Whether there's room in the cache is only a guess until the
+	 * lock is held, if the cache filled up meanwhile the rest goes too. */
+	size_t keep = space_cache_count < SKELETON_CACHE_SIZE;
+	strip_addr_space(pml4t, keep);
+
+	if (keep) {
+		uint64_t flags = spin_lock_irqsave(&skel_lock);
+		if (space_cache_count < SKELETON_CACHE_SIZE) {
+			space_cache[space_cache_count++] = pml4t;
+			spin_unlock_irqrestore(&skel_lock, flags);
+			return;
+		}
+		spin_unlock_irqrestore(&skel_lock, flags);
+		strip_addr_space(pml4t, 0);
+	}
+
+	free_page_struct(pml4t);
+}
+
+void skeleton_get_stats(struct skeleton_stats *s) {
+	if (s == NULL) { return; }
+
+	uint64_t flags = spin_lock_irqsave(&skel_lock);
+	memcpy(s, &skel_stats, sizeof(*s));
+	s->tasks_cached = task_cache_count;
+	s->spaces_cached = space_cache_count;
+	spin_unlock_irqrestore(&skel_lock, flags);
+}
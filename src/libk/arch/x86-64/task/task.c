@@ -3,12 +3,15 @@
 #include <string.h>
 #include <mem.h>
 #include <err.h>
+#include <fpu.h>
+#include <timer.h>
+#include <smp.h>
 #include <fs/fs.h>
 #include <tty.h>
+#include <klog.h>
 
-struct task *current_task;
-struct task *first_task;
-struct task *last_task;
+/* The scheduling classes, from the highest priority to the lowest. */
+struct sched_class *sched_classes = &fair_sched_class;
 
 /* Task termination is done as follows:
  * -a process calls terminate_process, which puts the process into this queue
@@ -20,43 +23,27 @@ struct task *last_task;
 QUEUE termination_queue;
 struct task *terminator_task;
 
-/* This lock will be used to make sure only one task can access the task
- * structures at a time. This should be replaced with a proper semaphore
- * in the future.
+/* The scheduler lock protects the run queues of every CPU and the scheduling
+ * fields of every task. It is a spinlock that keeps interrupts disabled on the
+ * CPU holding it, and that CPU may take it again. It is held across a task
+ * switch: the task switched to releases it (see yield() and schedule_tail()).
  */
-volatile int32_t sched_lock = 0;
-
-/* This lock will be used for miscellanious stuff to simply postpone task
- * switches while the cpu is holding a (any) lock. It does not protect the
- * task structures.
- */
-volatile int32_t task_switch_lock = 0;
-
-/* Flag to check whether a task switch was postponed while the above lock
- * was being held.
+static struct spinlock sched_spin;
+static struct cpu *volatile sched_owner = NULL;
+static int32_t sched_depth = 0;
+static uint64_t sched_flags = 0;
+
+/* lock_task_switches() simply postpones task switches on the CPU while it is
+ * holding a (any) lock. It does not protect the task structures. The counter
+ * and the postponed flag are per CPU, see struct cpu.
  */
-int32_t task_switch_postponed = 0;
 
-/* This is here to keep track of which PID to use next. */
-uint64_t last_pid = 0;
 
 
 struct task *get_current_task() {
-	return current_task;
-}
-
-struct task *find_task(uint64_t pid) {
-	if (current_task->pid == pid) {
-		return current_task;
-	}
-	struct task *i = first_task;
-	while (i != NULL) {
-		if (i->pid == pid) {
-			return i;
-		}
-		i = i->next;
-	}
-	return NULL;
+	struct task *t;
+	__asm__ volatile ("mov %%gs:%c1, %0" : "=r"(t) : "i"(offsetof(struct cpu, current_task)));
+	return t;
 }
 
 int64_t kchdir(struct task *t, char *fname) {
@@ -97,25 +84,33 @@ uint64_t flags, uint64_t stack, uint64_t kernel_stack, size_t ring, uint64_t arg
 	t->reg.r15 	= 0;
 
 	t->reg.rbp 	= stack;
-	t->reg.rsp 	= stack-8;
+	t->reg.rsp 	= stack-24;
 
 	/* OK, this is important.
 	 * The main function isn't set as the RIP. instead a task loader function is
 	 * set, and the main function's address is put on the task's stack.
-	 * The loader function simply pops this value, determines segment registers
-	 * etc, unlocks the scheduler,
+	 * The loader function simply pops this value and the stack pointer to start
+	 * with, determines segment registers etc, unlocks the scheduler,
 	 * and then switches to itself, which causes the real task to start execution.
+	 * The task starts as if main had been called, with main as the return address.
 	 */
 
 	size_t stack_paddr = get_page_entry(pml4t, stack - 1);
+	lock_phys_window();
 	map_memory(stack_paddr, 0xFFFFFFFF98000000, 1, pml4t, 0);
 	loadPML4T(getCR3());
 
+	/* The stack may be a recycled one, don't leak the old task's data. */
+	zero_page((void*)0xFFFFFFFF98000000);
+
 	uint64_t *return_ptr = (uint64_t*)(0xFFFFFFFF98001000 - 8);
-	*return_ptr = (uint64_t)main;
+	return_ptr[0] = (uint64_t)main;
+	return_ptr[-1] = stack-8;
+	return_ptr[-2] = (uint64_t)main;
 
 	unmap_memory(0xFFFFFFFF98000000, 1, pml4t);
 	loadPML4T(getCR3());
+	unlock_phys_window();
 
 	/* The kernel stack is used for system calls and interrupts for each task.
 	 * It's very unhealthy to use the task's stack, as it may become invalid.
@@ -144,38 +139,121 @@ uint64_t flags, uint64_t stack, uint64_t kernel_stack, size_t ring, uint64_t arg
 
 p_map_level4_table *create_address_space() {
 	/* This creates a blank address space with a stack and the kernel mapped. */
-	p_map_level4_table *pml4t = alloc_page_struct();
+	p_map_level4_table *pml4t = skeleton_get_space();
+	if (pml4t != NULL) {
+		return pml4t;
+	}
+
+	pml4t = alloc_page_struct();
+	if (pml4t == NULL) {
+		return NULL;
+	}
 	memset(pml4t, 0, 0x2000);
 	pml4t->child[511] = kgetPDPT();
 	pml4t->entries[511] = kgetPDPT()->physical_address | 2 | 1;
 
 	/* The magic addresses are explained in doc/memory_map.txt and doc/kernel_stack.txt */
 	size_t stack_base = allocpp() * 0x1000; // user stack.
-	map_memory(stack_base, 0xFFFFFF7000001000, 1, pml4t, 1);
+	map_memory(stack_base, TASK_USER_STACK, 1, pml4t, 1);
 
 	size_t kernel_stack_base = allocpp() * 0x1000;  // kernel stack.
-	map_memory(kernel_stack_base, 0xFFFFFF7FFFFFF000, 1, pml4t, 0);
+	map_memory(kernel_stack_base, TASK_KERNEL_STACK, 1, pml4t, 0);
+
+	/* The clock's time page is shared, and stays mapped if pml4t is recycled. */
+	if (clock_page_phys()) {
+		map_memory(clock_page_phys(), TASK_TIME_PAGE, 1, pml4t, MAP_USER_RO);
+	}
 
 	return pml4t;
 }
 
+static uint8_t should_preempt(struct task *curr, struct task *woken) {
+	/* A task of a higher priority class always preempts. */
+	if (curr->sched_class != woken->sched_class) {
+		for (struct sched_class *c = sched_classes; c != NULL; c = c->next) {
+			if (c == woken->sched_class) {
+				return 1;
+			}
+			if (c == curr->sched_class) {
+				return 0;
+			}
+		}
+		return 0;
+	}
+	return curr->sched_class->check_preempt(curr, woken);
+}
+
+static void kick_cpu(struct cpu *c, struct task *woken) {
+	/* woken was just queued on c. If it should run first, end the current
+	 * slice there. On this CPU the switch happens on the next tick, another
+	 * CPU is told right away. */
+	struct task *curr = c->current_task;
+	if (curr == NULL) {
+		return;
+	}
+	if ((curr != c->rq.idle) && !should_preempt(curr, woken)) {
+		return;
+	}
+
+	curr->ticks_remaining = 0;
+	if (c != this_cpu()) {
+		smp_send_resched(c);
+	}
+}
+
+static struct task *alloc_task(void) {
+	/* Returns a zeroed task structure with an empty wait queue, the only task
+	 * of its process. */
+	struct task *t = skeleton_get_task();
+	if (t == NULL) {
+		t = kmalloc(sizeof(*t));
+		if (t == NULL) {
+			return NULL;
+		}
+		memset(t, 0, sizeof(*t));
+
+		/* A queue so that tasks can wait for other tasks. */
+		t->wait_queue = kmalloc(sizeof(QUEUE));
+		if (t->wait_queue == NULL) {
+			kfree(t);
+			return NULL;
+		}
+		memset(t->wait_queue, 0, sizeof(QUEUE));
+	}
+
+	t->group_users = 1;
+	return t;
+}
+
+struct task *task_leader(struct task *t) {
+	/* The task that holds what t's process shares between its threads. */
+	return (t->leader != NULL) ? t->leader : t;
+}
+
 struct task *create_task(void (*main)(), p_map_level4_table *pml4t, size_t ring, char *argv[]) {
 	if (main == NULL) {
 		return NULL;
 	}
-	/* This function takes a pointer to the start of an executable, creates an
-	 * address space for the new task, and then executes that task.
+	/* This function takes a pointer to the start of an executable, and creates
+	 * a task for it in the given address space. Like with copy_task(), the
+	 * caller queues it with wake_up_new_task() once it is set up.
+	 *
+	 * Nobody else can see the task before it is queued, so none of this needs
+	 * the scheduler locked.
 	 */
 
-	lock_scheduler();
-	struct task *t = kmalloc(sizeof(struct task));
-	memset(t, 0, sizeof(*t));
-
+	struct task *t = alloc_task();
 	if (t == NULL) {
-		unlock_scheduler();
 		return NULL;
 	}
 
+	/* Only assign a PID to user tasks, kernel tasks don't need pids. */
+	if (register_task(t, ring != 0)) {
+		skeleton_put_task(t);
+		return NULL;
+	}
+	t->state = TASK_STATE_BLOCK;
+
 	uint64_t argc = 0;
 	if (argv != NULL){
 		/* Create the arguments. */
@@ -202,28 +280,154 @@ struct task *create_task(void (*main)(), p_map_level4_table *pml4t, size_t ring,
 	/* Now set the address space. */
 	t->pml4t = pml4t;
 
-	/* Only assign a PID to user tasks, kernel tasks don't need pids. */
-	if (ring) {
-		t->pid = last_pid++;
+	/* This sets most registers. */
+	initialise_task(t, main, t->pml4t, 0x202, TASK_USER_STACK + 0x1000, TASK_KERNEL_STACK + 0x1000, ring, argc);
+
+	t->sched_class = &fair_sched_class;
+	t->base_class = &fair_sched_class;
+	t->nice = 0;
+	t->weight = sched_nice_weight(0);
+	return t;
+}
+
+static void kthread_start(void) {
+	/* Where every kernel thread starts, see kthread_create(). */
+	struct task *t = get_current_task();
+	t->kthread_fn(t->kthread_arg);
+	terminate_task();
+}
+
+struct task *kthread_create(void (*fn)(void *arg), void *arg) {
+	/* Creates a kernel thread that runs fn(arg), and queues it. It ends when
+	 * fn returns.
+	 *
+	 * A kernel thread has no address space of its own, it runs on the
+	 * kernel's page tables (so switching between two of them doesn't reload
+	 * CR3), and its stacks are on the heap.
+	 */
+	if (fn == NULL) {
+		return NULL;
+	}
+	uint8_t *stack = kmalloc(KTHREAD_STACK_SIZE);
+	if (stack == NULL) {
+		return NULL;
 	}
 
-	/* A queue so that tasks can wait for other tasks. */
-	t->wait_queue = kmalloc(sizeof(QUEUE));
-	memset(t->wait_queue, 0, sizeof(QUEUE));
+	struct task *t = alloc_task();
+	if (t == NULL) {
+		kfree(stack);
+		return NULL;
+	}
+	if (register_task(t, 0)) {
+		skeleton_put_task(t);
+		kfree(stack);
+		return NULL;
+	}
 
-	/* This sets most registers. */
-	initialise_task(t, main, t->pml4t, 0x202, 0xFFFFFF7000001000 + 0x1000, 0xFFFFFF7FFFFFF000 + 0x1000, ring, argc);
+	/* The top page is the kernel stack, the rest the thread's own. Like
+	 * initialise_task() does, the loader finds where to go on the stack. */
+	uint64_t top = ((uint64_t)stack + KTHREAD_STACK_SIZE) & ~(uint64_t)0xF;
+	uint64_t sp = top - 0x1000;
+	*(uint64_t*)(sp - 8) = (uint64_t)kthread_start;
+	*(uint64_t*)(sp - 16) = sp - 8;
+	*(uint64_t*)(sp - 24) = (uint64_t)kthread_start;
+
+	t->kstack = stack;
+	t->kthread_fn = fn;
+	t->kthread_arg = arg;
+	t->pml4t = NULL;
+
+	t->reg.rbp = sp;
+	t->reg.rsp = sp - 24;
+	t->reg.kernel_rsp = top;
+	t->reg.cr3 = kgetPML4T()->physical_address;
+	t->reg.rflags = 0x202;
+	t->reg.rip = (uint64_t)task_loader;
+	t->reg.cs = 0x08;
+	t->reg.ds = 0x10;
+
+	t->next = NULL;
+	t->ticks_remaining = TASK_DEFAULT_TIME;
+	t->ring = 0;
+	t->fds = NULL;
+
+	t->sched_class = &fair_sched_class;
+	t->base_class = &fair_sched_class;
+	t->nice = 0;
+	t->weight = sched_nice_weight(0);
+	wake_up_new_task(t);
+	return t;
+}
 
-	/* Link the new task we created. */
-	if (first_task != NULL) {
-		t->next = first_task;
-		first_task = t;
-	} else {
-		first_task = t;
-		last_task = t;
+struct task *create_thread(struct task *parent, void (*entry)(), uint64_t stack, uint64_t arg, uint64_t tls) {
+	/* Creates a thread of parent's process. It starts in ring 3 at entry,
+	 * with arg in rdi, stack as its stack (entry is written just below it,
+	 * as if it was called) and tls as its FS base. parent must be the current
+	 * task, and stack mapped. Like create_task(), the caller queues it with
+	 * wake_up_new_task().
+	 *
+	 * The kernel stack at TASK_KERNEL_STACK belongs to the address space, so
+	 * a thread has one on the heap, like a kernel thread.
+	 */
+	if ((parent == NULL) || (entry == NULL)) {
+		return NULL;
+	}
+	uint8_t *kstack = kmalloc(THREAD_KSTACK_SIZE);
+	if (kstack == NULL) {
+		return NULL;
 	}
 
-	unlock_scheduler();
+	struct task *t = alloc_task();
+	if (t == NULL) {
+		kfree(kstack);
+		return NULL;
+	}
+	if (register_task(t, 1)) {
+		skeleton_put_task(t);
+		kfree(kstack);
+		return NULL;
+	}
+	t->state = TASK_STATE_BLOCK;
+
+	/* The process can't go away while parent is in it. */
+	struct task *leader = task_leader(parent);
+	__atomic_add_fetch(&leader->group_users, 1, __ATOMIC_RELAXED);
+	t->leader = leader;
+	t->pml4t = parent->pml4t;
+	t->kstack = kstack;
+
+	/* Other threads can write to the user stack, so task_loader() runs on
+	 * the kernel stack, below where switch_task() builds the iretq frame.
+	 * It pops entry and the user stack pointer from there, and goes to ring
+	 * 3 with entry just below the user stack, as if it had been called. */
+	uint64_t sp = (stack & ~(uint64_t)0xF) - 8;
+	*(uint64_t*)sp = (uint64_t)entry;
+
+	uint64_t ktop = ((uint64_t)kstack + THREAD_KSTACK_SIZE) & ~(uint64_t)0xF;
+	uint64_t *loader_sp = (uint64_t*)(ktop - 0x1000) - 2;
+	loader_sp[0] = (uint64_t)entry;
+	loader_sp[1] = sp;
+
+	t->reg.rdi = arg;
+	t->reg.rbp = 0;
+	t->reg.rsp = (uint64_t)loader_sp;
+	t->reg.kernel_rsp = ktop;
+	t->reg.fs_base = tls;
+	t->reg.cr3 = t->pml4t->physical_address;
+	t->reg.rflags = 0x202;
+	t->reg.rip = (uint64_t)task_loader;
+	t->reg.cs = 0x08;
+	t->reg.ds = 0x10;
+
+	t->next = NULL;
+	t->ticks_remaining = TASK_DEFAULT_TIME;
+	t->ring = 3;
+
+	/* It keeps its creator's scheduling class and nice value. */
+	t->base_class = parent->base_class;
+	t->nice = parent->nice;
+	t->sched_class = t->base_class;
+	t->weight = sched_nice_weight(t->nice);
 	return t;
 }
 
@@ -234,36 +438,58 @@ struct task *copy_task(struct task *t) {
 	 */
 	if (t == NULL) { return NULL; }
 
-	struct task *nt = kmalloc(sizeof(*nt));
+	struct task *nt = alloc_task();
 	if (nt == NULL) { return NULL; }
 
 	/* It's important for this part to be safe. */
 	lock_scheduler();
 
+	QUEUE *wq = nt->wait_queue;
 	memcpy(nt, t, sizeof(*nt));
+	nt->wait_queue = wq;
+	nt->first_arg = NULL;
+	nt->last_arg = NULL;
+	nt->fpu = NULL;
 	nt->next = NULL;
 	nt->fds = NULL;
 	nt->ticks_remaining = TASK_DEFAULT_TIME;
-	nt->state = TASK_STATE_READY;
+	nt->state = TASK_STATE_BLOCK;
+	nt->on_cpu = 0;
+	nt->fd_lock.locked = 0;
+	nt->leader = NULL;
+	nt->group_users = 1;
+
+	/* The parent's semaphores and boost stay with the parent. */
+	nt->pi_weight = 0;
+	nt->pi_blocked_on = NULL;
+	nt->pi_held = NULL;
+	nt->sched_class = nt->base_class;
+	nt->weight = sched_nice_weight(nt->nice);
+	unlock_scheduler();
 
 	/* Assign a PID. */
-	nt->pid = last_pid++;
-
-	nt->wait_queue = kmalloc(sizeof(QUEUE));
-	memset(nt->wait_queue, 0, sizeof(QUEUE));
+	if (register_task(nt, 1)) {
+		skeleton_put_task(nt);
+		return NULL;
+	}
 
 	/* This function makes an exact copy of the address space. */
-	nt->pml4t = copy_addr_space(t->pml4t);
+	p_map_level4_table *space = create_address_space();
+	nt->pml4t = copy_addr_space(space, t->pml4t);
 	if (nt->pml4t == NULL) {
 		/* This shouldn't happen, but just in case. */
-		unlock_scheduler();
-		kfree(nt);
+		skeleton_put_space(space);
+		unregister_task(nt);
+		skeleton_put_task(nt);
 		return NULL;
 	}
 	nt->reg.cr3 = nt->pml4t->physical_address;
+	fpu_copy(nt, t);
 
-	/* Create a proper copy of the file descriptors. */
-	struct file_descriptor *i = t->fds;
+	/* Create a proper copy of the file descriptors. The copy is a process of
+	 * its own, it gets no threads. */
+	struct task *leader = task_leader(t);
+	struct file_descriptor *i = leader->fds;
 	while (i != NULL) {
 		struct file_descriptor *nfd = vfs_create_fd(nt, i->node, i->file, i->mode);
 		nfd->pos = i->pos;
@@ -271,10 +497,10 @@ struct task *copy_task(struct task *t) {
 	}
 
 	/* Copy the current working directory. */
-	nt->current_dir = t->current_dir;
+	nt->current_dir = leader->current_dir;
 
 	/* Copy the arguments. */
-	struct task_arg *it = t->first_arg;
+	struct task_arg *it = leader->first_arg;
 	while (it != NULL) {
 		struct task_arg *j = kmalloc(sizeof(*j));
 		j->str = kmalloc(strlen(it->str) + 1);
@@ -292,32 +518,35 @@ struct task *copy_task(struct task *t) {
 		it = it->next;
 	}
 
-	if (first_task == NULL) {
-		first_task = nt;
-		last_task = nt;
-	} else {
-		last_task->next = nt;
-		last_task = last_task->next;
-	}
+	/* The copy keeps the scheduling class and nice value. It isn't queued
+	 * yet, the caller does that with wake_up_new_task() once the copy is
+	 * ready to run. */
+	return nt;
+}
 
+void wake_up_new_task(struct task *t) {
+	/* Queues a new task on the CPU with the fewest queued tasks. */
+	lock_scheduler();
+	struct cpu *best = &cpus[0];
+	for (uint64_t i = 1; i < cpu_count; i++) {
+		if (cpus[i].online && (cpus[i].rq.nr_queued < best->rq.nr_queued)) {
+			best = &cpus[i];
+		}
+	}
 
+	t->cpu = best->id;
+	t->state = TASK_STATE_READY;
+	t->sched_class->enqueue(&best->rq, t, SCHED_ENQUEUE_NEW);
+	kick_cpu(best, t);
 	unlock_scheduler();
-	return nt;
 }
 
 void terminate_task() {
-
-	/* Close all open file descriptors. */
-	struct file_descriptor *i = current_task->fds;
-
-	while (i != NULL) {
-		kclose(i->fd);
-		i = i->next;
-	}
-
+	/* The files are closed by the terminator, once the last task of the
+	 * process is gone. */
 	lock_task_switches();
 
-	wait_queue(&termination_queue);
+	prepare_to_wait(&termination_queue);
 	if ((terminator_task != NULL) && (terminator_task->state == TASK_STATE_BLOCK)) {
 		unblock_task(terminator_task);
 	}
@@ -326,276 +555,575 @@ void terminate_task() {
 
 void block_task() {
 	lock_scheduler();
-	current_task->state = TASK_STATE_BLOCK;
+	get_current_task()->state = TASK_STATE_BLOCK;
 	yield();
 	unlock_scheduler();
 }
 
+static uint8_t cpu_is_idle(struct cpu *c) {
+	return c->online && (c->current_task == c->rq.idle) && (c->rq.nr_queued == 0);
+}
+
+static struct cpu *select_cpu(struct task *t) {
+	/* Wakes t on the CPU it last ran on if that one is idle, its caches may
+	 * still be warm. Otherwise on any idle CPU, or on the old one if all are
+	 * busy. */
+	struct cpu *prev = &cpus[t->cpu];
+	if (cpu_is_idle(prev)) {
+		return prev;
+	}
+	for (uint64_t i = 0; i < cpu_count; i++) {
+		if (cpu_is_idle(&cpus[i])) {
+			return &cpus[i];
+		}
+	}
+	return prev;
+}
+
+static void move_task(struct cpu *from, struct cpu *to, struct task *t) {
+	t->sched_class->dequeue(&from->rq, t);
+	if (t->sched_class->migrate != NULL) {
+		t->sched_class->migrate(&from->rq, &to->rq, t);
+	}
+	t->cpu = to->id;
+	t->sched_class->enqueue(&to->rq, t, 0);
+}
+
 void unblock_task(struct task *t) {
 	lock_scheduler();
 
+	/* Tasks that are queued or running already must not be queued again. */
+	if (t->state != TASK_STATE_BLOCK) {
+		unlock_scheduler();
+		return;
+	}
+
+	if (t->on_cpu) {
+		/* It blocked itself, but hasn't switched away yet (its yield() was
+		 * postponed). It simply keeps running. */
+		t->state = TASK_STATE_RUNNING;
+		unlock_scheduler();
+		return;
+	}
 
-	t->state = TASK_STATE_READY;
-	t->next = NULL;
-	if (last_task == NULL) {
-		first_task = t;
-		last_task = t;
-	} else {
-		last_task->next = t;
-		last_task = last_task->next;
+	/* Note that t->next is left alone, it is the link of whatever queue or
+	 * semaphore the task was waiting on, and the caller may still need it. */
+	struct cpu *c = select_cpu(t);
+	if ((c->id != t->cpu) && (t->sched_class->migrate != NULL)) {
+		t->sched_class->migrate(&cpus[t->cpu].rq, &c->rq, t);
 	}
+	t->cpu = c->id;
+	t->state = TASK_STATE_READY;
+	t->sched_class->enqueue(&c->rq, t, SCHED_ENQUEUE_WAKEUP);
+	kick_cpu(c, t);
+
 	unlock_scheduler();
 }
 
+static uint8_t steal_task(struct cpu *c) {
+	/* Pulls the next task to run off the CPU with the most queued tasks, and
+	 * queues it on c. Returns 1 if there was something to take. */
+	struct cpu *busiest = NULL;
+	for (uint64_t i = 0; i < cpu_count; i++) {
+		struct cpu *o = &cpus[i];
+		if ((o == c) || !o->online || (o->rq.nr_queued == 0)) {
+			continue;
+		}
+		if ((busiest == NULL) || (o->rq.nr_queued > busiest->rq.nr_queued)) {
+			busiest = o;
+		}
+	}
+	if (busiest == NULL) {
+		return 0;
+	}
+
+	for (struct sched_class *cl = sched_classes; cl != NULL; cl = cl->next) {
+		struct task *t = cl->iterate(&busiest->rq, NULL);
+		if (t != NULL) {
+			move_task(busiest, c, t);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static struct task *pick_next_task(struct cpu *c) {
+	/* Ask every class for a task, from the highest priority to the lowest. If
+	 * this CPU has nothing, try to take work from another one. */
+	for (int tries = 0; tries < 2; tries++) {
+		for (struct sched_class *cl = sched_classes; cl != NULL; cl = cl->next) {
+			struct task *next = cl->pick_next(&c->rq);
+			if (next != NULL) {
+				return next;
+			}
+		}
+		if (!steal_task(c)) {
+			break;
+		}
+	}
+	return NULL;
+}
+
 void yield() {
 	/* This is a function that switches to the next task on the queue.
 	 *
 	 * Caller is responsible for locking the scheduler before calling this.
 	 * This is to ensure that the task structures don't get modified by another
-	 * task before this yield() returns.
+	 * task (or CPU) before this yield() returns.
 	 */
+	struct cpu *c = this_cpu();
 
-	if (task_switch_lock) {
-		task_switch_postponed++;
+	if (c->task_switch_lock) {
+		c->task_switch_postponed++;
 		return;
 	}
 
-	if ((first_task == NULL) || (last_task == NULL)) {
+	/* Will keep the task to be switched from. */
+	struct rq *rq = &c->rq;
+	struct task *last = c->current_task;
+
+	if (last->state == TASK_STATE_RUNNING) {
+		/* Put the task back into its class's queue, only if the task was
+		 * running as normal. If the task's state was changed to blocked, this
+		 * won't be executed, effectively blocking the task. The idle task
+		 * is never queued.
+		 */
+		last->state = TASK_STATE_READY;
+		if (last != rq->idle) {
+			last->sched_class->enqueue(rq, last, 0);
+		}
+	}
+
+	struct task *next = pick_next_task(c);
+	if (next == NULL) {
+		next = rq->idle;
+		if (next == NULL) {
+			/* Nothing else to run, this only happens before the scheduler
+			 * is set up. */
+			if (last->state == TASK_STATE_READY) {
+				last->state = TASK_STATE_RUNNING;
+			}
+			return;
+		}
+		next->ticks_remaining = TASK_DEFAULT_TIME;
+	}
+
+	next->state = TASK_STATE_RUNNING;
+	c->current_task = next;
+	if (next == last) {
 		return;
 	}
 
-	/* Will keep the task to be switched from. */
-	struct task *last;
+	/* Once the lock is released another CPU may pick up last, by then its
+	 * registers are saved. */
+	last->on_cpu = 0;
+	next->on_cpu = 1;
+	next->cpu = c->id;
+	fpu_switch(last, next);
+	tss_set_kernel_stack(c, next->reg.kernel_rsp);
+
+	/* Only tasks with thread-local storage pay for the MSR write. (The full
+	 * path of switch_task() writes it again after loading fs.) */
+	if (last->reg.fs_base | next->reg.fs_base) {
+		wrmsr(MSR_FS_BASE, next->reg.fs_base);
+	}
 
-	if (current_task->state == TASK_STATE_RUNNING) {
-		/* Put the task back into the list of running tasks, only if the task
-		 * was running as normal. If the task's state was changed to blocked,
-		 * this won't be executed, effectively blocking the task.
-		 */
-		current_task->next = NULL;
-		current_task->ticks_remaining = TASK_DEFAULT_TIME;
-		current_task->state = TASK_STATE_READY;
+	/* The scheduler lock is handed over to next, which releases it. When we
+	 * get switched back to, we own it again, with our own nesting. */
+	int32_t depth = sched_depth;
+	uint64_t flags = sched_flags;
+	switch_task(&(last->reg), &(next->reg));
+	sched_depth = depth;
+	sched_flags = flags;
+}
+
+void schedule_tail(void) {
+	/* The first thing a new (or forked) task does. The scheduler lock is still
+	 * held for the task that switched to it, and it holds it just once.
+	 * Interrupts stay off, the task's own RFLAGS get loaded when it starts. */
+	sched_depth = 1;
+	sched_flags = 0x2;
+	unlock_scheduler();
+}
+
+static void sched_update(struct task *t) {
+	/* Sets the class and weight t runs with, from what it was given and its
+	 * boost. With the scheduler locked. */
+	struct sched_class *class = t->base_class;
+	uint64_t weight = sched_nice_weight(t->nice);
+	if ((t->pi_weight != 0) && ((class != &fair_sched_class) || (t->pi_weight > weight))) {
+		class = &fair_sched_class;
+		weight = t->pi_weight;
+	}
+	if ((class == t->sched_class) && (weight == t->weight)) {
+		return;
+	}
 
-		last_task->next = current_task;
-		last_task = last_task->next;
+	struct rq *rq = &cpus[t->cpu].rq;
+	uint8_t queued = (t->state == TASK_STATE_READY) && !t->on_cpu && (t != rq->idle);
+	if (queued) {
+		t->sched_class->dequeue(rq, t);
 	}
 
-	last = current_task;
+	t->sched_class = class;
+	t->weight = weight;
 
-	/* Unlink the first task. */
-	current_task = first_task;
-	if (first_task == last_task) {
-		first_task = NULL;
-		last_task = NULL;
-	} else {
-		first_task = first_task->next;
+	if (queued) {
+		t->sched_class->enqueue(rq, t, 0);
 	}
+	if (t->on_cpu && (class != &fair_sched_class)) {
+		/* Give way to the fair tasks right away. */
+		t->ticks_remaining = 0;
+	}
+}
 
-	current_task->state = TASK_STATE_RUNNING;
-	current_task->ticks_remaining = TASK_DEFAULT_TIME;
-	current_task->next = NULL;
+uint8_t sched_setscheduler(struct task *t, uint64_t policy, int64_t nice) {
+	/* Moves t to the class of the policy, with the given nice value. A boost
+	 * from priority inheritance stays in effect. */
+	if (t == NULL)                              { return ERR_INVALID_PARAM; }
+	if ((nice < NICE_MIN) || (nice > NICE_MAX)) { return ERR_OUT_OF_BOUNDS; }
+
+	struct sched_class *class;
+	switch (policy) {
+	case SCHED_FAIR:
+		class = &fair_sched_class;
+		break;
+	case SCHED_IDLE:
+		class = &idle_sched_class;
+		break;
+	default:
+		return ERR_INVALID_PARAM;
+	}
 
-	switch_task(&(last->reg), &(current_task->reg));
+	lock_scheduler();
+	t->base_class = class;
+	t->nice = nice;
+	sched_update(t);
+	unlock_scheduler();
+	return GENERIC_SUCCESS;
+}
+
+void sched_pi_boost(struct task *t, uint64_t weight) {
+	/* Has t run as a fair task with at least weight (0 ends the boost). */
+	lock_scheduler();
+	t->pi_weight = weight;
+	sched_update(t);
+	unlock_scheduler();
 }
 
 
 
 void scheduler_irq0() {
-	/* This function will be called every time irq0 fires. */
+	/* This function will be called every time the tick fires. */
+	struct cpu *c = this_cpu();
+	struct task *curr = c->current_task;
 
-	if (current_task == NULL) {
-		/* The CPU is idle. */
+	/* The idle task leaves as soon as there is work, see idle_task_main(). */
+	if ((curr == NULL) || (curr == c->rq.idle)) {
 		return;
 	}
 
-	/* Decrement the current task's counter. */
-	if (current_task->ticks_remaining != 0) {
-		lock_scheduler();	/* For protection in SMP. */
-		current_task->ticks_remaining--;
-		unlock_scheduler();
+	/* Account the tick, this also decrements the current task's counter. If
+	 * it has run out of time, then switch tasks. yield() postpones the switch
+	 * if task switches are locked. */
+	lock_scheduler();
+	curr->sched_class->tick(&c->rq, curr);
+	if (curr->ticks_remaining == 0) {
+		yield();
 	}
+	unlock_scheduler();
+}
 
-	/* If the scheduler is locked, don't preempt. */
-	if (sched_lock) {
+void scheduler_ipi(void) {
+	/* Another CPU queued a task here that should run now, see kick_cpu(). */
+	struct task *curr = get_current_task();
+	if ((curr == NULL) || (curr->ticks_remaining != 0)) {
 		return;
 	}
 
-	/* If the current task has run out of time, then switch tasks. */
-	if (current_task->ticks_remaining == 0) {
-		lock_scheduler();
-		yield();
-		unlock_scheduler();
-	}
+	lock_scheduler();
+	yield();
+	unlock_scheduler();
 }
 
 
 
-/* When SMP support is added, all of these lock/unlock functions
- * need to be changed to actually guarantee mutual exclusion.
- * For a single CPU however, this works well enough.
- *
- * A spinlock could be good enough, as these structures aren't used
- * for that long.
+#ifdef DEBUG
+/* Every stretch of time a CPU can't switch tasks is measured, from the
+ * outermost lock_task_switches() or lock_scheduler() to the matching unlock.
+ * The longest one per CPU is kept with whoever started it, and logged when it
+ * is longer than a tick. Must be called with task switches or interrupts off,
+ * so the task can't move to another CPU in between.
  */
+static void preempt_off_begin(struct cpu *c, void *site) {
+	struct preempt_stats *p = &c->preempt_stats;
+	if (p->depth++ == 0) {
+		p->start = clock_gettime_ns();
+		p->site = site;
+	}
+}
+
+static void preempt_off_end(struct cpu *c) {
+	struct preempt_stats *p = &c->preempt_stats;
+	if ((p->depth == 0) || (--p->depth != 0)) {
+		return;
+	}
+	uint64_t ns = clock_gettime_ns() - p->start;
+	if (ns <= p->max_ns) {
+		return;
+	}
+	p->max_ns = ns;
+	p->max_site = p->site;
+	if (ns > NS_PER_TICK) {
+		klog_warn("CPU %u couldn't switch tasks for %u us, locked at %x\n",
+		          c->id, ns / 1000, (uint64_t)p->site);
+	}
+}
 
-void lock_scheduler() {
-	/* This will hopefully be changed to a spinlock soon. */
-	sched_lock++;
+#else
+#define preempt_off_begin(c, site)	((void)0)
+#define preempt_off_end(c)			((void)0)
+#endif
+
+/* Not inlined, so the call site the DEBUG build records is the caller's. */
+__attribute__((noinline)) void lock_scheduler() {
+	uint64_t flags = irq_save();
+	struct cpu *c = this_cpu();
+
+	if (sched_owner != c) {
+		spin_lock(&sched_spin);
+		sched_owner = c;
+		sched_flags = flags;
+		preempt_off_begin(c, __builtin_return_address(0));
+	}
+	sched_depth++;
 }
 
-void lock_task_switches() {
-	task_switch_lock++;
+__attribute__((noinline)) void lock_task_switches() {
+	/* A single instruction, so it can't be preempted halfway. Once it is
+	 * done, the task stays on this CPU. */
+	__asm__ volatile ("incl %%gs:%c0" : : "i"(offsetof(struct cpu, task_switch_lock)) : "memory");
+#ifdef DEBUG
+	struct cpu *c = this_cpu();
+	if (c->task_switch_lock == 1) {
+		preempt_off_begin(c, __builtin_return_address(0));
+	}
+#endif
 }
 
 
 void unlock_scheduler() {
-	if (sched_lock == 0) {
+	if (sched_owner != this_cpu()) {
+		return;
+	}
+	if (--sched_depth > 0) {
 		return;
 	}
-	//serial_putx(sched_lock);
-	//serial_puts("\r\n");
-	sched_lock--;
+
+	uint64_t flags = sched_flags;
+	sched_owner = NULL;
+	spin_unlock(&sched_spin);
+	preempt_off_end(this_cpu());
+	irq_restore(flags);
 }
 
 void unlock_task_switches() {
-	if (task_switch_lock == 0) {
+	uint64_t flags = irq_save();
+	struct cpu *c = this_cpu();
+
+	if (c->task_switch_lock == 0) {
+		irq_restore(flags);
 		return;
 	}
-	task_switch_lock--;
-	if ((task_switch_lock == 0) && task_switch_postponed) {
-		task_switch_postponed = 0;
+	c->task_switch_lock--;
+	if (c->task_switch_lock == 0) {
+		preempt_off_end(c);
+	}
+	if ((c->task_switch_lock == 0) && c->task_switch_postponed) {
+		c->task_switch_postponed = 0;
+		irq_restore(flags);
 		lock_scheduler();
 		yield();
 		unlock_scheduler();
+		return;
 	}
+	irq_restore(flags);
 }
 
-void terminator_task_main() {
+static void free_args(struct task *t) {
+	struct task_arg *i = t->first_arg;
+	while (i != NULL) {
+		if (i->str != NULL) {
+			kfree(i->str);
+		}
+		struct task_arg *j = i;
+		i = i->next;
+
+		kfree(j);
+	}
+	t->first_arg = NULL;
+	t->last_arg = NULL;
+}
+
+static void wait_off_cpu(struct task *t) {
+	/* A task that blocked may still be switching away on another CPU. Once it
+	 * is off its CPU and the scheduler lock was released after that, nothing
+	 * uses its stacks or address space anymore. */
+	while (1) {
+		lock_scheduler();
+		uint8_t on_cpu = t->on_cpu;
+		unlock_scheduler();
+		if (!on_cpu) {
+			return;
+		}
+		__asm__ volatile ("pause");
+	}
+}
+
+void terminator_task_main(void *arg) {
+	(void)arg;
 	//__asm__("cli;hlt;");
-	terminator_task = current_task;
+	terminator_task = get_current_task();
 
 	lock_task_switches();
 	while (1) {
-
+		uint64_t flags = spin_lock_irqsave(&termination_queue.lock);
 		while (termination_queue.amount_waiting == 0) {
 			block_task();
+			spin_unlock_irqrestore(&termination_queue.lock, flags);
 			unlock_task_switches(); /* This will trigger the block */
 			lock_task_switches();   /* If we reach here, we must have been unblocked. */
+			flags = spin_lock_irqsave(&termination_queue.lock);
 		}
 
-		/* Unlink the first task on the queue. */
+		/* Unlink the first task on the queue. It never gets to finish_wait(),
+		 * so it stops being a user of the queue here. */
+		struct queue_waiter *w = termination_queue.first_waiter;
+		termination_queue.first_waiter = w->next;
+		if (termination_queue.first_waiter == NULL) {
+			termination_queue.last_waiter = NULL;
+		}
 		termination_queue.amount_waiting--;
-		struct task *quitter = termination_queue.first_task;
-		if (quitter == NULL) {
-			continue;
+		termination_queue.users--;
+		struct task *quitter = w->task;
+		spin_unlock_irqrestore(&termination_queue.lock, flags);
+
+		/* The rest may take a while, and drain_queue() needs the waiters
+		 * to run. */
+		unlock_task_switches();
+		wait_off_cpu(quitter);
+
+		/* Nobody can find it from here on. */
+		unregister_task(quitter);
+
+		/* What the process shares goes with the last of its tasks. Until
+		 * then the leader's task structure stays as well, it holds it. */
+		struct task *leader = task_leader(quitter);
+		uint8_t last = (__atomic_sub_fetch(&leader->group_users, 1, __ATOMIC_ACQ_REL) == 0);
+		if (last) {
+			vfs_close_all(leader);
 		}
 
-		termination_queue.first_task = termination_queue.first_task->next;
-		if (termination_queue.first_task == NULL) {
-			termination_queue.last_task = NULL;
-		}
+		/* Whoever waits for it still uses the queue until it is back from
+		 * finish_wait(). Being unregistered, nobody new can find it. */
+		signal_queue_all(quitter->wait_queue);
+		drain_queue(quitter->wait_queue);
 
-		while ((quitter->wait_queue != NULL) && (quitter->wait_queue->amount_waiting > 0)) {
-			signal_queue(quitter->wait_queue);
+		/* Hand the address space and the task structures back for reuse. A
+		 * kernel thread has only its stack, a user thread its kernel stack. */
+		kfree(quitter->kstack);
+		if (quitter != leader) {
+			skeleton_put_task(quitter);
 		}
-		kfree(quitter->wait_queue);
-
-		if (quitter->first_arg != NULL){
-			struct task_arg *i = quitter->first_arg;
-
-			while (i != NULL) {
-				if (i->str != NULL) {
-					kfree(i->str);
-				}
-				struct task_arg *j = i;
-				i = i->next;
-
-				kfree(j);
-			}
-
+		if (last) {
+			free_args(leader);
+			skeleton_put_space(leader->pml4t);
+			skeleton_put_task(leader);
 		}
+		lock_task_switches();
+	}
+}
 
-		/* Now reclaim the memory of the quitter. */
-		for (size_t i = 0; i < 511; i++){
-			/* The last PDPT belongs to the kernel, and thus must not be freed.*/
-			pd_ptr_table *pdpt = quitter->pml4t->child[i];
-			if (pdpt == NULL) {
-				continue;
-			}
-			for (size_t j = 0; j < 512; j++) {
-				page_dir *pd = pdpt->child[j];
-				if (pd == NULL) {
-					continue;
-				}
-				for (size_t k = 0; k < 512; k++) {
-					page_table *pt = pd->child[k];
-					if (pt == NULL) {
-						continue;
-					}
-					/* Free the physical pages as well. */
-					for (size_t l = 0; l < 512; l++) {
-						uint64_t entry = pt->entries[l];
-						if (entry == 0) {
-							continue;
-						}
-						uint64_t page = entry / 0x1000;
-						freepp(page);
-
-						pt->entries[i] = 0;
-					}
-					free_page_struct((struct page_struct*)pt);
-				}
-				memset(pd->entries, 0, 0x1000);
-				memset(pd->child, 0, 0x1000);
-				free_page_struct(pd);
-			}
-			memset(pdpt->entries, 0, 0x1000);
-			memset(pdpt->child, 0, 0x1000);
-			free_page_struct(pdpt);
+static uint8_t sched_has_work(struct cpu *c) {
+	/* Whether anything but the idle task wants the CPU, or could be taken
+	 * from another CPU. Reading the other run queues without the lock is
+	 * fine, yield() looks again. */
+	if ((c->current_task->ticks_remaining == 0) || (c->rq.nr_queued != 0)) {
+		return 1;
+	}
+	for (uint64_t i = 0; i < cpu_count; i++) {
+		if (cpus[i].online && (cpus[i].rq.nr_queued != 0)) {
+			return 1;
 		}
-		memset(quitter->pml4t->entries, 0, 0x1000);
-		memset(quitter->pml4t->child, 0, 0x1000);
-		free_page_struct(quitter->pml4t);
-
-
-		kfree(quitter);
 	}
+	return 0;
 }
 
-void idle_task_main(void) {
+void idle_task_main(void *arg) {
+	(void)arg;
+	/* Halts until there is something to run. The check and the hlt happen with
+	 * interrupts disabled (sti only takes effect after hlt), so a wakeup can't
+	 * slip in between. While halted the tick may be stopped, see tick.c */
 	while (1) {
-		current_task->ticks_remaining = 1;
-		__asm__("hlt;");
+		__asm__ volatile ("cli");
+		if (sched_has_work(this_cpu())) {
+			__asm__ volatile ("sti");
+			lock_scheduler();
+			yield();
+			unlock_scheduler();
+			continue;
+		}
+
+		tick_idle_enter();
+		__asm__ volatile ("sti; hlt; cli");
+		tick_idle_exit();
+		__asm__ volatile ("sti");
 	}
 }
 
 uint8_t init_scheduler() {
 	uint8_t stat;
-	if ((stat = init_tss())) {
+	struct cpu *c = this_cpu();
+	if ((stat = init_tss(c))) {
 		return stat;
 	}
 	lock_scheduler();
 
-	current_task = kmalloc(sizeof(*current_task));
-	if (current_task == NULL) {
+	struct task *t = kmalloc(sizeof(*t));
+	if (t == NULL) {
 		return 1;
 	}
-	memset(current_task, 0, sizeof(*current_task));
-
-	current_task->state = TASK_STATE_RUNNING;
-	current_task->next = current_task;
-	current_task->fds = NULL;	/* The VFS layer will initialise this. */
-	current_task->ticks_remaining = TASK_DEFAULT_TIME;
-	current_task->ring = 0;
-	current_task->reg.kernel_rsp = (uint64_t)kmalloc(0x1000) + 0x1000 ;
+	memset(t, 0, sizeof(*t));
 
-	/* Initialise the global variables. */
-	last_task = NULL;
-	first_task = NULL;
+	t->state = TASK_STATE_RUNNING;
+	t->next = NULL;
+	t->fds = NULL;	/* The VFS layer will initialise this. */
+	t->ticks_remaining = TASK_DEFAULT_TIME;
+	t->ring = 0;
+	t->reg.kernel_rsp = (uint64_t)kmalloc(0x1000) + 0x1000 ;
+	t->sched_class = &fair_sched_class;
+	t->base_class = &fair_sched_class;
+	t->weight = sched_nice_weight(0);
+	t->group_users = 1;
+	t->on_cpu = 1;
+	c->current_task = t;
+	tss_set_kernel_stack(c, t->reg.kernel_rsp);
+	init_pids();
+	register_task(t, 0);
 
 	/* Create the terminator task, that only frees terminated tasks. */
-	create_task(terminator_task_main, create_address_space(), 0, NULL);
-	create_task(idle_task_main, create_address_space(), 0, NULL);
+	kthread_create(terminator_task_main, NULL);
+
+	/* The idle task only runs when nothing else can. It isn't queued, every
+	 * CPU has its own. */
+	struct task *idle = kthread_create(idle_task_main, NULL);
+	if (idle == NULL) {
+		return 1;
+	}
+	idle->sched_class->dequeue(&c->rq, idle);
+	idle->sched_class = &idle_sched_class;
+	idle->base_class = &idle_sched_class;
+	c->rq.idle = idle;
 
 	/* Release the lock we acquired.*/
 	unlock_scheduler();
@@ -615,22 +1143,92 @@ void print_task(struct task *t) {
 	kputx(t->ticks_remaining);
 	kputs(" ");
 	kputx(t->state);
+	kputs(" ");
+	kputs(t->sched_class->name);
+	kputs(" ");
+	kputx(t->vruntime);
 	kputs("\n");
 }
 
+struct blocked_list {
+	struct task *tasks[32];
+	size_t count;
+};
+
+static void collect_blocked(struct task *t, void *arg) {
+	/* kputs() may block, so only collect them here. */
+	struct blocked_list *l = arg;
+	if ((t->state == TASK_STATE_BLOCK) && (l->count < 32)) {
+		l->tasks[l->count++] = t;
+	}
+}
+
 void print_tasks() {
-	if (current_task == NULL) {
-		kputs("The CPU is currently idle. \n");
-		return;
+	kputs("TASK LIST {Address}: {Ticks remaining} {State} {Class} {Vruntime}\n");
+
+	for (uint64_t n = 0; n < cpu_count; n++) {
+		struct cpu *c = &cpus[n];
+		if (!c->online) {
+			continue;
+		}
+		kputs("CPU ");
+		kputx(c->id);
+		kputs(":\n");
+
+		if (c->current_task != NULL) {
+			print_task(c->current_task);
+		}
+		for (struct sched_class *cl = sched_classes; cl != NULL; cl = cl->next) {
+			struct task *i = cl->iterate(&c->rq, NULL);
+			while (i != NULL) {
+				print_task(i);
+				i = cl->iterate(&c->rq, i);
+			}
+		}
 	}
-	kputs("TASK LIST {Address}: {Ticks remaining} {State}\n");
 
-	print_task(current_task);
+	/* Blocked tasks are in no run queue. */
+	struct blocked_list blocked;
+	blocked.count = 0;
+	for_each_task(collect_blocked, &blocked);
+	kputs("BLOCKED:\n");
+	for (size_t i = 0; i < blocked.count; i++) {
+		print_task(blocked.tasks[i]);
+	}
 
-	struct task *i = first_task;
-	while (i != NULL) {
-		print_task(i);
-		i = i->next;
+	struct skeleton_stats st;
+	skeleton_get_stats(&st);
+	kputs("SKELETONS {Hits} {Misses} {Cached}\n");
+	kputs("tasks: ");
+	kputx(st.task_hits);
+	kputs(" ");
+	kputx(st.task_misses);
+	kputs(" ");
+	kputx(st.tasks_cached);
+	kputs("\nspaces: ");
+	kputx(st.space_hits);
+	kputs(" ");
+	kputx(st.space_misses);
+	kputs(" ");
+	kputx(st.spaces_cached);
+	kputs("\n");
+
+	print_preempt_stats();
+}
+
+void print_preempt_stats(void) {
+	kputs("LONGEST NON-PREEMPTIBLE SECTION {CPU}: {ns} {Locked at}\n");
+	for (uint64_t n = 0; n < cpu_count; n++) {
+		struct cpu *c = &cpus[n];
+		if (!c->online) {
+			continue;
+		}
+		kputx(c->id);
+		kputs(": ");
+		kputx(c->preempt_stats.max_ns);
+		kputs(" ");
+		kputx((uint64_t)c->preempt_stats.max_site);
+		kputs("\n");
 	}
 }
 
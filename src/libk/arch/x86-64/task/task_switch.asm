@@ -3,85 +3,86 @@
 
 GLOBAL switch_task
 GLOBAL task_loader
-EXTERN unlock_scheduler
+EXTERN schedule_tail
 EXTERN get_current_task
-
-; TODO: REWRITE THIS ENTIRE MECHANISM, SO THAT USER-TASKS ARENT ANY DIFFERENT THAN
-; KERNEL TASKS. THE TASK SWITCH CODE SHOULD SIMPLY SET REGISTERS & JUMP.
-; A GOOD IDEA WOULD BE TO ALWAYS USE IRETQ, REGARDLESS OF RING. THAT WAY,
-; YOU DONT NEED TO DO ANYTHING MORE THAN SET VARIABLES (MAYBE HAVE A LOADER FUNC ETC).
-; HAVE THE SEGMENT REGISTERS BE PART OF task_registers AND REMOVE THE ring VARIABLE
-; FROM task (Or maybe not, but it won't be used by switch_task).
-; TODO incorporate this into the actual fucking scheduler.
+EXTERN cr3_reloads
+
+; switch_task(from, to) saves the running context in from (unless it is NULL),
+; and loads the one in to. There are two ways to load one:
+;
+; The lean path. A context saved here is always in the kernel, in the middle of
+; a C call (yield()), so only the callee-saved registers, rsp and rflags need
+; saving, and resuming it is a matter of swapping stacks and returning. That is
+; nearly every switch.
+;
+; The full path, for contexts that weren't saved here: a new task (whose RIP is
+; task_loader), a forked one (fork_ret) and the first load of any task. It
+; loads every register and segment and goes through iretq, which is also how
+; ring 3 is entered.
+;
+; Either way, CR3 is only written if it changes.
 switch_task:
-	; This function does the same thing as above, excpet it returns to userspace
-	; instead.
 	; RSI should contain a pointer to the registers of the task to be switched to.
 	; RDI should contain a pointer to the registers of the task to be switched from.
 
-	; No matter what we do we must ensure that DS is the kernel's data segment
-	; until we load the task's DS.
-	push rax
-	mov rax, 0x10
-	mov ds, ax
-	mov ss, ax
-	pop rax
-
 	; If rsi == NULL, we can't switch. If rdi == NULL, we can't save.
-	cmp rsi, 0
+	test rsi, rsi
 	jz switch_task.reg_return
-	cmp rdi, 0
+	test rdi, rdi
 	jz switch_task.load
 
-	; Save the current values for all the registers we're going to push for iretq.
-	.save:
-	mov QWORD [rdi + 0xA0], ss  ; SS
-	mov QWORD [rdi + 0x70], rsp ; RSP
-	; We can save rflags later.
-	mov QWORD [rdi + 0x98], cs  ; CS
 	; Thanks to us saving the ret instruction as RIP, when another task switches
 	; to this one, everything will be as if this function returned normally.
-	mov QWORD [rdi + 0x80], switch_task.reg_return ; RIP
-
-	; Save rflags. Target flags will be loaded by iretq
-	push rax
-	pushfq
-	pop rax
-	mov [rdi + 0x90], rax
-	; Don't restore RAX yet!
-
-	; save old CR3 and load new CR3.
-	mov rax, cr3
-	mov [rdi + 0x88], rax
-	pop rax
-
-	; TODO: handle SSE registers as well (fxsave fxrstor)
-
-	; Save the current GPRs.
-	mov [rdi], rax
+	.save:
 	mov [rdi + 0x08], rbx
-	mov [rdi + 0x10], rcx
-	mov [rdi + 0x18], rdx
-	mov [rdi + 0x20], rdi	; Remember, this doesn't affect rdi.
-	mov [rdi + 0x28], rsi
-	mov [rdi + 0x30], r8
-	mov [rdi + 0x38], r9
-	mov [rdi + 0x40], r10
-	mov [rdi + 0x48], r11
 	mov [rdi + 0x50], r12
 	mov [rdi + 0x58], r13
 	mov [rdi + 0x60], r14
 	mov [rdi + 0x68], r15
+	mov [rdi + 0x70], rsp
+	mov [rdi + 0x78], rbp
+	pushfq
+	pop QWORD [rdi + 0x90]
+	mov QWORD [rdi + 0x80], switch_task.reg_return ; RIP
+	mov QWORD [rdi + 0x98], 0x08	; CS
+	mov QWORD [rdi + 0xA0], 0x10	; SS
+	mov rax, cr3
+	mov [rdi + 0x88], rax
 
-	;mov [rdi + 0x70], rsp ; we already saved rsp above.
-	mov [rdi + 0x78], rbp ; rbp wasn't changed in this function.
-
-	; Load.
 	.load:
-	; The kernel rsp must be loaded along with cr3, because there is a chance the old
-	; stack isn't mapped in the new page mappings.
+	; A CR3 write flushes the TLB. Kernel threads share the kernel's page
+	; tables, between them (or any two tasks with the same CR3) it's skipped.
+	; The stack may not be mapped anymore after the write, nothing touches it
+	; until rsp is loaded.
+	mov rax, cr3
+	cmp rax, [rsi + 0x88]
+	je switch_task.same_cr3
 	mov rax, [rsi + 0x88]
 	mov cr3, rax
+	inc QWORD [cr3_reloads]
+	.same_cr3:
+
+	cmp QWORD [rsi + 0x80], switch_task.reg_return
+	jne switch_task.full
+
+	; The lean path.
+	mov rsp, [rsi + 0x70]
+	mov rbx, [rsi + 0x08]
+	mov rbp, [rsi + 0x78]
+	mov r12, [rsi + 0x50]
+	mov r13, [rsi + 0x58]
+	mov r14, [rsi + 0x60]
+	mov r15, [rsi + 0x68]
+	push QWORD [rsi + 0x90]
+	popfq
+	.reg_return:
+	ret
+
+	.full:
+	; DS must be the kernel's data segment until we load the task's.
+	mov rax, 0x10
+	mov ds, ax
+	mov ss, ax
 
 	; Since we MUST switch to the new kernel stack of the task, we will.
 	; However, since irq0 uses the top of the stack, we risk overwriting the
@@ -119,45 +120,64 @@ switch_task:
 
 	; If ds is a user data segment, we cannot load rsi normally after setting ds.
 	; We accommodate for this by pushing rsi's future value, then popping it
-	; when we're done. (ss is set by iretq.)
+	; when we're done. (ss is set by iretq.) Loading fs clears the FS base, so
+	; the task's is written after it, from the stack as well.
 	push QWORD [rsi + 0x28]
+	push QWORD [rsi + 0xB0]
 	push rax
+	push rcx
+	push rdx
 	mov rax, [rsi + 0xA0]
 	mov ds, ax
 	mov es, ax
 	mov fs, ax
-	mov gs, ax
+	mov ecx, 0xC0000100		; MSR_FS_BASE
+	mov eax, [rsp + 24]
+	mov edx, [rsp + 28]
+	wrmsr
+	pop rdx
+	pop rcx
 	pop rax
+	add rsp, 8
 	pop rsi
 
+	; gs is left alone, its base is the CPU's struct cpu. User mode gets its
+	; own base back (see SWAPGS_IF_USER).
 	.iret:
+	test QWORD [rsp + 8], 3
+	jz switch_task.kernel
+	swapgs
+	.kernel:
 	iretq
 
-	.reg_return:
-	ret
-
 ; This function takes a pointer to a task struct and loads it. The rip should be
-; pushed to the stack.
+; on the stack, followed by the rsp the task starts with.
 ; The main purpose of this function is to unlock the scheduler before delivering
 ; control to the task. We cannot do this without a loader task.
+; It runs in ring 0, so its stack must be one no other task can write to. A
+; thread's user stack isn't, see create_thread().
 task_loader:
-	call unlock_scheduler
+	; Interrupts stay off until the task's RFLAGS are loaded by switch_task.
+	cli
+	call schedule_tail
 	call get_current_task
 	mov rdi, 0
 	mov rsi, rax
 
 	pop rax
 	mov [rsi + 0x80], rax; Move the real RIP.
+	pop rax
+	mov [rsi + 0x70], rax; And RSP.
 
 	; Now load the actual segment registers based on ring.
-	mov rax, [rsi + 0xC8] ; ring
+	mov rax, [rsi + 0xD0] ; ring
 	cmp rax, 0
 	jz task_loader.ring0
 	jmp task_loader.ring3
 
 	.ring3:
-	mov QWORD [rsi + 0xA0], 0x20 | 3
-	mov QWORD [rsi + 0x98], 0x18 | 3
+	mov QWORD [rsi + 0xA0], 0x18 | 3
+	mov QWORD [rsi + 0x98], 0x20 | 3
 	jmp task_loader.ring_done
 
 	.ring0:
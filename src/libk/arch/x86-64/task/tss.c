@@ -1,4 +1,6 @@
 #include <task.h>
+#include <smp.h>
+#include <cpu.h>
 #include <err.h>
 #include <string.h>
 #include <mem.h>
@@ -46,63 +48,107 @@ struct task_state_segment {
 	uint16_t io_map_base;
 } __attribute__((packed));
 
+struct gdt_descriptor {
+	uint16_t size;
+	uint64_t offset;
+} __attribute__((packed));
 
+/* The segments of GDT64 in gdt.asm. User data comes before user code, see
+ * init_syscall(). */
+#define GDT_KERNEL_CODE	0x00209A0000000000
+#define GDT_KERNEL_DATA	0x0000920000000000
+#define GDT_USER_CODE	0x0020FA0000000000
+#define GDT_USER_DATA	0x0000F20000000000
 
-struct gdt_entry tss_entry;
-struct task_state_segment *cur_tss = NULL;
-
-
-extern void loadTSS(void *tss); /* defined in gdt.asm */
 
-uint8_t load_tss(struct task_state_segment *t) {
-	if (t == NULL) { return ERR_INVALID_PARAM; }
+extern void loadCPUGDT(struct gdt_descriptor *d); /* defined in gdt.asm */
+extern void syscall_entry(void); /* defined in syscall.asm */
 
-	memset(&tss_entry, 0, sizeof(tss_entry));
+static void set_tss_entry(struct gdt_entry *e, struct task_state_segment *t) {
+	memset(e, 0, sizeof(*e));
 
 	/* Construct a proper entry here. */
 	uintptr_t tss_addr = (uintptr_t)t;
 	uint64_t tss_size = sizeof(*t) - 1;
 
-	tss_entry.base0_15 = (uint16_t)(tss_addr & 0xFFFF);
-	tss_entry.base16_23 = (uint8_t)((tss_addr >> 16) & 0xFF);
-	tss_entry.base24_31 = (uint8_t)((tss_addr >> 24) & 0xFF);
-	tss_entry.base32_64 = (uint32_t)(tss_addr >> 32);
-	tss_entry.limit0_15 = tss_size & 0xFFFF;
+	e->base0_15 = (uint16_t)(tss_addr & 0xFFFF);
+	e->base16_23 = (uint8_t)((tss_addr >> 16) & 0xFF);
+	e->base24_31 = (uint8_t)((tss_addr >> 24) & 0xFF);
+	e->base32_64 = (uint32_t)(tss_addr >> 32);
+	e->limit0_15 = tss_size & 0xFFFF;
 
 	/* A lot of MAGIC!!!! */
-	tss_entry.limit16_19_flags = (1 << 4) | ((tss_size >> 16) & 0x0F);
-	tss_entry.access = 0x89;
-
-	loadTSS(&tss_entry);
-	return GENERIC_SUCCESS;
+	e->limit16_19_flags = (1 << 4) | ((tss_size >> 16) & 0x0F);
+	e->access = 0x89;
 }
 
 
-uint8_t init_tss() {
-	lock_scheduler();
-	if (cur_tss != NULL) {
-		kfree(cur_tss);
-	}
+static void init_syscall(void) {
+	/* The SYSCALL instruction enters at syscall_entry with the kernel's
+	 * segments (0x08 and 0x10). SYSRET returns to 0x20 | 3 for code and
+	 * 0x18 | 3 for the stack. Interrupts, direction and trap flag are cleared
+	 * on entry. */
+	wrmsr(MSR_STAR, ((uint64_t)0x10 << 48) | ((uint64_t)0x08 << 32));
+	wrmsr(MSR_LSTAR, (uint64_t)syscall_entry);
+	wrmsr(MSR_SFMASK, 0x700);
+	wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_SCE);
+}
 
-	cur_tss = kmalloc(sizeof(*cur_tss));
-	if (cur_tss == NULL) {
-		unlock_scheduler();
-		return ERR_OUT_OF_MEM;
+uint8_t init_tss(struct cpu *c) {
+	/* Gives the CPU its own GDT and TSS, loads them and enables SYSCALL.
+	 * Called on every CPU, before it takes any interrupt from user mode. */
+	if (c->tss == NULL) {
+		c->tss = kmalloc(sizeof(*c->tss));
+		c->df_stack = kmalloc(CPU_DF_STACK_SIZE);
+		if ((c->tss == NULL) || (c->df_stack == NULL)) {
+			kfree(c->tss);
+			kfree(c->df_stack);
+			c->tss = NULL;
+			c->df_stack = NULL;
+			return ERR_OUT_OF_MEM;
+		}
 	}
-	memset(cur_tss, 0, sizeof(*cur_tss));
+	memset(c->tss, 0, sizeof(*c->tss));
 
 	/* The "kernel stack" of a process is always at the same address. Each process
 	 * has a different page mapped though, so this means interrupts won't overwrite
-	 * each other.
+	 * each other. Interrupts from user mode start at rsp0, the others stay on the
+	 * current stack. Double faults get a stack of the CPU's own (IST2), the task's
+	 * may be what caused it.
+	 * Kernel threads have their kernel stacks on the heap instead, yield() puts
+	 * the right one here on every switch (see tss_set_kernel_stack()).
 	 */
-	uintptr_t stack = ((uintptr_t)0xFFFFFF7FFFFFF000) + 0x1000;
-	cur_tss->rsp0_low = (uint32_t)(stack);
-	cur_tss->rsp0_high = (uint32_t)(stack >> 32);
-	cur_tss->ist1_low = (uint32_t)(stack);
-	cur_tss->ist1_high = (uint32_t)(stack >> 32);
-
-	load_tss(cur_tss);
-	unlock_scheduler();
+	uintptr_t stack = TASK_KERNEL_STACK + 0x1000;
+	c->tss->rsp0_low = (uint32_t)(stack);
+	c->tss->rsp0_high = (uint32_t)(stack >> 32);
+
+	uintptr_t df_stack = (uintptr_t)c->df_stack + CPU_DF_STACK_SIZE;
+	c->tss->ist2_low = (uint32_t)(df_stack);
+	c->tss->ist2_high = (uint32_t)(df_stack >> 32);
+
+	c->gdt[0] = 0;
+	c->gdt[1] = GDT_KERNEL_CODE;
+	c->gdt[2] = GDT_KERNEL_DATA;
+	c->gdt[3] = GDT_USER_DATA;
+	c->gdt[4] = GDT_USER_CODE;
+	set_tss_entry((struct gdt_entry*)&c->gdt[GDT_TSS / 8], c->tss);
+
+	struct gdt_descriptor d;
+	d.size = sizeof(c->gdt) - 1;
+	d.offset = (uint64_t)c->gdt;
+
+	/* Reloading the segments clears the GS base, so set it again. */
+	uint64_t flags = irq_save();
+	loadCPUGDT(&d);
+	wrmsr(MSR_GS_BASE, (uint64_t)c);
+	wrmsr(MSR_KERNEL_GS_BASE, 0);
+	init_syscall();
+	irq_restore(flags);
 	return GENERIC_SUCCESS;
 }
 
+void tss_set_kernel_stack(struct cpu *c, uint64_t rsp) {
+	/* Where interrupts on c switch to from now on. */
+	c->tss->rsp0_low = (uint32_t)(rsp);
+	c->tss->rsp0_high = (uint32_t)(rsp >> 32);
+}
@@ -0,0 +1,154 @@
+#include <workqueue.h>
+#include <task.h>
+#include <mem.h>
+#include <err.h>
+#include <string.h>
+
+/* Workqueues. Each one has a kernel thread that runs its work items in the
+ * order they were queued, one at a time. Queueing only takes the queue's lock
+ * (and the scheduler's, to wake the thread up), so it is cheap enough for an
+ * interrupt handler: the handler does what can't wait, and queues the rest.
+ *
+ * A work item is either pending (on one queue, once) or not. Queueing it again
+ * while it is pending does nothing, queueing it while its function runs makes
+ * it run once more after that.
+ */
+
+struct workqueue *system_wq = NULL;
+
+
+static void worker_main(void *arg) {
+	struct workqueue *wq = arg;
+
+	lock_task_switches();
+	while (1) {
+		uint64_t flags = spin_lock_irqsave(&wq->lock);
+		while (wq->first == NULL) {
+			/* Like the terminator, the block happens once task switches
+			 * are unlocked, after the queue's lock was released. */
+			block_task();
+			spin_unlock_irqrestore(&wq->lock, flags);
+			unlock_task_switches();
+			lock_task_switches();
+			flags = spin_lock_irqsave(&wq->lock);
+		}
+
+		struct work *w = wq->first;
+		wq->first = w->next;
+		if (wq->first == NULL) {
+			wq->last = NULL;
+		}
+		w->next = NULL;
+		w->pending = 0;
+		wq->running = w;
+		spin_unlock_irqrestore(&wq->lock, flags);
+
+		/* The function may block, or be preempted. */
+		unlock_task_switches();
+		w->func(w->data);
+		lock_task_switches();
+
+		flags = spin_lock_irqsave(&wq->lock);
+		wq->running = NULL;
+		spin_unlock_irqrestore(&wq->lock, flags);
+	}
+}
+
+struct workqueue *create_workqueue(char *name) {
+	/* Creates a queue and starts its thread. */
+	struct workqueue *wq = kmalloc(sizeof(*wq));
+	if (wq == NULL) {
+		return NULL;
+	}
+	memset(wq, 0, sizeof(*wq));
+	wq->name = name;
+
+	wq->worker = kthread_create(worker_main, wq);
+	if (wq->worker == NULL) {
+		kfree(wq);
+		return NULL;
+	}
+	return wq;
+}
+
+uint8_t init_workqueues(void) {
+	/* Needs the scheduler. */
+	system_wq = create_workqueue("events");
+	if (system_wq == NULL) {
+		return ERR_OUT_OF_MEM;
+	}
+	return GENERIC_SUCCESS;
+}
+
+void work_init(struct work *w, void (*func)(void *data), void *data) {
+	w->next = NULL;
+	w->func = func;
+	w->data = data;
+	w->pending = 0;
+}
+
+uint8_t queue_work(struct workqueue *wq, struct work *w) {
+	/* Runs w->func(w->data) in wq's thread. May be called with interrupts
+	 * disabled, or from an interrupt handler. */
+	if ((wq == NULL) || (w == NULL)) { return ERR_INVALID_PARAM; }
+	if (w->func == NULL)             { return ERR_INVALID_PARAM; }
+
+	uint64_t flags = spin_lock_irqsave(&wq->lock);
+	if (!w->pending) {
+		w->next = NULL;
+		if (wq->last == NULL) {
+			wq->first = w;
+		} else {
+			wq->last->next = w;
+		}
+		wq->last = w;
+		w->pending = 1;
+	}
+	spin_unlock_irqrestore(&wq->lock, flags);
+
+	/* The worker only blocks with the queue's lock held, so it either sees w
+	 * or is blocked by now. If it hasn't switched away yet, it keeps running. */
+	if (wq->worker->state == TASK_STATE_BLOCK) {
+		unblock_task(wq->worker);
+	}
+	return GENERIC_SUCCESS;
+}
+
+uint8_t cancel_work(struct workqueue *wq, struct work *w) {
+	/* Returns ERR_NOT_FOUND if w wasn't pending. If its function is running,
+	 * this waits for it to return, so w can be freed afterwards. Not to be
+	 * called from the function, or from anything it waits for. */
+	if ((wq == NULL) || (w == NULL)) { return ERR_INVALID_PARAM; }
+
+	uint64_t flags = spin_lock_irqsave(&wq->lock);
+	while (wq->running == w) {
+		spin_unlock_irqrestore(&wq->lock, flags);
+		__asm__ volatile ("pause");
+		flags = spin_lock_irqsave(&wq->lock);
+	}
+
+	if (!w->pending) {
+		spin_unlock_irqrestore(&wq->lock, flags);
+		return ERR_NOT_FOUND;
+	}
+
+	struct work *prev = NULL;
+	for (struct work *i = wq->first; i != w; prev = i, i = i->next);
+	if (prev == NULL) {
+		wq->first = w->next;
+	} else {
+		prev->next = w->next;
+	}
+	if (wq->last == w) {
+		wq->last = prev;
+	}
+	w->next = NULL;
+	w->pending = 0;
+	spin_unlock_irqrestore(&wq->lock, flags);
+	return GENERIC_SUCCESS;
+}
+
+uint8_t schedule_work(struct work *w) {
+	/* Queues w on system_wq. */
+	return queue_work(system_wq, w);
+}
@@ -0,0 +1,211 @@
+#include <bitmap.h>
+#include <string.h>
+#include <err.h>
+
+/* Generic bitmap helpers, used by the PMM, the page struct heap and ext2.
+ * Everything works on whole 64 bit words, so a search costs one bsf per word
+ * instead of one branch per bit.
+ */
+
+#define FULL_WORD (~(uint64_t)0)
+
+static size_t word_count(struct bitmap *b) {
+	return (b->bit_count + 63) / 64;
+}
+
+static uint64_t range_mask(size_t off, size_t n) {
+	/* n bits starting at bit off, n + off <= 64. */
+	if (n >= 64) {
+		return FULL_WORD;
+	}
+	return (((uint64_t)1 << n) - 1) << off;
+}
+
+static void update_summary(struct bitmap *b, size_t w) {
+	if (b->summary == NULL) { return; }
+
+	uint64_t bit = (uint64_t)1 << (w % 64);
+	if (b->words[w] == FULL_WORD) {
+		b->summary[w / 64] |= bit;
+	} else {
+		b->summary[w / 64] &= ~bit;
+	}
+}
+
+static size_t next_free_word(struct bitmap *b, size_t w) {
+	/* Returns the first word at or after w that isn't full, according to the
+	 * summary. May return something past the end. */
+	if (b->summary == NULL)  { return w; }
+	if (w >= word_count(b))  { return word_count(b); }
+
+	size_t s = w / 64;
+	uint64_t m = ~b->summary[s] & (FULL_WORD << (w % 64));
+	while (m == 0) {
+		s++;
+		if (s * 64 >= word_count(b)) {
+			return word_count(b);
+		}
+		m = ~b->summary[s];
+	}
+	return s * 64 + __builtin_ctzll(m);
+}
+
+
+void bitmap_init(struct bitmap *b, uint64_t *words, uint64_t *summary, size_t bits) {
+	if (b == NULL) { return; }
+
+	b->words = words;
+	b->summary = summary;
+	b->bit_count = bits;
+	bitmap_sync(b);
+}
+
+void bitmap_sync(struct bitmap *b) {
+	/* Rebuilds the summary, for when the words were changed directly. */
+	if (b == NULL)          { return; }
+	if (b->summary == NULL) { return; }
+
+	memset(b->summary, 0, BITMAP_SUMMARY_WORDS(b->bit_count) * sizeof(uint64_t));
+	for (size_t w = 0; w < word_count(b); w++) {
+		update_summary(b, w);
+	}
+}
+
+
+uint8_t bitmap_test(struct bitmap *b, size_t i) {
+	if (i >= b->bit_count) {
+		return 1;	/* Everything past the end counts as used. */
+	}
+	return (b->words[i / 64] >> (i % 64)) & 1;
+}
+
+void bitmap_set(struct bitmap *b, size_t i) {
+	if (i >= b->bit_count) { return; }
+
+	b->words[i / 64] |= (uint64_t)1 << (i % 64);
+	update_summary(b, i / 64);
+}
+
+void bitmap_clear(struct bitmap *b, size_t i) {
+	if (i >= b->bit_count) { return; }
+
+	b->words[i / 64] &= ~((uint64_t)1 << (i % 64));
+	update_summary(b, i / 64);
+}
+
+void bitmap_set_range(struct bitmap *b, size_t i, size_t len) {
+	if (i >= b->bit_count) { return; }
+	if (len > b->bit_count - i) {
+		len = b->bit_count - i;
+	}
+
+	while (len) {
+		size_t off = i % 64;
+		size_t n = (64 - off < len) ? 64 - off : len;
+
+		b->words[i / 64] |= range_mask(off, n);
+		update_summary(b, i / 64);
+		i += n;
+		len -= n;
+	}
+}
+
+void bitmap_clear_range(struct bitmap *b, size_t i, size_t len) {
+	if (i >= b->bit_count) { return; }
+	if (len > b->bit_count - i) {
+		len = b->bit_count - i;
+	}
+
+	while (len) {
+		size_t off = i % 64;
+		size_t n = (64 - off < len) ? 64 - off : len;
+
+		b->words[i / 64] &= ~range_mask(off, n);
+		update_summary(b, i / 64);
+		i += n;
+		len -= n;
+	}
+}
+
+
+int64_t bitmap_find_zero(struct bitmap *b, size_t start) {
+	/* Returns the index of the first clear bit at or after start. */
+	if (start >= b->bit_count) { return -ERR_NOT_FOUND; }
+
+	size_t w = start / 64;
+	uint64_t m = ~b->words[w] & (FULL_WORD << (start % 64));
+
+	while (m == 0) {
+		w = next_free_word(b, w + 1);
+		if (w >= word_count(b)) {
+			return -ERR_NOT_FOUND;
+		}
+		m = ~b->words[w];
+	}
+
+	size_t ret = w * 64 + __builtin_ctzll(m);
+	if (ret >= b->bit_count) {
+		return -ERR_NOT_FOUND;
+	}
+	return ret;
+}
+
+int64_t bitmap_find_one(struct bitmap *b, size_t start) {
+	/* Returns the index of the first set bit at or after start. */
+	if (start >= b->bit_count) { return -ERR_NOT_FOUND; }
+
+	size_t w = start / 64;
+	uint64_t m = b->words[w] & (FULL_WORD << (start % 64));
+
+	while (m == 0) {
+		w++;
+		if (w >= word_count(b)) {
+			return -ERR_NOT_FOUND;
+		}
+		m = b->words[w];
+	}
+
+	size_t ret = w * 64 + __builtin_ctzll(m);
+	if (ret >= b->bit_count) {
+		return -ERR_NOT_FOUND;
+	}
+	return ret;
+}
+
+int64_t bitmap_find_zero_run(struct bitmap *b, size_t start, size_t len) {
+	/* Returns the index of the first run of at least len clear bits. */
+	if (len == 0) { return -ERR_INVALID_PARAM; }
+
+	int64_t i = bitmap_find_zero(b, start);
+	while (i >= 0) {
+		int64_t j = bitmap_find_one(b, i);
+		if (j < 0) {
+			j = b->bit_count;
+		}
+
+		if ((size_t)(j - i) >= len) {
+			return i;
+		}
+		i = bitmap_find_zero(b, j);
+	}
+	return -ERR_NOT_FOUND;
+}
+
+size_t bitmap_count(struct bitmap *b, size_t i, size_t len) {
+	/* Returns how many bits are set in the given range. */
+	if (i >= b->bit_count) { return 0; }
+	if (len > b->bit_count - i) {
+		len = b->bit_count - i;
+	}
+
+	size_t ret = 0;
+	while (len) {
+		size_t off = i % 64;
+		size_t n = (64 - off < len) ? 64 - off : len;
+
+		ret += __builtin_popcountll(b->words[i / 64] & range_mask(off, n));
+		i += n;
+		len -= n;
+	}
+	return ret;
+}
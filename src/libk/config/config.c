@@ -3,6 +3,7 @@
 #include <err.h>
 #include <task.h>
 #include <mem.h>
+#include <klog.h>
 
 struct config_variable {
 	char *name;
@@ -177,10 +178,7 @@ uint8_t reload_config(char *f) {
 void config_put_variables() {
 	struct config_variable *i = first_var;
 	while (i != NULL) {
-		serial_puts(i->name);
-		serial_puts("=");
-		serial_puts(i->value);
-		serial_puts("\r\n");
+		klog_debug("%s=%s\n", i->name, i->value);
 		i = i->next;
 	}
 }
@@ -0,0 +1,135 @@
+#include <containers/hash.h>
+#include <mem.h>
+#include <err.h>
+
+static size_t bucket_of(struct hash_table *h, uint64_t key) {
+	return hash_u64(key) & (h->bucket_count - 1);
+}
+
+static void grow(struct hash_table *h) {
+	/* Doubles the bucket count. If there's no memory, the chains just get longer. */
+	size_t count = h->bucket_count * 2;
+	struct hash_node **buckets = kmalloc(count * sizeof(*buckets));
+	if (buckets == NULL) { return; }
+	memset(buckets, 0, count * sizeof(*buckets));
+
+	struct hash_node **old = h->buckets;
+	size_t old_count = h->bucket_count;
+	h->buckets = buckets;
+	h->bucket_count = count;
+
+	for (size_t i = 0; i < old_count; i++) {
+		struct hash_node *n = old[i];
+		while (n != NULL) {
+			struct hash_node *next = n->next;
+			size_t b = bucket_of(h, n->key);
+			n->next = buckets[b];
+			buckets[b] = n;
+			n = next;
+		}
+	}
+	kfree(old);
+}
+
+
+uint8_t hash_init(struct hash_table *h, size_t buckets) {
+	if (h == NULL) { return ERR_INVALID_PARAM; }
+
+	size_t count = 8;
+	while (count < buckets) {
+		count *= 2;
+	}
+
+	h->buckets = kmalloc(count * sizeof(*h->buckets));
+	if (h->buckets == NULL) {
+		return ERR_OUT_OF_MEM;
+	}
+	memset(h->buckets, 0, count * sizeof(*h->buckets));
+	h->bucket_count = count;
+	h->count = 0;
+	return GENERIC_SUCCESS;
+}
+
+void hash_destroy(struct hash_table *h) {
+	/* The nodes belong to whoever inserted them, only the buckets are freed. */
+	if (h == NULL) { return; }
+
+	kfree(h->buckets);
+	h->buckets = NULL;
+	h->bucket_count = 0;
+	h->count = 0;
+}
+
+
+uint8_t hash_insert(struct hash_table *h, struct hash_node *n, uint64_t key) {
+	if ((h == NULL) || (n == NULL)) { return ERR_INVALID_PARAM; }
+
+	if (h->count >= h->bucket_count * 2) {
+		grow(h);
+	}
+
+	size_t b = bucket_of(h, key);
+	n->key = key;
+	n->next = h->buckets[b];
+	h->buckets[b] = n;
+	h->count++;
+	return GENERIC_SUCCESS;
+}
+
+void hash_remove(struct hash_table *h, struct hash_node *n) {
+	if ((h == NULL) || (n == NULL)) { return; }
+
+	struct hash_node **i = &h->buckets[bucket_of(h, n->key)];
+	while (*i != NULL) {
+		if (*i == n) {
+			*i = n->next;
+			n->next = NULL;
+			h->count--;
+			return;
+		}
+		i = &(*i)->next;
+	}
+}
+
+struct hash_node *hash_find(struct hash_table *h, uint64_t key) {
+	if ((h == NULL) || (h->buckets == NULL)) { return NULL; }
+
+	struct hash_node *i = h->buckets[bucket_of(h, key)];
+	while ((i != NULL) && (i->key != key)) {
+		i = i->next;
+	}
+	return i;
+}
+
+struct hash_node *hash_next(struct hash_node *n) {
+	/* The next node with the same key, if any. */
+	if (n == NULL) { return NULL; }
+
+	struct hash_node *i = n->next;
+	while ((i != NULL) && (i->key != n->key)) {
+		i = i->next;
+	}
+	return i;
+}
+
+
+uint64_t hash_u64(uint64_t val) {
+	/* The splitmix64 finaliser. Sequential keys (PIDs, inodes) end up spread
+	 * over every bucket. */
+	val ^= val >> 30;
+	val *= 0xBF58476D1CE4E5B9;
+	val ^= val >> 27;
+	val *= 0x94D049BB133111EB;
+	val ^= val >> 31;
+	return val;
+}
+
+uint64_t hash_str(const char *str) {
+	/* FNV-1a */
+	uint64_t ret = 0xCBF29CE484222325;
+	while (*str) {
+		ret ^= (uint8_t)*str++;
+		ret *= 0x100000001B3;
+	}
+	return ret;
+}
@@ -0,0 +1,131 @@
+#include <containers/radix.h>
+#include <mem.h>
+#include <err.h>
+
+static uint64_t max_key(size_t height) {
+	/* The largest key a tree of this height can hold. */
+	if (height * RADIX_BITS >= 64) {
+		return ~(uint64_t)0;
+	}
+	return ((uint64_t)1 << (height * RADIX_BITS)) - 1;
+}
+
+static size_t slot_of(uint64_t key, size_t level) {
+	/* level 0 is the bottom. */
+	return (key >> (level * RADIX_BITS)) & (RADIX_SLOTS - 1);
+}
+
+static struct radix_node *new_node(void) {
+	struct radix_node *n = kmalloc(sizeof(*n));
+	if (n == NULL) { return NULL; }
+	memset(n, 0, sizeof(*n));
+	return n;
+}
+
+static void free_node(struct radix_node *n, size_t level) {
+	if (level > 0) {
+		for (size_t i = 0; i < RADIX_SLOTS; i++) {
+			if (n->slots[i] != NULL) {
+				free_node(n->slots[i], level - 1);
+			}
+		}
+	}
+	kfree(n);
+}
+
+
+uint8_t radix_insert(struct radix_tree *r, uint64_t key, void *item) {
+	/* Replaces whatever was at key. Inserting NULL is the same as removing. */
+	if (r == NULL) { return ERR_INVALID_PARAM; }
+	if (item == NULL) {
+		radix_remove(r, key);
+		return GENERIC_SUCCESS;
+	}
+
+	/* Grow the tree upwards until the key fits. */
+	while ((r->height == 0) || (key > max_key(r->height))) {
+		struct radix_node *n = new_node();
+		if (n == NULL) { return ERR_OUT_OF_MEM; }
+		if (r->root != NULL) {
+			n->slots[0] = r->root;
+			n->used = 1;
+		}
+		r->root = n;
+		r->height++;
+	}
+
+	struct radix_node *n = r->root;
+	for (size_t level = r->height - 1; level > 0; level--) {
+		size_t s = slot_of(key, level);
+		if (n->slots[s] == NULL) {
+			n->slots[s] = new_node();
+			if (n->slots[s] == NULL) { return ERR_OUT_OF_MEM; }
+			n->used++;
+		}
+		n = n->slots[s];
+	}
+
+	size_t s = slot_of(key, 0);
+	if (n->slots[s] == NULL) {
+		n->used++;
+		r->count++;
+	}
+	n->slots[s] = item;
+	return GENERIC_SUCCESS;
+}
+
+void *radix_lookup(struct radix_tree *r, uint64_t key) {
+	if ((r == NULL) || (r->height == 0)) { return NULL; }
+	if (key > max_key(r->height))        { return NULL; }
+
+	struct radix_node *n = r->root;
+	for (size_t level = r->height - 1; level > 0; level--) {
+		n = n->slots[slot_of(key, level)];
+		if (n == NULL) { return NULL; }
+	}
+	return n->slots[slot_of(key, 0)];
+}
+
+void *radix_remove(struct radix_tree *r, uint64_t key) {
+	if ((r == NULL) || (r->height == 0)) { return NULL; }
+	if (key > max_key(r->height))        { return NULL; }
+
+	/* Remember the path, so empty nodes can be freed on the way back. */
+	struct radix_node *path[64 / RADIX_BITS + 1];
+	struct radix_node *n = r->root;
+	for (size_t level = r->height - 1; level > 0; level--) {
+		path[level] = n;
+		n = n->slots[slot_of(key, level)];
+		if (n == NULL) { return NULL; }
+	}
+	path[0] = n;
+
+	void *ret = n->slots[slot_of(key, 0)];
+	if (ret == NULL) { return NULL; }
+	r->count--;
+
+	for (size_t level = 0; level < r->height; level++) {
+		n = path[level];
+		n->slots[slot_of(key, level)] = NULL;	/* The item, or a child freed below. */
+		n->used--;
+		if (n->used > 0) {
+			return ret;
+		}
+		kfree(n);
+	}
+
+	/* Every level was emptied. */
+	r->root = NULL;
+	r->height = 0;
+	return ret;
+}
+
+void radix_destroy(struct radix_tree *r) {
+	/* Frees the tree itself, not the items. */
+	if ((r == NULL) || (r->root == NULL)) { return; }
+
+	free_node(r->root, r->height - 1);
+	r->root = NULL;
+	r->height = 0;
+	r->count = 0;
+}
@@ -0,0 +1,269 @@
+#include <containers/rbtree.h>
+
+/* The usual red-black tree, with NULL leaves (which count as black). */
+
+static uint8_t is_black(struct rb_node *n) {
+	return (n == NULL) || (n->color == RB_BLACK);
+}
+
+static void replace_child(struct rb_tree *t, struct rb_node *old, struct rb_node *new) {
+	/* Puts new where old was, in old's parent. */
+	if (old->parent == NULL) {
+		t->root = new;
+	} else if (old == old->parent->left) {
+		old->parent->left = new;
+	} else {
+		old->parent->right = new;
+	}
+	if (new != NULL) {
+		new->parent = old->parent;
+	}
+}
+
+static void rotate_left(struct rb_tree *t, struct rb_node *x) {
+	struct rb_node *y = x->right;
+
+	x->right = y->left;
+	if (y->left != NULL) {
+		y->left->parent = x;
+	}
+	replace_child(t, x, y);
+	y->left = x;
+	x->parent = y;
+}
+
+static void rotate_right(struct rb_tree *t, struct rb_node *x) {
+	struct rb_node *y = x->left;
+
+	x->left = y->right;
+	if (y->right != NULL) {
+		y->right->parent = x;
+	}
+	replace_child(t, x, y);
+	y->right = x;
+	x->parent = y;
+}
+
+static struct rb_node *leftmost(struct rb_node *n) {
+	while (n->left != NULL) {
+		n = n->left;
+	}
+	return n;
+}
+
+
+void rb_insert(struct rb_tree *t, struct rb_node *n, uint64_t key) {
+	if ((t == NULL) || (n == NULL)) { return; }
+
+	struct rb_node *p = NULL;
+	struct rb_node **link = &t->root;
+	while (*link != NULL) {
+		p = *link;
+		/* Equal keys go right, so they come out in insertion order. */
+		link = (key < p->key) ? &p->left : &p->right;
+	}
+
+	n->key = key;
+	n->parent = p;
+	n->left = NULL;
+	n->right = NULL;
+	n->color = RB_RED;
+	*link = n;
+	t->count++;
+
+	if ((t->first == NULL) || (key < t->first->key)) {
+		t->first = n;
+	}
+
+	/* Fix any red node with a red parent. */
+	while (((p = n->parent) != NULL) && (p->color == RB_RED)) {
+		struct rb_node *g = p->parent;
+
+		if (p == g->left) {
+			struct rb_node *u = g->right;
+			if (!is_black(u)) {
+				p->color = RB_BLACK;
+				u->color = RB_BLACK;
+				g->color = RB_RED;
+				n = g;
+				continue;
+			}
+			if (n == p->right) {
+				rotate_left(t, p);
+				n = p;
+				p = n->parent;
+			}
+			p->color = RB_BLACK;
+			g->color = RB_RED;
+			rotate_right(t, g);
+		} else {
+			struct rb_node *u = g->left;
+			if (!is_black(u)) {
+				p->color = RB_BLACK;
+				u->color = RB_BLACK;
+				g->color = RB_RED;
+				n = g;
+				continue;
+			}
+			if (n == p->left) {
+				rotate_right(t, p);
+				n = p;
+				p = n->parent;
+			}
+			p->color = RB_BLACK;
+			g->color = RB_RED;
+			rotate_left(t, g);
+		}
+	}
+	t->root->color = RB_BLACK;
+}
+
+static void remove_fixup(struct rb_tree *t, struct rb_node *x, struct rb_node *xp) {
+	/* x (which may be NULL, hence xp) is missing one black. */
+	while ((x != t->root) && is_black(x)) {
+		if (x == xp->left) {
+			struct rb_node *w = xp->right;
+			if (w->color == RB_RED) {
+				w->color = RB_BLACK;
+				xp->color = RB_RED;
+				rotate_left(t, xp);
+				w = xp->right;
+			}
+			if (is_black(w->left) && is_black(w->right)) {
+				w->color = RB_RED;
+				x = xp;
+				xp = x->parent;
+				continue;
+			}
+			if (is_black(w->right)) {
+				w->left->color = RB_BLACK;
+				w->color = RB_RED;
+				rotate_right(t, w);
+				w = xp->right;
+			}
+			w->color = xp->color;
+			xp->color = RB_BLACK;
+			w->right->color = RB_BLACK;
+			rotate_left(t, xp);
+		} else {
+			struct rb_node *w = xp->left;
+			if (w->color == RB_RED) {
+				w->color = RB_BLACK;
+				xp->color = RB_RED;
+				rotate_right(t, xp);
+				w = xp->left;
+			}
+			if (is_black(w->left) && is_black(w->right)) {
+				w->color = RB_RED;
+				x = xp;
+				xp = x->parent;
+				continue;
+			}
+			if (is_black(w->left)) {
+				w->right->color = RB_BLACK;
+				w->color = RB_RED;
+				rotate_left(t, w);
+				w = xp->left;
+			}
+			w->color = xp->color;
+			xp->color = RB_BLACK;
+			w->left->color = RB_BLACK;
+			rotate_right(t, xp);
+		}
+		x = t->root;
+		break;
+	}
+	if (x != NULL) {
+		x->color = RB_BLACK;
+	}
+}
+
+void rb_remove(struct rb_tree *t, struct rb_node *n) {
+	if ((t == NULL) || (n == NULL)) { return; }
+
+	if (t->first == n) {
+		t->first = rb_next(n);
+	}
+
+	struct rb_node *x;
+	struct rb_node *xp;
+	uint8_t removed_color = n->color;
+
+	if (n->left == NULL) {
+		x = n->right;
+		xp = n->parent;
+		replace_child(t, n, n->right);
+	} else if (n->right == NULL) {
+		x = n->left;
+		xp = n->parent;
+		replace_child(t, n, n->left);
+	} else {
+		/* Two children, the successor takes n's place. */
+		struct rb_node *y = leftmost(n->right);
+		removed_color = y->color;
+		x = y->right;
+
+		if (y->parent == n) {
+			xp = y;
+		} else {
+			xp = y->parent;
+			replace_child(t, y, y->right);
+			y->right = n->right;
+			y->right->parent = y;
+		}
+		replace_child(t, n, y);
+		y->left = n->left;
+		y->left->parent = y;
+		y->color = n->color;
+	}
+
+	n->parent = n->left = n->right = NULL;
+	t->count--;
+
+	if (removed_color == RB_BLACK) {
+		remove_fixup(t, x, xp);
+	}
+}
+
+
+struct rb_node *rb_first(struct rb_tree *t) {
+	if (t == NULL) { return NULL; }
+	return t->first;
+}
+
+struct rb_node *rb_next(struct rb_node *n) {
+	if (n == NULL) { return NULL; }
+
+	if (n->right != NULL) {
+		return leftmost(n->right);
+	}
+	while ((n->parent != NULL) && (n == n->parent->right)) {
+		n = n->parent;
+	}
+	return n->parent;
+}
+
+struct rb_node *rb_lower_bound(struct rb_tree *t, uint64_t key) {
+	/* The first node with a key >= key. */
+	if (t == NULL) { return NULL; }
+
+	struct rb_node *ret = NULL;
+	struct rb_node *i = t->root;
+	while (i != NULL) {
+		if (i->key >= key) {
+			ret = i;
+			i = i->left;
+		} else {
+			i = i->right;
+		}
+	}
+	return ret;
+}
+
+struct rb_node *rb_find(struct rb_tree *t, uint64_t key) {
+	struct rb_node *ret = rb_lower_bound(t, key);
+	if ((ret == NULL) || (ret->key != key)) {
+		return NULL;
+	}
+	return ret;
+}
@@ -0,0 +1,91 @@
+#include <containers/ring.h>
+#include <mem.h>
+#include <err.h>
+
+/* A slot is free for the push at position pos when its sequence number is pos,
+ * and holds data for the pop at position pos when it is pos + 1.
+ */
+
+uint8_t ring_init(struct ring *r, size_t elem_size, size_t count) {
+	if ((r == NULL) || (elem_size == 0)) { return ERR_INVALID_PARAM; }
+
+	size_t slots = 2;
+	while (slots < count) {
+		slots *= 2;
+	}
+
+	r->data = kmalloc(slots * elem_size);
+	r->seq = kmalloc(slots * sizeof(*r->seq));
+	if ((r->data == NULL) || (r->seq == NULL)) {
+		kfree(r->data);
+		kfree(r->seq);
+		return ERR_OUT_OF_MEM;
+	}
+
+	for (size_t i = 0; i < slots; i++) {
+		r->seq[i] = i;
+	}
+	r->elem_size = elem_size;
+	r->mask = slots - 1;
+	r->head = 0;
+	r->tail = 0;
+	return GENERIC_SUCCESS;
+}
+
+void ring_destroy(struct ring *r) {
+	if (r == NULL) { return; }
+
+	kfree(r->data);
+	kfree(r->seq);
+	r->data = NULL;
+	r->seq = NULL;
+}
+
+
+uint8_t ring_push(struct ring *r, void *elem) {
+	/* Returns ERR_OUT_OF_BOUNDS if the ring is full. */
+	uint64_t pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+
+	while (1) {
+		size_t slot = pos & r->mask;
+		int64_t diff = __atomic_load_n(&r->seq[slot], __ATOMIC_ACQUIRE) - pos;
+
+		if (diff == 0) {
+			/* The slot is free, try to claim it. On failure pos is reloaded. */
+			if (__atomic_compare_exchange_n(&r->tail, &pos, pos + 1, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if (diff < 0) {
+			return ERR_OUT_OF_BOUNDS;
+		} else {
+			/* Someone else pushed in the meantime. */
+			pos = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	size_t slot = pos & r->mask;
+	memcpy(r->data + slot * r->elem_size, elem, r->elem_size);
+	__atomic_store_n(&r->seq[slot], pos + 1, __ATOMIC_RELEASE);
+	return GENERIC_SUCCESS;
+}
+
+uint8_t ring_pop(struct ring *r, void *elem) {
+	/* Returns ERR_NO_RESULT if there's nothing (finished) to pop. */
+	uint64_t pos = r->head;
+	size_t slot = pos & r->mask;
+
+	if (__atomic_load_n(&r->seq[slot], __ATOMIC_ACQUIRE) != pos + 1) {
+		return ERR_NO_RESULT;
+	}
+
+	memcpy(elem, r->data + slot * r->elem_size, r->elem_size);
+	__atomic_store_n(&r->seq[slot], pos + r->mask + 1, __ATOMIC_RELEASE);
+	r->head = pos + 1;
+	return GENERIC_SUCCESS;
+}
+
+size_t ring_count(struct ring *r) {
+	/* Only a snapshot, pushes may be going on. */
+	return __atomic_load_n(&r->tail, __ATOMIC_RELAXED) - r->head;
+}
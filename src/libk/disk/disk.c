@@ -3,6 +3,7 @@
 #include <mem.h>
 #include <task.h>
 #include <err.h>
+#include <klog.h>
 
 /* Disks are physical storage mediums. Drives are a range of sectors within a disk.
  * They can be partitions, filesystems etc. etc. or they can be the whole disk as
@@ -159,6 +160,6 @@ uint8_t init_disk() {
 	if (init_ide()) {
 		return 1;
 	}
-	serial_puts("IDE OK\r\n");
+	klog_info("IDE OK\n");
 	return refresh_disks();
 }
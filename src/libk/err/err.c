@@ -1,5 +1,6 @@
 #include <err.h>
 #include <vga.h>
+#include <klog.h>
 
 void kpanic(void) {
 	/* This is a temporary panic function, that fills the entire screen red
@@ -8,6 +9,7 @@ void kpanic(void) {
 	 * (when SMP is added), etc. etc.
 	 */
 	__asm__ volatile ("cli;");
+	klog_flush();
 	serial_puts("\r\nPANIC!\r\n at the disco");
 	vga_fill_screen(0x00FF0000);
 
@@ -0,0 +1,248 @@
+#include <klog.h>
+#include <containers/ring.h>
+#include <err.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <string.h>
+#include <stdarg.h>
+
+/* The kernel log. klog_write() formats a message into a record and pushes it
+ * into a lock-free ring, which is safe from any context, interrupt handlers
+ * included. The ring is drained by the UART's "transmit holding register
+ * empty" interrupt (IRQ4), up to 16 bytes at a time, so nobody busy-waits on
+ * the serial port any more. Drained records are also kept in a history buffer,
+ * which klogread() copies to user space.
+ *
+ * Until init_klog() has run (there's no heap for the ring yet), messages are
+ * written out synchronously.
+ */
+
+static struct ring klog_ring;
+static uint8_t klog_ready = 0;
+uint64_t klog_dropped = 0;	/* Records lost because the ring was full. */
+
+/* The consumer side. Only touched with tx_lock held. */
+static struct spinlock tx_lock;
+static struct klog_record tx_rec;
+static size_t tx_pos = 0;		/* Next byte of tx_rec to send. */
+static uint8_t tx_cr = 0;		/* The '\r' for the current '\n' was sent. */
+static uint8_t tx_active = 0;	/* The TX interrupt is enabled. */
+
+static char history[KLOG_HISTORY_SIZE];
+static uint64_t history_len = 0;	/* Bytes ever added to the history. */
+
+static char level_tags[] = "EWID";
+
+
+static size_t put_str(char *buf, size_t pos, char *str) {
+	if (str == NULL) {
+		str = "(null)";
+	}
+	while ((*str != '\0') && (pos < KLOG_LINE_MAX)) {
+		buf[pos++] = *(str++);
+	}
+	return pos;
+}
+
+static size_t put_dec(char *buf, size_t pos, uint64_t val) {
+	char tmp[20];
+	size_t n = 0;
+	do {
+		tmp[n++] = '0' + (val % 10);
+		val /= 10;
+	} while (val);
+
+	while ((n != 0) && (pos < KLOG_LINE_MAX)) {
+		buf[pos++] = tmp[--n];
+	}
+	return pos;
+}
+
+static void history_add(char *text, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		history[(history_len + i) & (KLOG_HISTORY_SIZE - 1)] = text[i];
+	}
+	history_len += len;
+}
+
+static uint8_t next_record(void) {
+	if (ring_pop(&klog_ring, &tx_rec)) {
+		return 0;
+	}
+	history_add(tx_rec.text, tx_rec.len);
+	tx_pos = 0;
+	tx_cr = 0;
+	return 1;
+}
+
+static int16_t next_char(void) {
+	/* Returns the next byte to send, or -1 if the ring is empty. */
+	if (tx_pos >= tx_rec.len) {
+		if (!next_record()) {
+			return -1;
+		}
+	}
+
+	char c = tx_rec.text[tx_pos];
+	if ((c == '\n') && !tx_cr) {
+		tx_cr = 1;
+		return '\r';
+	}
+	tx_cr = 0;
+	tx_pos++;
+	return c;
+}
+
+static void klog_kick(void) {
+	uint64_t flags = spin_lock_irqsave(&tx_lock);
+	if (!serial_ok) {
+		/* Nowhere to send it, only keep the history. */
+		while (next_record());
+	} else if (!tx_active) {
+		/* Enabling the interrupt while the FIFO is empty raises it right away. */
+		tx_active = 1;
+		serial_tx_irq(1);
+	}
+	spin_unlock_irqrestore(&tx_lock, flags);
+}
+
+
+uint8_t init_klog(void) {
+	uint8_t err = ring_init(&klog_ring, sizeof(struct klog_record), KLOG_RING_SLOTS);
+	if (err) {
+		return err;
+	}
+	klog_ready = 1;
+	return GENERIC_SUCCESS;
+}
+
+void klog_write(uint8_t level, char *fmt, ...) {
+	/* %d, %u and %x take 64 bit arguments. */
+	struct klog_record r;
+	size_t pos = 0;
+
+	r.level = level;
+	r.text[pos++] = '[';
+	r.text[pos++] = level_tags[(level > KLOG_DEBUG) ? KLOG_DEBUG : level];
+	r.text[pos++] = ']';
+	r.text[pos++] = ' ';
+
+	va_list args;
+	va_start(args, fmt);
+	while ((*fmt != '\0') && (pos < KLOG_LINE_MAX)) {
+		if (*fmt != '%') {
+			r.text[pos++] = *(fmt++);
+			continue;
+		}
+
+		fmt++;
+		switch (*fmt) {
+		case 's':
+			pos = put_str(r.text, pos, va_arg(args, char*));
+			break;
+		case 'c':
+			r.text[pos++] = (char)va_arg(args, int);
+			break;
+		case 'd': {
+			int64_t val = va_arg(args, int64_t);
+			if (val < 0) {
+				r.text[pos++] = '-';
+				pos = put_dec(r.text, pos, (uint64_t)0 - (uint64_t)val);
+			} else {
+				pos = put_dec(r.text, pos, val);
+			}
+			break;
+		}
+		case 'u':
+			pos = put_dec(r.text, pos, va_arg(args, uint64_t));
+			break;
+		case 'x': {
+			char str[19];
+			memset(str, 0, sizeof(str));
+			xtoa(va_arg(args, uint64_t), str);
+			pos = put_str(r.text, pos, str);
+			break;
+		}
+		case '\0':
+			fmt--;	/* A lone '%' at the end. */
+			r.text[pos++] = '%';
+			break;
+		default:
+			r.text[pos++] = '%';
+			if ((*fmt != '%') && (pos < KLOG_LINE_MAX)) {
+				r.text[pos++] = *fmt;
+			}
+			break;
+		}
+		fmt++;
+	}
+	va_end(args);
+	r.len = pos;
+
+	if (!klog_ready) {
+		/* Early boot. Interrupts are still off, so nothing can race us. */
+		history_add(r.text, r.len);
+		for (size_t i = 0; i < r.len; i++) {
+			if (r.text[i] == '\n') {
+				serial_putc('\r');
+			}
+			serial_putc(r.text[i]);
+		}
+		return;
+	}
+
+	if (ring_push(&klog_ring, &r)) {
+		__atomic_add_fetch(&klog_dropped, 1, __ATOMIC_RELAXED);
+	}
+	klog_kick();
+}
+
+void klog_uart_irq(void) {
+	/* Called by IRQ4, whenever the transmit FIFO is empty. */
+	spin_lock(&tx_lock);
+	size_t room = serial_tx_room();
+	while (room--) {
+		int16_t c = next_char();
+		if (c < 0) {
+			serial_tx_irq(0);
+			tx_active = 0;
+			break;
+		}
+		serial_tx_byte(c);
+	}
+	spin_unlock(&tx_lock);
+}
+
+void klog_flush(void) {
+	/* Sends everything synchronously. For kpanic(), with interrupts off. The
+	 * lock is not taken, whoever held it isn't coming back. */
+	if (!klog_ready) {
+		return;
+	}
+
+	int16_t c;
+	while ((c = next_char()) >= 0) {
+		if (serial_ok) {
+			serial_putc(c);
+		}
+	}
+}
+
+int64_t klog_read(char *buf, size_t size, size_t offset) {
+	/* Copies the history, starting offset bytes after the oldest byte still
+	 * kept. Returns the amount of bytes copied. */
+	if (buf == NULL) { return -ERR_INVALID_PARAM; }
+
+	uint64_t flags = spin_lock_irqsave(&tx_lock);
+	uint64_t oldest = (history_len > KLOG_HISTORY_SIZE) ? (history_len - KLOG_HISTORY_SIZE) : 0;
+	uint64_t start = oldest + offset;
+	size_t copied = 0;
+
+	while ((start + copied < history_len) && (copied < size)) {
+		buf[copied] = history[(start + copied) & (KLOG_HISTORY_SIZE - 1)];
+		copied++;
+	}
+	spin_unlock_irqrestore(&tx_lock, flags);
+
+	return copied;
+}
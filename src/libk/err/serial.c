@@ -4,6 +4,9 @@
 
 #define PORT 0x3f8
 
+/* Set once init_serial() found a working port. */
+uint8_t serial_ok = 0;
+
 size_t init_serial() {
 	outb(PORT + 1, 0x00);    // Disable all interrupts
 	outb(PORT + 3, 0x80);    // Enable DLAB (set baud rate divisor)
@@ -21,6 +24,7 @@ size_t init_serial() {
 	}
 
 	outb(PORT + 4, 0x0F);
+	serial_ok = 1;
 	return 0;
 }
 
@@ -47,3 +51,20 @@ void serial_putx(uint64_t val) {
 	xtoa(val, str);
 	serial_puts(str);
 }
+
+/* Interrupt driven transmission, used by klog. With the "transmitter holding
+ * register empty" interrupt enabled, IRQ4 fires whenever the FIFO has drained.
+ */
+void serial_tx_irq(uint8_t enable) {
+	outb(PORT + 1, enable ? 0x02 : 0x00);
+}
+
+size_t serial_tx_room(void) {
+	/* Bytes that can be written without waiting. The FIFO is 16 bytes deep, but
+	 * the line status register only says whether it is completely empty. */
+	return is_transmit_empty() ? 16 : 0;
+}
+
+void serial_tx_byte(char c) {
+	outb(PORT, c);
+}
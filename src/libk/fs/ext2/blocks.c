@@ -1,5 +1,6 @@
 #include <err.h>
 #include <mem.h>
+#include <bitmap.h>
 #include <disk/disk.h>
 #include <fs/fs.h>
 #include <fs/ext2.h>
@@ -90,8 +91,8 @@ size_t ext2_alloc_blocks(struct file_system *fs, size_t count, uint32_t *ret) {
 	size_t to_read = e2fs->sb->blocks_in_group / e2fs->block_size / 8;
 	to_read += !!(e2fs->sb->blocks_in_group % e2fs->block_size);
 
-	uint8_t *buf = kmalloc(to_read * e2fs->block_size);
-
+	uint64_t *buf = kmalloc(to_read * e2fs->block_size);
+	struct bitmap map;
 
 	for (size_t i = 0; i < e2fs->group_count; i++) {
 		/* Load the group descriptor. */
@@ -110,18 +111,17 @@ size_t ext2_alloc_blocks(struct file_system *fs, size_t count, uint32_t *ret) {
 			goto fail;
 		}
 
-		/* Iterate over this group's block usage bitmap. */
-		for (size_t j = 0; j < e2fs->sb->blocks_in_group; j++) {
-			if ((buf[j/8] & (1 << (j % 8))) == 0) {
-				buf[j/8] |= (1 << (j % 8));
-
-				*ret = i * e2fs->sb->blocks_in_group + j;  /* Set the block address.*/
-				ret++;
-				count--;
-				if (count == 0) {
-					break;
-				}
-			}
+		/* Take free blocks from this group's block usage bitmap. */
+		bitmap_init(&map, buf, NULL, e2fs->sb->blocks_in_group);
+
+		int64_t j = bitmap_find_zero(&map, 0);
+		while ((j >= 0) && (count > 0)) {
+			bitmap_set(&map, j);
+
+			*ret = i * e2fs->sb->blocks_in_group + j;  /* Set the block address.*/
+			ret++;
+			count--;
+			j = bitmap_find_zero(&map, j + 1);
 		}
 		ext2_write_blocks(fs, buf, gdes.block_bitmap_addr, to_read);
 		if (count == 0) {
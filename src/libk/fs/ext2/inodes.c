@@ -1,5 +1,6 @@
 #include <err.h>
 #include <mem.h>
+#include <bitmap.h>
 #include <string.h>
 #include <disk/disk.h>
 #include <fs/fs.h>
@@ -121,10 +122,12 @@ size_t ext2_alloc_inode(struct file_system *fs) {
 	size_t to_read = e2fs->sb->inodes_in_group / e2fs->block_size / 8;
 	to_read += !!(e2fs->sb->inodes_in_group % e2fs->block_size);
 
-	uint8_t *buf = kmalloc(to_read * e2fs->block_size);
+	uint64_t *buf = kmalloc(to_read * e2fs->block_size);
+	struct bitmap map;
 
 	for (size_t i = 0; i < e2fs->group_count; i++) {
 		if (ext2_load_group_des(fs, &gdes, i)) {
+			kfree(buf);
 			return 0;
 		};
 
@@ -139,13 +142,15 @@ size_t ext2_alloc_inode(struct file_system *fs) {
 			return 0;
 		}
 
-		/* Iterate over the inode usage bitmap. */
-		for (size_t j = 0; j < e2fs->sb->inodes_in_group; j++) {
-			if ((buf[j/8] & (1 << (j%8))) == 0) {
-				buf[j/8] |= (1 << (j%8));
-				ext2_write_blocks(fs, buf, gdes.inode_bitmap_addr, to_read);
-				return i * e2fs->sb->inodes_in_group + j;
-			}
+		/* Take the first free inode in the inode usage bitmap. */
+		bitmap_init(&map, buf, NULL, e2fs->sb->inodes_in_group);
+
+		int64_t j = bitmap_find_zero(&map, 0);
+		if (j >= 0) {
+			bitmap_set(&map, j);
+			ext2_write_blocks(fs, buf, gdes.inode_bitmap_addr, to_read);
+			kfree(buf);
+			return i * e2fs->sb->inodes_in_group + j;
 		}
 	}
 	kfree(buf);
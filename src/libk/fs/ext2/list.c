@@ -4,9 +4,10 @@
 #include <fs/fs.h>
 
 
-struct file_tnode *ext2_list_files(struct file_system *fs, size_t inode, size_t *count) {
+struct file_tnode *ext2_list_files(struct file_system *fs, size_t inode, size_t *count, struct arena *arena) {
 	if (fs == NULL) { return NULL; }
 	if (inode < 2)  { return NULL; }
+	if (arena == NULL) { return NULL; }
 
 	struct ext2_fs *e2fs = fs->special;
 	if (e2fs == NULL) { return NULL;}
@@ -54,16 +55,21 @@ struct file_tnode *ext2_list_files(struct file_system *fs, size_t inode, size_t
 
 			/* If the entry isn't for a directory, add the file to the list. */
 			if (entry->type != 2) {
+				struct file_tnode *t = arena_alloc(arena, sizeof(*t));
+				char *name = arena_alloc(arena, entry->name_len + 1);
+				if ((t == NULL) || (name == NULL)) {
+					goto done;
+				}
 				if (first_tnode == NULL){
-					first_tnode = kmalloc(sizeof(struct file_tnode));
-					last_tnode = first_tnode;
+					first_tnode = t;
 				} else {
-					last_tnode->next = kmalloc(sizeof(struct file_tnode));
-					last_tnode = last_tnode->next;
+					last_tnode->next = t;
 				}
+				last_tnode = t;
 
-				last_tnode->file_name = kmalloc(strlen(&entry->nm) + 1);
-				memcpy(last_tnode->file_name, &entry->nm, strlen(&entry->nm) + 1);
+				last_tnode->file_name = name;
+				memcpy(last_tnode->file_name, &entry->nm, entry->name_len);
+				last_tnode->file_name[entry->name_len] = '\0';
 				last_tnode->vnode = NULL;
 				last_tnode->next = NULL;
 				*count += 1;
@@ -86,9 +92,10 @@ done:
 }
 
 
-struct folder_tnode *ext2_list_folders(struct file_system *fs, size_t inode, size_t *count) {
+struct folder_tnode *ext2_list_folders(struct file_system *fs, size_t inode, size_t *count, struct arena *arena) {
 	if (fs == NULL) { return NULL; }
 	if (inode < 2)  { return NULL; }
+	if (arena == NULL) { return NULL; }
 
 	struct ext2_fs *e2fs = fs->special;
 	if (e2fs == NULL) { return NULL;}
@@ -132,15 +139,19 @@ struct folder_tnode *ext2_list_folders(struct file_system *fs, size_t inode, siz
 
 			/* If the entry is for a directory, add the folder to the list. */
 			if (entry->type == 2) {
+				struct folder_tnode *t = arena_alloc(arena, sizeof(*t));
+				char *name = arena_alloc(arena, entry->name_len + 1);
+				if ((t == NULL) || (name == NULL)) {
+					goto done;
+				}
 				if (first_tnode == NULL){
-					first_tnode = kmalloc(sizeof(struct file_tnode));
-					last_tnode = first_tnode;
+					first_tnode = t;
 				} else {
-					last_tnode->next = kmalloc(sizeof(struct file_tnode));
-					last_tnode = last_tnode->next;
+					last_tnode->next = t;
 				}
+				last_tnode = t;
 
-				last_tnode->folder_name = kmalloc(entry->name_len + 1);
+				last_tnode->folder_name = name;
 				memcpy(last_tnode->folder_name, &entry->nm, entry->name_len);
 				last_tnode->folder_name[entry->name_len] = '\0';
 				last_tnode->vnode = NULL;
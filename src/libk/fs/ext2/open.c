@@ -6,10 +6,12 @@
 #include <mem.h>
 
 
-struct ext2_dir_entry *ext2_search_dir(struct file_system *fs, struct ext2_inode *dir_node, char *file_name) {
+/* The returned entry, as well as the block buffer, are allocated from the arena. */
+struct ext2_dir_entry *ext2_search_dir(struct file_system *fs, struct ext2_inode *dir_node, char *file_name, struct arena *arena) {
 	if (fs == NULL)       { return NULL; }
 	if (dir_node == NULL) { return NULL; }
 	if (file_name == NULL) { return NULL; }
+	if (arena == NULL)    { return NULL; }
 	if (!(dir_node->type_perm & 0x4000)) {
 		/* If the node isn't a directory. */
 		return NULL;
@@ -18,7 +20,8 @@ struct ext2_dir_entry *ext2_search_dir(struct file_system *fs, struct ext2_inode
 	struct ext2_fs *e2fs = fs->special;
 
 	/* We'll iterate through every block of the directory. */
-	uint8_t *dir = kmalloc(e2fs->block_size);
+	uint8_t *dir = arena_alloc(arena, e2fs->block_size);
+	if (dir == NULL) { return NULL; }
 	struct ext2_dir_entry *entry;
 	struct ext2_dir_entry *ret;
 	size_t block = 0; /* Current block within the directory. */
@@ -27,18 +30,18 @@ struct ext2_dir_entry *ext2_search_dir(struct file_system *fs, struct ext2_inode
 	while (1) {
 		block_addr = ext2_block_in_inode(fs, dir_node, block);
 		if (block_addr == 0) {
-			goto fail;
+			return NULL;
 		}
 
 		if (ext2_load_blocks(fs, dir, block_addr, 1)) {
-			goto fail;
+			return NULL;
 		}
 
 		size_t i = 0;
 		while (1) {
 			entry = (void*)(dir + i);
 			if (entry->size > e2fs->block_size) {
-				goto fail;
+				return NULL;
 			}
 
 			char buf[entry->name_len + 1];
@@ -46,7 +49,11 @@ struct ext2_dir_entry *ext2_search_dir(struct file_system *fs, struct ext2_inode
 			buf[entry->name_len] = '\0';
 
 			if (!strcmp(buf, file_name)) {
-				goto success;
+				ret = arena_alloc(arena, sizeof(*ret));
+				if (ret != NULL) {
+					memcpy(ret, entry, sizeof(*ret));
+				}
+				return ret;
 			}
 
 			i += entry->size;
@@ -58,15 +65,6 @@ struct ext2_dir_entry *ext2_search_dir(struct file_system *fs, struct ext2_inode
 
 		block++;
 	}
-
-fail:
-	kfree(dir);
-	return NULL;
-success:
-	ret = kmalloc(sizeof(*ret));
-	memcpy(ret, entry, sizeof(*ret));
-	kfree(dir);
-	return ret;
 }
 
 
@@ -80,42 +78,41 @@ size_t ext2_open_at(struct file_system *fs, size_t folder_inode, char *full_path
 		return folder_inode;
 	}
 
-	char **arr = fs_parse_path(full_path);
-	if (arr == NULL) { return 0; }
+	/* Everything the lookup allocates goes into this, and is freed at once. */
+	struct arena arena;
+	arena_init(&arena);
 
-	struct ext2_inode *node = kmalloc(sizeof(*node));
+	char **arr = fs_parse_path(full_path, &arena);
+	struct ext2_inode *node = arena_alloc(&arena, sizeof(*node));
+	if ((arr == NULL) || (node == NULL)) {
+		arena_reset(&arena);
+		return 0;
+	}
 	ext2_load_inode(fs, node, folder_inode);  /* Load the root inode. */
 
 	struct ext2_dir_entry *entry;
 	size_t i = 0;
-
-	/* We'll need to return this after the loop - we can't do that without an
-	 * extra variable because we'll have kfree()'d entry already.
-	 */
 	size_t inode_num = folder_inode;
 
 	while (arr[i] != NULL) {
-		entry = ext2_search_dir(fs, node, arr[i]);
+		entry = ext2_search_dir(fs, node, arr[i], &arena);
 		if (entry == NULL) {
-			kfree(node);
-			fs_free_path(arr);
+			arena_reset(&arena);
 			return 0;
 		}
 
 		inode_num = entry->inode;
-		kfree(entry);
 
 		/* Load the next directory. */
 		if (ext2_load_inode(fs, node, inode_num)) {
-			kfree(node);
-			fs_free_path(arr);
+			arena_reset(&arena);
 			return 0;
 		}
 
 		i++;
 	}
 
-	kfree(node);
+	arena_reset(&arena);
 	return inode_num;
 }
 
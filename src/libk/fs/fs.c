@@ -133,14 +133,14 @@ uint8_t register_fs(struct drive *d) {
 	new_fs->root_node->vnode->fs = new_fs;
 	new_fs->root_node->vnode->mounted = 0;
 	new_fs->root_node->vnode->mount_point = NULL;
-	new_fs->root_node->vnode->mutex = create_semaphore(1);
+	new_fs->root_node->vnode->lock = create_rwsem();
 	new_fs->root_node->vnode->type_perm = new_fs->driver->get_type_perm(new_fs, new_fs->root_node->vnode->inode_num);
 	new_fs->root_node->vnode->link_count = new_fs->driver->get_links(new_fs, new_fs->root_node->vnode->inode_num);
 	new_fs->root_node->vnode->cached_links = 1;
 	/* Also get uids and stuff here.*/
 
 	if (vfs_dir_load_list(new_fs->root_node->vnode)) {
-		kfree(new_fs->root_node->vnode->mutex);
+		kfree(new_fs->root_node->vnode->lock);
 		kfree(new_fs->root_node->vnode);
 		return ERR_DISK;
 	}
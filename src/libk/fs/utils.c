@@ -35,9 +35,10 @@ size_t get_step_count(char *str, char sep) {
 	if (str == NULL) { return 0; }
 
 	size_t steps = 1;
+	char *start = str;
 
 	while (*str) {
-		if ((*str == sep) && (*(str - 1) != sep) && (*(str + 1) != '\0')) {
+		if ((*str == sep) && (str != start) && (*(str - 1) != sep) && (*(str + 1) != '\0')) {
 			steps++;
 		}
 		str++;
@@ -47,39 +48,38 @@ size_t get_step_count(char *str, char sep) {
 }
 
 
-char **fs_parse_path(char *path) {
-	/* The caller is responsible for calling fs_free_path() after this. */
+char **fs_parse_path(char *path, struct arena *arena) {
+	/* Everything is allocated from the arena, and goes away with arena_reset(). */
+	if (path == NULL)  { return NULL; }
+	if (arena == NULL) { return NULL; }
 
 	size_t steps = get_step_count(path, '/');
-	char **arr = kmalloc((steps + 1) * sizeof(char*));
-
-	for (size_t i = 0; i < (steps + 1); i++) {
-		/* Allocate a string, and write the next step to it. */
-		char *str = kmalloc(0x100);
-		if (get_step(str, &path, '/', 0x100) == ERR_NO_RESULT) {
-			/* get_step() returns ERR_NO_RESULT at the end of the string. */
-			arr[i] = NULL;
+	char **arr = arena_alloc(arena, (steps + 1) * sizeof(char*));
+	if (arr == NULL) { return NULL; }
+
+	size_t i = 0;
+	while (i < steps) {
+		/* Find out how long the next step is, so the string fits exactly. */
+		char *start = path;
+		while (*start == '/') {
+			start++;
+		}
+		if (*start == '\0') {
+			/* No more steps. A leading '/' counts as one in get_step_count(),
+			 * so this is where "/" and "/bin/sh" end up. */
 			break;
 		}
-		arr[i] = str;
-	}
-
-	return arr;
-}
-
-void fs_free_path(char **arr) {
-	if (arr == NULL) {
-		return;
-	}
+		size_t len = 0;
+		while ((start[len] != '\0') && (start[len] != '/')) {
+			len++;
+		}
 
-	/* First, free all the allocated strings. */
-	char **i = arr;
-	while (*i != NULL) {
-		kfree(*i);
-		i += 1;
+		char *str = arena_alloc(arena, len + 1);
+		if (str == NULL) { return NULL; }
+		get_step(str, &path, '/', len);
+		arr[i++] = str;
 	}
+	arr[i] = NULL;
 
-	/* Free the array that keeps the strings. */
-	kfree(arr);
-	return;
+	return arr;
 }
@@ -6,21 +6,24 @@
 int32_t vfs_close_file(struct task *t, struct file_descriptor *fd) {
 	if (fd == NULL)     { return -ERR_INVALID_PARAM; }
 	if (t == NULL)      { return -ERR_INVALID_PARAM; }
+	t = task_leader(t);
 	if (t->fds == NULL) { return -ERR_INVALID_PARAM; }
 
-	struct file_descriptor *i = t->fds;
+	uint64_t flags = spin_lock_irqsave(&t->fd_lock);
+	struct file_descriptor **i = &t->fds;
 
-	while ((i != NULL) && (i->next != fd)) {
-		i = i->next;
+	while ((*i != NULL) && (*i != fd)) {
+		i = &(*i)->next;
 	}
 
-	if (i == NULL) {
+	if (*i == NULL) {
 		/* The file descriptor was not found. */
+		spin_unlock_irqrestore(&t->fd_lock, flags);
 		return -ERR_INVALID_PARAM;
 	}
 
-	/* i points to the element before fd. */
-	i->next = i->next->next; /* Unlink fd. */
+	*i = fd->next; /* Unlink fd. */
+	spin_unlock_irqrestore(&t->fd_lock, flags);
 
 	/* Decrease stream count, and unload the node if that leaves it unused. */
 	if (fd->file) {
@@ -63,3 +66,22 @@ int32_t kclose(int32_t fd) {
 
 	return GENERIC_SUCCESS;
 }
+
+void vfs_close_all(struct task *t) {
+	/* Closes every file descriptor of t's process, once all of its tasks are
+	 * gone (see the terminator). */
+	t = task_leader(t);
+	struct file_descriptor *fdes;
+	while ((fdes = t->fds) != NULL) {
+		int32_t err;
+		if (fdes->file) {
+			struct file_vnode *fnode = fdes->node;
+			err = fnode->close(t, fdes);
+		} else {
+			err = vfs_close_file(t, fdes);
+		}
+		if (err) {
+			break;
+		}
+	}
+}
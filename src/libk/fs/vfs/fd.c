@@ -4,9 +4,14 @@
 #include <mem.h>
 #include <err.h>
 
+/* The file descriptors of a process are on its leader's list, which all of its
+ * threads share (see create_thread()). */
+
 struct file_descriptor *vfs_find_fd(struct task *t, int32_t fd) {
 	if (t == NULL)       { return NULL; }
 
+	t = task_leader(t);
+	uint64_t flags = spin_lock_irqsave(&t->fd_lock);
 	struct file_descriptor *i = t->fds;
 	while (i) {
 		if (i->fd == fd) {
@@ -15,6 +20,7 @@ struct file_descriptor *vfs_find_fd(struct task *t, int32_t fd) {
 
 		i = i->next;
 	};
+	spin_unlock_irqrestore(&t->fd_lock, flags);
 
 	return i;
 }
@@ -39,8 +45,9 @@ struct file_descriptor *vfs_create_fd(struct task *t, void *node, size_t file, s
 		n->streams_open++;
 	}
 
-	/* We're modifying task structures, therefore it is appropriate to do this. */
-	lock_scheduler();
+	/* Only the list needs guarding, not the scheduler. */
+	t = task_leader(t);
+	uint64_t flags = spin_lock_irqsave(&t->fd_lock);
 
 	/* Assign fd, then add new_fd to t's fds list. */
 	struct file_descriptor *fdi = t->fds;
@@ -49,7 +56,7 @@ struct file_descriptor *vfs_create_fd(struct task *t, void *node, size_t file, s
 		t->fds = new_fd;
 		t->fds->fd = i;
 
-		unlock_scheduler();
+		spin_unlock_irqrestore(&t->fd_lock, flags);
 		return new_fd;
 	}
 
@@ -68,7 +75,7 @@ struct file_descriptor *vfs_create_fd(struct task *t, void *node, size_t file, s
 	fdi->next = new_fd;
 	new_fd->fd = i;
 
-	unlock_scheduler();
+	spin_unlock_irqrestore(&t->fd_lock, flags);
 	return new_fd;
 }
 
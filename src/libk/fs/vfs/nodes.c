@@ -18,7 +18,7 @@ struct folder_tnode *vfs_search_dd(struct folder_vnode *node, char *name) {
 	if (node->mounted){
 		node = node->mount_point->vnode;
 	}
-	acquire_semaphore(node->mutex);
+	acquire_rwsem_read(node->lock);
 
 	struct folder_tnode *i = node->subfolders;
 	while (i != NULL) {
@@ -29,7 +29,7 @@ struct folder_tnode *vfs_search_dd(struct folder_vnode *node, char *name) {
 		i = i->next;
 	}
 
-	release_semaphore(node->mutex);
+	release_rwsem_read(node->lock);
 	return i;
 }
 
@@ -38,7 +38,7 @@ struct file_tnode *vfs_search_df(struct folder_vnode *node, char *name) {
 	if (node->mounted){
 		node = node->mount_point->vnode;
 	}
-	acquire_semaphore(node->mutex);
+	acquire_rwsem_read(node->lock);
 
 	struct file_tnode *i = node->subfiles;
 	while (i != NULL) {
@@ -49,44 +49,40 @@ struct file_tnode *vfs_search_df(struct folder_vnode *node, char *name) {
 		i = i->next;
 	}
 
-	release_semaphore(node->mutex);
+	release_rwsem_read(node->lock);
 	return i;
 }
 
-/* Load/free the list of a folder's children. */
+/* Load/free the list of a folder's children. The tnodes live in the folder's
+ * list arena, so only the loaded vnodes have to be freed one by one.
+ */
 void free_dir_list(struct folder_vnode *vnode) {
-	if (vnode->subfiles != NULL) {
-		struct file_tnode *i = vnode->subfiles;
-		while (i) {
-			if (i->vnode) {
-				kfree(i->vnode->mutex);
-				kfree(i->vnode->read_queue);
-				kfree(i->vnode->write_queue);
-				kfree(i->vnode);
-			}
-			kfree(i);
-
-			i = i->next;
+	struct file_tnode *fi = vnode->subfiles;
+	while (fi) {
+		if (fi->vnode) {
+			kfree(fi->vnode->lock);
+			kfree(fi->vnode->read_queue);
+			kfree(fi->vnode->write_queue);
+			kfree(fi->vnode);
 		}
-		vnode->subfiles = NULL;
-		vnode->subfile_count = 0;
+		fi = fi->next;
 	}
-	if (vnode->subfolders != NULL) {
-		/* TODO: free the folder tnodes here. */
-		struct folder_tnode *i = vnode->subfolders;
-		while (i) {
-			if (i->vnode) {
-				free_dir_list(i->vnode);
-				kfree(i->vnode->mutex);
-				kfree(i->vnode);
-			}
-			kfree(i);
 
-			i = i->next;
+	struct folder_tnode *di = vnode->subfolders;
+	while (di) {
+		if (di->vnode) {
+			free_dir_list(di->vnode);
+			kfree(di->vnode->lock);
+			kfree(di->vnode);
 		}
-		vnode->subfiles = NULL;
-		vnode->subfile_count = 0;
+		di = di->next;
 	}
+
+	arena_reset(&vnode->list_arena);
+	vnode->subfiles = NULL;
+	vnode->subfile_count = 0;
+	vnode->subfolders = NULL;
+	vnode->subfolder_count = 0;
 }
 
 size_t vfs_dir_load_list(struct folder_vnode *vnode) {
@@ -95,8 +91,8 @@ size_t vfs_dir_load_list(struct folder_vnode *vnode) {
 	free_dir_list(vnode);
 
 	/* Get directory listings (only tnodes). */
-	vnode->subfiles = vnode->fs->driver->list_files(vnode->fs, vnode->inode_num, &vnode->subfile_count);
-	vnode->subfolders = vnode->fs->driver->list_folders(vnode->fs, vnode->inode_num, &vnode->subfolder_count);
+	vnode->subfiles = vnode->fs->driver->list_files(vnode->fs, vnode->inode_num, &vnode->subfile_count, &vnode->list_arena);
+	vnode->subfolders = vnode->fs->driver->list_folders(vnode->fs, vnode->inode_num, &vnode->subfolder_count, &vnode->list_arena);
 
 	return GENERIC_SUCCESS;
 }
@@ -109,8 +105,8 @@ size_t vfs_dir_load_list(struct folder_vnode *vnode) {
  * are always loaded along with it. This helps us search for files/folders
  * faster.
  *
- * These two functions assume that the caller has acquired the semaphore of the
- * parent directory.
+ * These two functions assume that the caller holds the lock of the parent
+ * directory exclusively.
  */
 struct folder_vnode *vfs_load_folder_at(struct folder_vnode *parent, struct folder_tnode *tnode) {
 
@@ -142,7 +138,7 @@ struct folder_vnode *vfs_load_folder_at(struct folder_vnode *parent, struct fold
 	tnode->vnode->fs = parent->fs;
 	tnode->vnode->mounted = 0;
 	tnode->vnode->mount_point = NULL;
-	tnode->vnode->mutex = create_semaphore(1);
+	tnode->vnode->lock = create_rwsem();
 
 	/* Load some attributes from the node for easy use.
 	 * NOTE: Currently the functions used here all load the inode *every* time
@@ -153,7 +149,8 @@ struct folder_vnode *vfs_load_folder_at(struct folder_vnode *parent, struct fold
 	tnode->vnode->link_count = tnode->vnode->fs->driver->get_links(tnode->vnode->fs, inode);
 
 	if (vfs_dir_load_list(tnode->vnode)) {
-		kfree(tnode->vnode->mutex);
+		free_dir_list(tnode->vnode);
+		kfree(tnode->vnode->lock);
 		kfree(tnode->vnode);
 		return NULL;
 	}
@@ -201,8 +198,8 @@ struct file_vnode *vfs_load_file_at(struct folder_vnode *parent, struct file_tno
 	tnode->vnode->write = vfs_write_file;
 	tnode->vnode->close = vfs_close_file;
 
-	/* The mutex and the queues. */
-	tnode->vnode->mutex = create_semaphore(1);
+	/* The lock and the queues. */
+	tnode->vnode->lock = create_rwsem();
 	tnode->vnode->read_queue = kmalloc(sizeof(QUEUE));
 	memset(tnode->vnode->read_queue, 0, sizeof(QUEUE));
 	tnode->vnode->write_queue = kmalloc(sizeof(QUEUE));
@@ -221,13 +218,19 @@ void *vfs_search_vnode(char *path, int64_t *file) {
 	 */
 	if (root_tnode == NULL) { return NULL; } /* The vfs hasn't been initialised yet. */
 
-	char **arr = fs_parse_path(path);
+	struct arena arena;
+	arena_init(&arena);
+	char **arr = fs_parse_path(path, &arena);
+	if (arr == NULL) {
+		arena_reset(&arena);
+		return NULL;
+	}
 
 	/* Take the current working directory into account. */
 	struct folder_vnode *cur_dir = root_tnode->vnode;
 
-	if ((path[0] != '/') && (get_current_task()->current_dir != NULL)) {
-		cur_dir = get_current_task()->current_dir;
+	if ((path[0] != '/') && (task_leader(get_current_task())->current_dir != NULL)) {
+		cur_dir = task_leader(get_current_task())->current_dir;
 	}
 
 	if (cur_dir->mounted) {
@@ -237,14 +240,14 @@ void *vfs_search_vnode(char *path, int64_t *file) {
 	size_t depth = 0;
 
 	if (cur_dir == NULL) {
-		fs_free_path(arr);
+		arena_reset(&arena);
 		return NULL;
 	}
 
 	/* Return the root node if the parameter's empty and/or consists of a slash.*/
 	if (arr[0] == NULL) {
 		*file = 0;
-		fs_free_path(arr);
+		arena_reset(&arena);
 		return cur_dir;
 	}
 
@@ -253,21 +256,22 @@ void *vfs_search_vnode(char *path, int64_t *file) {
 
 		if (t == NULL) {
 			/* The node does not exist. */
-			fs_free_path(arr);
+			arena_reset(&arena);
 			return NULL;
 		}
 
 		if (t->vnode == NULL) {
-			/* The vnode exists, but hasn't been loaded yet. Load it. */
-			acquire_semaphore(par_dir->mutex);
+			/* The vnode exists, but hasn't been loaded yet. Load it, unless
+			 * someone else did while we waited for the lock. */
+			acquire_rwsem_write(par_dir->lock);
 
-			if (vfs_load_folder_at(par_dir, t) == NULL) {
-				release_semaphore(par_dir->mutex);
-				fs_free_path(arr);
+			if ((t->vnode == NULL) && (vfs_load_folder_at(par_dir, t) == NULL)) {
+				release_rwsem_write(par_dir->lock);
+				arena_reset(&arena);
 				return NULL;
 			}
 
-			release_semaphore(par_dir->mutex);
+			release_rwsem_write(par_dir->lock);
 		}
 		cur_dir = t->vnode;
 
@@ -282,7 +286,7 @@ void *vfs_search_vnode(char *path, int64_t *file) {
 		tnode = (void*)vfs_search_dd(cur_dir, arr[depth]);
 		if (tnode == NULL) {
 			/* Doesn't exist. */
-			fs_free_path(arr);
+			arena_reset(&arena);
 			return NULL;
 		}
 		/* is a directory. */
@@ -290,22 +294,24 @@ void *vfs_search_vnode(char *path, int64_t *file) {
 	}
 	if (tnode->vnode == NULL) {
 		/* It exists, but hasn't been loaded yet. */
-		acquire_semaphore(cur_dir->mutex);
-		if (*file) {
+		acquire_rwsem_write(cur_dir->lock);
+		if (tnode->vnode != NULL) {
+			/* Someone else loaded it in the meantime. */
+		} else if (*file) {
 			vfs_load_file_at(cur_dir, tnode);
 		} else {
 			vfs_load_folder_at(cur_dir, (void*)tnode);
 		}
-		release_semaphore(cur_dir->mutex);
+		release_rwsem_write(cur_dir->lock);
 	}
-	fs_free_path(arr);
+	arena_reset(&arena);
 	return tnode->vnode;
 }
 
 size_t vfs_unload_fnode(struct file_vnode *f) {
 	if (f == NULL) { return ERR_INVALID_PARAM; }
 
-	destroy_semaphore(f->mutex);
+	destroy_rwsem(f->lock);
 	destroy_queue(f->read_queue);
 	destroy_queue(f->write_queue);
 
@@ -321,7 +327,7 @@ size_t vfs_unload_fnode(struct file_vnode *f) {
 size_t vfs_unload_dnode(struct folder_vnode *f) {
 	if (f == NULL) { return ERR_INVALID_PARAM; }
 
-	destroy_semaphore(f->mutex);
+	destroy_rwsem(f->lock);
 	free_dir_list(f);
 	kfree(f);
 
@@ -332,7 +338,13 @@ struct file_vnode *mknode_file(char *path) {
 	/* Firstly, we need to go through the path because we need the vnode of the
 	 * file's parent.
 	 */
-	char **arr = fs_parse_path(path);
+	struct arena arena;
+	arena_init(&arena);
+	char **arr = fs_parse_path(path, &arena);
+	if (arr == NULL) {
+		arena_reset(&arena);
+		return NULL;
+	}
 	struct folder_tnode *cur_dir = root_tnode;
 	if (root_tnode->vnode->mounted) {
 		cur_dir = root_tnode->vnode->mount_point;
@@ -341,7 +353,7 @@ struct file_vnode *mknode_file(char *path) {
 	size_t depth = 0;
 
 	if (arr[0] == NULL) {
-		fs_free_path(arr);
+		arena_reset(&arena);
 		return NULL;
 	}
 
@@ -349,14 +361,14 @@ struct file_vnode *mknode_file(char *path) {
 		cur_dir = vfs_search_dd(par_dir->vnode, arr[depth]);
 
 		if (cur_dir == NULL) {
-			fs_free_path(arr);
+			arena_reset(&arena);
 			return NULL;
 		}
 
 		if (cur_dir->vnode == NULL) {
 			/* The vnode hasn't been loaded yet. Load it. */
 			if (vfs_load_folder_at(par_dir->vnode, cur_dir) == NULL) {
-				fs_free_path(arr);
+				arena_reset(&arena);
 				return NULL;
 			}
 		}
@@ -369,6 +381,7 @@ struct file_vnode *mknode_file(char *path) {
 	struct file_tnode *ret = vfs_search_df(par_dir->vnode, arr[depth]);
 	if (ret != NULL) {
 		/* If it exists, just return. */
+		arena_reset(&arena);
 		return ret->vnode;    /* Might change to return NULL later. */
 	}
 
@@ -379,8 +392,8 @@ struct file_vnode *mknode_file(char *path) {
 
 	ret->vnode = kmalloc(sizeof(struct file_vnode));
 
-	/* Allocate the mutex and the queues. */
-	ret->vnode->mutex = create_semaphore(1);
+	/* Allocate the lock and the queues. */
+	ret->vnode->lock = create_rwsem();
 	ret->vnode->read_queue = kmalloc(sizeof(QUEUE));
 	memset(ret->vnode->read_queue, 0, sizeof(QUEUE));
 	ret->vnode->write_queue = kmalloc(sizeof(QUEUE));
@@ -399,6 +412,7 @@ struct file_vnode *mknode_file(char *path) {
 	ret->vnode->read = vfs_read_file;
 	ret->vnode->write = vfs_write_file;
 
+	arena_reset(&arena);
 	vfs_dir_load_list(par_dir->vnode);
 
 	return ret->vnode;
@@ -410,10 +424,10 @@ size_t vfs_mount_fs(struct file_system *fs, struct folder_vnode *node) {
 		return ERR_INCOMPAT_PARAM; /* come up with a better error type. */
 	}
 
-	acquire_semaphore(node->mutex);
+	acquire_rwsem_write(node->lock);
 	node->mounted = 1;
 	node->mount_point = fs->root_node;
-	release_semaphore(node->mutex);
+	release_rwsem_write(node->lock);
 	return GENERIC_SUCCESS;
 }
 
@@ -432,7 +446,7 @@ size_t init_vfs(struct file_system *root) {
 	}
 
 	memset(root_tnode->vnode, 0, sizeof(*root_tnode->vnode));
-	root_tnode->vnode->mutex = create_semaphore(1);
+	root_tnode->vnode->lock = create_rwsem();
 
 	return vfs_mount_fs(root, root_tnode->vnode);
 }
@@ -7,13 +7,14 @@ int32_t vfs_open_file(struct file_vnode *node, struct task *t, size_t mode) {
 	if (node == NULL) { return -ERR_INVALID_PARAM; }
 	if (t == NULL)    { return -ERR_INVALID_PARAM; }
 
-	acquire_semaphore(node->mutex);
+	acquire_rwsem_write(node->lock);
 	struct file_descriptor *fdes = vfs_create_fd(t, node, 1, mode);
 	if (fdes == NULL) {
+		release_rwsem_write(node->lock);
 		return -1;
 	}
 
-	release_semaphore(node->mutex);
+	release_rwsem_write(node->lock);
 	return fdes->fd;
 }
 
@@ -22,12 +23,13 @@ int32_t vfs_open_dir(struct folder_vnode *node, struct task *t, size_t mode) {
 	if (t == NULL) { return -ERR_INVALID_PARAM; }
 	if (mode != FD_READ) { return -ERR_INVALID_PARAM; }
 
-	acquire_semaphore(node->mutex);
+	acquire_rwsem_write(node->lock);
 	struct file_descriptor *fdes = vfs_create_fd(t, node, 0, mode);
 	if (fdes == NULL) {
+		release_rwsem_write(node->lock);
 		return -1;
 	}
-	release_semaphore(node->mutex);
+	release_rwsem_write(node->lock);
 	return fdes->fd;
 }
 
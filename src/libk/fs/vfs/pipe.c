@@ -18,7 +18,7 @@ int32_t kpipeu(struct task *t, int32_t ret[]) {
 	pipe_vnode->type_perm = 0x1000;
 	// TODO: Set owner uid and gid to that of the task.
 
-	pipe_vnode->mutex = create_semaphore(1);
+	pipe_vnode->lock = create_rwsem();
 
 	pipe_vnode->read_queue = kmalloc(sizeof(QUEUE));
 	memset(pipe_vnode->read_queue, 0, sizeof(QUEUE));
@@ -36,7 +36,7 @@ int32_t kpipeu(struct task *t, int32_t ret[]) {
 	ret[1] = pipe_vnode->open(pipe_vnode, t, FD_WRITE);
 
 	if ((ret[0] < 0) || (ret[1] < 0)) {
-		kfree(pipe_vnode->mutex);
+		kfree(pipe_vnode->lock);
 		kfree(pipe_vnode->read_queue);
 		kfree(pipe_vnode->write_queue);
 		kfree(pipe_vnode);
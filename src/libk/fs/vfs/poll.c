@@ -0,0 +1,124 @@
+#include <fs/fs.h>
+#include <task.h>
+#include <timer.h>
+#include <string.h>
+#include <mem.h>
+#include <err.h>
+
+/* Waiting on several descriptors at once. kpoll() puts the task on the queue
+ * of every descriptor that isn't ready yet (as a poller, see queue.c), then
+ * sleeps until any of them is signaled, and looks again. Regular files and
+ * directories are always ready, only pipes (and the keyboard) make it wait.
+ */
+
+static int16_t fd_events(struct file_descriptor *fdes, QUEUE **q) {
+	/* Returns what fdes is ready for right now, and the queue that is
+	 * signaled when that changes in q (or NULL). The pipe's size is read
+	 * without its lock, kpoll() looks again after every signal. */
+	*q = NULL;
+	if (fdes->file == FILE_DIR) {
+		return POLLIN;
+	}
+
+	struct file_vnode *node = fdes->node;
+	if (fdes->mode == FD_READ) {
+		if (node->read != vfs_read_pipe) {
+			return POLLIN;
+		}
+		*q = node->read_queue;
+		return (node->size > 0) ? POLLIN : 0;
+	}
+
+	if (node->write != vfs_write_pipe) {
+		return POLLOUT;
+	}
+	*q = node->write_queue;
+	return (node->size < DEFAULT_PIPE_SIZE) ? POLLOUT : 0;
+}
+
+int64_t kpoll(struct pollfd *fds, size_t nfds, int64_t timeout_ns) {
+	/* Waits until one of fds is ready for what its events ask for, or for at
+	 * most timeout_ns nanoseconds. A timeout of 0 doesn't wait, a negative one
+	 * waits forever. Fills in every revents, and returns how many are
+	 * non-zero (0 after a timeout). */
+	if ((fds == NULL) && (nfds != 0)) { return -ERR_INVALID_PARAM; }
+	if (nfds > POLL_MAX)              { return -ERR_INVALID_PARAM; }
+
+	struct task *t = get_current_task();
+	struct poll_entry *entries = NULL;
+	if ((timeout_ns != 0) && (nfds != 0)) {
+		entries = kmalloc(nfds * sizeof(*entries));
+		if (entries == NULL) {
+			return -ERR_OUT_OF_MEM;
+		}
+		memset(entries, 0, nfds * sizeof(*entries));
+	}
+	uint64_t expires = (timeout_ns > 0) ? timer_ticks() + ns_to_ticks(timeout_ns) : 0;
+
+	int64_t ready = 0;
+	uint8_t registered = 0;
+	while (1) {
+		/* Anything signaled from here on wakes us up again. */
+		t->poll_woken = 0;
+		__asm__ volatile ("mfence" : : : "memory");
+
+		ready = 0;
+		for (size_t i = 0; i < nfds; i++) {
+			fds[i].revents = 0;
+			struct file_descriptor *fdes = vfs_find_fd(t, fds[i].fd);
+			if ((fdes == NULL) || (fdes->node == NULL)) {
+				fds[i].revents = POLLNVAL;
+				ready++;
+				continue;
+			}
+
+			QUEUE *q;
+			fds[i].revents = fd_events(fdes, &q) & fds[i].events;
+			if (fds[i].revents) {
+				ready++;
+			} else if ((entries != NULL) && !registered && (q != NULL)) {
+				entries[i].task = t;
+				if (queue_add_poller(q, &entries[i])) {
+					entries[i].q = NULL;
+				}
+			}
+		}
+		registered = 1;
+
+		if ((ready != 0) || (timeout_ns == 0)) {
+			break;
+		}
+		if ((timeout_ns > 0) && (timer_ticks() >= expires)) {
+			break;
+		}
+
+		/* The queues set poll_woken with the scheduler locked, so it can't
+		 * change between looking at it and blocking. */
+		uint8_t armed = 0;
+		lock_task_switches();
+		lock_scheduler();
+		if (!t->poll_woken) {
+			if (timeout_ns > 0) {
+				sleeper_arm(&t->sleeper, expires);
+				armed = 1;
+			} else {
+				block_task();
+			}
+		}
+		unlock_scheduler();
+		unlock_task_switches();
+		if (armed) {
+			sleeper_disarm(&t->sleeper);
+		}
+	}
+
+	if (entries != NULL) {
+		for (size_t i = 0; i < nfds; i++) {
+			if (entries[i].q != NULL) {
+				queue_remove_poller(entries[i].q, &entries[i]);
+			}
+		}
+		kfree(entries);
+	}
+	return ready;
+}
@@ -14,7 +14,7 @@ int64_t vfs_read_file(struct file_descriptor *fdes, void *buf, int64_t amount) {
 	}
 
 	struct file_vnode *node = fdes->node;
-	acquire_semaphore(node->mutex);
+	acquire_rwsem_read(node->lock);
 
 	/* Determine the exact amount we can read. */
 	int64_t to_read = amount;
@@ -23,14 +23,14 @@ int64_t vfs_read_file(struct file_descriptor *fdes, void *buf, int64_t amount) {
 	}
 
 	if (to_read == 0) {
-		release_semaphore(node->mutex);
+		release_rwsem_read(node->lock);
 		return -ERR_EOF;
 	}
 
 	/* Request the filesystem driver to read from disk. */
 	int64_t stat = node->fs->driver->read(node->fs, node->inode_num, buf, fdes->pos, to_read);
 
-	release_semaphore(node->mutex);
+	release_rwsem_read(node->lock);
 	if (stat > 0) {
 		fdes->pos += stat;
 	}
@@ -48,7 +48,7 @@ int64_t vfs_read_pipe(struct file_descriptor *fdes, void *buf, int64_t amount) {
 	}
 
 	struct file_vnode *node = fdes->node;
-	acquire_semaphore(node->mutex);
+	acquire_rwsem_write(node->lock);
 
 	int64_t ret = 0;
 	while (amount > 0) {
@@ -59,15 +59,22 @@ int64_t vfs_read_pipe(struct file_descriptor *fdes, void *buf, int64_t amount) {
 			/* There isn't enough data on the pipe yet. */
 			lock_task_switches();
 
-			wait_queue(node->read_queue);
-			release_semaphore(node->mutex);
-			signal_queue(node->write_queue);
+			uint8_t err = prepare_to_wait(node->read_queue);
+			release_rwsem_write(node->lock);
+			signal_queue_all(node->write_queue);
 
 			/* This causes block, and then unblock when the read queue is signalled
 			 * aka someone wrote to the pipe.
 			 */
 			unlock_task_switches();
-			acquire_semaphore(node->mutex);
+			if (err == GENERIC_SUCCESS) {
+				err = finish_wait(node->read_queue);
+			}
+			if (err == ERR_NOT_FOUND) {
+				/* The pipe is being destroyed. */
+				return ret;
+			}
+			acquire_rwsem_write(node->lock);
 			continue;
 		}
 
@@ -83,72 +90,44 @@ int64_t vfs_read_pipe(struct file_descriptor *fdes, void *buf, int64_t amount) {
 		ret += to_read;
 	}
 
-	signal_queue(node->write_queue);
-	release_semaphore(node->mutex);
+	signal_queue_all(node->write_queue);
+	release_rwsem_write(node->lock);
 	return ret;
 }
 
-int64_t vfs_read_dir(struct file_descriptor *fdes, void *buf, int64_t amount) {
-	if (fdes == NULL)       { return -ERR_INVALID_PARAM; }
-	if (buf == NULL)        { return -ERR_INVALID_PARAM; }
-	if (fdes->node == NULL) { return -ERR_INVALID_PARAM; }
-	if ((size_t)amount < sizeof(struct dirent)) { return -ERR_EOF; }
-
-	/* Returns <0 when EOF. Returns >0 when read is successful. 0 is undefined,
-	 * but it should be treated like an error.
-	 *
-	 * amount is the amount of memory reserved for this call. This is necessary
-	 * because the name field of the dirent struct has an undefined length, and
-	 * if a limit isn't defined then this call could end up overwriting important
-	 * data. Keep in mind that a partial read is treated the same way as a
-	 * complete one, so the only way to attempt a re-read is to use lseek() then
-	 * read again with more memory.
-	 */
-
-	/* Reads the next directory entry to buf.*/
-	struct folder_vnode *node = fdes->node;
-	if (node->mounted) {
-		node = node->mount_point->vnode;
-		if (node == NULL) {
-			return -ERR_INVALID_PARAM;
-		}
-	}
-	if (fdes->pos >= (node->subfolder_count + node->subfile_count)) { return -ERR_INVALID_PARAM; }
-	acquire_semaphore(node->mutex);
-
-	/* We'll be writing the information to the user's buffer. */
-	struct dirent *ptr = buf;
-
-	/* Find the node that corresponds to the current */
+static int64_t read_dirent(struct folder_vnode *node, struct file_descriptor *fdes, struct dirent *ptr, int64_t amount, uint8_t excl) {
+	/* Reads the next directory entry to ptr, with node's lock held. Loading
+	 * the entry's vnode changes the directory, so unless the lock is held
+	 * exclusively (excl), that returns 0 and leaves fdes alone. */
 	if (fdes->pos < node->subfolder_count) {
 		/* Return a folder's dirent. */
 		struct folder_tnode *ret_node = node->subfolders;
 		for (size_t i = 0; i < fdes->pos; i++) {
 			if (ret_node == NULL) {
-				release_semaphore(node->mutex);
 				return -ERR_INVALID_PARAM;
 			}
 			ret_node = ret_node->next;
 		}
-		fdes->pos++;
-
-		int64_t name_len = strlen(ret_node->folder_name) + 1;
 
 		/* The Vnode might not have been loaded yet. */
 		if (ret_node->vnode == NULL) {
+			if (!excl) {
+				return 0;
+			}
 			if (vfs_load_folder_at(node, ret_node) == NULL) {
-				release_semaphore(node->mutex);
+				fdes->pos++;
 				return -ERR_NO_RESULT;
 			}
 		}
+		fdes->pos++;
+
+		int64_t name_len = strlen(ret_node->folder_name) + 1;
 
 		ptr->inode = ret_node->vnode->inode_num;
 		ptr->type = ret_node->vnode->type_perm;
 		ptr->len = sizeof(*ptr) + name_len - 1;
 
 		memcpy(ptr->name, ret_node->folder_name, (name_len > amount) ? amount : name_len);
-
-		release_semaphore(node->mutex);
 		return ptr->len;
 	}
 
@@ -157,35 +136,77 @@ int64_t vfs_read_dir(struct file_descriptor *fdes, void *buf, int64_t amount) {
 
 	for (size_t i = 0; i < (fdes->pos - node->subfolder_count); i++) {
 		if (ret_node == NULL) {
-			release_semaphore(node->mutex);
 			return -ERR_INVALID_PARAM;
 		}
 		ret_node = ret_node->next;
 	}
-	fdes->pos++;
-
-	int64_t name_len = strlen(ret_node->file_name) + 1;
 
 	/* The Vnode might not have been loaded yet. */
 	if (ret_node->vnode == NULL) {
+		if (!excl) {
+			return 0;
+		}
 		if (vfs_load_file_at(node, ret_node) == NULL) {
-			release_semaphore(node->mutex);
+			fdes->pos++;
 			return -ERR_NO_RESULT;
 		}
 	}
+	fdes->pos++;
+
+	int64_t name_len = strlen(ret_node->file_name) + 1;
 
 	ptr->inode = ret_node->vnode->inode_num;
 	ptr->type = ret_node->vnode->type_perm;
 	ptr->len = sizeof(*ptr) + name_len - 1;
 	memcpy(ptr->name, ret_node->file_name, (name_len > amount) ? amount : name_len);
 
-	release_semaphore(node->mutex);
 	/* This part definitely generates a PF but halting here doesn't tell anything.
 	 * Perhaps it's best to single-step through it.
 	 */
 	return ptr->len;
 }
 
+int64_t vfs_read_dir(struct file_descriptor *fdes, void *buf, int64_t amount) {
+	if (fdes == NULL)       { return -ERR_INVALID_PARAM; }
+	if (buf == NULL)        { return -ERR_INVALID_PARAM; }
+	if (fdes->node == NULL) { return -ERR_INVALID_PARAM; }
+	if ((size_t)amount < sizeof(struct dirent)) { return -ERR_EOF; }
+
+	/* Returns <0 when EOF. Returns >0 when read is successful. 0 is undefined,
+	 * but it should be treated like an error.
+	 *
+	 * amount is the amount of memory reserved for this call. This is necessary
+	 * because the name field of the dirent struct has an undefined length, and
+	 * if a limit isn't defined then this call could end up overwriting important
+	 * data. Keep in mind that a partial read is treated the same way as a
+	 * complete one, so the only way to attempt a re-read is to use lseek() then
+	 * read again with more memory.
+	 */
+
+	/* Reads the next directory entry to buf.*/
+	struct folder_vnode *node = fdes->node;
+	if (node->mounted) {
+		node = node->mount_point->vnode;
+		if (node == NULL) {
+			return -ERR_INVALID_PARAM;
+		}
+	}
+	if (fdes->pos >= (node->subfolder_count + node->subfile_count)) { return -ERR_INVALID_PARAM; }
+
+	/* Readers of a directory only share its lock while the entries they
+	 * return are loaded already. */
+	acquire_rwsem_read(node->lock);
+	int64_t ret = read_dirent(node, fdes, buf, amount, 0);
+	release_rwsem_read(node->lock);
+
+	if (ret == 0) {
+		acquire_rwsem_write(node->lock);
+		ret = read_dirent(node, fdes, buf, amount, 1);
+		release_rwsem_write(node->lock);
+	}
+	return ret;
+}
+
 int64_t kread(int32_t fd, void *buf, int64_t amount) {
 	if (buf == NULL) { return -ERR_INVALID_PARAM; }
 	if (fd < 0)      { return -ERR_INVALID_PARAM; }
@@ -13,7 +13,7 @@ int64_t vfs_write_file(struct file_descriptor *fdes, void *buf, int64_t amount)
 	}
 
 	struct file_vnode *node = fdes->node;
-	acquire_semaphore(node->mutex);
+	acquire_rwsem_write(node->lock);
 
 	/* Determine the exact amount we can write. TODO: enlarge file. */
 	int64_t to_write = amount;
@@ -24,7 +24,7 @@ int64_t vfs_write_file(struct file_descriptor *fdes, void *buf, int64_t amount)
 	/* Request the filesystem driver to write to disk. */
 	int64_t stat = node->fs->driver->write(node->fs, node->inode_num, buf, fdes->pos, to_write);
 
-	release_semaphore(node->mutex);
+	release_rwsem_write(node->lock);
 	if (stat > 0) {
 		fdes->pos += stat;
 	}
@@ -42,7 +42,7 @@ int64_t vfs_write_pipe(struct file_descriptor *fdes, void *buf, int64_t amount)
 	}
 
 	struct file_vnode *node = fdes->node;
-	acquire_semaphore(node->mutex);
+	acquire_rwsem_write(node->lock);
 
 	int64_t ret = 0;
 	while (amount > 0) {
@@ -53,12 +53,19 @@ int64_t vfs_write_pipe(struct file_descriptor *fdes, void *buf, int64_t amount)
 			/* There isn't enough space on the pipe. Wait on a queue. */
 			lock_task_switches();
 
-			wait_queue(node->write_queue);
-			release_semaphore(node->mutex);
-			signal_queue(node->read_queue);
+			uint8_t err = prepare_to_wait(node->write_queue);
+			release_rwsem_write(node->lock);
+			signal_queue_all(node->read_queue);
 
 			unlock_task_switches();
-			acquire_semaphore(node->mutex);
+			if (err == GENERIC_SUCCESS) {
+				err = finish_wait(node->write_queue);
+			}
+			if (err == ERR_NOT_FOUND) {
+				/* The pipe is being destroyed. */
+				return ret;
+			}
+			acquire_rwsem_write(node->lock);
 			continue;
 		}
 
@@ -71,8 +78,8 @@ int64_t vfs_write_pipe(struct file_descriptor *fdes, void *buf, int64_t amount)
 		ret += to_write;
 	}
 
-	signal_queue(node->read_queue);
-	release_semaphore(node->mutex);
+	signal_queue_all(node->read_queue);
+	release_rwsem_write(node->lock);
 	return ret;
 }
 
@@ -0,0 +1,55 @@
+#ifndef ACPI_H
+#define ACPI_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MADT_MAX_IOAPICS	4
+#define MADT_MAX_OVERRIDES	16
+
+/* Flags of an interrupt source override (MPS INTI flags). */
+#define MADT_POLARITY_MASK	0x3
+#define MADT_POLARITY_LOW	0x3
+#define MADT_TRIGGER_MASK	0xC
+#define MADT_TRIGGER_LEVEL	0xC
+
+struct madt_ioapic {
+	uint8_t id;
+	uint64_t phys;
+	uint32_t gsi_base;	/* The first global system interrupt it handles. */
+};
+
+/* An ISA IRQ that isn't wired to the GSI of the same number, or isn't edge
+ * triggered and active high. */
+struct madt_override {
+	uint8_t irq;
+	uint32_t gsi;
+	uint16_t flags;
+};
+
+/* What the kernel needs from the MADT, copied out by init_acpi(). */
+struct madt_info {
+	uint8_t found;
+	uint8_t has_8259;	/* The legacy PICs are there, and have to be masked. */
+	uint64_t lapic_phys;
+
+	struct madt_ioapic ioapics[MADT_MAX_IOAPICS];
+	size_t num_ioapics;
+
+	struct madt_override overrides[MADT_MAX_OVERRIDES];
+	size_t num_overrides;
+};
+
+extern struct madt_info madt_info;
+
+uint8_t init_acpi(uintptr_t rsdp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ACPI_H */
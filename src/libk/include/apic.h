@@ -0,0 +1,51 @@
+#ifndef APIC_H
+#define APIC_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The local APIC's registers are mapped here, see doc/memory_map.txt */
+#define LAPIC_VIRT		0xFFFFFFFFFA000000
+
+/* Register offsets. */
+#define LAPIC_ID		0x20
+#define LAPIC_TPR		0x80
+#define LAPIC_EOI		0xB0
+#define LAPIC_SVR		0xF0
+#define LAPIC_ICR_LOW	0x300
+#define LAPIC_ICR_HIGH	0x310
+#define LAPIC_LVT_TIMER	0x320
+#define LAPIC_TIMER_INIT	0x380
+#define LAPIC_TIMER_CUR	0x390
+#define LAPIC_TIMER_DIV	0x3E0
+
+#define LAPIC_LVT_MASKED	(1 << 16)
+#define LAPIC_TIMER_PERIODIC	(1 << 17)
+#define LAPIC_ICR_PENDING	(1 << 12)
+
+/* Interrupt vectors. The spurious vector must end in 0xF on older CPUs. */
+#define LAPIC_TIMER_VECTOR		0x30
+#define LAPIC_SPURIOUS_VECTOR	0xFF
+
+uint8_t init_lapic(void);
+void lapic_enable(void);
+uint32_t lapic_id(void);
+void lapic_send_ipi(uint32_t id, uint8_t vector);
+uint32_t lapic_read(uint32_t reg);
+void lapic_write(uint32_t reg, uint32_t val);
+void lapic_eoi(void);
+
+uint32_t lapic_timer_calibrate(uint16_t pit_count);
+void lapic_timer_oneshot(uint32_t count);
+void lapic_timer_periodic(uint32_t count);
+uint32_t lapic_timer_current(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* APIC_H */
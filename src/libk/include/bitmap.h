@@ -0,0 +1,45 @@
+#ifndef BITMAP_H
+#define BITMAP_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* How many summary words are needed for a bitmap of the given size. */
+#define BITMAP_SUMMARY_WORDS(bits) (((bits) + 4095) / 4096)
+
+/* A set bit means used. Bit n is bit (n % 64) of words[n / 64], which is the
+ * same layout as a little endian byte bitmap (e.g. the ext2 ones), so those can
+ * be used as-is as long as the buffer is 8 byte aligned.
+ *
+ * The optional summary has one bit per word, set when that word is full. It
+ * lets the searches skip 4096 used bits at a time.
+ */
+struct bitmap {
+	uint64_t *words;
+	uint64_t *summary;
+	size_t bit_count;
+};
+
+void bitmap_init(struct bitmap *b, uint64_t *words, uint64_t *summary, size_t bits);
+void bitmap_sync(struct bitmap *b);
+
+uint8_t bitmap_test(struct bitmap *b, size_t i);
+void bitmap_set(struct bitmap *b, size_t i);
+void bitmap_clear(struct bitmap *b, size_t i);
+void bitmap_set_range(struct bitmap *b, size_t i, size_t len);
+void bitmap_clear_range(struct bitmap *b, size_t i, size_t len);
+
+int64_t bitmap_find_zero(struct bitmap *b, size_t start);
+int64_t bitmap_find_one(struct bitmap *b, size_t start);
+int64_t bitmap_find_zero_run(struct bitmap *b, size_t start, size_t len);
+size_t bitmap_count(struct bitmap *b, size_t i, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BITMAP_H */
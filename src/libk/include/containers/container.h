@@ -0,0 +1,17 @@
+#ifndef CONTAINER_H
+#define CONTAINER_H 1
+
+#include <stddef.h>
+
+/* The containers in this directory are intrusive: the node lives inside the
+ * structure being stored, so inserting never allocates. This gets the
+ * structure back from a pointer to its node.
+ */
+#define container_of(ptr, type, member) \
+	((type*)((char*)(ptr) - offsetof(type, member)))
+
+/* Same as container_of, but NULL stays NULL. */
+#define container_of_null(ptr, type, member) \
+	(((ptr) == NULL) ? NULL : container_of(ptr, type, member))
+
+#endif /* CONTAINER_H */
@@ -0,0 +1,60 @@
+#ifndef HASH_H
+#define HASH_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <containers/container.h>
+
+/* Chained hash table, keyed by a uint64_t. Strings etc. should be hashed with
+ * hash_str() first; since different strings can share a key, walk the matches
+ * with hash_next() and compare. The table doubles itself when it gets too full.
+ */
+
+/* Typed wrappers. HASH_DEFINE(fd, struct file_descriptor, hnode) gives
+ * fd_find(), fd_next(), fd_insert() and fd_remove().
+ */
+#define HASH_DEFINE(name, type, member)									\
+static inline type *name##_find(struct hash_table *h, uint64_t key) {	\
+	return container_of_null(hash_find(h, key), type, member);			\
+}																		\
+static inline type *name##_next(type *e) {								\
+	return container_of_null(hash_next(&e->member), type, member);		\
+}																		\
+static inline uint8_t name##_insert(struct hash_table *h, type *e, uint64_t key) {	\
+	return hash_insert(h, &e->member, key);								\
+}																		\
+static inline void name##_remove(struct hash_table *h, type *e) {		\
+	hash_remove(h, &e->member);											\
+}
+
+struct hash_node {
+	struct hash_node *next;
+	uint64_t key;
+};
+
+struct hash_table {
+	struct hash_node **buckets;
+	size_t bucket_count;	/* Always a power of two. */
+	size_t count;
+};
+
+uint8_t hash_init(struct hash_table *h, size_t buckets);
+void hash_destroy(struct hash_table *h);
+
+uint8_t hash_insert(struct hash_table *h, struct hash_node *n, uint64_t key);
+void hash_remove(struct hash_table *h, struct hash_node *n);
+struct hash_node *hash_find(struct hash_table *h, uint64_t key);
+struct hash_node *hash_next(struct hash_node *n);
+
+uint64_t hash_u64(uint64_t val);
+uint64_t hash_str(const char *str);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HASH_H */
@@ -0,0 +1,51 @@
+#ifndef RADIX_H
+#define RADIX_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Radix tree mapping a uint64_t to a pointer, 64 slots per level. The tree is
+ * only as tall as the largest key needs, so small dense keys (PIDs, inode
+ * numbers) are found in one or two steps. Empty levels are freed on removal.
+ */
+
+#define RADIX_BITS  6
+#define RADIX_SLOTS (1 << RADIX_BITS)
+
+/* Typed wrappers, see HASH_DEFINE in hash.h */
+#define RADIX_DEFINE(name, type)											\
+static inline type *name##_lookup(struct radix_tree *r, uint64_t key) {		\
+	return (type*)radix_lookup(r, key);										\
+}																			\
+static inline uint8_t name##_insert(struct radix_tree *r, uint64_t key, type *e) {	\
+	return radix_insert(r, key, e);											\
+}																			\
+static inline type *name##_remove(struct radix_tree *r, uint64_t key) {		\
+	return (type*)radix_remove(r, key);										\
+}
+
+struct radix_node {
+	void *slots[RADIX_SLOTS];
+	size_t used;
+};
+
+struct radix_tree {
+	struct radix_node *root;
+	size_t height;	/* 0 means empty. */
+	size_t count;
+};
+
+uint8_t radix_insert(struct radix_tree *r, uint64_t key, void *item);
+void *radix_lookup(struct radix_tree *r, uint64_t key);
+void *radix_remove(struct radix_tree *r, uint64_t key);
+void radix_destroy(struct radix_tree *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RADIX_H */
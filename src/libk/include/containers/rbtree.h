@@ -0,0 +1,63 @@
+#ifndef RBTREE_H
+#define RBTREE_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <containers/container.h>
+
+/* Red-black tree keyed by a uint64_t. Equal keys are allowed, they are kept in
+ * insertion order. rb_first() is O(1), the leftmost node is cached.
+ */
+
+/* Typed wrappers, see HASH_DEFINE in hash.h */
+#define RB_DEFINE(name, type, member)									\
+static inline type *name##_first(struct rb_tree *t) {					\
+	return container_of_null(rb_first(t), type, member);				\
+}																		\
+static inline type *name##_next(type *e) {								\
+	return container_of_null(rb_next(&e->member), type, member);		\
+}																		\
+static inline type *name##_find(struct rb_tree *t, uint64_t key) {		\
+	return container_of_null(rb_find(t, key), type, member);			\
+}																		\
+static inline void name##_insert(struct rb_tree *t, type *e, uint64_t key) {	\
+	rb_insert(t, &e->member, key);										\
+}																		\
+static inline void name##_remove(struct rb_tree *t, type *e) {			\
+	rb_remove(t, &e->member);											\
+}
+
+#define RB_RED   0
+#define RB_BLACK 1
+
+struct rb_node {
+	struct rb_node *parent;
+	struct rb_node *left;
+	struct rb_node *right;
+	uint64_t key;
+	uint8_t color;
+};
+
+struct rb_tree {
+	struct rb_node *root;
+	struct rb_node *first;
+	size_t count;
+};
+
+void rb_insert(struct rb_tree *t, struct rb_node *n, uint64_t key);
+void rb_remove(struct rb_tree *t, struct rb_node *n);
+
+struct rb_node *rb_first(struct rb_tree *t);
+struct rb_node *rb_next(struct rb_node *n);
+struct rb_node *rb_find(struct rb_tree *t, uint64_t key);
+struct rb_node *rb_lower_bound(struct rb_tree *t, uint64_t key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RBTREE_H */
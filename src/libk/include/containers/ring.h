@@ -0,0 +1,50 @@
+#ifndef RING_H
+#define RING_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Bounded ring buffer of fixed-size elements. Any number of producers may push
+ * at the same time (including from interrupt handlers), but there must only be
+ * one consumer. Every slot has a sequence number, so a slot that is claimed but
+ * not yet written is never read. No locks are taken.
+ */
+
+/* Typed wrappers, see HASH_DEFINE in hash.h */
+#define RING_DEFINE(name, type)											\
+static inline uint8_t name##_init(struct ring *r, size_t count) {		\
+	return ring_init(r, sizeof(type), count);							\
+}																		\
+static inline uint8_t name##_push(struct ring *r, type *e) {			\
+	return ring_push(r, e);												\
+}																		\
+static inline uint8_t name##_pop(struct ring *r, type *e) {				\
+	return ring_pop(r, e);												\
+}
+
+struct ring {
+	uint8_t *data;
+	uint64_t *seq;
+	size_t elem_size;
+	size_t mask;		/* Slot count - 1, the count is a power of two. */
+
+	uint64_t head;		/* Next slot to pop, only touched by the consumer. */
+	uint64_t tail;		/* Next slot to push. */
+};
+
+uint8_t ring_init(struct ring *r, size_t elem_size, size_t count);
+void ring_destroy(struct ring *r);
+
+uint8_t ring_push(struct ring *r, void *elem);
+uint8_t ring_pop(struct ring *r, void *elem);
+size_t ring_count(struct ring *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RING_H */
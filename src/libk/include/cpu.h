@@ -0,0 +1,83 @@
+#ifndef CPU_H
+#define CPU_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* What the CPU supports, filled in by init_cpu(). Until then, everything reads
+ * as unsupported, so it is always safe to use.
+ */
+struct cpu_info {
+	uint32_t max_leaf;
+	uint32_t max_ext_leaf;
+
+	uint8_t erms;	/* Enhanced rep movsb/stosb */
+	uint8_t fsrm;	/* Fast short rep movsb */
+	uint8_t fxsr;
+	uint8_t xsave;
+	uint8_t xsaveopt;
+	uint8_t avx;
+	uint8_t apic;	/* On-chip local APIC */
+	uint8_t tsc;
+	uint8_t tsc_invariant;	/* Runs at the same rate in every P- and C-state */
+};
+
+extern struct cpu_info cpu_info;
+
+/* The FS base, which user programs use for thread-local storage. */
+#define MSR_FS_BASE			0xC0000100
+
+/* The GS base of the running code, and the one swapgs exchanges it with. */
+#define MSR_GS_BASE			0xC0000101
+#define MSR_KERNEL_GS_BASE	0xC0000102
+
+/* SYSCALL/SYSRET, see init_syscall() in tss.c */
+#define MSR_EFER			0xC0000080
+#define MSR_STAR			0xC0000081
+#define MSR_LSTAR			0xC0000082
+#define MSR_SFMASK			0xC0000084
+#define EFER_SCE			1
+
+void init_cpu(void);
+
+
+static inline void cpuid(uint32_t leaf, uint32_t sub, uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d) {
+	__asm__ volatile ("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(sub));
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+	uint32_t lo, hi;
+	__asm__ volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t val) {
+	__asm__ volatile ("wrmsr" : : "c"(msr), "a"((uint32_t)val), "d"((uint32_t)(val >> 32)));
+}
+
+/* Disables interrupts, and returns the old RFLAGS for irq_restore(). */
+static inline uint64_t irq_save(void) {
+	uint64_t flags;
+	__asm__ volatile ("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+	return flags;
+}
+
+static inline void irq_restore(uint64_t flags) {
+	__asm__ volatile ("push %0; popfq" : : "r"(flags) : "memory", "cc");
+}
+
+static inline uint64_t rdtsc(void) {
+	uint32_t lo, hi;
+	__asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CPU_H */
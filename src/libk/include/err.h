@@ -51,6 +51,11 @@
 size_t init_serial();
 void serial_puts(char *);
 void serial_putx(uint64_t val);
+void serial_putc(char c);
+void serial_tx_irq(uint8_t enable);
+size_t serial_tx_room(void);
+void serial_tx_byte(char c);
+extern uint8_t serial_ok;
 int64_t print_stat(int64_t stat);
 void kpanic(void);
 
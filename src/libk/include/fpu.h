@@ -0,0 +1,22 @@
+#ifndef FPU_H
+#define FPU_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct task;
+
+uint8_t init_fpu(void);
+void fpu_switch(struct task *prev, struct task *next);
+void fpu_copy(struct task *dest, struct task *src);
+void fpu_release(struct task *t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FPU_H */
@@ -153,6 +153,7 @@ struct ext2_file {
 
 struct file_system;
 struct drive;
+struct arena;
 
 size_t ext2_load_blocks(struct file_system *fs, void *buf, size_t block_addr, size_t count);
 size_t ext2_write_blocks(struct file_system *fs, void *buf, size_t block_addr, size_t count);
@@ -179,7 +180,7 @@ int64_t ext2_write_file(struct file_system *fs, size_t inode, void *dest_buf, si
 
 size_t ext2_mknod(struct file_system *fs, size_t parent_inode, char *file_name, uint16_t type_perm, size_t uid, size_t gid);
 
-struct file_tnode *ext2_list_files(struct file_system *fs, size_t inode, size_t *count);
-struct folder_tnode *ext2_list_folders(struct file_system *fs, size_t inode, size_t *count);
+struct file_tnode *ext2_list_files(struct file_system *fs, size_t inode, size_t *count, struct arena *arena);
+struct folder_tnode *ext2_list_folders(struct file_system *fs, size_t inode, size_t *count, struct arena *arena);
 
 #endif
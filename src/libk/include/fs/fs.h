@@ -7,6 +7,7 @@ extern "C" {
 
 #include <stddef.h>
 #include <stdint.h>
+#include <mem.h>
 
 
 /* File systems */
@@ -39,8 +40,10 @@ extern "C" {
 struct task;
 struct semaphore;
 struct queue;
+struct rwsem;
 
 typedef struct semaphore SEMAPHORE;
+typedef struct rwsem RWSEM;
 typedef struct queue QUEUE;
 
 struct drive;
@@ -85,8 +88,9 @@ struct fs_driver {
 	int64_t (*get_links)(struct file_system *fs, size_t inode);
 	uint16_t (*get_type_perm)(struct file_system *fs, size_t inode);
 
-	struct file_tnode *(*list_files)(struct file_system *fs, size_t inode, size_t *count);
-	struct folder_tnode *(*list_folders)(struct file_system *fs, size_t inode, size_t *count);
+	/* The tnodes and their names are allocated from the arena. */
+	struct file_tnode *(*list_files)(struct file_system *fs, size_t inode, size_t *count, struct arena *arena);
+	struct folder_tnode *(*list_folders)(struct file_system *fs, size_t inode, size_t *count, struct arena *arena);
 
 	size_t (*mknod)(struct file_system *fs, size_t inode, char *name, uint16_t type_perm, size_t uid, size_t gid);
 
@@ -138,8 +142,8 @@ struct file_vnode {
 	int64_t (*write)(struct file_descriptor *, void *, int64_t count);
 	int32_t (*close)(struct task *t, struct file_descriptor *);
 
-	/* This solves the mutual exclusion problem. */
-	SEMAPHORE *mutex;
+	/* Reads of a file share it, everything else takes it exclusively. */
+	RWSEM *lock;
 
 	/* These two help us notify other processes when the file is written to/read
 	 * from.
@@ -176,6 +180,7 @@ struct folder_vnode {
 
 	size_t subfile_count;
 	size_t subfolder_count;
+	struct arena list_arena; /* Holds the tnodes above. */
 
 	size_t inode_num;
 
@@ -187,7 +192,8 @@ struct folder_vnode {
 	size_t mounted;
 	struct folder_tnode *mount_point;
 
-	SEMAPHORE *mutex;
+	/* Walking the children shares it, loading them takes it exclusively. */
+	RWSEM *lock;
 
 	/* A folder doesn't need any queues.*/
 
@@ -212,6 +218,19 @@ struct dirent {
 
 
 
+/* For kpoll(), one per descriptor. The same layout as in user space. */
+struct pollfd {
+	int32_t fd;
+	int16_t events;		/* What the caller waits for. */
+	int16_t revents;	/* What happened. */
+};
+
+#define POLLIN		0x01	/* There is something to read. */
+#define POLLOUT		0x04	/* There is room to write. */
+#define POLLNVAL	0x20	/* Not an open descriptor. */
+
+#define POLL_MAX	64
+
 struct file_descriptor {
 	void *node; /* THIS REFERST TO A VNODE, NOT A TNODE. */
 	size_t file; /* Whether it points to a file or folder. 1 if file. */
@@ -234,8 +253,7 @@ struct file_system *fs_get_first();
 
 
 size_t fs_check_drive(struct drive *d);
-char **fs_parse_path(char *path);
-void fs_free_path(char **arr);
+char **fs_parse_path(char *path, struct arena *arena);
 
 struct file_vnode *vfs_load_file_at(struct folder_vnode *parent, struct file_tnode *tnode);
 struct folder_vnode *vfs_load_folder_at(struct folder_vnode *parent, struct folder_tnode *tnode);
@@ -266,6 +284,9 @@ int32_t kopen(char *path, size_t mode);
 int64_t kread(int32_t fd, void *buf, int64_t amount);
 int64_t kwrite(int32_t fd, void *buf, int64_t amount);
 int32_t kclose(int32_t fd);
+void vfs_close_all(struct task *t);
+
+int64_t kpoll(struct pollfd *fds, size_t nfds, int64_t timeout_ns);
 
 int64_t ktell(int32_t fd);
 int64_t kseek(int32_t fd, int64_t pos);
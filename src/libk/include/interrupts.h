@@ -40,6 +40,10 @@ extern void irq0();
 extern void irq1();
 extern void irq2();
 extern void irq3();
+extern void irq4();
+extern void lapic_timer();
+extern void lapic_spurious();
+extern void ipi_resched();
 
 
 extern void exception_divide_by_zero(void);
@@ -50,6 +54,9 @@ extern void exception_ts(void);
 extern void exception_np(void);
 extern void exception_ss(void);
 extern void exception_pf(void);
+extern void exception_nm(void);
+extern void exception_mf(void);
+extern void exception_xm(void);
 
 extern void syscall_interrupt(void);
 
@@ -57,6 +64,7 @@ extern void syscall_interrupt(void);
 void put_time();
 
 uint8_t init_interrupts();
+void init_ap_interrupts(void);
 
 void kpanic();
 
@@ -0,0 +1,41 @@
+#ifndef IOAPIC_H
+#define IOAPIC_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The IO-APICs' registers are mapped here, a page each, see
+ * doc/memory_map.txt */
+#define IOAPIC_VIRT		0xFFFFFFFFFA001000
+
+/* The vector an ISA IRQ is given at boot, the same as with the 8259s.
+ *
+ * The local APIC delivers pending interrupts by priority class (vector >> 4),
+ * highest first, so a device that needs lower latency should be routed to a
+ * vector of a higher class with irq_route(). 0x20-0x2F (the ISA IRQs) is the
+ * lowest class in use, the LAPIC timer and IPIs (0x30-0x3F) come above it.
+ */
+#define ISA_IRQ_VECTOR(irq)	(0x20 + (irq))
+
+/* IRQs 0-15 are ISA IRQs, and are translated through the MADT's overrides.
+ * Anything above is taken as a global system interrupt (a PCI one, so level
+ * triggered and active low).
+ *
+ * Until init_ioapic() has run, or if there is no IO-APIC, the 8259 PICs are
+ * used and irq_route() fails.
+ */
+uint8_t init_ioapic(void);
+uint8_t irq_route(uint8_t irq, uint8_t vector, uint64_t cpu);
+void irq_mask(uint8_t irq);
+void irq_unmask(uint8_t irq);
+void irq_eoi(uint8_t irq);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IOAPIC_H */
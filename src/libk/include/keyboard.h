@@ -32,6 +32,7 @@ extern "C" {
 struct file_descriptor;
 
 
+void kbd_irq(uint8_t key);
 void kbd_handle_key(uint8_t key);
 struct file_descriptor *init_kbd();
 void kbd_flush();
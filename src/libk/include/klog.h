@@ -0,0 +1,63 @@
+#ifndef KLOG_H
+#define KLOG_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Log levels. Lower is more important. */
+#define KLOG_ERR	0
+#define KLOG_WARN	1
+#define KLOG_INFO	2
+#define KLOG_DEBUG	3
+
+/* Messages above this level are compiled out. Can be overridden with
+ * -DKLOG_LEVEL=n.
+ */
+#ifndef KLOG_LEVEL
+#ifdef DEBUG
+#define KLOG_LEVEL KLOG_DEBUG
+#else
+#define KLOG_LEVEL KLOG_INFO
+#endif
+#endif
+
+#define KLOG_LINE_MAX		126		/* Longer messages are cut. */
+#define KLOG_RING_SLOTS		64
+#define KLOG_HISTORY_SIZE	0x2000	/* Bytes kept for klogread(). */
+
+/* klog(level, fmt, ...) formats a message and queues it without waiting for
+ * the serial port. Supported conversions are %s, %c, %d, %u, %x and %%.
+ * Lines should end with "\n", it is sent as "\r\n".
+ */
+#define klog(level, ...) do {				\
+	if ((level) <= KLOG_LEVEL) {			\
+		klog_write((level), __VA_ARGS__);	\
+	}										\
+} while (0)
+
+#define klog_err(...)	klog(KLOG_ERR, __VA_ARGS__)
+#define klog_warn(...)	klog(KLOG_WARN, __VA_ARGS__)
+#define klog_info(...)	klog(KLOG_INFO, __VA_ARGS__)
+#define klog_debug(...)	klog(KLOG_DEBUG, __VA_ARGS__)
+
+struct klog_record {
+	uint8_t level;
+	uint8_t len;
+	char text[KLOG_LINE_MAX];
+};
+
+uint8_t init_klog(void);
+void klog_write(uint8_t level, char *fmt, ...);
+void klog_flush(void);
+void klog_uart_irq(void);
+int64_t klog_read(char *buf, size_t size, size_t offset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* KLOG_H */
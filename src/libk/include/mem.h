@@ -11,6 +11,7 @@ extern "C" {
 #include <stddef.h>
 #include <string.h>
 #include <stivale2.h>
+#include <bitmap.h>
 
 /*
  * Loading a Page-Map Level 4 Table is one of the rare things we can't do in C. Because
@@ -43,6 +44,7 @@ struct memory_map {
 	struct memory_block blocks[32]; 		//32 blocks at most.
 	uint64_t num_blocks;						//total number of blocks.
 	uint64_t bitmap[98304];					//This is equal to 24 GB
+	uint64_t summary[BITMAP_SUMMARY_WORDS(98304 * 64)];	//One bit for every full word of the bitmap.
 }; //lists total available physical memory and provides bitmaps for each of them.
 
 typedef struct memory_block memory_block_t;
@@ -125,6 +127,54 @@ struct heap {
 };
 
 
+/* Memory counters, as returned by get_mem_stats() and the memstat syscall.
+ * Frame counts per block are computed from the bitmap when read.
+ */
+struct mem_block_stats {
+	uint64_t base_page;
+	uint64_t length;
+	uint64_t free_frames;
+	uint64_t used_frames;
+};
+
+struct mem_stats {
+	uint64_t free_frames;
+	uint64_t used_frames;
+	uint64_t frame_allocs;		/* Frames handed out by allocpp()/allocpps() */
+	uint64_t frame_frees;
+	uint64_t frame_alloc_fails;
+
+	uint64_t page_structs_total;
+	uint64_t page_structs_used;
+	uint64_t page_struct_fails;
+
+	uint64_t maps;				/* Pages mapped by map_memory() */
+	uint64_t unmaps;			/* Pages unmapped by unmap_memory() */
+	uint64_t flushes;			/* CR3 reloads */
+
+	uint64_t num_blocks;
+	struct mem_block_stats blocks[32];
+};
+
+
+/* Arenas hand out memory by bumping a pointer through page sized chunks, and
+ * release all of it at once with arena_reset(). A zeroed arena is an empty one.
+ */
+#define ARENA_PAGE_SIZE 0x1000
+#define ARENA_POOL_SIZE 8		/* Released pages kept around for reuse. */
+
+struct arena_page {
+	struct arena_page *next;
+	size_t size;	/* Usable bytes after the header. */
+	size_t used;
+};
+
+struct arena {
+	struct arena_page *first;	/* The page being allocated from is first. */
+	size_t pages;
+};
+
+
 typedef struct chunk_header chunk_header_t;
 typedef struct heap heap_t;
 
@@ -153,20 +203,36 @@ uint8_t setppUsed(uint64_t, uint8_t);		//sets a page's 'used' bit to whatever yo
 uint64_t allocpp();		//"allocates" a single physical page.
 uint64_t allocpps(uint64_t);		//"allocates" multiple physical pages..
 uint8_t freepp(uint64_t);			//"frees" a single physical page.
+void pmm_get_stats(struct mem_stats *s);	//fills in the frame counters.
 
 
 
 
 //Virtual memory management
 
+/* What map_memory() and alloc_pages() take as user_accessible. A MAP_USER_RO
+ * page can only be read by user code, and isn't owned by the address spaces it
+ * is mapped into: copy_addr_space() and the skeleton cache leave it alone.
+ */
+#define MAP_KERNEL		0
+#define MAP_USER		1
+#define MAP_USER_RO		2
+
+/* An available bit of the page table entry, set on MAP_USER_RO pages. */
+#define PAGE_SHARED		0x200
+
 uint8_t map_memory(uint64_t phys, uint64_t virt, uint64_t amount, p_map_level4_table*, size_t user_accessible);	//maps a single physical page to a virtual page. doesn't check if pp is avilable.
 uint8_t unmap_memory(uint64_t virt, uint64_t amount, p_map_level4_table*);	//unmaps a virtual page, also frees the physical page attached to it.
 uint64_t get_page_entry(p_map_level4_table *pml4t, uint64_t va);
 uint8_t is_mapped(uintptr_t va, p_map_level4_table *pml4t);
-p_map_level4_table *copy_addr_space(p_map_level4_table *pml4t);
+uint8_t is_user_writable(uintptr_t va, size_t size, p_map_level4_table *pml4t);
+p_map_level4_table *copy_addr_space(p_map_level4_table *dest, p_map_level4_table *pml4t);
+void lock_phys_window(void);	//serialises users of the window at 0xFFFFFFFF98000000.
+void unlock_phys_window(void);
 
 /* Allocates a random physical page and a random virtual one. Starting address is returned. */
 uint64_t alloc_pages(uint64_t amount, uint64_t base, uint64_t limit, size_t user_accessible);
+void vmm_get_stats(struct mem_stats *s);
 
 
 
@@ -177,6 +243,11 @@ uint8_t link(chunk_header_t*, chunk_header_t*);	//links two chunks to each other
 void* kmalloc(uint64_t);
 uint8_t kfree(void*);
 
+//Arenas.
+void arena_init(struct arena *arena);
+void *arena_alloc(struct arena *arena, size_t size);	//8 byte aligned, NULL on failure.
+void arena_reset(struct arena *arena);					//releases everything allocated from the arena.
+
 
 
 //these  functions simply initalise different layers of the Memory Manager (TM)
@@ -187,6 +258,9 @@ uint8_t init_heap();										//Heap			  Manager (TM)
 //initialises everything (a.k.a. calls the three functions declared above.)
 uint8_t init_memory(struct stivale2_struct_tag_memmap*);
 
+//fills s with the current memory counters.
+uint8_t get_mem_stats(struct mem_stats *s);
+
 
 
 
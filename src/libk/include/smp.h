@@ -0,0 +1,94 @@
+#ifndef SMP_H
+#define SMP_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <task.h>
+#include <timer.h>
+
+#define MAX_CPUS	16
+
+/* Every CPU gets its own GDT, since the TSS descriptor is in there. The layout
+ * is the same as in gdt.asm: null, kernel code/data, user code/data, TSS (which
+ * takes two entries).
+ */
+#define GDT_ENTRIES	7
+#define GDT_TSS		0x28
+
+/* Size of the per-CPU stack for double faults (IST2). */
+#define CPU_DF_STACK_SIZE	0x1000
+
+/* How long a CPU went without being able to switch tasks, because task
+ * switches or the scheduler were locked. DEBUG builds only, see task.c */
+struct preempt_stats {
+	uint32_t depth;
+	uint64_t start;		/* clock_gettime_ns() when it was locked. */
+	void *site;			/* Who locked it. */
+	uint64_t max_ns;
+	void *max_site;
+};
+
+/* Interrupt vector used to make another CPU look at its run queue. */
+#define IPI_RESCHED_VECTOR	0x31
+
+struct task_state_segment;
+
+/* Per-CPU data. The kernel's GS base always points at the running CPU's
+ * struct cpu (user mode gets its own, see SWAPGS_IF_USER in macros.asm).
+ * The first fields are read with a single gs-relative mov, so their offsets
+ * must not change.
+ */
+struct cpu {
+	struct cpu *self;			/* gs:0x00 */
+	struct task *current_task;	/* gs:0x08 */
+	int32_t task_switch_lock;	/* gs:0x10 */
+	int32_t task_switch_postponed;
+	uint64_t syscall_rsp;		/* gs:0x18, the user's rsp in syscall_entry */
+
+	uint64_t id;
+	uint32_t lapic_id;
+	volatile uint8_t online;
+
+	struct rq rq;
+
+	/* Whose FPU/SSE state is in this CPU's registers, and whether it was
+	 * saved since it last ran. See fpu.c */
+	struct task *fpu_owner;
+	uint8_t fpu_saved;
+
+	/* Tick state, see tick.c */
+	volatile uint8_t tick_oneshot;
+	volatile uint8_t tick_stopped;
+	uint64_t tick_programmed;
+	struct tick_stats tick_stats;
+	struct preempt_stats preempt_stats;
+
+	uint64_t gdt[GDT_ENTRIES];
+	struct task_state_segment *tss;
+	uint8_t *df_stack;
+};
+
+extern struct cpu cpus[MAX_CPUS];
+extern uint64_t cpu_count;		/* Entries of cpus[] in use. Check online before relying on one. */
+
+static inline struct cpu *this_cpu(void) {
+	struct cpu *c;
+	__asm__ volatile ("mov %%gs:0, %0" : "=r"(c));
+	return c;
+}
+
+void init_bsp_cpu(void);
+uint8_t init_smp(uintptr_t smp_tag_phys);
+uint8_t init_tss(struct cpu *c);
+void tss_set_kernel_stack(struct cpu *c, uint64_t rsp);
+void smp_send_resched(struct cpu *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SMP_H */
@@ -0,0 +1,55 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cpu.h>
+
+/* A test and test-and-set spinlock. A zeroed lock is unlocked, so locks inside
+ * kmalloc()'d and memset() structures need no init.
+ *
+ * Anything that can be taken from an interrupt handler must be taken with
+ * spin_lock_irqsave(), otherwise the handler can spin on a lock the interrupted
+ * code holds, on the same CPU. Nothing may block while holding a spinlock.
+ */
+struct spinlock {
+	volatile uint32_t locked;
+};
+
+static inline void spin_lock(struct spinlock *l) {
+	while (__atomic_exchange_n(&l->locked, 1, __ATOMIC_ACQUIRE)) {
+		while (__atomic_load_n(&l->locked, __ATOMIC_RELAXED)) {
+			__asm__ volatile ("pause");
+		}
+	}
+}
+
+static inline uint8_t spin_trylock(struct spinlock *l) {
+	/* Returns 1 if the lock was taken. */
+	return !__atomic_exchange_n(&l->locked, 1, __ATOMIC_ACQUIRE);
+}
+
+static inline void spin_unlock(struct spinlock *l) {
+	__atomic_store_n(&l->locked, 0, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t spin_lock_irqsave(struct spinlock *l) {
+	uint64_t flags = irq_save();
+	spin_lock(l);
+	return flags;
+}
+
+static inline void spin_unlock_irqrestore(struct spinlock *l, uint64_t flags) {
+	spin_unlock(l);
+	irq_restore(flags);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SPINLOCK_H */
@@ -12,6 +12,8 @@ int32_t memcmp(const void*, const void*, size_t);
 void *memcpy(void*, void*, size_t);
 void *memset(void*, uint8_t, size_t);
 void *memmove(void*, void*, size_t);
+void zero_page(void*);
+void copy_page(void*, void*);
 
 size_t strlen(const char*);
 size_t strcmp(const char*, const char*);
@@ -24,6 +26,10 @@ void xtoa(uint64_t, char*);
 uint32_t oct2bin(char*, uint32_t);
 int32_t bin2oct(uint32_t, char*, uint32_t);
 
+#ifdef BENCH
+void string_bench(void);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -8,10 +8,52 @@ extern "C" {
 #include <stdint.h>
 #include <stddef.h>
 #include <mem.h>
+#include <spinlock.h>
+#include <timer.h>
+#include <containers/rbtree.h>
 
 
 #define TASK_DEFAULT_TIME 50
 
+/* Scheduling policies, for sched_setparam(). */
+#define SCHED_FAIR	0	/* Shares the CPU fairly, weighted by nice. */
+#define SCHED_IDLE	1	/* Only runs when no SCHED_FAIR task can. */
+
+#define NICE_MIN	-20
+#define NICE_MAX	19
+
+/* The fair class tries to run every task once within SCHED_LATENCY ticks, but
+ * gives nobody less than SCHED_MIN_GRANULARITY ticks at a time.
+ */
+#define SCHED_LATENCY			24
+#define SCHED_MIN_GRANULARITY	3
+
+/* Flags for sched_class.enqueue */
+#define SCHED_ENQUEUE_NEW		1	/* The task was just created. */
+#define SCHED_ENQUEUE_WAKEUP	2	/* The task was blocked. */
+
+/* The stacks of every task are mapped at these addresses.
+ * See doc/memory_map.txt and doc/kernel_stack.txt
+ */
+#define TASK_USER_STACK   0xFFFFFF7000001000
+#define TASK_KERNEL_STACK 0xFFFFFF7FFFFFF000
+
+/* The clock's time page (read-only), see timer.h */
+#define TASK_TIME_PAGE    0xFFFFFF7000002000
+
+/* The heap stack of a kernel thread. The top page of it is its kernel stack,
+ * for interrupts. See kthread_create(). */
+#define KTHREAD_STACK_SIZE 0x3000
+
+/* The kernel stack of a user thread, on the heap too. See create_thread(). */
+#define THREAD_KSTACK_SIZE 0x2000
+
+/* How many finished task structures/address spaces are kept for reuse. */
+#define SKELETON_CACHE_SIZE 16
+
+/* PIDs run from 1 to PID_MAX - 1, see pid.c */
+#define PID_MAX 32768
+
 /* Some values for the task's state attribute. */
 
 /* The task is currently being run. */
@@ -24,6 +66,57 @@ extern "C" {
 #define TASK_STATE_BLOCK		3
 
 struct queue;
+struct task;
+
+/* A CPU's run queue. Every class keeps its queue of ready tasks here. All run
+ * queues are protected by the scheduler lock (see lock_scheduler()).
+ */
+struct rq {
+	/* The fair class, see sched_fair.c */
+	struct rb_tree fair_queue;
+	uint64_t fair_weight;	/* Sum of the weights of the queued tasks. */
+	uint64_t min_vruntime;	/* Never goes backwards. */
+
+	/* The idle class, see sched_idle.c */
+	struct rb_tree idle_queue;
+
+	uint64_t nr_queued;		/* Tasks in any of the queues above. */
+
+	/* The CPU's own idle task. It is in no queue, and runs when nothing else
+	 * can. */
+	struct task *idle;
+};
+
+/* A scheduling class. Classes are kept in a list from the highest priority to
+ * the lowest, and a task of a class only runs if no class before it has a task
+ * to run. The running task is never in its class's queue.
+ *
+ * Every function is called with the scheduler locked.
+ */
+struct sched_class {
+	char *name;
+	struct sched_class *next;
+
+	void (*enqueue)(struct rq *rq, struct task *t, uint8_t flags);
+	void (*dequeue)(struct rq *rq, struct task *t);
+
+	/* Removes the next task to run from the queue, and sets its time slice.
+	 * Returns NULL if the queue is empty. */
+	struct task *(*pick_next)(struct rq *rq);
+
+	/* Called on every timer tick for the running task. */
+	void (*tick)(struct rq *rq, struct task *t);
+
+	/* Whether woken, just enqueued, should preempt curr (of the same class). */
+	uint8_t (*check_preempt)(struct task *curr, struct task *woken);
+
+	/* Returns the queued task after prev, or the first one if prev is NULL. */
+	struct task *(*iterate)(struct rq *rq, struct task *prev);
+
+	/* Called after t was dequeued from one CPU, before it is enqueued on
+	 * another. May be NULL. */
+	void (*migrate)(struct rq *from, struct rq *to, struct task *t);
+};
 
 struct file_descriptor; /* Definition in <fs/fs.h>*/
 struct task_registers {
@@ -61,7 +154,7 @@ struct task_registers {
 	uint64_t ds;   /* 0xA0 This is also used for ss, es, fs, gs.*/
 
 	uint64_t kernel_rsp; /* 0xA8 Kernel stack for the task. */
-	//char fxsave_area[544]; // 0xB0
+	uint64_t fs_base;	/* 0xB0 For thread-local storage, see yield(). */
 } __attribute__((packed));
 
 
@@ -74,6 +167,29 @@ struct task_arg {
 };
 
 
+/* A task waiting on a queue, see queue.c */
+struct queue_waiter {
+	struct task *task;
+	struct queue_waiter *next;
+	uint8_t woken;
+	uint8_t result;
+};
+
+/* A task polling a queue, see kpoll() */
+struct poll_entry {
+	struct task *task;
+	struct queue *q;
+	struct poll_entry *next;
+};
+
+/* A task waiting on a futex, see futex.c */
+struct futex_waiter {
+	uint64_t key;
+	struct task *task;
+	struct futex_waiter *next;
+	uint8_t woken;
+};
+
 struct task {
 	struct task_registers reg;
 
@@ -93,16 +209,99 @@ struct task {
 
 	struct folder_vnode *current_dir;
 
+	/* Guards the fds list. (fds itself can't move, task_loader() knows the
+	 * offsets of the fields after it.) */
+	struct spinlock fd_lock;
+
+	/* FPU/SSE save area, NULL until the task first uses the FPU. See fpu.c */
+	void *fpu;
+
+	/* Scheduling. The run queue node belongs to whichever class the task is in. */
+	struct sched_class *sched_class;
+	int64_t nice;
+	uint64_t weight;
+	uint64_t vruntime;	/* Weighted time spent running, for the fair class. */
+	struct rb_node run_node;
+
+	/* Priority inheritance, see semaphore.c. sched_class and weight above are
+	 * what the task runs with, base_class and nice what it was given. All of
+	 * it is protected by the scheduler lock. */
+	struct sched_class *base_class;
+	uint64_t pi_weight;				/* The boost, 0 for none. */
+	struct semaphore *pi_blocked_on;
+	struct semaphore *pi_held;		/* The binary semaphores it holds. */
+
+	/* The CPU the task runs (or last ran) on, and whether it is running right
+	 * now. A task that blocked may still be on its CPU until the switch away
+	 * from it is done. */
+	uint64_t cpu;
+	uint8_t on_cpu;
+
+	/* The CPU whose registers its FPU state was last loaded into. */
+	uint64_t fpu_cpu;
+
+	/* Kernel threads only, see kthread_create(). Their stacks are on the heap,
+	 * the terminator frees them. */
+	void *kstack;
+	void (*kthread_fn)(void *arg);
+	void *kthread_arg;
+
+	/* Threads, see create_thread(). A thread shares the address space, the
+	 * files, the working directory and the arguments of its process, which
+	 * are kept in the process's first task, its leader (NULL for the leader
+	 * itself, see task_leader()). The leader counts the tasks of the process
+	 * the terminator hasn't freed yet, the last one takes all of it along. */
+	struct task *leader;
+	uint64_t group_users;
+
+	/* For timed waits (see sleeper_arm()), futex_wait() and wait_queue().
+	 * Other tasks get to these from any address space, so they can't be on
+	 * the task's kernel stack. */
+	struct sleeper sleeper;
+	struct futex_waiter futex;
+	struct queue_waiter queue;
+	volatile uint8_t poll_woken;	/* One of its polled queues was signaled. */
+
+	/* The list of every task, see pid.c */
+	struct task *all_next;
+	struct task *all_prev;
+
+	/* Semaphores and rwsems link their waiters through next. sem_result is
+	 * what a waiter gets when it's woken, see destroy_semaphore(). */
+	uint8_t sem_result;
 	struct task *next;
 };
 
 
 struct semaphore {
+	struct spinlock lock;
 	size_t max_count;
 	size_t current_count;
 
 	struct task *first_waiting_task;
 	struct task *last_waiting_task;
+
+	/* Binary semaphores only, for priority inheritance. */
+	struct task *owner;
+	struct semaphore *held_next;	/* The owner's other ones. */
+
+	/* Set by destroy_semaphore(), which waits for the timed waiters that
+	 * still use the semaphore (users) to leave. */
+	uint8_t dead;
+	size_t users;
+};
+
+/* A reader-writer semaphore, see rwsem.c */
+struct rwsem {
+	struct spinlock lock;
+	int64_t count;	/* Readers holding it, or -1 for a writer. */
+
+	struct task *first_reader;
+	struct task *last_reader;
+	struct task *first_writer;
+	struct task *last_writer;
+
+	uint8_t dead;	/* Set by destroy_rwsem(). */
 };
 
 /* ELF (the executable and linkable format) stuff. */
@@ -149,35 +348,87 @@ struct queue {
 	/* The structure itself is pretty similar to Semaphore, but its purpose
 	 * and the functions used to manipulate it are different.
 	 */
+	struct spinlock lock;
 	size_t amount_waiting;
 
-	struct task *first_task;
-	struct task *last_task;
+	struct queue_waiter *first_waiter;
+	struct queue_waiter *last_waiter;
+
+	/* Tasks polling the queue. They're woken by every signal, but stay. */
+	struct poll_entry *pollers;
+
+	/* Tasks between prepare_to_wait() and finish_wait(), or polling, which
+	 * still use the queue. destroy_queue() waits for them. */
+	size_t users;
+	uint8_t dead;
+};
+
+struct skeleton_stats {
+	uint64_t task_hits;
+	uint64_t task_misses;
+	uint64_t space_hits;
+	uint64_t space_misses;
+
+	/* How many of each are sitting in the cache right now. */
+	uint64_t tasks_cached;
+	uint64_t spaces_cached;
 };
 
 /* These structs are opaque, so it's okay to typedef them. */
 typedef struct semaphore SEMAPHORE;
+typedef struct rwsem RWSEM;
 typedef struct queue QUEUE;
 
 p_map_level4_table *create_address_space();
 p_map_level4_table *load_elf(char *file_name, uintptr_t *entry);
 struct task *create_task(void (*main)(), p_map_level4_table *pml4t, size_t user, char *argv[]);
+struct task *kthread_create(void (*fn)(void *arg), void *arg);
+struct task *create_thread(struct task *parent, void (*entry)(), uint64_t stack, uint64_t arg, uint64_t tls);
+struct task *task_leader(struct task *t);
 struct task *copy_task(struct task *t);
-uint8_t init_tss();
+void wake_up_new_task(struct task *t);
 uint8_t init_scheduler();
 struct task *get_current_task();
+
+/* PIDs and the task list, see pid.c */
+void init_pids(void);
+uint8_t register_task(struct task *t, uint8_t user);
+void unregister_task(struct task *t);
+void pid_transfer(struct task *from, struct task *to);
 struct task *find_task(uint64_t pid);
+uint8_t prepare_to_wait_task(uint64_t pid, QUEUE **q);
+uint8_t sched_setscheduler_task(uint64_t pid, uint64_t policy, int64_t nice);
+void for_each_task(void (*fn)(struct task *t, void *arg), void *arg);
+uint64_t get_task_count(void);
 
 int64_t kchdir(struct task *t, char *fname);
 char *task_get_arg(struct task *t, uint64_t arg);
 
 void scheduler_irq0();
+void scheduler_ipi(void);
 void yield();
+void schedule_tail(void);
+void idle_task_main(void *arg);
+
+/* Scheduling classes, see sched_fair.c and sched_idle.c */
+extern struct sched_class fair_sched_class;
+extern struct sched_class idle_sched_class;
+uint64_t sched_nice_weight(int64_t nice);
+uint8_t sched_setscheduler(struct task *t, uint64_t policy, int64_t nice);
+void sched_pi_boost(struct task *t, uint64_t weight);
 
 void terminate_task();
 void block_task();
 void unblock_task(struct task *t);
 int64_t kfork(void);
+int64_t kclone(void (*entry)(), uint64_t stack, uint64_t arg, uint64_t tls);
+
+/* Recycling of finished tasks, see skeleton.c */
+struct task *skeleton_get_task(void);
+void skeleton_put_task(struct task *t);
+p_map_level4_table *skeleton_get_space(void);
+void skeleton_put_space(p_map_level4_table *pml4t);
+void skeleton_get_stats(struct skeleton_stats *s);
 
 /* Some stuff to prevent being preempted in the middle of a critical section. */
 void lock_scheduler();
@@ -185,17 +436,43 @@ void unlock_scheduler();
 void lock_task_switches();
 void unlock_task_switches();
 
+#ifdef DEBUG
+void print_preempt_stats(void);
+#endif
+
 /* Some stuff for process syncronization. */
 SEMAPHORE *create_semaphore(int32_t max_count);
-void acquire_semaphore(SEMAPHORE *s);
+uint8_t acquire_semaphore(SEMAPHORE *s);
+uint8_t acquire_semaphore_timeout(SEMAPHORE *s, uint64_t ticks);
 void release_semaphore(SEMAPHORE *s);
 void destroy_semaphore(SEMAPHORE *s);
 
+RWSEM *create_rwsem(void);
+uint8_t acquire_rwsem_read(RWSEM *s);
+void release_rwsem_read(RWSEM *s);
+uint8_t acquire_rwsem_write(RWSEM *s);
+void release_rwsem_write(RWSEM *s);
+void destroy_rwsem(RWSEM *s);
+
 /* Some stuff to make it easier to have processes wait on a resource. */
-void wait_queue(QUEUE *q);
+uint8_t wait_queue(QUEUE *q);
+uint8_t wait_queue_timeout(QUEUE *q, uint64_t ticks);
+uint8_t prepare_to_wait(QUEUE *q);
+uint8_t finish_wait(QUEUE *q);
 void signal_queue(QUEUE *q);
+size_t signal_queue_n(QUEUE *q, size_t n);
+size_t signal_queue_all(QUEUE *q);
+void drain_queue(QUEUE *q);
+uint8_t queue_add_poller(QUEUE *q, struct poll_entry *e);
+void queue_remove_poller(QUEUE *q, struct poll_entry *e);
 void destroy_queue(QUEUE *q);
 
+/* Waiting on a word of user memory, see futex.c */
+#define FUTEX_WAIT	0
+#define FUTEX_WAKE	1
+int64_t futex_wait(uint32_t *uaddr, uint32_t val, uint64_t timeout_ns);
+int64_t futex_wake(uint32_t *uaddr, uint64_t n);
+
 
 /* These two are the task-switching functions that load/save registers etc. */
 extern void switch_task(struct task_registers *from, struct task_registers *to);
@@ -205,6 +482,10 @@ extern void task_loader(struct task *t);
 void print_tasks();
 #endif
 
+#ifdef BENCH
+void switch_bench(void);
+#endif
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,111 @@
+#ifndef TIMER_H
+#define TIMER_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The PIT is programmed with a reload value of 0xE90 (see init_pit()), which
+ * makes irq0 fire 1193182 / 3728 = ~320 times a second. The LAPIC timer, when
+ * it takes over, is calibrated to the same period.
+ */
+#define TIMER_HZ		320
+#define NS_PER_TICK		3124414
+
+/* The clock, see clock.c. Its time page is written through TIME_PAGE_VIRT,
+ * and mapped read-only at TASK_TIME_PAGE into every address space, so user
+ * code can read the time without a syscall. The layout is part of the user
+ * ABI (see doc/syscalls/syscalls.txt), fields may only be added at the end.
+ */
+#define TIME_PAGE_VIRT	0xFFFFFFFFF8000000
+
+#define TIME_PAGE_TSC	1	/* The TSC fields are valid. */
+
+struct time_page {
+	volatile uint64_t seq;	/* Odd while it is being written. */
+	uint64_t flags;
+
+	/* ns = ns_base + scale(tsc - tsc_base), where scale(d) is d * mult >> shift,
+	 * without overflowing. See clock_scale(). */
+	uint64_t tsc_base;
+	uint64_t ns_base;
+	uint64_t mult;
+	uint64_t shift;
+
+	volatile uint64_t ticks;	/* timer_ticks() */
+	uint64_t ns_per_tick;
+};
+
+/* The wheel. The first level has a slot for each of the next 256 ticks, every
+ * level after that has 64 slots that each cover a whole turn of the level
+ * before it. Timers further away than 2^32 ticks (~155 days) are clamped.
+ */
+#define TIMER_ROOT_BITS	8
+#define TIMER_LVL_BITS	6
+#define TIMER_ROOT_SIZE	(1 << TIMER_ROOT_BITS)
+#define TIMER_LVL_SIZE	(1 << TIMER_LVL_BITS)
+#define TIMER_LEVELS	4	/* Not counting the root. */
+
+struct timer {
+	struct timer *next;
+	struct timer *prev;
+
+	uint64_t expires;	/* In ticks, see timer_ticks(). */
+	void (*func)(void *data);
+	void *data;
+
+	uint8_t pending;
+};
+
+/* Wakes a task up when its timer runs out, see sleeper_arm(). */
+struct sleeper {
+	struct timer timer;
+	struct task *task;
+	volatile uint8_t fired;
+};
+
+void timer_init(struct timer *t, void (*func)(void *data), void *data);
+uint8_t timer_add(struct timer *t, uint64_t expires);
+uint8_t timer_del(struct timer *t);
+void timer_tick(uint64_t n);
+uint64_t timer_next_expiry(void);
+uint64_t timer_ticks(void);
+uint64_t ns_to_ticks(uint64_t ns);
+
+void sleeper_arm(struct sleeper *s, uint64_t expires);
+uint8_t sleeper_disarm(struct sleeper *s);
+void sleep_until(uint64_t expires);
+void sleep_ticks(uint64_t ticks);
+
+uint8_t init_clock(void);
+uint64_t clock_gettime_ns(void);
+uint64_t clock_page_phys(void);
+void clock_tick(uint64_t ticks);
+
+/* What drives the tick, see tick.c */
+struct tick_stats {
+	uint64_t irqs;			/* Timer interrupts taken. */
+	uint64_t idle_stops;	/* Times the tick was stopped while idle. */
+	uint64_t ticks_skipped;	/* Ticks that passed without an interrupt. */
+};
+
+uint8_t init_tick(void);
+void init_tick_ap(void);
+uint64_t tick_irq(void);
+void tick_idle_enter(void);
+void tick_idle_exit(void);
+void tick_set_nohz(uint8_t enable);
+void tick_get_stats(struct tick_stats *s);
+
+#ifdef BENCH
+void tick_bench(void);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TIMER_H */
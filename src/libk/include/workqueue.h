@@ -0,0 +1,50 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <spinlock.h>
+
+/* Work deferred to a kernel thread, see workqueue.c. A work item can be queued
+ * from anywhere, including interrupt handlers, its function runs later in the
+ * queue's thread, where it may block.
+ */
+struct work {
+	struct work *next;
+	void (*func)(void *data);
+	void *data;
+
+	uint8_t pending;
+};
+
+struct workqueue {
+	char *name;
+	struct spinlock lock;
+
+	struct work *first;
+	struct work *last;
+	struct work *volatile running;
+
+	struct task *worker;
+};
+
+/* The queue for work that doesn't need one of its own. */
+extern struct workqueue *system_wq;
+
+uint8_t init_workqueues(void);
+struct workqueue *create_workqueue(char *name);
+
+void work_init(struct work *w, void (*func)(void *data), void *data);
+uint8_t queue_work(struct workqueue *wq, struct work *w);
+uint8_t cancel_work(struct workqueue *wq, struct work *w);
+uint8_t schedule_work(struct work *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WORKQUEUE_H */
@@ -4,6 +4,8 @@
 #include <task.h>
 #include <fs/fs.h>
 #include <mem.h>
+#include <spinlock.h>
+#include <workqueue.h>
 
 /* Whether the keyboard interrupts will work or not. It works similarly
  * to a lock, the keyboard won't be flushed immediately if this lock is
@@ -34,6 +36,18 @@ struct file_vnode *kbd_pipe;
 char key_buf[0x200];
 size_t key_buf_cursor = 0; /* Where we are in the buffer.*/
 
+/* Scancodes, from irq1 until the keyboard's work item gets to them. The
+ * indices only ever grow, scancodes are taken modulo the size. */
+#define SCANCODE_BUF_SIZE 64
+
+static uint8_t scancodes[SCANCODE_BUF_SIZE];
+static uint64_t scancode_head = 0;
+static uint64_t scancode_tail = 0;
+static struct spinlock scancode_lock;
+
+static void kbd_work_func(void *data);
+static struct work kbd_work = { .func = kbd_work_func };
+
 /* This is the keyset we'll look up our characters on.
  * '#' represents invalid characters.
  * '*' represents characters that are valid, but not displayable. (e. g. the enter key.)
@@ -49,6 +63,8 @@ void kbd_flush() {
 	 */
 
 	if (key_buf_cursor != 0) {
+		/* Readers move the pipe's contents under the same lock. */
+		acquire_rwsem_write(kbd_pipe->lock);
 		size_t to_cpy = ((kbd_pipe->size + key_buf_cursor) > 0x1000) ? (0x1000 - kbd_pipe->size) : (key_buf_cursor);
 		memcpy(((char *)kbd_pipe->pipe_mem) + kbd_pipe->size, key_buf, to_cpy);
 		kbd_pipe->size += to_cpy;
@@ -56,7 +72,8 @@ void kbd_flush() {
 		key_buf_cursor = 0;
 
 		/* Wake up any task that might be waiting for input. */
-		signal_queue(kbd_pipe->read_queue);
+		signal_queue_all(kbd_pipe->read_queue);
+		release_rwsem_write(kbd_pipe->lock);
 	}
 }
 
@@ -148,6 +165,33 @@ void kbd_handle_key(uint8_t key) {
 	return;
 }
 
+void kbd_irq(uint8_t key) {
+	/* Called by irq1. The key is handled later, in system_wq, since echoing
+	 * it and waking the readers up takes too long for an interrupt handler.
+	 * If the buffer is full, the key is dropped. */
+	uint64_t flags = spin_lock_irqsave(&scancode_lock);
+	if (scancode_head - scancode_tail < SCANCODE_BUF_SIZE) {
+		scancodes[scancode_head++ % SCANCODE_BUF_SIZE] = key;
+	}
+	spin_unlock_irqrestore(&scancode_lock, flags);
+	schedule_work(&kbd_work);
+}
+
+static void kbd_work_func(void *data) {
+	(void)data;
+	while (1) {
+		uint64_t flags = spin_lock_irqsave(&scancode_lock);
+		if (scancode_tail == scancode_head) {
+			spin_unlock_irqrestore(&scancode_lock, flags);
+			return;
+		}
+		uint8_t key = scancodes[scancode_tail++ % SCANCODE_BUF_SIZE];
+		spin_unlock_irqrestore(&scancode_lock, flags);
+
+		kbd_handle_key(key);
+	}
+}
+
 struct file_descriptor *init_kbd() {
 	/* The keyboard driver creates a (custom) pipe, and returns a file descriptor
 	 * to it. This descriptor can be added to any task's list of fds. When
@@ -161,7 +205,7 @@ struct file_descriptor *init_kbd() {
 	memset(kbd_pipe, 0, sizeof(*kbd_pipe));
 
 	kbd_pipe->pipe_mem = kmalloc(0x1000);
-	kbd_pipe->mutex = create_semaphore(1);
+	kbd_pipe->lock = create_rwsem();
 	kbd_pipe->streams_open = 2;
 
 	kbd_pipe->open = vfs_open_file;
@@ -0,0 +1,110 @@
+#include <mem.h>
+#include <task.h>
+#include <err.h>
+#include <spinlock.h>
+
+/* Arena allocator, for short-lived bulk allocations like the components of a
+ * path during a lookup, or the tnodes of a directory listing. Allocating is a
+ * pointer bump, and everything is freed at once with arena_reset().
+ *
+ * Pages are page sized heap chunks. Released pages go into a small pool, so
+ * that a lookup usually doesn't touch the heap at all. Requests that don't fit
+ * into a page get a chunk of their own, which is never pooled.
+ */
+
+#define PAGE_DATA (ARENA_PAGE_SIZE - sizeof(struct arena_page))
+
+static struct arena_page *page_pool = NULL;
+static size_t page_pool_count = 0;
+static struct spinlock pool_lock;
+
+
+static struct arena_page *get_page(size_t size) {
+	struct arena_page *p = NULL;
+
+	if (size <= PAGE_DATA) {
+		size = PAGE_DATA;
+
+		uint64_t flags = spin_lock_irqsave(&pool_lock);
+		p = page_pool;
+		if (p != NULL) {
+			page_pool = p->next;
+			page_pool_count--;
+		}
+		spin_unlock_irqrestore(&pool_lock, flags);
+	}
+
+	if (p == NULL) {
+		p = kmalloc(sizeof(*p) + size);
+		if (p == NULL) { return NULL; }
+		p->size = size;
+	}
+
+	p->next = NULL;
+	p->used = 0;
+	return p;
+}
+
+static void put_page(struct arena_page *p) {
+	if (p->size == PAGE_DATA) {
+		uint64_t flags = spin_lock_irqsave(&pool_lock);
+		if (page_pool_count < ARENA_POOL_SIZE) {
+			p->next = page_pool;
+			page_pool = p;
+			page_pool_count++;
+			p = NULL;
+		}
+		spin_unlock_irqrestore(&pool_lock, flags);
+	}
+
+	if (p != NULL) {
+		kfree(p);
+	}
+}
+
+
+void arena_init(struct arena *arena) {
+	arena->first = NULL;
+	arena->pages = 0;
+}
+
+void *arena_alloc(struct arena *arena, size_t size) {
+	if (arena == NULL) { return NULL; }
+	if (size == 0)     { size = 1; }
+
+	size = (size + 7) & ~(size_t)7;
+
+	struct arena_page *p = arena->first;
+	if ((p == NULL) || (p->size - p->used < size)) {
+		p = get_page(size);
+		if (p == NULL) { return NULL; }
+
+		if ((arena->first != NULL) && (p->size != PAGE_DATA)) {
+			/* Keep allocating from the current page after an oversized one. */
+			p->next = arena->first->next;
+			arena->first->next = p;
+		} else {
+			p->next = arena->first;
+			arena->first = p;
+		}
+		arena->pages++;
+	}
+
+	void *ret = (uint8_t*)(p + 1) + p->used;
+	p->used += size;
+	return ret;
+}
+
+void arena_reset(struct arena *arena) {
+	if (arena == NULL) { return; }
+
+	struct arena_page *p = arena->first;
+	while (p != NULL) {
+		struct arena_page *next = p->next;
+		put_page(p);
+		p = next;
+	}
+
+	arena->first = NULL;
+	arena->pages = 0;
+}
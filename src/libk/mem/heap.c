@@ -4,6 +4,7 @@
 
 #include <mem.h>
 #include <err.h>
+#include <spinlock.h>
 
 
 //this heap implementation I came up with (aka read the osdev wiki about)
@@ -24,6 +25,10 @@
 //can have its own heap, and I can still access them without going through hell.
 heap_t kheap_default;
 
+//every CPU allocates from the same heap, kmalloc() and kfree() take this lock.
+//interrupts are off while it's held, so a handler can't spin on it forever.
+static struct spinlock heap_lock;
+
 
 
 //this exists to make things easier to refactor in case I want to rename the variable.
@@ -151,7 +156,7 @@ chunk_header_t* mergeChunk(chunk_header_t *h1, chunk_header_t *h2) {
 
 
 /* Now comes the legendary malloc and free! */
-void *kmalloc(uint64_t bytes) {
+static void *heap_alloc(uint64_t bytes) {
 	if (bytes == 0) {
 		return NULL;
 	}
@@ -224,10 +229,7 @@ void *kmalloc(uint64_t bytes) {
 }
 
 
-uint8_t kfree(void *ptr) {
-	if (ptr == NULL) {
-		return 1;
-	}
+static uint8_t heap_free(void *ptr) {
 	/* I'm going to use two variables to loop over free chunks,
 	 * in order to find where this chunk we're freeing should be placed.
 	 * We're also going to be merging adjacent free chunks if we find any along the way.
@@ -310,6 +312,25 @@ uint8_t kfree(void *ptr) {
 }
 
 
+void *kmalloc(uint64_t bytes) {
+	uint64_t flags = spin_lock_irqsave(&heap_lock);
+	void *ret = heap_alloc(bytes);
+	spin_unlock_irqrestore(&heap_lock, flags);
+	return ret;
+}
+
+uint8_t kfree(void *ptr) {
+	if (ptr == NULL) {
+		return 1;
+	}
+
+	uint64_t flags = spin_lock_irqsave(&heap_lock);
+	uint8_t ret = heap_free(ptr);
+	spin_unlock_irqrestore(&heap_lock, flags);
+	return ret;
+}
+
+
 uint8_t init_heap(void) {
 	/* Maps 256 pages to the heap. 0xFFFFFFFFA0000000 is the kernel's heap's address.*/
 	if (map_memory(page_to_addr(allocpps(256)), 0xFFFFFFFFA0000000, 256, kgetPML4T(), 1)) {
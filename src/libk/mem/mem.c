@@ -43,3 +43,12 @@ uint8_t init_memory(struct stivale2_struct_tag_memmap *memtag) {
 
 	return GENERIC_SUCCESS;
 }
+
+uint8_t get_mem_stats(struct mem_stats *s) {
+	if (s == NULL) { return ERR_INVALID_PARAM; }
+
+	memset(s, 0, sizeof(*s));
+	pmm_get_stats(s);
+	vmm_get_stats(s);
+	return GENERIC_SUCCESS;
+}
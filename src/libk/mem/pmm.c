@@ -4,10 +4,26 @@
 //for Heap (TM) and Virtual Memory Management (TM) look at the other files in the same directory.
 #include <err.h>
 #include <mem.h>
+#include <bitmap.h>
+#include <spinlock.h>
 
 
 memory_map_t physical_memory;
 
+/* Wraps physical_memory.bitmap. Pages that aren't usable are always marked as
+ * used, so a search never has to check isppValid().
+ */
+struct bitmap pmm_bitmap;
+
+/* Always-on counters, see get_mem_stats(). */
+uint64_t pmm_allocs = 0;
+uint64_t pmm_frees = 0;
+uint64_t pmm_alloc_fails = 0;
+
+/* Taken by the allocation and freeing functions, the bitmap is shared by every
+ * CPU. */
+static struct spinlock pmm_lock;
+
 memory_map_t *getPhysicalMem() {
 	return &physical_memory;
 }
@@ -49,14 +65,7 @@ uint8_t isppUsed(uint64_t page) {
 		 */
 	}
 
-	/* Find the byte our bit will be in. */
-	uint64_t byte = physical_memory.bitmap[page/64];
-
-	/* Get the value of the corresponding bit. */
-	uint64_t bit = (byte >> (page % 64)) & 1;
-
-
-	return (uint8_t)(bit);
+	return bitmap_test(&pmm_bitmap, page);
 }
 
 
@@ -71,25 +80,12 @@ uint8_t setppUsed(uint64_t page, uint8_t value) {
 		return 1;	/* Page is invalid. */
 	}
 
-	uint64_t byte = physical_memory.bitmap[page/64];
-
-	/* Bit number. */
-	uint64_t bit = page % 64;
-
 	if (!value) {
-		/*
-		 * This sets it to zero by xor'ing all 1's with the bit, which is then AND'ed
-		 * with byte to set it to zero.
-		 */
-		byte = byte & (0xFFFFFFFFFFFFFFFF ^ ((uint64_t)1 << bit));
-
+		bitmap_clear(&pmm_bitmap, page);
 	} else {
-		byte = byte | ((uint64_t)1 << bit);
+		bitmap_set(&pmm_bitmap, page);
 	}
 
-	/* Now write the byte back into the bitmap. */
-	physical_memory.bitmap[page/64] = byte;
-
 	return GENERIC_SUCCESS;
 }
 
@@ -97,19 +93,22 @@ uint8_t setppUsed(uint64_t page, uint8_t value) {
 
 uint64_t allocpp() {
 	/* This function allocates a single (usable) physical page, and returns its page number. */
-
-	for (uint64_t i = 0; i < (sizeof(physical_memory.bitmap) * 8); i++) {
-		if (!isppUsed(i)){
-			setppUsed(i, 1);
-			return i;
-		}
+	uint64_t flags = spin_lock_irqsave(&pmm_lock);
+	int64_t i = bitmap_find_zero(&pmm_bitmap, 0);
+	if (i < 0) {
+		pmm_alloc_fails++;
+		spin_unlock_irqrestore(&pmm_lock, flags);
+		/*
+		 * This is supposed to be an invalid page value.
+		 * Might be a good idea to change it later.
+		 */
+		return 0;
 	}
 
-	/*
-	 * This is supposed to be an invalid page value.
-	 * Might be a good idea to change it later.
-	 */
-	return 0;
+	bitmap_set(&pmm_bitmap, i);
+	pmm_allocs++;
+	spin_unlock_irqrestore(&pmm_lock, flags);
+	return i;
 }
 
 
@@ -118,52 +117,44 @@ uint64_t allocpps(uint64_t amount) {
 	 * This function is like allocpp(), except it allocates multiple, *continous* physical
 	 * pages. It doesn't loop over allocpp() because that would be very inefficient.
 	 */
-
-	uint64_t ia = 0;
-	for (uint64_t i = 0; i < (sizeof(physical_memory.bitmap))*8; i++) {
-		/* This loop goes over every page available. */
-
-		for (uint64_t j = 0; j < amount; j++, ia++) {
-			if (isppUsed(i + j)) {
-				break;
-			}
-		}
-
-		if (ia != amount) {
-			/* The amount of continous pages at i was less than the requested amount. */
-			i += ia;
-			ia = 0;
-			continue;
-		}
-
-
-		/* If we reached here, then we found the requested amount of pages. */
-
-		/* Mark the pages as used. */
-		for (uint64_t j = 0; j < amount; j++) {
-			setppUsed(i + j, 1);
-		}
-
-		/* Return the first page's number. */
-		return i;
+	uint64_t flags = spin_lock_irqsave(&pmm_lock);
+	int64_t i = bitmap_find_zero_run(&pmm_bitmap, 0, amount);
+	if (i < 0) {
+		/* The amount of pages requested could not be found. */
+		pmm_alloc_fails++;
+		spin_unlock_irqrestore(&pmm_lock, flags);
+		return 0;
 	}
 
-	/* If we're here, then the amount of pages requested could not be found. */
-	return 0;
+	bitmap_set_range(&pmm_bitmap, i, amount);
+	pmm_allocs += amount;
+	spin_unlock_irqrestore(&pmm_lock, flags);
+	return i;
 }
 
 
 uint8_t freepp(uint64_t page) {
-	return setppUsed(page, 0);	/* Might be a good idea to make this a macro. */
+	uint64_t flags = spin_lock_irqsave(&pmm_lock);
+	if (setppUsed(page, 0)) {
+		spin_unlock_irqrestore(&pmm_lock, flags);
+		return 1;
+	}
+	pmm_frees++;
+	spin_unlock_irqrestore(&pmm_lock, flags);
+	return 0;
 }
 
 uint8_t freepps(uint64_t page, uint64_t amount) {
+	uint64_t flags = spin_lock_irqsave(&pmm_lock);
 	for (size_t i = 0; i < amount; i++) {
 		if (setppUsed(page + i, 0)) {
+			spin_unlock_irqrestore(&pmm_lock, flags);
 			return 1;
 		}
+		pmm_frees++;
 	}
 
+	spin_unlock_irqrestore(&pmm_lock, flags);
 	return 0;
 }
 
@@ -179,6 +170,10 @@ uint8_t init_pmm(struct stivale2_struct_tag_memmap *memtag) {
 
 	physical_memory.num_blocks = 0;
 
+	/* Everything starts out as used, only the usable blocks are freed below. */
+	memset(physical_memory.bitmap, 0xFF, sizeof(physical_memory.bitmap));
+	bitmap_init(&pmm_bitmap, physical_memory.bitmap, physical_memory.summary, sizeof(physical_memory.bitmap) * 8);
+
 	/* Extract the necessary info from the memory map provided by the bootloader. */
 	for (size_t i = 0; i < memtag->entries; i++) {
 
@@ -186,17 +181,34 @@ uint8_t init_pmm(struct stivale2_struct_tag_memmap *memtag) {
 			/* TODO: add the *-reclaimable fields to the memory map as well. */
 			continue;
 		}
-		_create_block(memtag->memmap[i].base, memtag->memmap[i].length, &(physical_memory.blocks[physical_memory.num_blocks]));
+		memory_block_t *block = &(physical_memory.blocks[physical_memory.num_blocks]);
+		_create_block(memtag->memmap[i].base, memtag->memmap[i].length, block);
+		bitmap_clear_range(&pmm_bitmap, block->base_page, block->length);
 		physical_memory.num_blocks++;
 	}
 
 
 	/* Mark the first 4 MiBs as used. */
-	for (size_t i = 0; i < 16; i++) {
-		physical_memory.bitmap[i] = 0xFFFFFFFFFFFFFFFF;
-	}
+	bitmap_set_range(&pmm_bitmap, 0, 1024);
 
 	return 0;
 }
 
 
+void pmm_get_stats(struct mem_stats *s) {
+	s->frame_allocs = pmm_allocs;
+	s->frame_frees = pmm_frees;
+	s->frame_alloc_fails = pmm_alloc_fails;
+
+	s->num_blocks = physical_memory.num_blocks;
+	for (size_t i = 0; i < physical_memory.num_blocks; i++) {
+		struct mem_block_stats *b = &s->blocks[i];
+		b->base_page = physical_memory.blocks[i].base_page;
+		b->length = physical_memory.blocks[i].length;
+		b->used_frames = bitmap_count(&pmm_bitmap, b->base_page, b->length);
+		b->free_frames = b->length - b->used_frames;
+
+		s->used_frames += b->used_frames;
+		s->free_frames += b->free_frames;
+	}
+}
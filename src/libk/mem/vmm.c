@@ -3,6 +3,8 @@
 
 #include <mem.h>
 #include <err.h>
+#include <task.h>
+#include <spinlock.h>
 
 
 /* Define the first structs, and initialise them with all zeroes. Necessary to bootstrap. */
@@ -64,46 +66,58 @@ uint64_t page_heap_length;			/* Length, in bytes.  */
 uint64_t *page_heap_bitmap;
 struct page_struct *page_heap_first;
 
+/* Only the blocks that actually fit in the heap are part of the bitmap. */
+struct bitmap page_heap_map;
+uint64_t page_heap_summary[BITMAP_SUMMARY_WORDS(0x2000 * 8)];
 
-struct page_struct *alloc_page_struct(void) {
-	for (size_t i = 0; i < (page_heap_bitmap_length * 8) ; i++) {
-		uint64_t byte8 = page_heap_bitmap[i/64];
-		uint64_t bit   = i % 64;
-		if (byte8 & ((uint64_t)1 << bit)) {
-			/* It is used. */
-			continue;
-		}
+/* Always-on counters, see get_mem_stats(). cr3_reloads is incremented by
+ * loadPML4T() itself. */
+uint64_t page_struct_fails = 0;
+uint64_t vmm_maps = 0;
+uint64_t vmm_unmaps = 0;
+uint64_t cr3_reloads = 0;
 
-		/* Mark it as used and return it. */
-		byte8 = byte8 | ((uint64_t)1 << bit);
-		page_heap_bitmap[i/64] = byte8;
+/* The page struct heap is a leaf lock. vmm_lock covers the tables themselves,
+ * the kernel PDPT is shared by every address space. The window at
+ * 0xFFFFFFFF98000000 is held across page copies and file reads, so it is a
+ * semaphore instead. */
+static struct spinlock page_struct_lock;
+static struct spinlock vmm_lock;
+static struct semaphore phys_window = { .max_count = 1 };
 
-		struct page_struct *ps = (struct page_struct*)(page_heap_begin + page_heap_bitmap_length + i * 0x3000);
-		uintptr_t ps_addr = (uintptr_t)ps;
+static uint8_t map_pages(uint64_t pa, uint64_t va, uint64_t amount, p_map_level4_table* pml4t, size_t user_accessible);
 
-		memset(ps, 0, sizeof(*ps));
-		ps->physical_address = (ps_addr - page_heap_begin) + page_heap_phys;
 
-		return ps;
+struct page_struct *alloc_page_struct(void) {
+	uint64_t flags = spin_lock_irqsave(&page_struct_lock);
+	int64_t i = bitmap_find_zero(&page_heap_map, 0);
+	if (i < 0) {
+		page_struct_fails++;
+		spin_unlock_irqrestore(&page_struct_lock, flags);
+		return NULL;
 	}
-	return NULL;
+
+	/* Mark it as used and return it. */
+	bitmap_set(&page_heap_map, i);
+	spin_unlock_irqrestore(&page_struct_lock, flags);
+
+	struct page_struct *ps = page_heap_first + i;
+	uintptr_t ps_addr = (uintptr_t)ps;
+
+	memset(ps, 0, sizeof(*ps));
+	ps->physical_address = (ps_addr - page_heap_begin) + page_heap_phys;
+
+	return ps;
 }
 
 void free_page_struct(struct page_struct *ps) {
-	struct page_struct *pi = page_heap_first;
-	for (size_t i = 0; i < (page_heap_bitmap_length * 8) ; i++) {
-		if (pi == ps) {
-			/* Found its index. */
-			uint64_t byte8 = page_heap_bitmap[i/64];
-			uint64_t bit = i % 64;
-
-			byte8 = byte8 & (0xFFFFFFFFFFFFFFFF ^ ((uint64_t)1 << bit));
-			page_heap_bitmap[i/64] = byte8;
-			break;
+	uintptr_t off = (uintptr_t)ps - (uintptr_t)page_heap_first;
+	if (ps < page_heap_first)   { return; }
+	if (off % sizeof(*ps) != 0) { return; }
 
-		}
-		pi++;
-	}
+	uint64_t flags = spin_lock_irqsave(&page_struct_lock);
+	bitmap_clear(&page_heap_map, off / sizeof(*ps));
+	spin_unlock_irqrestore(&page_struct_lock, flags);
 	return;
 }
 
@@ -134,7 +148,7 @@ uint64_t alloc_pages(uint64_t amount, uint64_t base, uint64_t limit, size_t user
 	 */
 	uint64_t ia = 0;
 
-
+	uint64_t flags = spin_lock_irqsave(&vmm_lock);
 	while (1){
 		if (i > limit) {
 			break;
@@ -193,13 +207,15 @@ uint64_t alloc_pages(uint64_t amount, uint64_t base, uint64_t limit, size_t user
 				break;	/* Failed allocation. */
 			}
 
-			map_memory(page_to_addr(base_pp), i - ia * 0x1000, ia, pml4t, user_accessible);
+			map_pages(page_to_addr(base_pp), i - ia * 0x1000, ia, pml4t, user_accessible);
+			spin_unlock_irqrestore(&vmm_lock, flags);
 			krefresh_vmm();
 
 			return (i - ia * 0x1000);
 		}
 	}
 
+	spin_unlock_irqrestore(&vmm_lock, flags);
 	return 0;
 }
 
@@ -212,7 +228,7 @@ uint64_t free_pages(uint64_t base, uint64_t amount) {
 
 
 
-uint8_t map_memory(uint64_t pa, uint64_t va, uint64_t amount, p_map_level4_table* pml4t, size_t user_accessible) {
+static uint8_t map_pages(uint64_t pa, uint64_t va, uint64_t amount, p_map_level4_table* pml4t, size_t user_accessible) {
 	/* This function maps an arbitrary amount of continous physical pages to virtual ones.
 	 * A couple things to keep in mind:
 	 * 	This function does not check or care whether the physical page is valid.
@@ -312,7 +328,9 @@ uint8_t map_memory(uint64_t pa, uint64_t va, uint64_t amount, p_map_level4_table
 
 		/* The page table index needs to be "recalculated" every time. */
 		pt_index		= (va % 0x200000) / 0x1000;
-		if (user_accessible) {
+		if (user_accessible == MAP_USER_RO) {
+			pt->entries[pt_index] = (pa) | PAGE_SHARED | 4 | 1;
+		} else if (user_accessible) {
 			pt->entries[pt_index] = (pa) | 4 | 2 | 1;
 		} else {
 			pt->entries[pt_index] = (pa) | 2 | 1;
@@ -320,12 +338,13 @@ uint8_t map_memory(uint64_t pa, uint64_t va, uint64_t amount, p_map_level4_table
 		va += 0x1000;
 		pa += 0x1000;
 	}
+	vmm_maps += amount;
 
 
 	return (uint8_t)GENERIC_SUCCESS;
 }
 
-uint8_t unmap_memory(uint64_t va, uint64_t amount, p_map_level4_table* pml4t) {
+static uint8_t unmap_pages(uint64_t va, uint64_t amount, p_map_level4_table* pml4t) {
 	/*
 	 * This function unmaps virtual pages.
 	 * It works with the same logic as map_memory, except instead of setting the entry
@@ -385,6 +404,7 @@ uint8_t unmap_memory(uint64_t va, uint64_t amount, p_map_level4_table* pml4t) {
 
 
 		pt->entries[pt_index] = 0;
+		vmm_unmaps++;
 
 		va += 0x1000;
 	}
@@ -392,17 +412,35 @@ uint8_t unmap_memory(uint64_t va, uint64_t amount, p_map_level4_table* pml4t) {
 	return GENERIC_SUCCESS;
 }
 
-p_map_level4_table *copy_addr_space(p_map_level4_table *pml4t) {
-	if (pml4t == NULL) { return NULL; }
+uint8_t map_memory(uint64_t pa, uint64_t va, uint64_t amount, p_map_level4_table* pml4t, size_t user_accessible) {
+	uint64_t flags = spin_lock_irqsave(&vmm_lock);
+	uint8_t ret = map_pages(pa, va, amount, pml4t, user_accessible);
+	spin_unlock_irqrestore(&vmm_lock, flags);
+	return ret;
+}
 
-	p_map_level4_table *ret = alloc_page_struct();
-	if (ret == NULL) {
-		serial_puts("wtf!!\r\n");
-	}
-	memset(ret, 0, 0x2000);
+uint8_t unmap_memory(uint64_t va, uint64_t amount, p_map_level4_table* pml4t) {
+	uint64_t flags = spin_lock_irqsave(&vmm_lock);
+	uint8_t ret = unmap_pages(va, amount, pml4t);
+	spin_unlock_irqrestore(&vmm_lock, flags);
+	return ret;
+}
+
+void lock_phys_window(void) {
+	acquire_semaphore(&phys_window);
+}
+
+void unlock_phys_window(void) {
+	release_semaphore(&phys_window);
+}
 
-	ret->child[511] = kgetPDPT();
-	ret->entries[511] = kgetPDPT()->physical_address | 2 | 1;
+p_map_level4_table *copy_addr_space(p_map_level4_table *ret, p_map_level4_table *pml4t) {
+	/* Copies every user page of pml4t into ret. Pages that are already mapped
+	 * in ret (e.g. the stacks of a recycled address space) are reused instead
+	 * of allocating new ones.
+	 */
+	if (pml4t == NULL) { return NULL; }
+	if (ret == NULL)   { return NULL; }
 
 	/* This is a pointer to the base of the memory reserved for mapping physical
 	 * addresses when accessing them is necessary.
@@ -411,6 +449,8 @@ p_map_level4_table *copy_addr_space(p_map_level4_table *pml4t) {
 
 	/* This is the temporary buffer used to store the data on the page. */
 	void *buf = kmalloc(0x1000);
+	if (buf == NULL) { return NULL; }
+	lock_phys_window();
 
 	/* Recreate the memory mappings */
 	for (size_t i = 0; i < 511; i++){
@@ -432,7 +472,8 @@ p_map_level4_table *copy_addr_space(p_map_level4_table *pml4t) {
 				}
 				for (size_t l = 0; l < 512; l++) {
 					uint64_t entry = pt->entries[l];
-					if (entry == 0) {
+					if ((entry == 0) || (entry & PAGE_SHARED)) {
+						/* A shared page is already mapped in ret. */
 						continue;
 					}
 
@@ -444,21 +485,24 @@ p_map_level4_table *copy_addr_space(p_map_level4_table *pml4t) {
 					map_memory(entry, 0xFFFFFFFF98000000, 1, ret, 0);
 					loadPML4T(getCR3());
 
-					memcpy(buf, phys_base, 0x1000);
-
+					copy_page(buf, phys_base);
 
-					uint64_t pp = allocpp();
 
-					map_memory(pp * 0x1000, va, 1, ret, 1);
+					uint64_t pp = get_page_entry(ret, va) / 0x1000;
+					if (pp == 0) {
+						pp = allocpp();
+						map_memory(pp * 0x1000, va, 1, ret, 1);
+					}
 					map_memory(pp * 0x1000, 0xFFFFFFFF98000000, 1, ret, 0);
 					loadPML4T(getCR3());
 
-					memcpy(phys_base, buf, 0x1000);
+					copy_page(phys_base, buf);
 				}
 			}
 		}
 	}
 	unmap_memory(0xFFFFFFFF98000000, 1, ret);
+	unlock_phys_window();
 
 	kfree(buf);
 	return ret;
@@ -485,6 +529,16 @@ uint64_t get_page_entry(p_map_level4_table *pml4t, uint64_t va) {
 	return pt->entries[pt_index];
 }
 
+void vmm_get_stats(struct mem_stats *s) {
+	s->page_structs_total = page_heap_map.bit_count;
+	s->page_structs_used = bitmap_count(&page_heap_map, 0, page_heap_map.bit_count);
+	s->page_struct_fails = page_struct_fails;
+
+	s->maps = vmm_maps;
+	s->unmaps = vmm_unmaps;
+	s->flushes = cr3_reloads;
+}
+
 uint8_t is_mapped(uintptr_t va, p_map_level4_table *pml4t) {
 	/* Checks whether a virtual address is mapped. */
 	if (get_page_entry(pml4t, va) & 1) {
@@ -493,6 +547,26 @@ uint8_t is_mapped(uintptr_t va, p_map_level4_table *pml4t) {
 	return 0;
 }
 
+uint8_t is_user_writable(uintptr_t va, size_t size, p_map_level4_table *pml4t) {
+	/* Checks whether every page of the size bytes at va is mapped present,
+	 * writable and user accessible. The kernel writes to user buffers only
+	 * after this, is_mapped() lets through the read-only time page. */
+	if (size == 0) {
+		return 1;
+	}
+	uintptr_t end = va + size - 1;
+	if ((end < va) || (end >= 0xFFFFFF7FFFFFF000)) {
+		return 0;
+	}
+
+	for (uintptr_t page = va & ~(uintptr_t)0xFFF; page <= end; page += 0x1000) {
+		if ((get_page_entry(pml4t, page) & 7) != 7) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
 
 
 
@@ -547,6 +621,8 @@ uint8_t init_vmm(void) {
 		memset(page_heap_bitmap, 0, page_heap_bitmap_length);
 
 		page_heap_first = (struct page_struct*) (page_heap_begin + page_heap_bitmap_length);
+		bitmap_init(&page_heap_map, page_heap_bitmap, page_heap_summary,
+			(page_heap_length - page_heap_bitmap_length) / sizeof(struct page_struct));
 
 
 		/* Now that the allocation mechanism is in place, we can map the whole thing. */
@@ -0,0 +1,94 @@
+#include <string.h>
+#include <mem.h>
+#include <cpu.h>
+#include <err.h>
+
+#ifdef BENCH
+
+/* Compares memcpy()/memset()/memmove() against the old one byte per iteration
+ * loops. Results (in TSC ticks, best of a few runs) go to the serial port.
+ * The empty asm keeps the compiler from turning the loops back into calls.
+ */
+
+static void byte_copy(uint8_t *dst, uint8_t *src, size_t size) {
+	for (size_t i = 0; i < size; i++) {
+		dst[i] = src[i];
+		__asm__ volatile ("" : : : "memory");
+	}
+}
+
+static void byte_set(uint8_t *dst, uint8_t val, size_t size) {
+	for (size_t i = 0; i < size; i++) {
+		dst[i] = val;
+		__asm__ volatile ("" : : : "memory");
+	}
+}
+
+static void report(char *name, size_t size, uint64_t old, uint64_t new) {
+	serial_puts(name);
+	serial_puts(" size ");
+	serial_putx(size);
+	serial_puts(": bytes ");
+	serial_putx(old);
+	serial_puts(" new ");
+	serial_putx(new);
+	serial_puts("\r\n");
+}
+
+#define RUNS 8
+#define TIME(best, expr) do {				\
+	best = ~(uint64_t)0;					\
+	for (size_t r = 0; r < RUNS; r++) {		\
+		uint64_t t = rdtsc();				\
+		expr;								\
+		t = rdtsc() - t;					\
+		best = (t < best) ? t : best;		\
+	}										\
+} while (0)
+
+void string_bench(void) {
+	size_t sizes[] = {16, 64, 512, 0x1000, 0x10000};
+	uint8_t *a = kmalloc(0x10000 + 64);
+	uint8_t *b = kmalloc(0x10000 + 64);
+	if ((a == NULL) || (b == NULL)) {
+		serial_puts("string_bench: out of memory\r\n");
+		return;
+	}
+
+	serial_puts("string_bench: erms ");
+	serial_putx(cpu_info.erms);
+	serial_puts("\r\n");
+
+	uint64_t old, new;
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+		size_t s = sizes[i];
+
+		TIME(old, byte_copy(b, a, s));
+		TIME(new, memcpy(b, a, s));
+		report("memcpy", s, old, new);
+
+		TIME(old, byte_copy(b + 3, a + 1, s));
+		TIME(new, memcpy(b + 3, a + 1, s));
+		report("memcpy unaligned", s, old, new);
+
+		TIME(old, byte_set(b, 0xAA, s));
+		TIME(new, memset(b, 0xAA, s));
+		report("memset", s, old, new);
+
+		TIME(new, memmove(a + 8, a, s));
+		report("memmove backwards", s, 0, new);
+	}
+
+	TIME(old, byte_set(a, 0, 0x1000));
+	TIME(new, zero_page(a));
+	report("zero_page", 0x1000, old, new);
+
+	TIME(old, byte_copy(b, a, 0x1000));
+	TIME(new, copy_page(b, a));
+	report("copy_page", 0x1000, old, new);
+
+	kfree(a);
+	kfree(b);
+}
+
+#endif /* BENCH */
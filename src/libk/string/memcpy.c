@@ -1,15 +1,24 @@
-
-#include <string.h> 
+#include <string.h>
+#include <cpu.h>
 
 
 void* memcpy(void *dstptr, void *srcptr, size_t size) {
-	uint8_t *dst = (uint8_t*) dstptr;
-	uint8_t *src = (uint8_t*) srcptr;
-	for (size_t i = 0; i < size; i++) {
-		*(dst + i) = *(src + i);
-	}
-	return dstptr;
-}
+	/* Always copies forwards, memmove() relies on this. */
+	void *dst = dstptr;
+	void *src = srcptr;
 
+	if (cpu_info.erms || (size < 16)) {
+		__asm__ volatile ("rep movsb" : "+D"(dst), "+S"(src), "+c"(size) : : "memory");
+		return dstptr;
+	}
 
+	/* Align the destination, copy 8 bytes at a time, then copy the rest. */
+	size_t head = (8 - ((uintptr_t)dst % 8)) % 8;
+	size_t words = (size - head) / 8;
+	size_t tail = (size - head) % 8;
 
+	__asm__ volatile ("rep movsb" : "+D"(dst), "+S"(src), "+c"(head) : : "memory");
+	__asm__ volatile ("rep movsq" : "+D"(dst), "+S"(src), "+c"(words) : : "memory");
+	__asm__ volatile ("rep movsb" : "+D"(dst), "+S"(src), "+c"(tail) : : "memory");
+	return dstptr;
+}
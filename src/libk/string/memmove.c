@@ -2,21 +2,33 @@
 #include <string.h>
 
 void *memmove(void* dstptr, void *srcptr, size_t size) {
-	uint8_t *dst = (uint8_t*) dstptr;
-	uint8_t *src = (uint8_t*) srcptr;
-	if (dst < src) {
-		//if they overlap, it will be necessary to start from the bottom.
-		for (size_t i = 0; i < size; i++) {
-			*(dst + i) = *(src + i);
-		}
-	} else {
-		//if they overlap, it will be necessary to start from the start
-		for (size_t i = size; i > 0; i--) {
-			*(dst + i - 1) = *(src + i - 1);
-		}
+	uintptr_t dst = (uintptr_t)dstptr;
+	uintptr_t src = (uintptr_t)srcptr;
+
+	if ((dst <= src) || (dst >= src + size)) {
+		/* Either they don't overlap, or it is safe to start from the bottom. */
+		return memcpy(dstptr, srcptr, size);
 	}
-	
-	return dstptr;
-}
 
+	/* dst overlaps the end of src, so we have to start from the top. The odd
+	 * bytes at the end go first, then 8 bytes at a time.
+	 * Setting DF is fine, every interrupt handler does a cld.
+	 */
+	void *d = (uint8_t*)dstptr + size - 1;
+	void *s = (uint8_t*)srcptr + size - 1;
+	size_t tail = size % 8;
+	size_t words = size / 8;
 
+	__asm__ volatile ("std\n\t"
+		"rep movsb\n\t"
+		"sub $7, %%rdi\n\t"
+		"sub $7, %%rsi\n\t"
+		"mov %3, %%rcx\n\t"
+		"rep movsq\n\t"
+		"cld"
+		: "+D"(d), "+S"(s), "+c"(tail)
+		: "r"(words)
+		: "memory");
+
+	return dstptr;
+}
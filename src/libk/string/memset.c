@@ -1,16 +1,24 @@
 
-
-
 #include <string.h>
+#include <cpu.h>
 
 
 void *memset(void *dstptr, uint8_t value, size_t size) {
-	uint8_t *dst = (uint8_t *) dstptr;
-	for (size_t i = 0; i < size; i++) {
-		*(dst + i) = value;
-	}
-	return dstptr;
-}
+	void *dst = dstptr;
 
+	if (cpu_info.erms || (size < 16)) {
+		__asm__ volatile ("rep stosb" : "+D"(dst), "+c"(size) : "a"(value) : "memory");
+		return dstptr;
+	}
 
+	/* Same as memcpy(), align the destination and store 8 bytes at a time. */
+	uint64_t pattern = 0x0101010101010101 * value;
+	size_t head = (8 - ((uintptr_t)dst % 8)) % 8;
+	size_t words = (size - head) / 8;
+	size_t tail = (size - head) % 8;
 
+	__asm__ volatile ("rep stosb" : "+D"(dst), "+c"(head) : "a"(pattern) : "memory");
+	__asm__ volatile ("rep stosq" : "+D"(dst), "+c"(words) : "a"(pattern) : "memory");
+	__asm__ volatile ("rep stosb" : "+D"(dst), "+c"(tail) : "a"(pattern) : "memory");
+	return dstptr;
+}
@@ -0,0 +1,13 @@
+#include <string.h>
+
+/* These always work on exactly one page (0x1000 bytes). */
+
+void zero_page(void *page) {
+	size_t count = 0x1000 / 8;
+	__asm__ volatile ("rep stosq" : "+D"(page), "+c"(count) : "a"(0) : "memory");
+}
+
+void copy_page(void *dst, void *src) {
+	size_t count = 0x1000 / 8;
+	__asm__ volatile ("rep movsq" : "+D"(dst), "+S"(src), "+c"(count) : : "memory");
+}
@@ -0,0 +1,77 @@
+#include <timer.h>
+#include <task.h>
+#include <cpu.h>
+#include <err.h>
+
+#ifdef BENCH
+
+/* Timer interrupts taken while idle, and how long a task takes to run after
+ * its timer went off (in TSC ticks), with the tick always on and with it
+ * stopped while idle. Must be called from a task, with interrupts enabled.
+ */
+
+struct bench_sleep {
+	struct timer timer;
+	struct task *task;
+	uint64_t fired;
+};
+
+static void bench_wake(void *data) {
+	struct bench_sleep *b = data;
+	b->fired = rdtsc();
+	unblock_task(b->task);
+}
+
+static uint64_t wake_latency(uint64_t ticks) {
+	struct bench_sleep b;
+	b.task = get_current_task();
+	timer_init(&b.timer, bench_wake, &b);
+
+	lock_task_switches();
+	lock_scheduler();
+	b.task->state = TASK_STATE_BLOCK;
+	timer_add(&b.timer, timer_ticks() + ticks);
+	yield();
+	unlock_scheduler();
+	unlock_task_switches();
+
+	return rdtsc() - b.fired;
+}
+
+static void report(char *name, uint64_t val) {
+	serial_puts(name);
+	serial_puts(": ");
+	serial_putx(val);
+	serial_puts("\r\n");
+}
+
+void tick_bench(void) {
+	struct tick_stats before, after;
+
+	for (uint8_t nohz = 0; nohz < 2; nohz++) {
+		tick_set_nohz(nohz);
+		serial_puts(nohz ? "tick_bench: tickless idle\r\n" : "tick_bench: periodic\r\n");
+
+		/* Sleep a second, nothing else should be running. */
+		tick_get_stats(&before);
+		uint64_t tsc = rdtsc();
+		sleep_ticks(TIMER_HZ);
+		tsc = rdtsc() - tsc;
+		tick_get_stats(&after);
+		report("irqs per second", after.irqs - before.irqs);
+		report("ticks skipped", after.ticks_skipped - before.ticks_skipped);
+		report("tsc per second", tsc);
+
+		uint64_t worst = 0, total = 0;
+		for (size_t i = 0; i < 16; i++) {
+			uint64_t l = wake_latency(1 + (i % 4) * 8);
+			worst = (l > worst) ? l : worst;
+			total += l;
+		}
+		report("wakeup latency avg", total / 16);
+		report("wakeup latency max", worst);
+	}
+	tick_set_nohz(1);
+}
+
+#endif /* BENCH */
@@ -0,0 +1,150 @@
+#include <timer.h>
+#include <cpu.h>
+#include <mem.h>
+#include <io.h>
+#include <klog.h>
+#include <err.h>
+#include <string.h>
+
+/* The monotonic clock, in nanoseconds since init_clock(). If there is a TSC, it
+ * is calibrated against the PIT at boot and read directly, otherwise the clock
+ * only moves with the jiffies.
+ *
+ * Every CPU reads its own TSC. They are taken to be in sync, which they are
+ * when the firmware started them together and the TSC is invariant.
+ *
+ * The time page holds everything needed to do the same in user space. Only the
+ * BSP writes to it, on every tick. Readers retry while seq is odd, or if it
+ * changed while they read (a seqlock).
+ */
+
+#define PIT_HZ	1193182
+
+static uint8_t use_tsc = 0;
+static uint64_t tsc_base;
+static uint64_t mult;
+static uint64_t shift;
+
+static volatile struct time_page *time_page = NULL;
+static uint64_t time_page_phys = 0;
+
+
+static uint64_t tsc_calibrate(uint16_t pit_count) {
+	/* Returns how far the TSC counts while the PIT counts pit_count, on PIT
+	 * channel 2 like lapic_timer_calibrate(). Must be called with interrupts
+	 * disabled. */
+	uint8_t gate = inb(0x61);
+	outb(0x61, (gate & ~0x02) | 0x01);	/* Speaker off, gate on. */
+
+	outb(0x43, 0xB0);	/* Channel 2, lobyte/hibyte, mode 0. */
+	outb(0x42, pit_count & 0xFF);
+	outb(0x42, (pit_count >> 8) & 0xFF);
+
+	uint8_t v = inb(0x61) & ~0x01;
+	outb(0x61, v);
+	outb(0x61, v | 0x01);
+
+	uint64_t start = rdtsc();
+	while (!(inb(0x61) & 0x20));
+	uint64_t end = rdtsc();
+
+	outb(0x61, gate);
+	return end - start;
+}
+
+static uint64_t clock_scale(uint64_t d) {
+	/* d * mult >> shift, in two halves. mult < 2^(64 - shift), so neither
+	 * overflows. */
+	uint64_t mask = ((uint64_t)1 << shift) - 1;
+	return (d >> shift) * mult + (((d & mask) * mult) >> shift);
+}
+
+static inline uint64_t read_tsc(void) {
+	/* rdtsc may run ahead of the loads before it otherwise. */
+	__asm__ volatile ("lfence" : : : "memory");
+	return rdtsc();
+}
+
+uint8_t init_clock(void) {
+	/* Sets up the time page, and the TSC if it can be used. Must run before
+	 * the first address space is created. */
+	uint64_t pp = allocpp();
+	if (pp == 0) {
+		return ERR_OUT_OF_MEM;
+	}
+	if (map_memory(pp * 0x1000, TIME_PAGE_VIRT, 1, kgetPML4T(), MAP_KERNEL)) {
+		freepp(pp);
+		return ERR_OUT_OF_MEM;
+	}
+	krefresh_vmm();
+	time_page_phys = pp * 0x1000;
+	time_page = (volatile struct time_page*)TIME_PAGE_VIRT;
+	memset((void*)time_page, 0, 0x1000);
+	time_page->ns_per_tick = NS_PER_TICK;
+	time_page->ticks = timer_ticks();
+
+	if (!cpu_info.tsc) {
+		return ERR_INCOMPAT_PARAM;
+	}
+
+	/* The best of a few, as in init_tick(). */
+	uint64_t flags = irq_save();
+	uint64_t cycles = 0xFFFFFFFFFFFFFFFF;
+	for (size_t i = 0; i < 4; i++) {
+		uint64_t c = tsc_calibrate(0xE90 * 3);
+		cycles = (c < cycles) ? c : cycles;
+	}
+	irq_restore(flags);
+
+	uint64_t run_ns = (uint64_t)0xE90 * 3 * 1000000000 / PIT_HZ;
+	if (cycles < 1000) {
+		/* Not a usable TSC, keep the jiffies. */
+		return ERR_INCOMPAT_PARAM;
+	}
+
+	/* As precise as it gets, while the halves in clock_scale() still fit. */
+	shift = 32;
+	mult = (run_ns << shift) / cycles;
+	while ((shift > 0) && (mult >> (64 - shift))) {
+		shift--;
+		mult = (run_ns << shift) / cycles;
+	}
+
+	tsc_base = rdtsc();
+	use_tsc = 1;
+
+	time_page->tsc_base = tsc_base;
+	time_page->ns_base = 0;
+	time_page->mult = mult;
+	time_page->shift = shift;
+	time_page->flags = TIME_PAGE_TSC;
+
+	klog_info("TSC: %u kHz%s\n", cycles * 1000000 / run_ns,
+	          cpu_info.tsc_invariant ? "" : " (not invariant)");
+	return GENERIC_SUCCESS;
+}
+
+uint64_t clock_gettime_ns(void) {
+	/* Nanoseconds since boot. Never goes backwards. */
+	if (!use_tsc) {
+		return timer_ticks() * NS_PER_TICK;
+	}
+	return clock_scale(read_tsc() - tsc_base);
+}
+
+uint64_t clock_page_phys(void) {
+	/* 0 until init_clock() ran. */
+	return time_page_phys;
+}
+
+void clock_tick(uint64_t ticks) {
+	/* Publishes the jiffies. Called by timer_tick(), on the BSP. */
+	if (time_page == NULL) {
+		return;
+	}
+	time_page->seq++;
+	__asm__ volatile ("" : : : "memory");
+	time_page->ticks = ticks;
+	__asm__ volatile ("" : : : "memory");
+	time_page->seq++;
+}
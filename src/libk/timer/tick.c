@@ -0,0 +1,235 @@
+#include <timer.h>
+#include <apic.h>
+#include <smp.h>
+#include <spinlock.h>
+#include <ioapic.h>
+#include <cpu.h>
+#include <err.h>
+#include <string.h>
+
+/* The tick. It starts out as the PIT firing irq0 TIMER_HZ times a second. If
+ * there's a local APIC, init_tick() calibrates its timer against the PIT and
+ * hands the tick over to it, with the same period.
+ *
+ * While tasks run, the LAPIC timer is periodic. When the idle task is about to
+ * halt, it switches the timer to one-shot mode for the next timer on the wheel
+ * (tick_idle_enter()), so an idle machine isn't woken ~320 times a second for
+ * nothing. Whatever wakes the CPU up, the ticks that went by are worked out
+ * from the timer's count and handed to the wheel at once.
+ *
+ * Tick boundaries stay where the periodic timer would have put them, so the
+ * jiffies don't drift every time the tick is stopped.
+ *
+ * Every CPU has its own LAPIC timer for the scheduler, but only the BSP's
+ * advances the jiffies and runs the wheel. An idle AP simply stops its timer.
+ * The BSP only stops its tick when every AP has, so nobody reads the jiffies
+ * while they stand still. An AP that wakes up while the BSP's tick is stopped
+ * wakes the BSP, and waits for it to catch up (see tick_idle_exit()).
+ */
+
+/* The timer's count is 32 bits, this leaves room for the part of a tick. */
+#define MAX_IDLE_TICKS(c)	((0xFFFFFFFF / (c)) - 1)
+
+static uint8_t lapic_tick = 0;		/* The LAPIC timer drives the tick. */
+static uint8_t nohz = 1;			/* Stop the tick when idle. */
+static uint32_t tick_count;			/* LAPIC counts per tick. */
+
+/* Per CPU, in struct cpu: when tick_oneshot is set, the BSP's timer covers the
+ * next tick_programmed ticks, then goes back to being periodic. tick_stopped
+ * is set while a CPU's tick is stopped, on the BSP that means the jiffies are
+ * behind. nohz_lock covers tick_stopped.
+ */
+static struct spinlock nohz_lock;
+
+
+uint8_t init_tick(void) {
+	if (init_lapic()) {
+		return ERR_INCOMPAT_PARAM;
+	}
+
+	uint64_t flags = irq_save();
+
+	/* Take the best of a few, an interrupt (or SMI) can only make a run
+	 * longer. Three PIT periods per run, so the division is more precise. */
+	uint32_t best = 0xFFFFFFFF;
+	for (size_t i = 0; i < 4; i++) {
+		uint32_t c = lapic_timer_calibrate(0xE90 * 3);
+		best = (c < best) ? c : best;
+	}
+	tick_count = best / 3;
+
+	if (tick_count < 16) {
+		/* Not a usable timer, keep the PIT. */
+		irq_restore(flags);
+		return ERR_INCOMPAT_PARAM;
+	}
+
+	/* Mask irq0 and start the LAPIC timer. */
+	irq_mask(0);
+	lapic_timer_periodic(tick_count);
+	lapic_tick = 1;
+
+	irq_restore(flags);
+	return GENERIC_SUCCESS;
+}
+
+void init_tick_ap(void) {
+	/* Starts the calling AP's tick, with the period the BSP worked out. */
+	if (lapic_tick) {
+		lapic_timer_periodic(tick_count);
+	}
+}
+
+uint64_t tick_irq(void) {
+	/* Called by the timer interrupt. Returns how many ticks passed, which is
+	 * always none on the APs. */
+	struct cpu *c = this_cpu();
+	c->tick_stats.irqs++;
+	if (c->id != 0) {
+		return 0;
+	}
+	if (!c->tick_oneshot) {
+		return 1;
+	}
+
+	/* The one-shot ran out, so did the ticks it was set for. */
+	c->tick_oneshot = 0;
+	lapic_timer_periodic(tick_count);
+	c->tick_stats.ticks_skipped += c->tick_programmed - 1;
+	__atomic_store_n(&c->tick_stopped, 0, __ATOMIC_RELEASE);
+	return c->tick_programmed;
+}
+
+static void ap_idle_enter(struct cpu *c) {
+	spin_lock(&nohz_lock);
+	lapic_timer_oneshot(0);	/* A zero count stops it. */
+	c->tick_stopped = 1;
+	spin_unlock(&nohz_lock);
+	c->tick_stats.idle_stops++;
+}
+
+static void ap_idle_exit(struct cpu *c) {
+	spin_lock(&nohz_lock);
+	c->tick_stopped = 0;
+	uint8_t behind = cpus[0].tick_stopped;
+	spin_unlock(&nohz_lock);
+	lapic_timer_periodic(tick_count);
+
+	if (behind) {
+		/* The BSP stopped its tick, as nobody was busy. It works out the
+		 * ticks that went by once it's awake, and won't stop again while
+		 * this CPU runs. */
+		smp_send_resched(&cpus[0]);
+		while (__atomic_load_n(&cpus[0].tick_stopped, __ATOMIC_ACQUIRE)) {
+			__asm__ volatile ("pause");
+		}
+	}
+}
+
+static uint8_t aps_stopped(void) {
+	for (uint64_t i = 1; i < cpu_count; i++) {
+		if (cpus[i].online && !cpus[i].tick_stopped) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+void tick_idle_enter(void) {
+	/* Called by the idle task with interrupts disabled, right before it halts.
+	 * If the next timer is more than a tick away, the tick is stopped until
+	 * then. */
+	struct cpu *c = this_cpu();
+	if (!lapic_tick || !nohz) {
+		return;
+	}
+	if (c->id != 0) {
+		ap_idle_enter(c);
+		return;
+	}
+	if (c->tick_oneshot) {
+		return;
+	}
+
+	uint64_t now = timer_ticks();
+	uint64_t next = timer_next_expiry();
+	uint64_t delta = (next > now) ? next - now : 0;
+	if (delta <= 1) {
+		return;
+	}
+	if (delta > MAX_IDLE_TICKS(tick_count)) {
+		delta = MAX_IDLE_TICKS(tick_count);
+	}
+
+	spin_lock(&nohz_lock);
+	if (!aps_stopped()) {
+		spin_unlock(&nohz_lock);
+		return;
+	}
+
+	/* Keep the phase, the first tick ends when the periodic one would have. */
+	uint32_t rem = lapic_timer_current();
+	if (rem == 0) {
+		/* It just ran out, the interrupt is pending. */
+		spin_unlock(&nohz_lock);
+		return;
+	}
+
+	c->tick_programmed = delta;
+	c->tick_oneshot = 1;
+	c->tick_stopped = 1;
+	lapic_timer_oneshot(rem + (delta - 1) * tick_count);
+	spin_unlock(&nohz_lock);
+	c->tick_stats.idle_stops++;
+}
+
+void tick_idle_exit(void) {
+	/* Called by the idle task with interrupts disabled, right after it woke
+	 * up. If something other than the timer woke it, the ticks that went by
+	 * are accounted for now, and the timer is set to the next tick boundary. */
+	struct cpu *c = this_cpu();
+	if (c->id != 0) {
+		if (c->tick_stopped) {
+			ap_idle_exit(c);
+		}
+		return;
+	}
+	if (!c->tick_oneshot) {
+		return;
+	}
+
+	uint32_t rem = lapic_timer_current();
+	if (rem == 0) {
+		/* It ran out, tick_irq() does the rest once interrupts are back on. */
+		return;
+	}
+
+	/* Tick boundaries are at multiples of tick_count from zero. */
+	uint64_t left = (rem + tick_count - 1) / tick_count;
+	uint64_t elapsed = c->tick_programmed - left;
+
+	c->tick_programmed = 1;
+	lapic_timer_oneshot(rem - (left - 1) * tick_count);
+
+	if (elapsed) {
+		c->tick_stats.ticks_skipped += elapsed;
+		timer_tick(elapsed);
+	}
+	__atomic_store_n(&c->tick_stopped, 0, __ATOMIC_RELEASE);
+}
+
+void tick_set_nohz(uint8_t enable) {
+	nohz = enable;
+}
+
+void tick_get_stats(struct tick_stats *s) {
+	/* The sum over all CPUs. */
+	uint64_t flags = irq_save();
+	memset(s, 0, sizeof(*s));
+	for (uint64_t i = 0; i < cpu_count; i++) {
+		s->irqs += cpus[i].tick_stats.irqs;
+		s->idle_stops += cpus[i].tick_stats.idle_stops;
+		s->ticks_skipped += cpus[i].tick_stats.ticks_skipped;
+	}
+	irq_restore(flags);
+}
@@ -0,0 +1,306 @@
+#include <timer.h>
+#include <task.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <err.h>
+
+/* A hierarchical timer wheel. Adding and removing a timer is O(1). On every
+ * tick the root slot for that tick is run. Whenever the root wraps around, the
+ * next slot of the first level is "cascaded" down, meaning its timers are added
+ * again and land in the root (or, when a level wraps too, further down). A
+ * timer is moved at most TIMER_LEVELS times, however far away it was.
+ *
+ * Timers run from the BSP's tick, with interrupts disabled. They must not
+ * block. The wheel is protected by wheel_lock, which is released while a
+ * timer's function runs (so it can add its timer again, or wake a task).
+ */
+
+#define ROOT_MASK	(TIMER_ROOT_SIZE - 1)
+#define LVL_MASK	(TIMER_LVL_SIZE - 1)
+
+/* Where the n'th level (starting at 0) begins, in bits of the expiry time. */
+#define LVL_SHIFT(n)	(TIMER_ROOT_BITS + (n) * TIMER_LVL_BITS)
+
+/* List heads. A slot is empty when its head points to itself. */
+static struct timer root[TIMER_ROOT_SIZE];
+static struct timer levels[TIMER_LEVELS][TIMER_LVL_SIZE];
+static uint8_t wheel_ready = 0;
+
+static volatile uint64_t ticks = 0;		/* Ticks since boot. */
+static uint64_t wheel_time = 0;			/* The next tick the wheel will run. */
+
+static struct spinlock wheel_lock;
+static struct timer *volatile running_timer = NULL;
+
+
+static void list_init(struct timer *head) {
+	head->next = head;
+	head->prev = head;
+}
+
+static void list_add(struct timer *head, struct timer *t) {
+	t->prev = head->prev;
+	t->next = head;
+	head->prev->next = t;
+	head->prev = t;
+}
+
+static void list_del(struct timer *t) {
+	t->prev->next = t->next;
+	t->next->prev = t->prev;
+	t->next = NULL;
+	t->prev = NULL;
+}
+
+static void init_wheel(void) {
+	for (size_t i = 0; i < TIMER_ROOT_SIZE; i++) {
+		list_init(&root[i]);
+	}
+	for (size_t i = 0; i < TIMER_LEVELS; i++) {
+		for (size_t j = 0; j < TIMER_LVL_SIZE; j++) {
+			list_init(&levels[i][j]);
+		}
+	}
+	wheel_ready = 1;
+}
+
+static void internal_add(struct timer *t) {
+	uint64_t expires = t->expires;
+	uint64_t delta = expires - wheel_time;
+	struct timer *head;
+
+	if ((int64_t)delta < 0) {
+		/* Already expired, run it on the next tick. */
+		head = &root[wheel_time & ROOT_MASK];
+	} else if (delta < TIMER_ROOT_SIZE) {
+		head = &root[expires & ROOT_MASK];
+	} else {
+		if (delta > 0xFFFFFFFF) {
+			expires = wheel_time + 0xFFFFFFFF;
+		}
+
+		size_t lvl = 0;
+		while ((lvl < TIMER_LEVELS - 1) && (delta >= ((uint64_t)1 << LVL_SHIFT(lvl + 1)))) {
+			lvl++;
+		}
+		head = &levels[lvl][(expires >> LVL_SHIFT(lvl)) & LVL_MASK];
+	}
+
+	list_add(head, t);
+}
+
+static size_t cascade(size_t lvl) {
+	/* Re-adds every timer of the current slot of a level. Returns the slot's
+	 * index, when it's 0, the level wrapped around and the next one has to be
+	 * cascaded as well. */
+	size_t index = (wheel_time >> LVL_SHIFT(lvl)) & LVL_MASK;
+	struct timer *head = &levels[lvl][index];
+
+	while (head->next != head) {
+		struct timer *t = head->next;
+		list_del(t);
+		internal_add(t);
+	}
+	return index;
+}
+
+
+void timer_init(struct timer *t, void (*func)(void *data), void *data) {
+	t->next = NULL;
+	t->prev = NULL;
+	t->expires = 0;
+	t->func = func;
+	t->data = data;
+	t->pending = 0;
+}
+
+uint8_t timer_add(struct timer *t, uint64_t expires) {
+	/* Runs t->func(t->data) from irq0 once timer_ticks() reaches expires. If
+	 * the timer is already pending, it is moved. */
+	if (t == NULL)       { return ERR_INVALID_PARAM; }
+	if (t->func == NULL) { return ERR_INVALID_PARAM; }
+
+	uint64_t flags = spin_lock_irqsave(&wheel_lock);
+	if (!wheel_ready) {
+		init_wheel();
+	}
+	if (t->pending) {
+		list_del(t);
+	}
+
+	t->expires = expires;
+	t->pending = 1;
+	internal_add(t);
+	spin_unlock_irqrestore(&wheel_lock, flags);
+	return GENERIC_SUCCESS;
+}
+
+uint8_t timer_del(struct timer *t) {
+	/* Returns ERR_NOT_FOUND if the timer wasn't pending (it already ran). If
+	 * its function is running on another CPU, this waits for it to return,
+	 * so t can be freed afterwards. Not to be called from the function. */
+	if (t == NULL) { return ERR_INVALID_PARAM; }
+
+	uint64_t flags = spin_lock_irqsave(&wheel_lock);
+	while (running_timer == t) {
+		spin_unlock_irqrestore(&wheel_lock, flags);
+		__asm__ volatile ("pause");
+		flags = spin_lock_irqsave(&wheel_lock);
+	}
+
+	if (!t->pending) {
+		spin_unlock_irqrestore(&wheel_lock, flags);
+		return ERR_NOT_FOUND;
+	}
+
+	list_del(t);
+	t->pending = 0;
+	spin_unlock_irqrestore(&wheel_lock, flags);
+	return GENERIC_SUCCESS;
+}
+
+void timer_tick(uint64_t n) {
+	/* Called by the timer interrupt, n is how many ticks passed since the last
+	 * call. That is more than 1 when the tick was stopped while idle. */
+	if (n == 0) {
+		return;
+	}
+
+	uint64_t flags = spin_lock_irqsave(&wheel_lock);
+	ticks += n;
+	clock_tick(ticks);
+	if (!wheel_ready) {
+		wheel_time = ticks + 1;
+		spin_unlock_irqrestore(&wheel_lock, flags);
+		return;
+	}
+
+	while (wheel_time <= ticks) {
+		size_t index = wheel_time & ROOT_MASK;
+
+		/* The root wrapped around, pull the next timers down. */
+		if (index == 0) {
+			for (size_t lvl = 0; (lvl < TIMER_LEVELS) && (cascade(lvl) == 0); lvl++);
+		}
+
+		/* Take the whole slot first. A function may add its timer again, and
+		 * that must not land in the list being run. */
+		struct timer list;
+		list_init(&list);
+		struct timer *head = &root[index];
+		if (head->next != head) {
+			list.next = head->next;
+			list.prev = head->prev;
+			list.next->prev = &list;
+			list.prev->next = &list;
+			list_init(head);
+		}
+		wheel_time++;
+
+		while (list.next != &list) {
+			struct timer *t = list.next;
+			list_del(t);
+			t->pending = 0;
+
+			running_timer = t;
+			spin_unlock(&wheel_lock);
+			t->func(t->data);
+			spin_lock(&wheel_lock);
+			running_timer = NULL;
+		}
+	}
+	spin_unlock_irqrestore(&wheel_lock, flags);
+}
+
+uint64_t timer_next_expiry(void) {
+	/* Returns the tick the wheel next has to run at, or UINT64_MAX if there are
+	 * no timers. Timers on the levels are not looked at one by one, the next
+	 * cascade is reported instead, which may be early but never late. */
+	uint64_t flags = spin_lock_irqsave(&wheel_lock);
+	if (!wheel_ready) {
+		spin_unlock_irqrestore(&wheel_lock, flags);
+		return UINT64_MAX;
+	}
+
+	uint64_t next = UINT64_MAX;
+	for (uint64_t i = 0; i < TIMER_ROOT_SIZE; i++) {
+		struct timer *head = &root[(wheel_time + i) & ROOT_MASK];
+		if (head->next != head) {
+			next = wheel_time + i;
+			break;
+		}
+	}
+
+	for (size_t lvl = 0; lvl < TIMER_LEVELS; lvl++) {
+		for (size_t i = 0; i < TIMER_LVL_SIZE; i++) {
+			if (levels[lvl][i].next != &levels[lvl][i]) {
+				uint64_t cascade = (wheel_time + ROOT_MASK) & ~(uint64_t)ROOT_MASK;
+				next = (cascade < next) ? cascade : next;
+				spin_unlock_irqrestore(&wheel_lock, flags);
+				return next;
+			}
+		}
+	}
+	spin_unlock_irqrestore(&wheel_lock, flags);
+	return next;
+}
+
+uint64_t timer_ticks(void) {
+	return ticks;
+}
+
+uint64_t ns_to_ticks(uint64_t ns) {
+	/* Rounds up, sleeping too short is worse than sleeping too long. */
+	return (ns / NS_PER_TICK) + ((ns % NS_PER_TICK) != 0);
+}
+
+
+static void sleeper_wake(void *data) {
+	struct sleeper *s = data;
+	s->fired = 1;
+	unblock_task(s->task);
+}
+
+void sleeper_arm(struct sleeper *s, uint64_t expires) {
+	/* Marks the current task as blocked, and arms a timer that unblocks it at
+	 * expires. The caller must hold the task switch lock, the task blocks as
+	 * soon as that is released. Then it calls sleeper_disarm().
+	 *
+	 * The state is set before the timer is armed, so a timer that runs out
+	 * right away still finds a blocked task to wake. s is the task's own
+	 * sleeper: the kernel stack of a user task is only mapped in its own
+	 * address space.
+	 */
+	struct task *t = get_current_task();
+	s->task = t;
+	s->fired = 0;
+	timer_init(&s->timer, sleeper_wake, s);
+
+	lock_scheduler();
+	t->state = TASK_STATE_BLOCK;
+	timer_add(&s->timer, expires);
+	yield();	/* Postponed until the task switch lock is released. */
+	unlock_scheduler();
+}
+
+uint8_t sleeper_disarm(struct sleeper *s) {
+	/* Returns 1 if the task was woken by the timer. */
+	timer_del(&s->timer);
+	return s->fired;
+}
+
+void sleep_until(uint64_t expires) {
+	/* Blocks the current task until timer_ticks() reaches expires. */
+	if (get_current_task() == NULL) { return; }
+	if (expires <= timer_ticks())   { return; }
+
+	struct sleeper *s = &get_current_task()->sleeper;
+	lock_task_switches();
+	sleeper_arm(s, expires);
+	unlock_task_switches();
+	sleeper_disarm(s);
+}
+
+void sleep_ticks(uint64_t n) {
+	sleep_until(timer_ticks() + n);
+}
@@ -61,9 +61,8 @@ void scroll(uint32_t bg) {
 	uint32_t *fb = vga_get_fb();
 
 	/* Move everything except the last row up by one character. */
-	for (uint32_t i = 0; i < ((height * pitch)/4 - pitch * font_hdr->height / 4); i++) {
-		fb[i] = fb[i + pitch * font_hdr->height / 4 ];
-	}
+	uint32_t row = pitch * font_hdr->height;
+	memmove(fb, (uint8_t*)fb + row, height * pitch - row);
 
 	/* Fill the last row with the requested color. */
 	for (uint32_t i = ((height * pitch)/4 - pitch * font_hdr->height / 4); i < (height * pitch)/4 ; i++) {
@@ -0,0 +1,18 @@
+#include "std.h"
+
+/* Prints the kernel log history. */
+int64_t main(int64_t argc) {
+	char buf[256];
+	uint64_t offset = 0;
+	int64_t got;
+
+	while ((got = klogread(buf, 255, offset)) > 0) {
+		buf[got] = '\0';
+		puts(buf);
+		offset += got;
+	}
+	if (got < 0) {
+		puts("klogread failed.\n");
+	}
+	exit(0);
+}
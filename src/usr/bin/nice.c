@@ -0,0 +1,21 @@
+#include "std.h"
+
+/* Runs a program from /bin with a nice value 10 higher than ours. */
+int64_t main(int64_t argc) {
+	if (argc == 0) {
+		puts("Please specify a program.\n");
+		exit(0);
+	}
+
+	char path[256] = "/bin/";
+	getarg(0, path + 5, 250);
+
+	nice(10);
+	char *argv[] = {NULL};
+	exec(path, argv);
+
+	puts("Failed to find file '");
+	puts(path);
+	puts("'\n");
+	exit(0);
+}
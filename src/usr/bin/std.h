@@ -9,6 +9,19 @@
 #define STDOUT 1
 /* There's no stderr yet. */
 
+/* Scheduling policies for sched_setparam(). */
+#define SCHED_FAIR 0
+#define SCHED_IDLE 1
+
+/* Operations of futex(). */
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+
+/* For poll(). */
+#define POLLIN   0x01
+#define POLLOUT  0x04
+#define POLLNVAL 0x20
+
 #define O_READ  0
 #define O_WRITE 1
 
@@ -21,6 +34,46 @@ struct dirent {
 	char name[1];
 };
 
+/* Filled in by memstat(), same layout as the kernel's struct mem_stats. */
+struct mem_block_stats {
+	uint64_t base_page;
+	uint64_t length;
+	uint64_t free_frames;
+	uint64_t used_frames;
+};
+
+struct mem_stats {
+	uint64_t free_frames;
+	uint64_t used_frames;
+	uint64_t frame_allocs;
+	uint64_t frame_frees;
+	uint64_t frame_alloc_fails;
+
+	uint64_t page_structs_total;
+	uint64_t page_structs_used;
+	uint64_t page_struct_fails;
+
+	uint64_t maps;
+	uint64_t unmaps;
+	uint64_t flushes;
+
+	uint64_t num_blocks;
+	struct mem_block_stats blocks[32];
+};
+
+/* One descriptor for poll(), same layout as the kernel's. */
+struct pollfd {
+	int32_t fd;
+	int16_t events;
+	int16_t revents;
+};
+
+/* A lock that only makes a syscall when it's contended. 0 is unlocked. */
+struct mutex {
+	uint32_t state;
+};
+#define MUTEX_INIT { 0 }
+
 
 /* Syscalls. */
 extern void exit(uint64_t err);
@@ -37,8 +90,23 @@ extern int64_t fork(void);
 extern int64_t exec(char *fname, char *argv[]);
 
 extern int64_t chdir(char *buf);
+extern int64_t memstat(struct mem_stats *buf);
+extern int64_t klogread(char *buf, uint64_t size, uint64_t offset);
+extern int64_t nice(int64_t inc);
+extern int64_t sched_setparam(int64_t pid, uint64_t policy, int64_t nice);
+extern int64_t nanosleep(uint64_t ns);
+extern int64_t getpid(void);
+extern int64_t getpid_int80(void);	/* Through int 0x80, for sysbench. */
+extern int64_t clock_gettime_syscall(void);
+extern int64_t futex(uint32_t *addr, uint64_t op, uint64_t val, uint64_t timeout_ns);
+extern int64_t poll(struct pollfd *fds, uint64_t nfds, int64_t timeout_ns);
+extern int64_t clone(void (*entry)(), uint64_t stack, uint64_t arg, uint64_t tls);
 
 int64_t wait(uint64_t);
+int64_t clock_gettime(void);	/* ns since boot, reads the kernel's time page. */
+void mutex_lock(struct mutex *m);
+void mutex_unlock(struct mutex *m);
+int64_t thread_create(void (*fn)(void *arg), void *arg, void *stack, void *tls);
 
 int64_t strlen(char *str);
 int64_t strcmp(char *s1, char *s2);
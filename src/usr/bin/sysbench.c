@@ -0,0 +1,53 @@
+#include "std.h"
+
+/* Times a null system call (getpid), through SYSCALL and through int 0x80, and
+ * clock_gettime() through the time page and through its syscall. */
+
+#define ROUNDS 100000
+
+static uint64_t rdtsc(void) {
+	uint32_t lo, hi;
+	__asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+void putd(uint64_t val) {
+	char buf[21] = {};
+	int64_t i = 19;
+	do {
+		buf[i--] = '0' + (val % 10);
+		val /= 10;
+	} while (val);
+	puts(buf + i + 1);
+}
+
+uint64_t run(int64_t (*call)(void)) {
+	/* Returns the cycles per call. */
+	call();	/* Warm up. */
+
+	uint64_t start = rdtsc();
+	for (uint64_t i = 0; i < ROUNDS; i++) {
+		call();
+	}
+	return (rdtsc() - start) / ROUNDS;
+}
+
+int64_t main(int64_t argc) {
+	uint64_t fast = run(getpid);
+	uint64_t slow = run(getpid_int80);
+	uint64_t page = run(clock_gettime);
+	uint64_t call = run(clock_gettime_syscall);
+
+	puts("getpid() round trip, cycles:\n");
+	puts("syscall:  ");
+	putd(fast);
+	puts("\nint 0x80: ");
+	putd(slow);
+	puts("\n\nclock_gettime(), cycles:\n");
+	puts("time page: ");
+	putd(page);
+	puts("\nsyscall:   ");
+	putd(call);
+	puts("\n");
+	exit(0);
+}
@@ -0,0 +1,51 @@
+#include "std.h"
+
+void putd(uint64_t val) {
+	char buf[21] = {};
+	int64_t i = 19;
+	do {
+		buf[i--] = '0' + (val % 10);
+		val /= 10;
+	} while (val);
+	puts(buf + i + 1);
+}
+
+void line(char *name, uint64_t val) {
+	puts(name);
+	putd(val);
+	puts("\n");
+}
+
+
+int64_t main(int64_t argc) {
+	struct mem_stats st;
+	if (memstat(&st) < 0) {
+		puts("memstat failed.\n");
+		exit(0);
+	}
+
+	line("free frames:        ", st.free_frames);
+	line("used frames:        ", st.used_frames);
+	line("frame allocs:       ", st.frame_allocs);
+	line("frame frees:        ", st.frame_frees);
+	line("failed allocs:      ", st.frame_alloc_fails);
+	line("page structs:       ", st.page_structs_used);
+	line("page structs total: ", st.page_structs_total);
+	line("failed page structs:", st.page_struct_fails);
+	line("maps:               ", st.maps);
+	line("unmaps:             ", st.unmaps);
+	line("CR3 reloads:        ", st.flushes);
+
+	for (uint64_t i = 0; i < st.num_blocks; i++) {
+		puts("block ");
+		putd(i);
+		puts(": base page ");
+		putd(st.blocks[i].base_page);
+		puts(", ");
+		putd(st.blocks[i].free_frames);
+		puts(" free, ");
+		putd(st.blocks[i].used_frames);
+		puts(" used\n");
+	}
+	exit(0);
+}
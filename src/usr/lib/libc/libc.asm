@@ -12,103 +12,152 @@ GLOBAL pipe:function
 
 GLOBAL getarg:function
 GLOBAL chdir:function
+GLOBAL memstat:function
+GLOBAL klogread:function
+GLOBAL nice:function
+GLOBAL sched_setparam:function
+GLOBAL nanosleep:function
+GLOBAL getpid:function
+GLOBAL getpid_int80:function
+GLOBAL clock_gettime_syscall:function
+GLOBAL futex:function
+GLOBAL poll:function
+GLOBAL clone:function
+GLOBAL thread_start:function
 
 GLOBAL exit:function
 EXTERN main
 
 
-; These are the functions that do raw syscalls.
+; These are the functions that do raw syscalls. They use SYSCALL, which takes
+; the parameters in the same registers the C caller put them in (rdi, rsi,
+; rdx), so all there is to do is load the number. rcx and r11 are clobbered,
+; which the caller expects anyway.
 exit:
 	mov rax, 0
-	mov rbx, rdi
-	int 0x80 ; Does not return.
+	syscall ; Does not return.
 
 fork:
 	mov rax, 1
-	int 0x80
+	syscall
 	ret
 
 exec:
-	push rbx
 	mov rax, 2
-	mov rbx, rdi
-	mov rcx, rsi
-	int 0x80
-	pop rbx
-	ret ; A successful exec doesn't return, but an error might be returned anyway.
+	syscall
+	ret
 
 wait_syscall:
-	push rbx
 	mov rax, 3
-	mov rbx, rdi
-	int 0x80
-	pop rbx
+	syscall
 	ret
 
 open:
-	push rbx ; This is the only register we need to preserve
 	mov rax, 4
-	mov rbx, rdi
-	mov rcx, rsi
-	mov rdx, rdx
-	int 0x80
-	pop rbx
+	syscall
 	ret
 
 read:
-	push rbx
 	mov rax, 5
-	mov rbx, rdi
-	mov rcx, rsi
-	mov rdx, rdx
-	int 0x80
-	pop rbx
+	syscall
 	ret
 
 write:
-	push rbx
 	mov rax, 6
-	mov rbx, rdi
-	mov rcx, rsi
-	mov rdx, rdx
-	int 0x80
-	pop rbx
+	syscall
 	ret
 
 close:
-	push rbx
 	mov rax, 7
-	mov rbx, rdi
-	int 0x80
-	pop rbx
+	syscall
 	ret
 
 pipe:
-	push rbx
 	mov rax, 8
-	mov rbx, rdi
-	int 0x80
-	pop rbx
+	syscall
 	ret
 
 chdir:
-	push rbx
 	mov rax, 9
-	mov rbx, rdi
-	int 0x80
-	pop rbx
+	syscall
 	ret
 
 getarg:
-	push rbx
 	mov rax, 10
-	mov rbx, rdi
-	mov rcx, rsi
-	;mov rdx, rdx
+	syscall
+	ret
+
+memstat:
+	mov rax, 11
+	syscall
+	ret
+
+klogread:
+	mov rax, 12
+	syscall
+	ret
+
+nice:
+	mov rax, 13
+	syscall
+	ret
+
+sched_setparam:
+	mov rax, 14
+	syscall
+	ret
+
+nanosleep:
+	mov rax, 15
+	syscall
+	ret
+
+getpid:
+	mov rax, 16
+	syscall
+	ret
+
+; The same as getpid, through the old int 0x80 entry. Only there so the two
+; can be compared, see bin/sysbench.c
+getpid_int80:
+	mov rax, 16
 	int 0x80
-	pop rbx
 	ret
 
+; libc.c's clock_gettime() only makes this call if there's no TSC.
+clock_gettime_syscall:
+	mov rax, 17
+	syscall
+	ret
+
+; A fourth parameter goes in r10, since SYSCALL uses rcx itself.
+futex:
+	mov rax, 18
+	mov r10, rcx
+	syscall
+	ret
+
+poll:
+	mov rax, 19
+	syscall
+	ret
+
+clone:
+	mov rax, 20
+	mov r10, rcx
+	syscall
+	ret
+
+; Where thread_create() starts a thread. rdi points at the function and its
+; argument, at the top of the thread's stack.
+thread_start:
+	mov rax, [rdi]
+	mov rdi, [rdi + 8]
+	and rsp, -16
+	call rax
+	; If the function returns, the thread exits.
+	jmp exit
+
 ; This is the entry point of a user program.
 _start:
 	; The kernel passes argc in rax.
@@ -28,6 +28,94 @@ int64_t wait(uint64_t pid) {
 	return wait_syscall(pid);
 }
 
+extern int64_t clock_gettime_syscall(void);
+
+/* The kernel maps its time page here, read-only. Same layout as the kernel's
+ * struct time_page, see doc/syscalls/syscalls.txt */
+#define TIME_PAGE 0xFFFFFF7000002000
+#define TIME_PAGE_TSC 1
+
+struct time_page {
+	volatile uint64_t seq;
+	uint64_t flags;
+	uint64_t tsc_base;
+	uint64_t ns_base;
+	uint64_t mult;
+	uint64_t shift;
+	volatile uint64_t ticks;
+	uint64_t ns_per_tick;
+};
+
+int64_t clock_gettime(void) {
+	/* Nanoseconds since boot, without entering the kernel. */
+	volatile struct time_page *tp = (volatile struct time_page*)TIME_PAGE;
+	if (!(tp->flags & TIME_PAGE_TSC)) {
+		return clock_gettime_syscall();
+	}
+
+	uint64_t seq, tsc_base, ns_base, mult, shift, tsc;
+	do {
+		seq = tp->seq;
+		tsc_base = tp->tsc_base;
+		ns_base = tp->ns_base;
+		mult = tp->mult;
+		shift = tp->shift;
+
+		uint32_t lo, hi;
+		__asm__ volatile ("lfence; rdtsc" : "=a"(lo), "=d"(hi) : : "memory");
+		tsc = ((uint64_t)hi << 32) | lo;
+	} while ((seq & 1) || (seq != tp->seq));
+
+	uint64_t d = tsc - tsc_base;
+	uint64_t mask = ((uint64_t)1 << shift) - 1;
+	return ns_base + (d >> shift) * mult + (((d & mask) * mult) >> shift);
+}
+
+extern int64_t futex(uint32_t *addr, uint64_t op, uint64_t val, uint64_t timeout_ns);
+
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+
+/* A mutex is 0 when unlocked, 1 when locked, and 2 when locked and someone
+ * might be sleeping on it. Only the last case needs the kernel. */
+struct mutex {
+	uint32_t state;
+};
+
+void mutex_lock(struct mutex *m) {
+	uint32_t c = 0;
+	if (__atomic_compare_exchange_n(&m->state, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		return;
+	}
+	if (c != 2) {
+		c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+	}
+	while (c != 0) {
+		futex(&m->state, FUTEX_WAIT, 2, 0);
+		c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+	}
+}
+
+void mutex_unlock(struct mutex *m) {
+	if (__atomic_exchange_n(&m->state, 0, __ATOMIC_RELEASE) == 2) {
+		futex(&m->state, FUTEX_WAKE, 1, 0);
+	}
+}
+
+extern int64_t clone(void (*entry)(), uint64_t stack, uint64_t arg, uint64_t tls);
+extern void thread_start();
+
+int64_t thread_create(void (*fn)(void *arg), void *arg, void *stack, void *tls) {
+	/* Runs fn(arg) in a new thread of this process, on the stack that ends
+	 * at stack, with tls as its FS base (may be NULL). Returns the thread's
+	 * PID, to wait() for, or a negative error. fn and arg are handed over at
+	 * the top of the stack, which thread_start picks up. */
+	uint64_t *top = (uint64_t*)(((uintptr_t)stack & ~(uintptr_t)0xF) - 16);
+	top[0] = (uint64_t)(uintptr_t)fn;
+	top[1] = (uint64_t)(uintptr_t)arg;
+	return clone(thread_start, (uint64_t)(uintptr_t)top, (uint64_t)(uintptr_t)top, (uint64_t)(uintptr_t)tls);
+}
+
 /* These are standard file descriptors, set up by the kernel. */
 #define STDIN  0
 #define STDOUT 1
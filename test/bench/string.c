@@ -0,0 +1,39 @@
+#include <stdio.h>
+#include <cpu.h>
+
+/* Runs string_bench() (src/libk/string/bench.c) on the host, see "make bench".
+ * memcpy() and friends only use unprivileged instructions, so they run the same
+ * as in the kernel. They are built with the kernel's flags, this file and
+ * test/host.c with the host's.
+ */
+
+void string_bench(void);
+
+void serial_putc(char c) {
+	if (c != '\r') {
+		putchar(c);
+	}
+}
+
+void serial_puts(char *s) {
+	while (*s) {
+		serial_putc(*s++);
+	}
+}
+
+void serial_putx(uint64_t val) {
+	/* In decimal, the kernel's is hex. */
+	printf("%llu", (unsigned long long)val);
+}
+
+int main(void) {
+	init_cpu();
+	string_bench();
+
+	/* The path for CPUs without ERMS as well. */
+	if (cpu_info.erms) {
+		cpu_info.erms = 0;
+		string_bench();
+	}
+	return 0;
+}
@@ -0,0 +1,83 @@
+#include <containers/hash.h>
+#include <err.h>
+#include "../test.h"
+
+#define ITEMS 1000
+
+struct item {
+	struct hash_node node;
+	uint64_t value;
+	uint8_t in_table;
+};
+
+HASH_DEFINE(item, struct item, node)
+
+static struct item items[ITEMS];
+
+static size_t count_key(struct hash_table *h, uint64_t key) {
+	size_t n = 0;
+	for (struct item *i = item_find(h, key); i != NULL; i = item_next(i)) {
+		CHECK(i->node.key == key);
+		CHECK(i->in_table);
+		n++;
+	}
+	return n;
+}
+
+int main(void) {
+	struct hash_table h;
+	CHECK(hash_init(&h, 1) == GENERIC_SUCCESS);
+	CHECK(h.bucket_count == 8);
+	CHECK(item_find(&h, 0) == NULL);
+
+	/* 100 keys, 10 items each: equal keys chain up, and with 8 buckets to
+	 * start with different keys share buckets until the table grows. */
+	for (size_t i = 0; i < ITEMS; i++) {
+		items[i].value = i;
+		items[i].in_table = 1;
+		CHECK(item_insert(&h, &items[i], i % 100) == GENERIC_SUCCESS);
+	}
+	CHECK(h.count == ITEMS);
+	CHECK(h.bucket_count > 8);
+	CHECK((h.bucket_count & (h.bucket_count - 1)) == 0);
+	for (uint64_t k = 0; k < 100; k++) {
+		CHECK(count_key(&h, k) == 10);
+	}
+	CHECK(item_find(&h, 100) == NULL);
+
+	/* Removing from the middle, the head and the tail of chains. */
+	for (size_t i = 0; i < ITEMS; i += 3) {
+		item_remove(&h, &items[i]);
+		items[i].in_table = 0;
+	}
+	for (uint64_t k = 0; k < 100; k++) {
+		size_t expect = 0;
+		for (size_t i = k; i < ITEMS; i += 100) {
+			expect += items[i].in_table;
+		}
+		CHECK(count_key(&h, k) == expect);
+	}
+
+	/* Removing what isn't there changes nothing. */
+	size_t count = h.count;
+	item_remove(&h, &items[0]);
+	CHECK(h.count == count);
+
+	for (size_t i = 0; i < ITEMS; i++) {
+		if (items[i].in_table) {
+			item_remove(&h, &items[i]);
+			items[i].in_table = 0;
+		}
+	}
+	CHECK(h.count == 0);
+	for (uint64_t k = 0; k < 100; k++) {
+		CHECK(item_find(&h, k) == NULL);
+	}
+
+	CHECK(hash_str("abc") == hash_str("abc"));
+	CHECK(hash_str("abc") != hash_str("abd"));
+
+	hash_destroy(&h);
+	CHECK(test_allocs == 0);
+	return test_done("hash");
+}
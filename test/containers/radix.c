@@ -0,0 +1,61 @@
+#include <containers/radix.h>
+#include <err.h>
+#include "../test.h"
+
+#define ITEMS 2000
+
+static uint64_t keys[ITEMS];
+static int items[ITEMS];
+
+int main(void) {
+	struct radix_tree r = {0};
+	CHECK(radix_lookup(&r, 0) == NULL);
+	CHECK(radix_remove(&r, 0) == NULL);
+
+	/* Dense small keys (one or two levels), then sparse large ones. */
+	for (size_t i = 0; i < ITEMS; i++) {
+		keys[i] = (i < ITEMS / 2) ? i : (test_rand() | ((uint64_t)1 << 63));
+		CHECK(radix_insert(&r, keys[i], &items[i]) == GENERIC_SUCCESS);
+	}
+	CHECK(r.count == ITEMS);
+	CHECK(r.height == (64 + RADIX_BITS - 1) / RADIX_BITS);
+
+	for (size_t i = 0; i < ITEMS; i++) {
+		CHECK(radix_lookup(&r, keys[i]) == &items[i]);
+	}
+	CHECK(radix_lookup(&r, ITEMS / 2) == NULL);
+
+	/* Replacing keeps the count, inserting NULL removes. */
+	CHECK(radix_insert(&r, keys[0], &items[1]) == GENERIC_SUCCESS);
+	CHECK(radix_lookup(&r, keys[0]) == &items[1]);
+	CHECK(r.count == ITEMS);
+	CHECK(radix_insert(&r, keys[0], NULL) == GENERIC_SUCCESS);
+	CHECK(radix_lookup(&r, keys[0]) == NULL);
+	CHECK(r.count == ITEMS - 1);
+	CHECK(radix_remove(&r, keys[0]) == NULL);
+
+	for (size_t i = 1; i < ITEMS; i += 2) {
+		CHECK(radix_remove(&r, keys[i]) == &items[i]);
+		CHECK(radix_lookup(&r, keys[i]) == NULL);
+	}
+	for (size_t i = 2; i < ITEMS; i += 2) {
+		CHECK(radix_lookup(&r, keys[i]) == &items[i]);
+	}
+	for (size_t i = 2; i < ITEMS; i += 2) {
+		CHECK(radix_remove(&r, keys[i]) == &items[i]);
+	}
+
+	/* Every level is freed once the last item is gone. */
+	CHECK(r.count == 0);
+	CHECK(r.height == 0);
+	CHECK(r.root == NULL);
+	CHECK(test_allocs == 0);
+
+	for (size_t i = 0; i < 100; i++) {
+		radix_insert(&r, i * 4099, &items[i]);
+	}
+	radix_destroy(&r);
+	CHECK(r.root == NULL);
+	CHECK(test_allocs == 0);
+	return test_done("radix");
+}
@@ -0,0 +1,120 @@
+#include <containers/rbtree.h>
+#include "../test.h"
+
+#define NODES 1000
+
+struct item {
+	struct rb_node node;
+	uint64_t order;		/* Insertion order, for equal keys. */
+	uint8_t in_tree;
+};
+
+RB_DEFINE(item, struct item, node)
+
+static struct item items[NODES];
+
+static size_t check_node(struct rb_node *n, struct rb_node *parent, size_t *count) {
+	/* Returns the black height below n, checks parents, order and colours. */
+	if (n == NULL) {
+		return 1;
+	}
+	(*count)++;
+	CHECK(n->parent == parent);
+	if (n->left != NULL) {
+		CHECK(n->left->key <= n->key);
+	}
+	if (n->right != NULL) {
+		CHECK(n->right->key >= n->key);
+	}
+	if (n->color == RB_RED) {
+		CHECK((n->left == NULL) || (n->left->color == RB_BLACK));
+		CHECK((n->right == NULL) || (n->right->color == RB_BLACK));
+	}
+
+	size_t l = check_node(n->left, n, count);
+	size_t r = check_node(n->right, n, count);
+	CHECK(l == r);
+	return l + (n->color == RB_BLACK);
+}
+
+static void check_tree(struct rb_tree *t) {
+	size_t count = 0;
+	CHECK((t->root == NULL) || (t->root->color == RB_BLACK));
+	check_node(t->root, NULL, &count);
+	CHECK(count == t->count);
+
+	/* In order, equal keys in insertion order, and rb_first() is cached. */
+	struct rb_node *leftmost = t->root;
+	while ((leftmost != NULL) && (leftmost->left != NULL)) {
+		leftmost = leftmost->left;
+	}
+	CHECK(rb_first(t) == leftmost);
+
+	size_t seen = 0;
+	struct item *prev = NULL;
+	for (struct item *i = item_first(t); i != NULL; i = item_next(i)) {
+		CHECK(i->in_tree);
+		if (prev != NULL) {
+			CHECK(prev->node.key <= i->node.key);
+			if (prev->node.key == i->node.key) {
+				CHECK(prev->order < i->order);
+			}
+		}
+		prev = i;
+		seen++;
+	}
+	CHECK(seen == t->count);
+}
+
+int main(void) {
+	struct rb_tree t = {0};
+	check_tree(&t);
+	CHECK(rb_first(&t) == NULL);
+	CHECK(rb_find(&t, 1) == NULL);
+
+	/* Few distinct keys, so there are plenty of equal ones. */
+	uint64_t order = 0;
+	for (size_t i = 0; i < NODES; i++) {
+		items[i].order = order++;
+		items[i].in_tree = 1;
+		item_insert(&t, &items[i], test_rand() % 200);
+	}
+	check_tree(&t);
+
+	for (size_t i = 0; i < NODES; i++) {
+		struct item *f = item_find(&t, items[i].node.key);
+		CHECK(f != NULL);
+		if (f != NULL) {
+			CHECK(f->node.key == items[i].node.key);
+		}
+	}
+	CHECK(rb_lower_bound(&t, 1000) == NULL);
+
+	/* Remove and reinsert at random, checking everything every time. */
+	for (size_t round = 0; round < 5000; round++) {
+		struct item *e = &items[test_rand() % NODES];
+		if (e->in_tree) {
+			item_remove(&t, e);
+			e->in_tree = 0;
+		} else {
+			e->order = order++;
+			e->in_tree = 1;
+			item_insert(&t, e, test_rand() % 200);
+		}
+		if ((round % 50) == 0) {
+			check_tree(&t);
+		}
+	}
+	check_tree(&t);
+
+	for (size_t i = 0; i < NODES; i++) {
+		if (items[i].in_tree) {
+			item_remove(&t, &items[i]);
+			items[i].in_tree = 0;
+		}
+	}
+	check_tree(&t);
+	CHECK(t.root == NULL);
+	CHECK(t.count == 0);
+	return test_done("rbtree");
+}
@@ -0,0 +1,54 @@
+#include <containers/ring.h>
+#include <err.h>
+#include "../test.h"
+
+RING_DEFINE(u64, uint64_t)
+
+int main(void) {
+	struct ring r;
+	CHECK(u64_init(&r, 3) == GENERIC_SUCCESS);
+	CHECK(r.mask == 3);	/* Rounded up to 4 slots. */
+
+	uint64_t v;
+	CHECK(u64_pop(&r, &v) == ERR_NO_RESULT);
+
+	/* Fill it up, one more doesn't fit. */
+	for (uint64_t i = 0; i < 4; i++) {
+		CHECK(u64_push(&r, &i) == GENERIC_SUCCESS);
+	}
+	uint64_t extra = 99;
+	CHECK(u64_push(&r, &extra) == ERR_OUT_OF_BOUNDS);
+	CHECK(ring_count(&r) == 4);
+	for (uint64_t i = 0; i < 4; i++) {
+		CHECK((u64_pop(&r, &v) == GENERIC_SUCCESS) && (v == i));
+	}
+	CHECK(u64_pop(&r, &v) == ERR_NO_RESULT);
+
+	/* Go around many times with a varying fill level, in order. */
+	uint64_t next_push = 100, next_pop = 100;
+	for (size_t round = 0; round < 10000; round++) {
+		size_t n = test_rand() % 5;
+		for (size_t i = 0; i < n; i++) {
+			if (u64_push(&r, &next_push) == GENERIC_SUCCESS) {
+				next_push++;
+			} else {
+				CHECK(ring_count(&r) == 4);
+			}
+		}
+		n = test_rand() % 5;
+		for (size_t i = 0; i < n; i++) {
+			if (u64_pop(&r, &v) == GENERIC_SUCCESS) {
+				CHECK(v == next_pop);
+				next_pop++;
+			} else {
+				CHECK(ring_count(&r) == 0);
+			}
+		}
+		CHECK(ring_count(&r) == next_push - next_pop);
+	}
+	CHECK(r.tail > 4 * (r.mask + 1));
+
+	ring_destroy(&r);
+	CHECK(test_allocs == 0);
+	return test_done("ring");
+}
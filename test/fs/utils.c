@@ -0,0 +1,75 @@
+#include <stdlib.h>
+#include <string.h>
+#include <mem.h>
+#include "../test.h"
+
+/* fs_parse_path(), with an arena that hands out garbage-filled memory, so a
+ * step that is never written shows. */
+
+char **fs_parse_path(char *path, struct arena *arena);
+
+#define MAX_ALLOCS 64
+
+static void *allocs[MAX_ALLOCS];
+static size_t alloc_count = 0;
+static struct arena *arena = (struct arena*)allocs;	/* Never looked at. */
+
+void *arena_alloc(struct arena *a, size_t size) {
+	(void)a;
+	if (alloc_count == MAX_ALLOCS) {
+		return NULL;
+	}
+	void *p = malloc(size);
+	if (p != NULL) {
+		memset(p, 0xAA, size);
+		allocs[alloc_count++] = p;
+	}
+	return p;
+}
+
+static void arena_reset(void) {
+	while (alloc_count > 0) {
+		free(allocs[--alloc_count]);
+	}
+}
+
+static void check_path(char *path, char **expect) {
+	char **arr = fs_parse_path(path, arena);
+	CHECK(arr != NULL);
+	if (arr == NULL) {
+		return;
+	}
+
+	size_t i = 0;
+	for (; expect[i] != NULL; i++) {
+		CHECK(arr[i] != NULL);
+		if (arr[i] == NULL) {
+			printf("  \"%s\": step %zu missing\n", path, i);
+			break;
+		}
+		if (strcmp(arr[i], expect[i])) {
+			printf("  \"%s\": step %zu is \"%s\", not \"%s\"\n", path, i, arr[i], expect[i]);
+			test_failures++;
+		}
+	}
+	if (expect[i] == NULL) {
+		CHECK(arr[i] == NULL);
+	}
+	arena_reset();
+}
+
+int main(void) {
+	check_path("", (char*[]){NULL});
+	check_path("/", (char*[]){NULL});
+	check_path("//", (char*[]){NULL});
+	check_path("/bin/sh", (char*[]){"bin", "sh", NULL});
+	check_path("bin/sh", (char*[]){"bin", "sh", NULL});
+	check_path("/bin/sh/", (char*[]){"bin", "sh", NULL});
+	check_path("//bin///sh", (char*[]){"bin", "sh", NULL});
+	check_path("a", (char*[]){"a", NULL});
+	check_path("/usr/local/lib/x.so", (char*[]){"usr", "local", "lib", "x.so", NULL});
+
+	CHECK(fs_parse_path(NULL, arena) == NULL);
+	CHECK(fs_parse_path("/", NULL) == NULL);
+	return test_done("fs_parse_path");
+}
@@ -0,0 +1,37 @@
+#include <stdlib.h>
+#include "test.h"
+
+/* What the kernel's sources need from outside when they run on the host. */
+
+int test_failures = 0;
+size_t test_allocs = 0;
+
+void *kmalloc(uint64_t size) {
+	void *p = malloc(size);
+	if (p != NULL) {
+		test_allocs++;
+	}
+	return p;
+}
+
+uint8_t kfree(void *p) {
+	if (p != NULL) {
+		test_allocs--;
+		free(p);
+	}
+	return 0;
+}
+
+int test_done(const char *name) {
+	printf("%s: %s\n", name, test_failures ? "FAILED" : "ok");
+	return test_failures ? 1 : 0;
+}
+
+uint64_t test_rand(void) {
+	/* xorshift64, the same sequence on every run. */
+	static uint64_t x = 0x9E3779B97F4A7C15;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return x;
+}
@@ -0,0 +1,2 @@
+/* The host has an err.h of its own, this one comes first. */
+#include "../../src/libk/include/err.h"
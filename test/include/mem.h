@@ -0,0 +1,17 @@
+#ifndef MEM_H
+#define MEM_H 1
+
+/* Stands in for the kernel's mem.h, which needs the whole kernel. kmalloc()
+ * and kfree() are in test/host.c, a test that needs arenas brings its own. */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+void *kmalloc(uint64_t size);
+uint8_t kfree(void *p);
+
+struct arena;
+void *arena_alloc(struct arena *arena, size_t size);
+
+#endif /* MEM_H */
@@ -0,0 +1,26 @@
+#ifndef TEST_H
+#define TEST_H 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* Host-side unit tests. Every test is a program of its own, built with the
+ * host's compiler against the kernel's sources (see "make test"). CHECK()
+ * reports a failure and goes on, test_done() gives main()'s return value.
+ */
+
+extern int test_failures;
+extern size_t test_allocs;	/* Blocks handed out by kmalloc() and not freed. */
+
+#define CHECK(cond) do {												\
+	if (!(cond)) {														\
+		printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);	\
+		test_failures++;												\
+	}																	\
+} while (0)
+
+int test_done(const char *name);
+uint64_t test_rand(void);
+
+#endif /* TEST_H */